@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+bool
+bt_parse_cpu_list(const char *list, cpu_set_t *set)
+{
+  const char *pos = list;
+
+  CPU_ZERO(set);
+
+  while (true) {
+    char *end;
+    long first = strtol(pos, &end, 10), last = first;
+
+    if (end == pos || first < 0) {
+      return false;
+    }
+
+    pos = end;
+
+    if ('-' == *pos) {
+      last = strtol(pos + 1, &end, 10);
+
+      if (end == pos + 1 || last < first) {
+        return false;
+      }
+      pos = end;
+    }
+
+    if (last >= CPU_SETSIZE) {
+      return false;
+    }
+
+    for (long cpu = first; cpu <= last; cpu++) {
+      CPU_SET(cpu, set);
+    }
+
+    while (g_ascii_isspace(*pos)) {
+      pos++;
+    }
+
+    if ('\0' == *pos) {
+      return true;
+    }
+
+    if (',' != *pos++) {
+      return false;
+    }
+  }
+}
+
+/* Adds the CPUs an interrupt is delivered to, as listed under /proc/irq. */
+bool
+bt_add_irq_cpus(int irq, cpu_set_t *set)
+{
+  const char *files[] = { "effective_affinity_list", "smp_affinity_list" };
+
+  for (int i = 0; i < G_N_ELEMENTS(files); i++) {
+    char path[64], *contents = NULL;
+    cpu_set_t irq_set;
+
+    snprintf(path, sizeof(path), "/proc/irq/%d/%s", irq, files[i]);
+
+    if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+      continue;
+    }
+
+    bool parsed = bt_parse_cpu_list(contents, &irq_set);
+    g_free(contents);
+
+    if (parsed) {
+      CPU_OR(set, set, &irq_set);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool
+bt_irq_cpus(const char *interface, cpu_set_t *set)
+{
+  char *contents = NULL;
+  size_t name_len = strlen(interface);
+  bool found = false;
+
+  if (!g_file_get_contents("/proc/interrupts", &contents, NULL, NULL)) {
+    syslog(LOG_ERR, "Cannot read /proc/interrupts");
+    return false;
+  }
+
+  gchar **lines = g_strsplit(contents, "\n", -1);
+
+  /* Queues are named after their interface, as in "eth0-TxRx-3". */
+  for (int i = 0; NULL != lines[i]; i++) {
+    char *end, *name = lines[i];
+    long irq = strtol(lines[i], &end, 10);
+
+    if (end == lines[i] || ':' != *end) {
+      continue;
+    }
+
+    while (NULL != (name = strstr(name, interface))) {
+      bool starts = name == lines[i] || g_ascii_isspace(name[-1]);
+      char next = name[name_len];
+
+      if (starts && !g_ascii_isalnum(next) && '.' != next) {
+        found |= bt_add_irq_cpus(irq, set);
+        break;
+      }
+      name += name_len;
+    }
+  }
+
+  g_strfreev(lines);
+  g_free(contents);
+
+  return found;
+}
+
+/* Pins the calling thread to `set`. */
+bool
+bt_pin_thread(const cpu_set_t *set)
+{
+  int error = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), set);
+
+  if (0 != error) {
+    syslog(LOG_ERR, "Cannot set thread affinity: %s", strerror(error));
+    return false;
+  }
+
+  return true;
+}
+
+void
+bt_pin_receiver(const bt_config_t *config)
+{
+  const char *list = config->thread_receiver_cpus;
+  cpu_set_t set;
+
+  if (NULL == list || '\0' == list[0]) {
+    return;
+  }
+
+  if (!bt_parse_cpu_list(list, &set)) {
+    syslog(LOG_ERR, "Invalid list of receiver CPUs: %s", list);
+    return;
+  }
+
+  if (bt_pin_thread(&set)) {
+    syslog(LOG_DEBUG, "Receiver pinned to CPUs %s", list);
+  }
+}
+
+/* Fills `set` with the CPUs workers may run on. Returns false if unset. */
+bool
+bt_worker_cpus(const bt_config_t *config, cpu_set_t *set)
+{
+  const char *list = config->thread_worker_cpus;
+  const char *interface = config->thread_irq_interface;
+  bool has_list = NULL != list && '\0' != list[0];
+  bool has_interface = NULL != interface && '\0' != interface[0];
+  cpu_set_t irq_set;
+
+  if (has_list && !bt_parse_cpu_list(list, set)) {
+    syslog(LOG_ERR, "Invalid list of worker CPUs: %s", list);
+    return false;
+  }
+
+  if (!has_interface) {
+    return has_list;
+  }
+
+  CPU_ZERO(&irq_set);
+
+  if (!bt_irq_cpus(interface, &irq_set)) {
+    syslog(LOG_WARNING, "No interrupts found for interface %s", interface);
+    return has_list;
+  }
+
+  /* Keeps workers on the CPUs that take the interrupts of the NIC. */
+  if (has_list) {
+    CPU_AND(&irq_set, &irq_set, set);
+  }
+
+  if (0 == CPU_COUNT(&irq_set)) {
+    syslog(LOG_WARNING, "No worker CPU serves the interrupts of %s",
+           interface);
+    return has_list;
+  }
+
+  memcpy(set, &irq_set, sizeof(cpu_set_t));
+  return true;
+}
+
+void
+bt_pin_worker(const bt_config_t *config, int index)
+{
+  cpu_set_t set, single;
+
+  if (!bt_worker_cpus(config, &set)) {
+    return;
+  }
+
+  int nth = index % CPU_COUNT(&set);
+
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, &set) || nth-- > 0) {
+      continue;
+    }
+
+    CPU_ZERO(&single);
+    CPU_SET(cpu, &single);
+
+    if (bt_pin_thread(&single)) {
+      syslog(LOG_DEBUG, "Worker %d pinned to CPU %d", index, cpu);
+    }
+    return;
+  }
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BTTRACKER_AFFINITY_H_
+#define BTTRACKER_AFFINITY_H_
+
+/*
+ * Placement of the receiving and worker threads on CPUs. A pinned thread
+ * keeps its caches warm, and since Linux places memory on the NUMA node of
+ * the CPU that first touches it, whatever a pinned thread allocates for
+ * itself stays local to it.
+ */
+
+/* Parses a list of CPUs such as "0-3,8,10". Returns false if malformed. */
+bool
+bt_parse_cpu_list(const char *list, cpu_set_t *set);
+
+/*
+ * Adds to `set` the CPUs that serve the interrupts of a network interface.
+ * Returns false if no interrupt of that interface was found.
+ */
+bool
+bt_irq_cpus(const char *interface, cpu_set_t *set);
+
+/* Pins the calling thread, which receives the datagrams, if configured. */
+void
+bt_pin_receiver(const bt_config_t *config);
+
+/*
+ * Pins the calling thread, which runs worker `index`, to a single CPU of
+ * those set for workers, if any. Workers are dealt the CPUs in turns.
+ */
+void
+bt_pin_worker(const bt_config_t *config, int index);
+
+#endif // BTTRACKER_AFFINITY_H_
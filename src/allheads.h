@@ -31,14 +31,15 @@
 #ifndef BTTRACKER_ALLHEADS_H_
 #define BTTRACKER_ALLHEADS_H_
 
-#include <stdio.h>
-#include <string.h>
-#include <sys/time.h>
-
+/* Comes first so feature macros such as _GNU_SOURCE apply to every header. */
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
 
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
 #ifdef HAVE_INTTYPES_H
 #include <inttypes.h>
 #endif
@@ -76,26 +77,90 @@
 #include <netdb.h>
 #endif
 
-#ifdef HAVE_PTHREAD
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+
+#ifdef HAVE_SYS_UN_H
+#include <sys/un.h>
+#endif
+
+#ifdef HAVE_LINUX_FILTER_H
+#include <linux/filter.h>
+#endif
+
+#ifdef HAVE_LINUX_SOCK_DIAG_H
+#include <linux/sock_diag.h>
+#endif
+
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#ifdef HAVE_PTHREAD_H
 #include <pthread.h>
+#include <signal.h>
+#endif
+
+#ifdef HAVE_SCHED_H
+#include <sched.h>
 #endif
 
 /* Library headers. */
 #include <glib.h>
 #include <hiredis/hiredis.h>
 
+#ifdef BT_ENABLE_USDT
+#include <sys/sdt.h>
+#endif
+
 /* Application headers. */
 #include "byteorder.h"
+#include "probes.h"
 #include "random.h"
 #include "conf.h"
+#include "locality.h"
 #include "data.h"
+#include "swarm.h"
+#include "snapshot.h"
+#include "census.h"
+#include "shm.h"
 #include "net.h"
 #include "error.h"
 #include "connect.h"
 #include "handshake.h"
 #include "announce.h"
+#include "interval.h"
 #include "scrape.h"
 #include "pool.h"
+#include "refresh.h"
+#include "ring.h"
+#include "scheduler.h"
+#include "respcache.h"
+#include "hot.h"
+#include "known.h"
+#include "breaker.h"
+#include "worker.h"
+#include "affinity.h"
+#include "handoff.h"
+#include "ratelimit.h"
+#include "stats.h"
+#include "spin.h"
+#include "filter.h"
+#include "trace.h"
+#include "capture.h"
 #include "exit.h"
 
 #endif // BTTRACKER_ALLHEADS_H_
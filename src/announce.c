@@ -53,25 +53,61 @@ void
 bt_update_peer_list(redisContext *redis, const bt_config_t *config,
                     bt_announce_req_t *announce_request,
                     struct sockaddr_in *client_addr,
-                    char *info_hash_str, bool is_seeder)
+                    const bt_info_hash_key_t *info_hash_key,
+                    bool is_seeder)
 {
   bt_peer_t *peer = NULL;
   int8_t *peer_id = announce_request->peer_id;
 
+  /* Peers recently written by the worker handling this torrent. */
+  bt_worker_t *worker = bt_current_worker();
+  bt_refresh_cache_t *cache = NULL != worker ? worker->refresh : NULL;
+
   switch(announce_request->event) {
   case BT_EVENT_STOPPED:
-    bt_remove_peer(redis, config, info_hash_str, peer_id, is_seeder);
+    if (NULL != cache) {
+      bt_refresh_forget(cache, info_hash_key, peer_id);
+    }
+    bt_remove_peer(redis, config, info_hash_key, peer_id, is_seeder);
     break;
 
   case BT_EVENT_COMPLETED:
-    bt_promote_peer(redis, config, info_hash_str, peer_id);
+    if (NULL == cache) {
+      bt_promote_peer(redis, config, info_hash_key, peer_id);
+      break;
+    }
+
+    /* Bursts of completions end up in a single increment per torrent. */
+    bt_refresh_forget(cache, info_hash_key, peer_id);
+    if (bt_move_peer_to_seeders(redis, config, info_hash_key, peer_id)) {
+      bt_refresh_count_download(cache, redis, config, info_hash_key);
+    }
     break;
 
   case BT_EVENT_NONE:
   case BT_EVENT_STARTED:
     peer = bt_new_peer(announce_request,
                        (uint32_t) ntohl(client_addr->sin_addr.s_addr));
-    bt_insert_peer(redis, config, info_hash_str, peer_id, peer, is_seeder);
+
+    /* Periodic announces of unchanged peers only extend their life. */
+    if (NULL != cache && BT_EVENT_NONE == announce_request->event &&
+        bt_refresh_peer(cache, redis, config, info_hash_key, peer_id, peer,
+                        is_seeder)) {
+      free(peer);
+      break;
+    }
+
+    if (NULL != cache) {
+      bt_refresh_forget(cache, info_hash_key, peer_id);
+    }
+
+    bt_insert_peer(redis, config, info_hash_key, peer_id, peer, is_seeder);
+    bt_stats_inc(BT_STAT_PEER_WRITES);
+
+    if (NULL != cache) {
+      bt_refresh_remember(cache, config, info_hash_key, peer_id, peer,
+                          is_seeder);
+    }
     free(peer);
     break;
 
@@ -109,6 +145,46 @@ bt_serialize_announce_response(bt_announce_resp_t* response_data,
   return resp_buffer;
 }
 
+/*
+ * Returns up to `num_want` peers for a requester: peers of the other kind
+ * first, then siblings, then peers from the last snapshot.
+ */
+bt_list *
+bt_sample_peers(redisContext *redis, const bt_config_t *config,
+                const int8_t *info_hash,
+                const bt_info_hash_key_t *info_hash_key, int32_t num_want,
+                bool is_seeder, int64_t group, int *peer_count)
+{
+  /*
+   * First, if the requesting peer is a seeder, we try to get all leechers.
+   * Similarly, if the peer is a leecher, we try to get all seeders.
+   */
+  bt_list *peers = bt_peer_list(redis, config, info_hash_key, num_want,
+                                peer_count, !is_seeder, group);
+
+  /* Fallbacks to sibling peers in order to fill the gap. */
+  if (*peer_count < num_want) {
+    int complement_count = 0;
+    bt_list *complement =
+      bt_peer_list(redis, config, info_hash_key, (num_want - *peer_count),
+                   &complement_count, is_seeder, group);
+
+    /* There are new peers to add to the previous list. */
+    if (complement != NULL && complement_count > 0) {
+      *peer_count += complement_count;
+      peers = bt_list_concat(peers, complement);
+    }
+  }
+
+  /* Peers from the last snapshot fill the gap while swarms are rebuilt. */
+  if (*peer_count < num_want) {
+    peers = bt_snapshot_complement(config, info_hash, peers, peer_count,
+                                   num_want);
+  }
+
+  return peers;
+}
+
 bt_response_buffer_t *
 bt_handle_announce(const bt_req_t *request, const bt_config_t *config,
                    const char *buff, size_t buflen,
@@ -122,70 +198,227 @@ bt_handle_announce(const bt_req_t *request, const bt_config_t *config,
     return NULL;
   }
 
+  bt_trace_mark(BT_TRACE_VALIDATE);
+
   /* Unpacks the data retrieved via network socket. */
   bt_announce_req_t announce_request;
   bt_read_announce_request_data(buff, &announce_request);
 
-  /* Uses a more user friendly representation for the info hash byte array. */
-  char *info_hash_str;
-  bt_bytearray_to_hexarray(announce_request.info_hash, 20, &info_hash_str);
+  /* Fragment of the Redis keys that identifies this torrent. */
+  bt_info_hash_key_t info_hash_key;
+  bt_info_hash_key(config, announce_request.info_hash, &info_hash_key);
 
   bt_log_announce_request(&announce_request);
 
+  /* Swarms that get most of the requests are served from a local cache. */
+  const int8_t *info_hash = announce_request.info_hash;
+  bt_worker_t *worker = bt_current_worker();
+  bool is_hot = bt_hot_find(config, info_hash);
+  bt_hot_cache_t *hot_cache = is_hot && NULL != worker ? worker->hot : NULL;
+
+  bt_hot_count(config, info_hash);
+
   /* Checks whether the announced info hash is blacklisted. */
-  if (bt_info_hash_blacklisted(redis, config, info_hash_str)) {
+  if (bt_info_hash_blacklisted(redis, config, &info_hash_key)) {
+    char *info_hash_str;
+    bt_bytearray_to_hexarray(announce_request.info_hash, 20, &info_hash_str);
     syslog(LOG_DEBUG, "Blacklisted info hash: %s", info_hash_str);
     free(info_hash_str);
     return bt_send_error(request, "Blacklisted info hash");
   }
 
+  bt_trace_mark(BT_TRACE_RESTRICT);
+
   /* Whether the requesting peer is a seeder. */
   bool is_seeder = announce_request.left == 0;
 
   /* Updates the list of peers by updating or removing the requesting peer. */
   bt_update_peer_list(redis, config, &announce_request, client_addr,
-                      info_hash_str, is_seeder);
+                      &info_hash_key, is_seeder);
+
+  bt_trace_mark(BT_TRACE_PEER_UPDATE);
 
   /* Number of peers to retrieve from the swarm. */
   int32_t num_want = announce_request.num_want;
   num_want = (num_want < 0 || num_want > config->announce_max_numwant)
     ? config->announce_max_numwant : num_want;
 
-  /*
-   * First, if the requesting peer is a seeder, we try to get all leechers.
-   * Similarly, if the peer is a leecher, we try to get all seeders.
-   */
-  peers = bt_peer_list(redis, config, info_hash_str, num_want,
-                       &peer_count, !is_seeder);
+  /* Peers close to the requester get part of the slots. */
+  int64_t group = bt_locality_group(config,
+                                    ntohl(client_addr->sin_addr.s_addr));
 
-  /* Fallbacks to sibling peers in order to fill the gap. */
-  if (peer_count < num_want) {
-    int complement_count = 0;
-    bt_list *complement =
-      bt_peer_list(redis, config, info_hash_str, (num_want - peer_count),
-                   &complement_count, is_seeder);
+  if (NULL == hot_cache) {
+    peers = bt_sample_peers(redis, config, info_hash, &info_hash_key,
+                            num_want, is_seeder, group, &peer_count);
+  } else if (!bt_hot_cached_peers(hot_cache, info_hash, is_seeder, num_want,
+                                  &peers, &peer_count, false)) {
+    /* Hot swarms share a full list, so it ignores the requester's group. */
+    int pool_count = 0;
+    bt_list *pool = bt_sample_peers(redis, config, info_hash, &info_hash_key,
+                                    config->announce_max_numwant, is_seeder,
+                                    BT_LOCALITY_NONE, &pool_count);
 
-    /* There are new peers to add to the previous list. */
-    if (complement != NULL && complement_count > 0) {
-      peer_count += complement_count;
-      peers = bt_list_concat(peers, complement);
-    }
+    peers = bt_hot_cache_peers(hot_cache, info_hash, is_seeder, pool,
+                               pool_count, num_want, &peer_count);
+    bt_list_free(pool);
+  }
+
+  bt_trace_mark(BT_TRACE_PEER_SAMPLE);
+
+  /* Peers handed out are what is known of the swarm if Redis goes away. */
+  bt_known_cache_t *known = NULL != worker ? worker->known : NULL;
+
+  if (NULL != known) {
+    bt_known_store_peers(known, info_hash, is_seeder, peers, peer_count);
   }
 
   /* Retrieves the latest status about this torrent. */
   bt_torrent_stats_t stats;
-  bt_get_torrent_stats(redis, config, info_hash_str, &stats);
+
+  if (NULL == hot_cache ||
+      !bt_hot_cached_stats(hot_cache, info_hash, &stats, false)) {
+    bt_get_torrent_stats(redis, config, &info_hash_key, &stats);
+    bt_snapshot_merge_stats(config, info_hash, &stats);
+
+    if (NULL != hot_cache) {
+      bt_hot_cache_stats(hot_cache, info_hash, &stats);
+    }
+  }
+
+  if (NULL != known) {
+    bt_known_store_stats(known, info_hash, &stats);
+  }
+
+  bt_trace_mark(BT_TRACE_STATS);
 
   /* Fixed announce response fields. */
   bt_announce_resp_t response_header = {
     .action = request->action,
     .transaction_id = request->transaction_id,
-    .interval = config->announce_wait_time,
+    .interval = is_hot ? bt_hot_announce_interval(config)
+                       : bt_announce_interval(config),
     .leechers = stats.leechers,
     .seeders = stats.seeders
   };
 
-  free(info_hash_str);
+  return bt_serialize_announce_response(&response_header, peer_count, peers);
+}
+
+/* Buffers the update of the requesting peer until Redis comes back. */
+void
+bt_buffer_peer_update(const bt_config_t *config,
+                      bt_announce_req_t *announce_request,
+                      struct sockaddr_in *client_addr,
+                      const bt_info_hash_key_t *info_hash_key,
+                      bool is_seeder)
+{
+  bt_buffered_write_t write;
+  memset(&write, 0, sizeof(write));
+
+  write.info_hash_key = *info_hash_key;
+  memcpy(write.peer_id, announce_request->peer_id, 20);
+  write.is_seeder = is_seeder;
+
+  switch(announce_request->event) {
+  case BT_EVENT_STOPPED:
+    write.kind = BT_WRITE_REMOVE;
+    break;
+
+  case BT_EVENT_COMPLETED:
+    write.kind = BT_WRITE_PROMOTE;
+    break;
+
+  case BT_EVENT_NONE:
+  case BT_EVENT_STARTED: {
+    uint32_t sockaddr = ntohl(client_addr->sin_addr.s_addr);
+    bt_peer_t *peer = bt_new_peer(announce_request, sockaddr);
+
+    write.kind = BT_WRITE_INSERT;
+    write.peer = *peer;
+    free(peer);
+    break;
+  }
+
+  default:
+    syslog(LOG_ERR, "Invalid announce event");
+    return;
+  }
+
+  /* Buffered peers are written in full, not refreshed. */
+  bt_worker_t *worker = bt_current_worker();
+
+  if (NULL != worker && NULL != worker->refresh) {
+    bt_refresh_forget(worker->refresh, info_hash_key,
+                      announce_request->peer_id);
+  }
+
+  bt_breaker_buffer(config, &write);
+}
+
+bt_response_buffer_t *
+bt_handle_stale_announce(const bt_req_t *request, const bt_config_t *config,
+                         const char *buff, size_t buflen,
+                         struct sockaddr_in *client_addr)
+{
+  bt_list *peers = NULL;
+  int peer_count = 0;
+
+  /* Connection IDs cannot be checked without Redis. */
+  if (buflen < BT_MIN_ANNOUNCE_LEN) {
+    syslog(LOG_ERR, "Invalid announce packet");
+    return NULL;
+  }
+
+  bt_announce_req_t announce_request;
+  bt_read_announce_request_data(buff, &announce_request);
+
+  bt_info_hash_key_t info_hash_key;
+  bt_info_hash_key(config, announce_request.info_hash, &info_hash_key);
+
+  bt_log_announce_request(&announce_request);
+
+  const int8_t *info_hash = announce_request.info_hash;
+  bool is_seeder = announce_request.left == 0;
+
+  bt_hot_count(config, info_hash);
+  bt_buffer_peer_update(config, &announce_request, client_addr,
+                        &info_hash_key, is_seeder);
+
+  int32_t num_want = announce_request.num_want;
+  num_want = (num_want < 0 || num_want > config->announce_max_numwant)
+    ? config->announce_max_numwant : num_want;
+
+  /* The last peers a worker handed out for the swarm, then the snapshot. */
+  bt_worker_t *worker = bt_current_worker();
+
+  if (NULL != worker && NULL != worker->known &&
+      bt_known_peers(worker->known, info_hash, is_seeder, num_want, &peers,
+                     &peer_count)) {
+    bt_stats_inc(BT_STAT_KNOWN_HITS);
+  } else if (NULL == worker || NULL == worker->hot ||
+             !bt_hot_cached_peers(worker->hot, info_hash, is_seeder,
+                                  num_want, &peers, &peer_count, true)) {
+    peer_count = 0;
+    peers = NULL;
+  }
+
+  if (peer_count < num_want) {
+    peers = bt_snapshot_complement(config, info_hash, peers, &peer_count,
+                                   num_want);
+  }
+
+  bt_torrent_stats_t stats;
+  bt_stale_torrent_stats(config, info_hash, &stats);
+  bt_stats_inc(BT_STAT_STALE_ANSWERS);
+
+  bt_announce_resp_t response_header = {
+    .action = request->action,
+    .transaction_id = request->transaction_id,
+    .interval = bt_hot_find(config, info_hash)
+      ? bt_hot_announce_interval(config) : bt_announce_interval(config),
+    .leechers = stats.leechers,
+    .seeders = stats.seeders
+  };
 
   return bt_serialize_announce_response(&response_header, peer_count, peers);
 }
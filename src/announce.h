@@ -45,4 +45,14 @@ bt_handle_announce(const bt_req_t *request, const bt_config_t *config,
                    const char *buff, size_t buflen,
                    struct sockaddr_in *client_addr, redisContext *redis);
 
+/*
+ * Returns the response data to an announce request while Redis is left
+ * alone: peers and stats come from the data at hand, and the update of the
+ * requesting peer is buffered.
+ */
+bt_response_buffer_t *
+bt_handle_stale_announce(const bt_req_t *request, const bt_config_t *config,
+                         const char *buff, size_t buflen,
+                         struct sockaddr_in *client_addr);
+
 #endif // BTTRACKER_ANNOUNCE_H_
@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Whether the breaker is open. */
+static volatile bool bt_breaker_state = false;
+
+/* Round trips reported since the last evaluation. */
+static volatile int64_t bt_breaker_total = 0;
+static volatile int64_t bt_breaker_failures = 0;
+static volatile int64_t bt_breaker_latency = 0;  // Sum over successes, in us
+
+/* Ring of writes waiting for Redis, oldest first. */
+static GMutex bt_breaker_lock;
+static bt_buffered_write_t *bt_breaker_writes = NULL;
+static size_t bt_breaker_head = 0;
+static size_t bt_breaker_length = 0;
+static size_t bt_breaker_capacity = 0;
+
+/* Number of buffered writes taken at once for replay. */
+#define BT_BREAKER_REPLAY_BATCH (256)
+
+bool
+bt_breaker_enabled(const bt_config_t *config)
+{
+  return config->breaker_error_rate > 0 ||
+    config->breaker_latency_threshold > 0;
+}
+
+bool
+bt_breaker_open(void)
+{
+  return __atomic_load_n(&bt_breaker_state, __ATOMIC_ACQUIRE);
+}
+
+void
+bt_breaker_record(bool ok, int64_t latency)
+{
+  __sync_fetch_and_add(&bt_breaker_total, 1);
+
+  if (ok) {
+    __sync_fetch_and_add(&bt_breaker_latency, latency);
+  } else {
+    __sync_fetch_and_add(&bt_breaker_failures, 1);
+  }
+}
+
+void
+bt_breaker_record_trips(const bt_redis_trips_t *trips)
+{
+  if (trips->total > 0) {
+    __sync_fetch_and_add(&bt_breaker_total, trips->total);
+    __sync_fetch_and_add(&bt_breaker_failures, trips->failures);
+    __sync_fetch_and_add(&bt_breaker_latency, trips->latency);
+  }
+}
+
+bool
+bt_breaker_evaluate(const bt_config_t *config)
+{
+  int64_t total = __atomic_exchange_n(&bt_breaker_total, 0, __ATOMIC_SEQ_CST);
+  int64_t failures = __atomic_exchange_n(&bt_breaker_failures, 0,
+                                         __ATOMIC_SEQ_CST);
+  int64_t latency = __atomic_exchange_n(&bt_breaker_latency, 0,
+                                        __ATOMIC_SEQ_CST);
+  int64_t successes = total - failures;
+
+  if (total < MAX(1, config->breaker_min_requests)) {
+    return false;
+  }
+
+  bool failing = config->breaker_error_rate > 0 &&
+    failures * 100 >= total * config->breaker_error_rate;
+  bool lagging = config->breaker_latency_threshold > 0 && successes > 0 &&
+    latency / successes > config->breaker_latency_threshold * 1000LL;
+
+  if (!failing && !lagging) {
+    return false;
+  }
+
+  syslog(LOG_WARNING, "Redis is %s, answering from stale data",
+         failing ? "failing" : "lagging");
+
+  __atomic_store_n(&bt_breaker_state, true, __ATOMIC_RELEASE);
+  bt_stats_set(BT_STAT_BREAKER_OPEN, 1);
+
+  return true;
+}
+
+bool
+bt_breaker_buffer(const bt_config_t *config, const bt_buffered_write_t *write)
+{
+  bool buffered = false;
+
+  g_mutex_lock(&bt_breaker_lock);
+
+  if (NULL == bt_breaker_writes && config->breaker_buffer_size > 0) {
+    bt_breaker_capacity = config->breaker_buffer_size;
+    bt_breaker_writes = (bt_buffered_write_t *)
+      malloc(bt_breaker_capacity * sizeof(bt_buffered_write_t));
+
+    if (NULL == bt_breaker_writes) {
+      syslog(LOG_ERR, "Cannot allocate memory for buffered writes");
+      exit(BT_EXIT_MALLOC_ERROR);
+    }
+  }
+
+  if (bt_breaker_length < bt_breaker_capacity) {
+    size_t slot = (bt_breaker_head + bt_breaker_length) % bt_breaker_capacity;
+
+    bt_breaker_writes[slot] = *write;
+    bt_breaker_length++;
+    buffered = true;
+  }
+
+  bt_stats_set(BT_STAT_BUFFERED_WRITES, bt_breaker_length);
+  g_mutex_unlock(&bt_breaker_lock);
+
+  if (!buffered) {
+    bt_stats_inc(BT_STAT_DROPPED_WRITES);
+  }
+
+  return buffered;
+}
+
+/* Sends a buffered write to Redis. */
+void
+bt_breaker_replay(redisContext *redis, const bt_config_t *config,
+                  const bt_buffered_write_t *write)
+{
+  switch (write->kind) {
+  case BT_WRITE_CONNECTION:
+    bt_insert_connection(redis, config, write->connection_id);
+    break;
+
+  case BT_WRITE_INSERT:
+    bt_insert_peer(redis, config, &write->info_hash_key, write->peer_id,
+                   &write->peer, write->is_seeder);
+    break;
+
+  case BT_WRITE_REMOVE:
+    bt_remove_peer(redis, config, &write->info_hash_key, write->peer_id,
+                   write->is_seeder);
+    break;
+
+  case BT_WRITE_PROMOTE:
+    bt_promote_peer(redis, config, &write->info_hash_key, write->peer_id);
+    break;
+  }
+}
+
+/*
+ * Puts writes taken for replay back at the head of the ring, in their
+ * order. Those the ring has no room left for are dropped.
+ */
+void
+bt_breaker_requeue(const bt_buffered_write_t *writes, size_t count)
+{
+  size_t dropped = 0;
+
+  g_mutex_lock(&bt_breaker_lock);
+
+  for (size_t i = count; i > 0; i--) {
+    if (bt_breaker_length == bt_breaker_capacity) {
+      dropped = i;
+      break;
+    }
+
+    bt_breaker_head = (bt_breaker_head + bt_breaker_capacity - 1) %
+      bt_breaker_capacity;
+    bt_breaker_writes[bt_breaker_head] = writes[i - 1];
+    bt_breaker_length++;
+  }
+
+  bt_stats_set(BT_STAT_BUFFERED_WRITES, bt_breaker_length);
+  g_mutex_unlock(&bt_breaker_lock);
+
+  if (dropped > 0) {
+    bt_stats_add(BT_STAT_DROPPED_WRITES, dropped);
+  }
+}
+
+bool
+bt_breaker_close(redisContext *redis, const bt_config_t *config)
+{
+  bt_buffered_write_t batch[BT_BREAKER_REPLAY_BATCH];
+  size_t replayed = 0;
+
+  while (true) {
+    g_mutex_lock(&bt_breaker_lock);
+
+    /* Closes while holding the lock, so no write is left behind. */
+    if (0 == bt_breaker_length) {
+      __atomic_store_n(&bt_breaker_state, false, __ATOMIC_RELEASE);
+      bt_stats_set(BT_STAT_BREAKER_OPEN, 0);
+      bt_stats_set(BT_STAT_BUFFERED_WRITES, 0);
+      g_mutex_unlock(&bt_breaker_lock);
+      break;
+    }
+
+    size_t count = MIN(bt_breaker_length, BT_BREAKER_REPLAY_BATCH);
+
+    for (size_t i = 0; i < count; i++) {
+      batch[i] = bt_breaker_writes[bt_breaker_head];
+      bt_breaker_head = (bt_breaker_head + 1) % bt_breaker_capacity;
+    }
+
+    bt_breaker_length -= count;
+    bt_stats_set(BT_STAT_BUFFERED_WRITES, bt_breaker_length);
+    g_mutex_unlock(&bt_breaker_lock);
+
+    size_t done = 0;
+
+    while (done < count && !redis->err) {
+      bt_breaker_replay(redis, config, &batch[done++]);
+    }
+
+    if (redis->err) {
+      /* The write that failed may not have been applied, so it goes back. */
+      bt_breaker_requeue(&batch[done - 1], count - done + 1);
+      syslog(LOG_ERR, "Redis failed again while replaying writes");
+      return false;
+    }
+
+    replayed += count;
+  }
+
+  syslog(LOG_WARNING, "Redis is back, replayed %zu buffered writes",
+         replayed);
+
+  return true;
+}
+
+void
+bt_stale_torrent_stats(const bt_config_t *config, const int8_t *info_hash,
+                       bt_torrent_stats_t *stats)
+{
+  bt_worker_t *worker = bt_current_worker();
+
+  if (NULL != worker && NULL != worker->known &&
+      bt_known_stats(worker->known, info_hash, stats)) {
+    bt_stats_inc(BT_STAT_KNOWN_HITS);
+    return;
+  }
+
+  if (NULL != worker && NULL != worker->hot &&
+      bt_hot_cached_stats(worker->hot, info_hash, stats, true)) {
+    return;
+  }
+
+  if (!bt_census_find(config, info_hash, stats)) {
+    memset(stats, 0, sizeof(bt_torrent_stats_t));
+    bt_snapshot_merge_stats(config, info_hash, stats);
+  }
+}
+
+void *
+bt_breaker_thread(void *data)
+{
+  bt_config_t *config = (bt_config_t *) data;
+  redisContext *redis = NULL;
+
+  while (true) {
+    if (!bt_breaker_open()) {
+      g_usleep(MAX(1, config->breaker_window) * 1000);
+      bt_breaker_evaluate(config);
+      continue;
+    }
+
+    g_usleep(MAX(1, config->breaker_probe_interval) * 1000);
+
+    if (NULL == redis) {
+      redis = bt_redis_connect(config->redis_socket_path, config->redis_host,
+                               config->redis_port,
+                               config->redis_timeout * 1000, config->redis_db);
+
+      if (NULL == redis) {
+        continue;
+      }
+    }
+
+    /* Waits for Redis to answer as fast as it must to close the breaker. */
+    int64_t start = g_get_monotonic_time();
+    bool ok = bt_redis_ping(redis);
+    int64_t latency = g_get_monotonic_time() - start;
+
+    if (ok && (0 == config->breaker_latency_threshold ||
+               latency <= config->breaker_latency_threshold * 1000LL) &&
+        bt_breaker_close(redis, config)) {
+      continue;
+    }
+
+    if (redis->err) {
+      redisFree(redis);
+      redis = NULL;
+    }
+  }
+
+  return NULL;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BTTRACKER_BREAKER_H_
+#define BTTRACKER_BREAKER_H_
+
+/*
+ * Circuit breaker in front of Redis. Workers report how their round trips
+ * go, and the breaker thread opens the circuit when too many fail or the
+ * average one gets too slow. While it is open, workers do not touch Redis:
+ * requests are answered from the data at hand and writes are buffered. The
+ * breaker thread probes Redis meanwhile, replays the buffered writes once
+ * it answers again and then closes the circuit.
+ */
+
+/* Kind of a buffered write. */
+typedef enum {
+  BT_WRITE_CONNECTION,
+  BT_WRITE_INSERT,
+  BT_WRITE_REMOVE,
+  BT_WRITE_PROMOTE
+} bt_write_kind;
+
+/* Write waiting for Redis to come back. */
+typedef struct {
+  bt_write_kind kind;
+  int64_t connection_id;
+  bt_info_hash_key_t info_hash_key;
+  int8_t peer_id[20];
+  bt_peer_t peer;
+  bool is_seeder;
+} bt_buffered_write_t;
+
+/* Returns whether the breaker is enabled in the configuration. */
+bool
+bt_breaker_enabled(const bt_config_t *config);
+
+/* Returns whether Redis must be left alone. */
+bool
+bt_breaker_open(void);
+
+/*
+ * Reports a round trip to Redis that took `latency` microseconds, or that
+ * failed if `ok` is false.
+ */
+void
+bt_breaker_record(bool ok, int64_t latency);
+
+/* Reports the round trips a worker made to Redis while handling requests. */
+void
+bt_breaker_record_trips(const bt_redis_trips_t *trips);
+
+/*
+ * Opens the breaker if the round trips reported since the last call fail
+ * or lag too much. Returns whether it opened.
+ */
+bool
+bt_breaker_evaluate(const bt_config_t *config);
+
+/*
+ * Buffers a write to be replayed when the breaker closes. Returns false if
+ * the buffer is full and the write was dropped.
+ */
+bool
+bt_breaker_buffer(const bt_config_t *config, const bt_buffered_write_t *write);
+
+/*
+ * Replays the buffered writes and closes the breaker once none are left.
+ * Returns false if Redis failed in the meantime, leaving the breaker open.
+ */
+bool
+bt_breaker_close(redisContext *redis, const bt_config_t *config);
+
+/*
+ * Fills `stats` from the data at hand: the caches of the worker, the census
+ * and the last snapshot.
+ */
+void
+bt_stale_torrent_stats(const bt_config_t *config, const int8_t *info_hash,
+                       bt_torrent_stats_t *stats);
+
+/*
+ * Thread that opens the breaker and probes Redis while it is open. The
+ * argument `data` is a pointer to the `bt_config_t` object.
+ */
+void *
+bt_breaker_thread(void *data);
+
+#endif // BTTRACKER_BREAKER_H_
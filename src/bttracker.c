@@ -31,13 +31,22 @@
 /* Configuration data. */
 bt_config_t config;
 
-/* Thread pool used to answer all requests. */
-GThreadPool *pool;
+/* Worker threads used to answer all requests. */
+bt_workers_t *workers;
+
+/* Per-address request budgets, NULL if disabled. */
+bt_ratelimit_t *limiter;
+
+/* Sample of the incoming datagrams, NULL if disabled. */
+bt_capture_t *capture;
 
 /* Input socket descriptors. */
 int in_sock;
 struct addrinfo *in_addrinfo;
 
+/* Hands the input socket off to a newer process, NULL if disabled. */
+bt_handoff_t *handoff;
+
 /* Function that is executed when the signal SIGINT/SIGTERM is received. */
 void
 on_sigterm(int signum);
@@ -72,36 +81,202 @@ main(int argc, char *argv[])
   signal(SIGINT, on_sigterm);
   signal(SIGTERM, on_sigterm);
 
-  /* Creates the thread pool. */
-  pool = bt_new_request_processor_pool(&config);
+  /* Attaches to the swarm table shared with the other processes. */
+  if (BT_PEER_STORAGE_SHM == config.announce_peer_storage &&
+      !bt_shm_open(&config)) {
+    exit(BT_EXIT_SHM_ERROR);
+  }
+
+  /* Records the stages of sampled and slow requests. */
+  bt_trace_open(&config);
+
+  /* Reads the network prefixes peers are grouped by. */
+  if (!bt_load_locality(&config)) {
+    exit(BT_EXIT_CONFIG_ERROR);
+  }
+
+  /* Starts the worker threads. */
+  workers = bt_new_workers(&config);
+
+  /* Creates the table of per-address token buckets. */
+  limiter = bt_new_ratelimit(&config);
+
+  /* Records a sample of the real traffic for bttracker-replay. */
+  capture = bt_new_capture(&config);
+
+  /* Periodically logs the tracker counters. */
+  if (config.bttracker_stats_interval > 0) {
+    g_thread_unref(g_thread_new("stats", bt_stats_report_thread, &config));
+  }
+
+  /* Serves the swarms saved before the last shutdown while they rebuild. */
+  bt_load_snapshot(&config);
+
+  if (NULL != config.snapshot_path && '\0' != config.snapshot_path[0]) {
+    if (BT_PEER_STORAGE_SWARM == config.announce_peer_storage) {
+      g_thread_unref(g_thread_new("snapshot", bt_snapshot_thread, &config));
+    } else {
+      syslog(LOG_WARNING, "Snapshots require the 'swarm' peer storage");
+    }
+  }
+
+  /* Counts the peers of all swarms in the background. */
+  if (NULL != config.census_path && '\0' != config.census_path[0]) {
+    bt_load_census(&config);
+    g_thread_unref(g_thread_new("census", bt_census_thread, &config));
+  }
+
+  /* Stops waiting on Redis when it fails, and probes it until it is back. */
+  if (bt_breaker_enabled(&config)) {
+    g_thread_unref(g_thread_new("breaker", bt_breaker_thread, &config));
+  }
+
+  /* Finds the swarms that get most of the requests. */
+  if (config.hot_size > 0) {
+    g_thread_unref(g_thread_new("hot", bt_hot_thread, &config));
+  }
+
+  /* Removes stale peers from the swarms in the background. */
+  if (BT_PEER_STORAGE_SWARM == config.announce_peer_storage) {
+    g_thread_unref(g_thread_new("reaper", bt_swarm_reaper_thread, &config));
+  }
 
   /* Required by network communication code. */
   struct sockaddr_in si_other;
   socklen_t other_len = sizeof(si_other);
 
-  /* Local address where the UDP server socket will bind against. */
-  syslog(LOG_DEBUG, "Creating UDP server socket");
-  in_sock = bt_ipv4_udp_sock(config.bttracker_addr, config.bttracker_port,
-                             &in_addrinfo);
+  /* Takes the socket over from a running tracker, if there is one. */
+  bool handoff_enabled = NULL != config.bttracker_handoff_socket &&
+    '\0' != config.bttracker_handoff_socket[0];
+
+  in_sock = -1;
+  in_addrinfo = NULL;
+
+  if (handoff_enabled) {
+    in_sock = bt_handoff_receive(config.bttracker_handoff_socket);
+  }
+
+  if (-1 == in_sock) {
+    /* Local address where the UDP server socket will bind against. */
+    syslog(LOG_DEBUG, "Creating UDP server socket");
+    in_sock = bt_ipv4_udp_sock(config.bttracker_addr, config.bttracker_port,
+                               &in_addrinfo);
+
+    /* Lets other tracker processes bind to the same address. */
+    int reuse_port = 1;
+
+    if (config.bttracker_reuse_port &&
+        setsockopt(in_sock, SOL_SOCKET, SO_REUSEPORT, &reuse_port,
+                   sizeof(reuse_port)) == -1) {
+      syslog(LOG_ERR, "Cannot set SO_REUSEPORT on the UDP socket");
+    }
+
+    syslog(LOG_DEBUG, "Binding UDP socket to %s:%d",
+           config.bttracker_addr, config.bttracker_port);
 
-  syslog(LOG_DEBUG, "Binding UDP socket to %s:%d",
-         config.bttracker_addr, config.bttracker_port);
+    if (bind(in_sock, in_addrinfo->ai_addr, in_addrinfo->ai_addrlen) == -1) {
+      syslog(LOG_ERR, "Error in bind(). Exiting");
+      exit(BT_EXIT_NETWORK_ERROR);
+    }
+  }
+
+  /* Drops junk in the kernel, also on a socket taken over. */
+  bt_attach_filter(&config, in_sock);
+
+  /* Lets the next process take the socket over in turn. */
+  handoff = handoff_enabled
+    ? bt_new_handoff(config.bttracker_handoff_socket, in_sock) : NULL;
+
+  /* Pinned last, so that the threads started above are not. */
+  bt_pin_receiver(&config);
 
-  if (bind(in_sock, in_addrinfo->ai_addr, in_addrinfo->ai_addrlen) == -1) {
-    syslog(LOG_ERR, "Error in bind(). Exiting");
-    exit(BT_EXIT_NETWORK_ERROR);
+  /* Keeps polling the socket for a while after each datagram. */
+  bt_spin_t spin;
+  bt_spin_init(&spin, config.thread_receive_spin_time, BT_STAT_RECEIVE_SPIN);
+
+#ifdef SO_BUSY_POLL
+  int busy_poll = config.thread_receive_spin_time;
+
+  if (busy_poll > 0 &&
+      setsockopt(in_sock, SOL_SOCKET, SO_BUSY_POLL, &busy_poll,
+                 sizeof(busy_poll)) == -1) {
+    syslog(LOG_WARNING, "Cannot set SO_BUSY_POLL on the UDP socket");
   }
+#endif
 
   while (true) {
+    bool spinning = bt_spin_active(&spin);
+
+    /* Stops reading once a newer process is reading from the socket. */
+    if (NULL != handoff && bt_handoff_done(handoff)) {
+      break;
+    }
+
+    /* Interrupted by the handoff thread once the socket was handed off. */
     char buff[BT_RECV_BUFLEN];
-    size_t buflen = recvfrom(in_sock, buff, BT_RECV_BUFLEN, 0,
+    size_t buflen = recvfrom(in_sock, buff, BT_RECV_BUFLEN,
+                             spinning ? MSG_DONTWAIT : 0,
                              (struct sockaddr *) &si_other, &other_len);
 
-    if (-1 == buflen) {
+    if (-1 == buflen &&
+        (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno)) {
+      continue;
+    } else if (-1 == buflen) {
       syslog(LOG_ERR, "Cannot retrieve data from socket. Continuing");
       continue;
     }
 
+    /* Opens a new window once this datagram has been dealt with. */
+    bt_spin_end(&spin);
+    bt_spin_begin(&spin);
+
+    bt_stats_inc(BT_STAT_RECEIVED);
+    BT_PROBE2(receive, buflen, si_other.sin_addr.s_addr);
+
+    if (NULL != capture) {
+      bt_capture_datagram(capture, buff, buflen, &si_other,
+                          g_get_monotonic_time());
+    }
+
+    /* Sources over their budget never reach the workers. */
+    if (NULL != limiter &&
+        !bt_ratelimit_accept(limiter, buff, buflen, &si_other)) {
+      bt_stats_inc(BT_STAT_RATE_LIMITED);
+      BT_PROBE2(drop, NULL, BT_STAT_RATE_LIMITED);
+
+      if (config.ratelimit_reply_with_error) {
+        bt_reply_error(in_sock, buff, &si_other, other_len,
+                       "Too many requests");
+      }
+      continue;
+    }
+
+    /* Retransmits are answered from the cache, or by the original request. */
+    if (NULL != workers->responses) {
+      char cached[BT_RESPCACHE_MAX_LEN];
+      size_t cached_len;
+
+      switch (bt_respcache_lookup(workers->responses, buff, buflen, &si_other,
+                                  g_get_monotonic_time(), cached,
+                                  &cached_len)) {
+      case BT_RESPCACHE_HIT:
+        bt_stats_inc(BT_STAT_CACHE_HITS);
+
+        if (sendto(in_sock, cached, cached_len, 0,
+                   (struct sockaddr *) &si_other, other_len) == -1) {
+          syslog(LOG_ERR, "Error in sendto()");
+        }
+        continue;
+
+      case BT_RESPCACHE_IN_FLIGHT:
+        bt_stats_inc(BT_STAT_CACHE_MERGED);
+        continue;
+
+      case BT_RESPCACHE_MISS:
+        break;
+      }
+    }
+
     char ipv4_str[INET_ADDRSTRLEN];
     inet_ntop(AF_INET, &si_other.sin_addr, ipv4_str, INET_ADDRSTRLEN);
     syslog(LOG_DEBUG, "Datagram received");
@@ -116,13 +291,38 @@ main(int argc, char *argv[])
     params->sock          = in_sock;
     params->buff          = buff_clone;
     params->buflen        = buflen;
-    params->from_addr     = &si_other;
+    params->from_addr     = si_other;
     params->from_addr_len = other_len;
+    params->received_at   = g_get_monotonic_time();
+    params->class         = bt_classify_request(buff, buflen);
+    params->enqueued_at   = g_get_monotonic_time();
 
-    if (g_thread_pool_push(pool, params, NULL)) {
-      syslog(LOG_DEBUG, "Successfully pushed job to thread pool");
+    if (bt_workers_push(workers, params)) {
+      syslog(LOG_DEBUG, "Successfully pushed job to worker");
+    } else if (NULL != workers->responses) {
+      /* Lets a retransmit try again. */
+      bt_respcache_store(workers->responses, buff, buflen, &si_other,
+                         g_get_monotonic_time(), NULL, 0);
     }
   }
+
+  /* Answers the requests still queued before letting the socket go. */
+  syslog(LOG_INFO, "Draining pending requests");
+  bt_free_workers(workers);
+  bt_free_ratelimit(limiter);
+  bt_free_capture(capture);
+  bt_trace_close();
+  bt_free_snapshot();
+  bt_free_locality();
+  bt_free_handoff(handoff);
+  bt_shm_close();
+
+  close(in_sock);
+
+  syslog(LOG_INFO, "Exiting");
+  closelog();
+
+  return BT_EXIT_OK;
 }
 
 void
@@ -132,12 +332,21 @@ on_sigterm(int signum)
 
   syslog(LOG_DEBUG, "Freeing resources");
 
-  /* Terminates the thread pool. */
-  g_thread_pool_free(pool, true, true);
+  /* Terminates the worker threads. */
+  bt_free_workers(workers);
+  bt_free_ratelimit(limiter);
+  bt_free_capture(capture);
+  bt_trace_close();
+  bt_free_snapshot();
+  bt_free_locality();
+  bt_free_handoff(handoff);
+  bt_shm_close();
 
   /* Closes UDP socket. */
   close(in_sock);
-  freeaddrinfo(in_addrinfo);
+  if (NULL != in_addrinfo) {
+    freeaddrinfo(in_addrinfo);
+  }
 
   syslog(LOG_INFO, "Exiting");
   closelog();
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+bt_capture_t *
+bt_new_capture(const bt_config_t *config)
+{
+  if (NULL == config->capture_path || '\0' == config->capture_path[0] ||
+      config->capture_sample_rate <= 0) {
+    return NULL;
+  }
+
+  FILE *file = fopen(config->capture_path, "wb");
+
+  if (NULL == file) {
+    syslog(LOG_ERR, "Cannot open capture file %s", config->capture_path);
+    return NULL;
+  }
+
+  bt_capture_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, BT_CAPTURE_MAGIC, 8);
+  header.version = BT_CAPTURE_VERSION;
+  header.byte_order = BT_SNAPSHOT_BYTE_ORDER;
+  header.created_at = time(NULL);
+
+  if (fwrite(&header, sizeof(header), 1, file) != 1) {
+    syslog(LOG_ERR, "Cannot write to capture file %s", config->capture_path);
+    fclose(file);
+    return NULL;
+  }
+
+  bt_capture_t *capture = (bt_capture_t *) malloc(sizeof(bt_capture_t));
+
+  if (NULL == capture) {
+    syslog(LOG_ERR, "Cannot allocate memory for capture");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  capture->file = file;
+  capture->sample_rate = config->capture_sample_rate;
+  capture->max_size = (uint64_t) config->capture_max_size * 1024 * 1024;
+  capture->size = sizeof(header);
+  capture->started_at = g_get_monotonic_time();
+
+  syslog(LOG_INFO, "Capturing %g of the datagrams to %s",
+         capture->sample_rate, config->capture_path);
+
+  return capture;
+}
+
+void
+bt_free_capture(bt_capture_t *capture)
+{
+  if (NULL != capture) {
+    if (NULL != capture->file) {
+      fclose(capture->file);
+    }
+    free(capture);
+  }
+}
+
+void
+bt_capture_datagram(bt_capture_t *capture, const char *buff, size_t buflen,
+                    const struct sockaddr_in *from, int64_t received_at)
+{
+  if (NULL == capture || NULL == capture->file ||
+      (double) rand() / RAND_MAX >= capture->sample_rate) {
+    return;
+  }
+
+  size_t record_size = sizeof(bt_capture_record_t) + buflen;
+
+  /* Stops for good once full, so the capture stays a contiguous window. */
+  if (capture->max_size > 0 && capture->size + record_size > capture->max_size) {
+    syslog(LOG_INFO, "Capture file is full, stopping capture");
+    fclose(capture->file);
+    capture->file = NULL;
+    return;
+  }
+
+  bt_capture_record_t record = {
+    .offset = received_at - capture->started_at,
+    .ipv4_addr = from->sin_addr.s_addr,
+    .port = from->sin_port,
+    .length = buflen
+  };
+
+  /* Writes go through the stdio buffer, so most datagrams cost a memcpy. */
+  if (fwrite(&record, sizeof(record), 1, capture->file) != 1 ||
+      fwrite(buff, 1, buflen, capture->file) != buflen) {
+    syslog(LOG_ERR, "Cannot write to capture file, stopping capture");
+    fclose(capture->file);
+    capture->file = NULL;
+    return;
+  }
+
+  capture->size += record_size;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BTTRACKER_CAPTURE_H_
+#define BTTRACKER_CAPTURE_H_
+
+/* Identifies capture files and their layout. */
+#define BT_CAPTURE_MAGIC   "BTCAPTUR"
+#define BT_CAPTURE_VERSION (1)
+
+/*
+ * Capture file layout: this header, then one record per captured datagram,
+ * each followed by the `length` bytes of its payload. Record fields are
+ * stored in the byte order of the host, except the source address and
+ * port, which stay in network byte order.
+ */
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;    // BT_SNAPSHOT_BYTE_ORDER as written by the host
+  int64_t created_at;     // Unix time
+} bt_capture_header_t;
+
+/* Captured datagram. */
+typedef struct {
+  int64_t offset;         // Microseconds since the capture started
+  uint32_t ipv4_addr;
+  uint16_t port;
+  uint16_t length;
+} bt_capture_record_t;
+
+/* Capture being written. */
+typedef struct {
+  FILE *file;
+  double sample_rate;
+  uint64_t max_size;      // Bytes, 0 if unbounded
+  uint64_t size;
+  int64_t started_at;     // Monotonic time, in microseconds
+} bt_capture_t;
+
+/*
+ * Opens the capture file set in the configuration. Returns NULL if
+ * capturing is disabled or the file cannot be opened.
+ */
+bt_capture_t *
+bt_new_capture(const bt_config_t *config);
+
+/* Flushes and closes a capture. */
+void
+bt_free_capture(bt_capture_t *capture);
+
+/*
+ * Appends a datagram received at `received_at` (monotonic time) to the
+ * capture, if it is sampled. Only called from the receiving thread.
+ */
+void
+bt_capture_datagram(bt_capture_t *capture, const char *buff, size_t buflen,
+                    const struct sockaddr_in *from, int64_t received_at);
+
+#endif // BTTRACKER_CAPTURE_H_
@@ -0,0 +1,451 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Census mapped by this process. */
+typedef struct {
+  void *map;
+  size_t size;
+  const bt_census_header_t *header;
+  const bt_census_torrent_t *torrents;
+} bt_census_t;
+
+static bt_census_t *bt_census = NULL;
+
+/*
+ * Census replaced by the last load. Scrapes might still be reading it, so
+ * it is only unmapped when the next one replaces it, `Interval` seconds
+ * later.
+ */
+static bt_census_t *bt_census_retired = NULL;
+
+/* Growable array of counted torrents. */
+typedef struct {
+  bt_census_torrent_t *torrents;
+  size_t length;
+  size_t capacity;
+} bt_census_entries_t;
+
+/* Unmaps a census. */
+void
+bt_census_unmap(bt_census_t *census)
+{
+  if (NULL != census) {
+    munmap(census->map, census->size);
+    free(census);
+  }
+}
+
+bool
+bt_load_census(const bt_config_t *config)
+{
+  if (NULL == config->census_path || '\0' == config->census_path[0]) {
+    return false;
+  }
+
+  int fd = open(config->census_path, O_RDONLY);
+
+  if (-1 == fd) {
+    syslog(LOG_INFO, "No census found at %s", config->census_path);
+    return false;
+  }
+
+  struct stat st;
+
+  if (fstat(fd, &st) == -1 || st.st_size < sizeof(bt_census_header_t)) {
+    syslog(LOG_ERR, "Invalid census file");
+    close(fd);
+    return false;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (MAP_FAILED == map) {
+    syslog(LOG_ERR, "Cannot map census file");
+    return false;
+  }
+
+  const bt_census_header_t *header = (const bt_census_header_t *) map;
+  size_t expected_size = sizeof(bt_census_header_t) +
+    header->torrent_count * sizeof(bt_census_torrent_t);
+
+  if (memcmp(header->magic, BT_CENSUS_MAGIC, 8) != 0 ||
+      header->version != BT_CENSUS_VERSION ||
+      header->byte_order != BT_SNAPSHOT_BYTE_ORDER ||
+      expected_size != st.st_size) {
+    syslog(LOG_ERR, "Ignoring incompatible census file");
+    munmap(map, st.st_size);
+    return false;
+  }
+
+  bt_census_t *census = (bt_census_t *) malloc(sizeof(bt_census_t));
+
+  if (NULL == census) {
+    syslog(LOG_ERR, "Cannot allocate memory for census");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  census->map = map;
+  census->size = st.st_size;
+  census->header = header;
+  census->torrents = (const bt_census_torrent_t *) (header + 1);
+
+  madvise(map, st.st_size, MADV_RANDOM);
+
+  bt_census_unmap(bt_census_retired);
+  bt_census_retired = __atomic_exchange_n(&bt_census, census,
+                                          __ATOMIC_ACQ_REL);
+
+  return true;
+}
+
+bool
+bt_census_find(const bt_config_t *config, const int8_t *info_hash,
+               bt_torrent_stats_t *stats)
+{
+  const bt_census_t *census = __atomic_load_n(&bt_census, __ATOMIC_ACQUIRE);
+
+  if (NULL == census || census->header->created_at <
+      (int64_t) time(NULL) - config->census_max_age) {
+    return false;
+  }
+
+  size_t low = 0, high = census->header->torrent_count;
+
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    const bt_census_torrent_t *torrent = &census->torrents[mid];
+    int cmp = memcmp(torrent->info_hash, info_hash, 20);
+
+    if (0 == cmp) {
+      stats->seeders = torrent->seeders;
+      stats->leechers = torrent->leechers;
+      stats->downloads = torrent->downloads;
+      return true;
+    } else if (cmp < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  return false;
+}
+
+/* Appends the counters of a torrent, merged with its other entries later. */
+void
+bt_census_entries_append(bt_census_entries_t *entries, const int8_t *info_hash,
+                         uint32_t seeders, uint32_t leechers,
+                         uint32_t downloads)
+{
+  if (entries->length == entries->capacity) {
+    entries->capacity = MAX(1024, entries->capacity * 2);
+    entries->torrents = (bt_census_torrent_t *)
+      realloc(entries->torrents,
+              entries->capacity * sizeof(bt_census_torrent_t));
+
+    if (NULL == entries->torrents) {
+      syslog(LOG_ERR, "Cannot allocate memory for census");
+      exit(BT_EXIT_MALLOC_ERROR);
+    }
+  }
+
+  bt_census_torrent_t *torrent = &entries->torrents[entries->length++];
+  memcpy(torrent->info_hash, info_hash, 20);
+  torrent->seeders = seeders;
+  torrent->leechers = leechers;
+  torrent->downloads = downloads;
+}
+
+/* Orders torrents by info hash. */
+int
+bt_census_torrent_cmp(const void *a, const void *b)
+{
+  return memcmp(((const bt_census_torrent_t *) a)->info_hash,
+                ((const bt_census_torrent_t *) b)->info_hash, 20);
+}
+
+/* Adds the stats of a torrent of the shared memory table. */
+void
+bt_census_append_shm_torrent(const int8_t *info_hash,
+                             const bt_torrent_stats_t *stats, void *data)
+{
+  bt_census_entries_append((bt_census_entries_t *) data, info_hash,
+                           stats->seeders, stats->leechers, stats->downloads);
+}
+
+/*
+ * Walks the peer keys or sets of the swarms, one SCAN page at a time, and
+ * counts their peers. Returns false if Redis stopped answering.
+ */
+bool
+bt_census_collect(redisContext *redis, const bt_config_t *config,
+                  bt_census_entries_t *entries)
+{
+  const bt_key_names_t *names = bt_key_names(config);
+  bool swarm = BT_PEER_STORAGE_SWARM == config->announce_peer_storage;
+  long long cutoff = (long long) time(NULL) - config->announce_peer_ttl;
+  size_t prefix_len = strlen(config->redis_key_prefix) +
+    strlen(names->peer) + 2;
+  size_t info_hash_len =
+    BT_KEY_SCHEMA_COMPACT == config->redis_key_schema ? 20 : 40;
+  char *pattern = bt_peer_key_pattern(config);
+  char cursor[32] = "0";
+
+  do {
+    redisReply *reply =
+      bt_redis_command(redis, "SCAN %s MATCH %s COUNT %u TYPE %s",
+                       cursor, pattern,
+                       MAX(1, config->announce_reaper_batch_size),
+                       swarm ? "zset" : "string");
+
+    if (NULL == reply || REDIS_REPLY_ARRAY != reply->type ||
+        2 != reply->elements) {
+      syslog(LOG_ERR, "Cannot scan peers");
+      if (NULL != reply) {
+        freeReplyObject(reply);
+      }
+      free(pattern);
+      return false;
+    }
+
+    snprintf(cursor, sizeof(cursor), "%s", reply->element[0]->str);
+
+    redisReply *keys = reply->element[1];
+    size_t first = entries->length;
+
+    for (size_t i = 0; i < keys->elements; i++) {
+      const char *key = keys->element[i]->str;
+      size_t key_len = keys->element[i]->len;
+      int8_t info_hash[20];
+      bool seeder;
+
+      if (swarm) {
+        if (!bt_swarm_parse_key(config, key, key_len, info_hash, &seeder)) {
+          continue;
+        }
+
+        /* The set is counted below, once the whole page is parsed. */
+        bt_redis_append_command(redis, "ZCOUNT %b %lld +inf", key, key_len,
+                                cutoff);
+        bt_census_entries_append(entries, info_hash, seeder, !seeder, 0);
+        continue;
+      }
+
+      /* Peer keys read <prefix>:<peer>:<info hash>:<s|l>:<peer id>. */
+      if (key_len <= prefix_len + info_hash_len + 2 + 20 ||
+          ':' != key[prefix_len + info_hash_len]) {
+        continue;
+      }
+
+      size_t name_len = key_len - prefix_len - info_hash_len - 2 - 20;
+
+      if (BT_KEY_SCHEMA_COMPACT == config->redis_key_schema) {
+        memcpy(info_hash, key + prefix_len, 20);
+      } else if (!bt_hexarray_to_bytearray(key + prefix_len, info_hash_len,
+                                           info_hash)) {
+        continue;
+      }
+
+      seeder = name_len == strlen(names->seeder) &&
+        memcmp(key + prefix_len + info_hash_len + 1, names->seeder,
+               name_len) == 0;
+
+      bt_census_entries_append(entries, info_hash, seeder, !seeder, 0);
+    }
+
+    freeReplyObject(reply);
+
+    /* Replaces the placeholders of the sets with their live peer counts. */
+    for (size_t i = first; swarm && i < entries->length; i++) {
+      redisReply *count;
+
+      if (bt_redis_get_reply(redis, (void **) &count) != REDIS_OK) {
+        syslog(LOG_ERR, "Got a NULL reply from Redis");
+        free(pattern);
+        return false;
+      }
+
+      uint32_t peers = REDIS_REPLY_INTEGER == count->type ? count->integer : 0;
+      bt_census_torrent_t *torrent = &entries->torrents[i];
+
+      torrent->seeders *= peers;
+      torrent->leechers *= peers;
+
+      freeReplyObject(count);
+    }
+  } while (strcmp(cursor, "0") != 0);
+
+  free(pattern);
+  return true;
+}
+
+/* Fills the download counters of the torrents, pipelining the reads. */
+void
+bt_census_fill_downloads(redisContext *redis, const bt_config_t *config,
+                         bt_census_torrent_t *torrents, size_t count)
+{
+  size_t batch_size = MAX(1, config->announce_reaper_batch_size);
+  const char *torrent_ns = bt_key_names(config)->torrent;
+
+  for (size_t start = 0; start < count; start += batch_size) {
+    size_t end = MIN(count, start + batch_size);
+
+    for (size_t i = start; i < end; i++) {
+      bt_info_hash_key_t info_hash_key;
+      bt_info_hash_key(config, torrents[i].info_hash, &info_hash_key);
+
+      bt_redis_append_command(redis, "HGET %s:%s:%b downs",
+                              config->redis_key_prefix, torrent_ns,
+                              info_hash_key.str, info_hash_key.len);
+    }
+
+    for (size_t i = start; i < end; i++) {
+      redisReply *reply;
+
+      if (bt_redis_get_reply(redis, (void **) &reply) != REDIS_OK) {
+        return;
+      }
+
+      if (REDIS_REPLY_STRING == reply->type) {
+        torrents[i].downloads = strtoul(reply->str, NULL, 10);
+      }
+
+      freeReplyObject(reply);
+    }
+  }
+}
+
+bool
+bt_write_census(redisContext *redis, const bt_config_t *config,
+                const char *path)
+{
+  bt_census_entries_t entries = { NULL, 0, 0 };
+
+  if (BT_PEER_STORAGE_SHM == config->announce_peer_storage) {
+    bt_shm_foreach_torrent(config, bt_census_append_shm_torrent, &entries);
+  } else if (!bt_census_collect(redis, config, &entries)) {
+    free(entries.torrents);
+    return false;
+  }
+
+  qsort(entries.torrents, entries.length, sizeof(bt_census_torrent_t),
+        bt_census_torrent_cmp);
+
+  /* Merges the entries of each torrent, dropping those without peers. */
+  size_t torrent_count = 0;
+
+  for (size_t i = 0; i < entries.length; i++) {
+    bt_census_torrent_t *entry = &entries.torrents[i];
+    bt_census_torrent_t *last = torrent_count > 0
+      ? &entries.torrents[torrent_count - 1] : NULL;
+
+    if (NULL != last && memcmp(last->info_hash, entry->info_hash, 20) == 0) {
+      last->seeders += entry->seeders;
+      last->leechers += entry->leechers;
+      last->downloads = MAX(last->downloads, entry->downloads);
+    } else if (entry->seeders + entry->leechers > 0) {
+      entries.torrents[torrent_count++] = *entry;
+    }
+  }
+
+  if (BT_PEER_STORAGE_SHM != config->announce_peer_storage) {
+    bt_census_fill_downloads(redis, config, entries.torrents, torrent_count);
+  }
+
+  bt_census_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, BT_CENSUS_MAGIC, 8);
+  header.version = BT_CENSUS_VERSION;
+  header.byte_order = BT_SNAPSHOT_BYTE_ORDER;
+  header.created_at = time(NULL);
+  header.torrent_count = torrent_count;
+
+  /* Written aside and renamed, so readers never see a partial file. */
+  char tmp_path[PATH_MAX];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+  FILE *file = fopen(tmp_path, "wb");
+  bool succeeded = NULL != file &&
+    fwrite(&header, sizeof(header), 1, file) == 1 &&
+    fwrite(entries.torrents, sizeof(bt_census_torrent_t), torrent_count,
+           file) == torrent_count;
+
+  if (NULL != file) {
+    succeeded = fflush(file) == 0 && fsync(fileno(file)) == 0 && succeeded;
+    succeeded = fclose(file) == 0 && succeeded;
+  }
+
+  if (succeeded && rename(tmp_path, path) == -1) {
+    succeeded = false;
+  }
+
+  if (succeeded) {
+    syslog(LOG_INFO, "Wrote census of %zu torrents", torrent_count);
+  } else {
+    syslog(LOG_ERR, "Cannot write census to %s", path);
+    unlink(tmp_path);
+  }
+
+  free(entries.torrents);
+
+  return succeeded;
+}
+
+void *
+bt_census_thread(void *data)
+{
+  bt_config_t *config = (bt_config_t *) data;
+  bool needs_redis = BT_PEER_STORAGE_SHM != config->announce_peer_storage;
+  redisContext *redis = NULL;
+
+  while (true) {
+    sleep(MAX(1, config->census_interval));
+
+    if (needs_redis && NULL == redis) {
+      redis = bt_redis_connect(config->redis_socket_path, config->redis_host,
+                               config->redis_port,
+                               config->redis_timeout * 1000, config->redis_db);
+
+      if (NULL == redis) {
+        continue;
+      }
+    }
+
+    if (bt_write_census(redis, config, config->census_path)) {
+      bt_load_census(config);
+    } else if (NULL != redis && redis->err) {
+      redisFree(redis);
+      redis = NULL;
+    }
+  }
+
+  return NULL;
+}
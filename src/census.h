@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BTTRACKER_CENSUS_H_
+#define BTTRACKER_CENSUS_H_
+
+/* Identifies census files and their layout. */
+#define BT_CENSUS_MAGIC   "BTCENSUS"
+#define BT_CENSUS_VERSION (1)
+
+/*
+ * Census file layout: this header, then one entry per torrent sorted by
+ * info hash, so readers can map the file and binary-search it. Integers are
+ * stored in the byte order of the host, which `byte_order` reveals.
+ */
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;    // BT_SNAPSHOT_BYTE_ORDER as written by the host
+  int64_t created_at;     // Unix time
+  uint64_t torrent_count;
+} bt_census_header_t;
+
+/* Torrent entry of a census. */
+typedef struct {
+  int8_t info_hash[20];
+  uint32_t seeders;
+  uint32_t leechers;
+  uint32_t downloads;
+} bt_census_torrent_t;
+
+/*
+ * Maps the census file set in the configuration, replacing the one mapped
+ * before. The census thread keeps loading new ones, so the last one stays
+ * mapped until the process exits. Returns false if there is no usable
+ * census.
+ */
+bool
+bt_load_census(const bt_config_t *config);
+
+/*
+ * Fills `stats` with the counters of a torrent if the census is younger
+ * than `MaxAge` and knows the torrent. Returns false otherwise.
+ */
+bool
+bt_census_find(const bt_config_t *config, const int8_t *info_hash,
+               bt_torrent_stats_t *stats);
+
+/* Counts the peers of all swarms and writes the result to `path`. */
+bool
+bt_write_census(redisContext *redis, const bt_config_t *config,
+                const char *path);
+
+/*
+ * Thread that periodically writes a census and loads it. The argument
+ * `data` is a pointer to the `bt_config_t` object.
+ */
+void *
+bt_census_thread(void *data);
+
+#endif // BTTRACKER_CENSUS_H_
@@ -50,16 +50,100 @@ bt_load_config(const char *filename, bt_config_t *config)
     g_key_file_get_string (keyfile, "BtTracker", "Address", NULL);
   config->bttracker_port          =
     g_key_file_get_integer(keyfile, "BtTracker", "Port", NULL);
+  config->bttracker_stats_interval =
+    g_key_file_get_integer(keyfile, "BtTracker", "StatsInterval", NULL);
+  config->bttracker_reuse_port =
+    g_key_file_get_boolean(keyfile, "BtTracker", "ReusePort", NULL);
+  config->bttracker_socket_filter =
+    g_key_file_get_boolean(keyfile, "BtTracker", "SocketFilter", NULL);
+  config->bttracker_handoff_socket =
+    g_key_file_get_string (keyfile, "BtTracker", "HandoffSocket", NULL);
   config->thread_max              =
     g_key_file_get_integer(keyfile, "Threading", "MaxThreads", NULL);
-  config->thread_max_idle_time    =
-    g_key_file_get_integer(keyfile, "Threading", "MaxIdleTime", NULL);
+  config->thread_max_queue_len    =
+    g_key_file_get_integer(keyfile, "Threading", "MaxQueueLength", NULL);
+  config->thread_queue_deadline   =
+    g_key_file_get_integer(keyfile, "Threading", "QueueDeadline", NULL);
+  config->thread_receiver_cpus    =
+    g_key_file_get_string (keyfile, "Threading", "ReceiverCPUs", NULL);
+  config->thread_worker_cpus      =
+    g_key_file_get_string (keyfile, "Threading", "WorkerCPUs", NULL);
+  config->thread_irq_interface    =
+    g_key_file_get_string (keyfile, "Threading", "IRQInterface", NULL);
+  config->thread_receive_spin_time =
+    g_key_file_get_integer(keyfile, "Threading", "ReceiveSpinTime", NULL);
+  config->thread_worker_spin_time =
+    g_key_file_get_integer(keyfile, "Threading", "WorkerSpinTime", NULL);
+  config->sched_connect_weight    =
+    g_key_file_get_integer(keyfile, "Threading", "ConnectWeight", NULL);
+  config->sched_announce_weight   =
+    g_key_file_get_integer(keyfile, "Threading", "AnnounceWeight", NULL);
+  config->sched_scrape_weight     =
+    g_key_file_get_integer(keyfile, "Threading", "ScrapeWeight", NULL);
+
+  char *sched_policy_str =
+    g_key_file_get_string(keyfile,  "Threading", "SchedulingPolicy", NULL);
+
+  if (NULL != sched_policy_str && strcmp(sched_policy_str, "strict") == 0) {
+    config->sched_policy = BT_SCHED_STRICT;
+  } else if (NULL != sched_policy_str &&
+             strcmp(sched_policy_str, "weighted") == 0) {
+    config->sched_policy = BT_SCHED_WEIGHTED;
+  } else {
+    config->sched_policy = BT_SCHED_FIFO;
+  }
+
+  free(sched_policy_str);
   config->announce_wait_time      =
     g_key_file_get_integer(keyfile, "Announce",  "WaitTime", NULL);
   config->announce_peer_ttl       =
     g_key_file_get_integer(keyfile, "Announce",  "PeerTTL", NULL);
   config->announce_max_numwant    =
     g_key_file_get_integer(keyfile, "Announce",  "MaxNumWant", NULL);
+  config->announce_reaper_interval =
+    g_key_file_get_integer(keyfile, "Announce",  "ReaperInterval", NULL);
+  config->announce_reaper_batch_size =
+    g_key_file_get_integer(keyfile, "Announce",  "ReaperBatchSize", NULL);
+
+  config->announce_min_interval   =
+    g_key_file_get_integer(keyfile, "Announce",  "MinInterval", NULL);
+  config->announce_max_interval   =
+    g_key_file_get_integer(keyfile, "Announce",  "MaxInterval", NULL);
+  config->announce_interval_step  =
+    g_key_file_get_integer(keyfile, "Announce",  "IntervalStep", NULL);
+  config->announce_interval_jitter =
+    g_key_file_get_integer(keyfile, "Announce",  "IntervalJitter", NULL);
+  config->announce_load_queue_threshold =
+    g_key_file_get_integer(keyfile, "Announce",  "LoadQueueThreshold", NULL);
+  config->announce_load_latency_threshold =
+    g_key_file_get_integer(keyfile, "Announce",  "LoadLatencyThreshold", NULL);
+
+  config->announce_refresh_cache_size =
+    g_key_file_get_integer(keyfile, "Announce",  "RefreshCacheSize", NULL);
+  config->announce_refresh_batch_size =
+    g_key_file_get_integer(keyfile, "Announce",  "RefreshBatchSize", NULL);
+  config->announce_refresh_delay =
+    g_key_file_get_integer(keyfile, "Announce",  "RefreshDelay", NULL);
+  config->announce_locality_share =
+    g_key_file_get_integer(keyfile, "Announce",  "LocalityShare", NULL);
+  config->announce_locality_prefix_len =
+    g_key_file_get_integer(keyfile, "Announce",  "LocalityPrefixLength", NULL);
+  config->announce_locality_groups =
+    g_key_file_get_string(keyfile,  "Announce",  "LocalityGroups", NULL);
+
+  char *peer_storage_str =
+    g_key_file_get_string(keyfile,  "Announce",  "PeerStorage", NULL);
+
+  if (NULL != peer_storage_str && strcmp(peer_storage_str, "swarm") == 0) {
+    config->announce_peer_storage = BT_PEER_STORAGE_SWARM;
+  } else if (NULL != peer_storage_str &&
+             strcmp(peer_storage_str, "shm") == 0) {
+    config->announce_peer_storage = BT_PEER_STORAGE_SHM;
+  } else {
+    config->announce_peer_storage = BT_PEER_STORAGE_KEYS;
+  }
+
+  free(peer_storage_str);
 
   char *info_hash_restriction_str =
     g_key_file_get_string(keyfile,  "Announce",  "InfoHashRestriction", NULL);
@@ -110,6 +194,123 @@ bt_load_config(const char *filename, bt_config_t *config)
     g_key_file_get_integer(keyfile, "Redis", "DB", NULL);
   config->redis_key_prefix  =
     g_key_file_get_string(keyfile,  "Redis", "KeyPrefix", NULL);
+  config->redis_store_peer_stats =
+    g_key_file_get_boolean(keyfile, "Redis", "StorePeerStats", NULL);
+
+  char *key_schema_str =
+    g_key_file_get_string(keyfile,  "Redis", "KeySchema", NULL);
+
+  if (NULL != key_schema_str && strcmp(key_schema_str, "compact") == 0) {
+    config->redis_key_schema = BT_KEY_SCHEMA_COMPACT;
+  } else {
+    config->redis_key_schema = BT_KEY_SCHEMA_LEGACY;
+  }
+
+  free(key_schema_str);
+
+  config->shm_name              =
+    g_key_file_get_string(keyfile,  "SharedMemory", "Name", NULL);
+  config->shm_buckets           =
+    g_key_file_get_integer(keyfile, "SharedMemory", "Buckets", NULL);
+  config->shm_peers_per_torrent =
+    g_key_file_get_integer(keyfile, "SharedMemory", "PeersPerTorrent", NULL);
+
+  if (config->shm_peers_per_torrent > BT_SHM_MAX_PEERS_PER_TORRENT) {
+    syslog(LOG_NOTICE, "Lowering PeersPerTorrent to %d",
+           BT_SHM_MAX_PEERS_PER_TORRENT);
+    config->shm_peers_per_torrent = BT_SHM_MAX_PEERS_PER_TORRENT;
+  }
+
+  config->snapshot_path     =
+    g_key_file_get_string(keyfile,  "Snapshot", "Path", NULL);
+  config->snapshot_interval =
+    g_key_file_get_integer(keyfile, "Snapshot", "Interval", NULL);
+
+  config->trace_path           =
+    g_key_file_get_string(keyfile,  "Trace", "Path", NULL);
+  config->trace_sample_rate    =
+    g_key_file_get_double(keyfile,  "Trace", "SampleRate", NULL);
+  config->trace_slow_threshold =
+    g_key_file_get_integer(keyfile, "Trace", "SlowThreshold", NULL);
+
+  config->capture_path        =
+    g_key_file_get_string(keyfile,  "Capture", "Path", NULL);
+  config->capture_sample_rate =
+    g_key_file_get_double(keyfile,  "Capture", "SampleRate", NULL);
+  config->capture_max_size    =
+    g_key_file_get_integer(keyfile, "Capture", "MaxSize", NULL);
+
+  config->census_path     =
+    g_key_file_get_string(keyfile,  "Census", "Path", NULL);
+  config->census_interval =
+    g_key_file_get_integer(keyfile, "Census", "Interval", NULL);
+  config->census_max_age  =
+    g_key_file_get_integer(keyfile, "Census", "MaxAge", NULL);
+
+  config->ratelimit_connect_rate     =
+    g_key_file_get_double(keyfile,  "RateLimit", "ConnectRate", NULL);
+  config->ratelimit_connect_burst    =
+    g_key_file_get_integer(keyfile, "RateLimit", "ConnectBurst", NULL);
+  config->ratelimit_announce_rate    =
+    g_key_file_get_double(keyfile,  "RateLimit", "AnnounceRate", NULL);
+  config->ratelimit_announce_burst   =
+    g_key_file_get_integer(keyfile, "RateLimit", "AnnounceBurst", NULL);
+  config->ratelimit_scrape_rate      =
+    g_key_file_get_double(keyfile,  "RateLimit", "ScrapeRate", NULL);
+  config->ratelimit_scrape_burst     =
+    g_key_file_get_integer(keyfile, "RateLimit", "ScrapeBurst", NULL);
+  config->ratelimit_table_size       =
+    g_key_file_get_integer(keyfile, "RateLimit", "TableSize", NULL);
+  config->ratelimit_reply_with_error =
+    g_key_file_get_boolean(keyfile, "RateLimit", "ReplyWithError", NULL);
+
+  config->respcache_ttl        =
+    g_key_file_get_integer(keyfile, "ResponseCache", "TTL", NULL);
+  config->respcache_table_size =
+    g_key_file_get_integer(keyfile, "ResponseCache", "TableSize", NULL);
+
+  config->hot_size            =
+    g_key_file_get_integer(keyfile, "HotSwarms", "Size", NULL);
+  config->hot_min_requests    =
+    g_key_file_get_integer(keyfile, "HotSwarms", "MinRequests", NULL);
+  config->hot_interval        =
+    g_key_file_get_integer(keyfile, "HotSwarms", "Interval", NULL);
+  config->hot_path            =
+    g_key_file_get_string(keyfile,  "HotSwarms", "Path", NULL);
+  config->hot_cache_time      =
+    g_key_file_get_integer(keyfile, "HotSwarms", "CacheTime", NULL);
+  config->hot_interval_factor =
+    g_key_file_get_double(keyfile,  "HotSwarms", "IntervalFactor", NULL);
+  config->hot_max_interval    =
+    g_key_file_get_integer(keyfile, "HotSwarms", "MaxInterval", NULL);
+
+  /* Peers must outlive the longest interval, with the configured slack. */
+  uint32_t ttl_slack = config->announce_peer_ttl > config->announce_wait_time
+    ? config->announce_peer_ttl - config->announce_wait_time : 0;
+  uint32_t min_peer_ttl = bt_longest_announce_interval(config) + ttl_slack;
+
+  if (config->announce_peer_ttl < min_peer_ttl) {
+    syslog(LOG_NOTICE, "Raising PeerTTL to %" PRIu32 " seconds to cover "
+           "the longest announce interval", min_peer_ttl);
+    config->announce_peer_ttl = min_peer_ttl;
+  }
+
+  config->breaker_error_rate        =
+    g_key_file_get_integer(keyfile, "CircuitBreaker", "ErrorRate", NULL);
+  config->breaker_latency_threshold =
+    g_key_file_get_integer(keyfile, "CircuitBreaker", "LatencyThreshold", NULL);
+  config->breaker_min_requests      =
+    g_key_file_get_integer(keyfile, "CircuitBreaker", "MinRequests", NULL);
+  config->breaker_window            =
+    g_key_file_get_integer(keyfile, "CircuitBreaker", "Window", NULL);
+  config->breaker_probe_interval    =
+    g_key_file_get_integer(keyfile, "CircuitBreaker", "ProbeInterval", NULL);
+  config->breaker_buffer_size       =
+    g_key_file_get_integer(keyfile, "CircuitBreaker", "BufferSize", NULL);
+  config->breaker_known_swarms      =
+    g_key_file_get_integer(keyfile, "CircuitBreaker", "KnownSwarms", NULL);
+  config->breaker_known_peers       =
+    g_key_file_get_integer(keyfile, "CircuitBreaker", "KnownPeers", NULL);
 
   g_key_file_free(keyfile);
 
@@ -38,6 +38,26 @@ typedef enum {
   BT_RESTRICTION_BLACKLIST
 } bt_restriction;
 
+/* Layouts used to store torrents and peers in Redis. */
+typedef enum {
+  BT_KEY_SCHEMA_LEGACY,
+  BT_KEY_SCHEMA_COMPACT
+} bt_key_schema;
+
+/* Structures used to store the peers of each torrent. */
+typedef enum {
+  BT_PEER_STORAGE_KEYS,  // One key per peer, expired by Redis
+  BT_PEER_STORAGE_SWARM, // Sorted sets per torrent, expired by the reaper
+  BT_PEER_STORAGE_SHM    // Table in shared memory, shared by processes
+} bt_peer_storage;
+
+/* Order in which pending requests of different classes are handled. */
+typedef enum {
+  BT_SCHED_FIFO,     // Arrival order, regardless of the class
+  BT_SCHED_STRICT,   // Connect, then announce, then scrape requests
+  BT_SCHED_WEIGHTED  // Smooth weighted round-robin among the classes
+} bt_sched_policy;
+
 /* Configuration data. */
 typedef struct {
 
@@ -45,15 +65,46 @@ typedef struct {
   char *bttracker_addr;
   uint16_t bttracker_port;
   int bttracker_log_level_mask;
+  uint32_t bttracker_stats_interval;
+  bool bttracker_reuse_port;
+  bool bttracker_socket_filter;
+  char *bttracker_handoff_socket;
 
   // Threading options
   uint16_t thread_max;
-  uint32_t thread_max_idle_time;
+  uint32_t thread_max_queue_len;
+  uint32_t thread_queue_deadline;
+  char *thread_receiver_cpus;
+  char *thread_worker_cpus;
+  char *thread_irq_interface;
+  uint32_t thread_receive_spin_time;
+  uint32_t thread_worker_spin_time;
+
+  // Scheduling options
+  bt_sched_policy sched_policy;
+  uint16_t sched_connect_weight;
+  uint16_t sched_announce_weight;
+  uint16_t sched_scrape_weight;
 
   // Announce options
   uint32_t announce_wait_time;
   uint32_t announce_peer_ttl;
   uint16_t announce_max_numwant;
+  bt_peer_storage announce_peer_storage;
+  uint32_t announce_reaper_interval;
+  uint32_t announce_reaper_batch_size;
+  uint32_t announce_refresh_cache_size;
+  uint32_t announce_refresh_batch_size;
+  uint32_t announce_refresh_delay;
+  uint32_t announce_min_interval;
+  uint32_t announce_max_interval;
+  uint32_t announce_interval_step;
+  uint32_t announce_interval_jitter;
+  uint32_t announce_load_queue_threshold;
+  uint32_t announce_load_latency_threshold;
+  uint32_t announce_locality_share;
+  uint32_t announce_locality_prefix_len;
+  char *announce_locality_groups;
 
   // Redis options
   char *redis_socket_path;
@@ -62,9 +113,68 @@ typedef struct {
   uint32_t redis_timeout;
   uint16_t redis_db;
   char *redis_key_prefix;
+  bt_key_schema redis_key_schema;
+  bool redis_store_peer_stats;
+
+  // Shared memory options
+  char *shm_name;
+  uint32_t shm_buckets;
+  uint32_t shm_peers_per_torrent;
+
+  // Snapshot options
+  char *snapshot_path;
+  uint32_t snapshot_interval;
+
+  // Tracing options
+  char *trace_path;
+  double trace_sample_rate;
+  uint32_t trace_slow_threshold;
+
+  // Capture options
+  char *capture_path;
+  double capture_sample_rate;
+  uint32_t capture_max_size;
+
+  // Census options
+  char *census_path;
+  uint32_t census_interval;
+  uint32_t census_max_age;
 
   // Blacklist options
   bt_restriction info_hash_restriction;
+
+  // Rate limiting options
+  double ratelimit_connect_rate;
+  uint32_t ratelimit_connect_burst;
+  double ratelimit_announce_rate;
+  uint32_t ratelimit_announce_burst;
+  double ratelimit_scrape_rate;
+  uint32_t ratelimit_scrape_burst;
+  uint32_t ratelimit_table_size;
+  bool ratelimit_reply_with_error;
+
+  // Response cache options
+  uint32_t respcache_ttl;
+  uint32_t respcache_table_size;
+
+  // Hot swarm options
+  uint32_t hot_size;
+  uint32_t hot_min_requests;
+  uint32_t hot_interval;
+  char *hot_path;
+  uint32_t hot_cache_time;
+  double hot_interval_factor;
+  uint32_t hot_max_interval;
+
+  // Circuit breaker options
+  uint32_t breaker_error_rate;
+  uint32_t breaker_latency_threshold;
+  uint32_t breaker_min_requests;
+  uint32_t breaker_window;
+  uint32_t breaker_probe_interval;
+  uint32_t breaker_buffer_size;
+  uint32_t breaker_known_swarms;
+  uint32_t breaker_known_peers;
 } bt_config_t;
 
 /* Loads configuration file to a `bt_config_t` object. */
@@ -79,3 +79,33 @@ bt_handle_connection(bt_req_t *request, const bt_config_t *config,
 
   return bt_serialize_connection_response(&response_data);
 }
+
+bt_response_buffer_t *
+bt_handle_stale_connection(bt_req_t *request, const bt_config_t *config,
+                           size_t buflen)
+{
+  syslog(LOG_DEBUG, "Handling connection without Redis");
+
+  /* Connect requests are validated without Redis. */
+  if (!bt_valid_request(NULL, config, request, buflen)) {
+    return NULL;
+  }
+
+  int64_t connection_id = bt_random_int64();
+
+  /* The connection is stored once Redis comes back. */
+  bt_buffered_write_t write = {
+    .kind = BT_WRITE_CONNECTION,
+    .connection_id = connection_id
+  };
+  bt_breaker_buffer(config, &write);
+  bt_stats_inc(BT_STAT_STALE_ANSWERS);
+
+  bt_connection_resp_t response_data = {
+    .action = request->action,
+    .transaction_id = request->transaction_id,
+    .connection_id = connection_id
+  };
+
+  return bt_serialize_connection_response(&response_data);
+}
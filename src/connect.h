@@ -39,6 +39,14 @@ bt_response_buffer_t *
 bt_handle_connection(bt_req_t *request, const bt_config_t *config,
                      size_t buflen, redisContext *redis);
 
+/*
+ * Returns the response data to a connection request while Redis is left
+ * alone. The connection is stored when it comes back.
+ */
+bt_response_buffer_t *
+bt_handle_stale_connection(bt_req_t *request, const bt_config_t *config,
+                           size_t buflen);
+
 /*
  * Thread that purges all connections older than 2 minutes. The argument `data`
  * is a pointer to a `bt_connection_purge_data_t` object.
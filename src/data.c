@@ -28,11 +28,75 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+/* Key names used by each key schema. */
+static const bt_key_names_t bt_legacy_key_names = {
+  .conn = "conn", .peer = "pr", .seeder = "sd", .leecher = "lc",
+  .torrent = "ih", .addrs = "ad", .local = "lg"
+};
+
+static const bt_key_names_t bt_compact_key_names = {
+  .conn = "c", .peer = "p", .seeder = "s", .leecher = "l",
+  .torrent = "i", .addrs = "a", .local = "g"
+};
+
+const bt_key_names_t *
+bt_key_names(const bt_config_t *config)
+{
+  return BT_KEY_SCHEMA_COMPACT == config->redis_key_schema
+    ? &bt_compact_key_names : &bt_legacy_key_names;
+}
+
+/* Copies `str` to `pattern`, escaping glob characters. Returns its length. */
+size_t
+bt_glob_escape(const char *str, size_t len, char *pattern)
+{
+  size_t pattern_len = 0;
+
+  for (size_t i = 0; i < len; i++) {
+    char c = str[i];
+
+    if ('*' == c || '?' == c || '[' == c || ']' == c || '\\' == c) {
+      pattern[pattern_len++] = '\\';
+    }
+    pattern[pattern_len++] = c;
+  }
+
+  return pattern_len;
+}
+
+char *
+bt_peer_key_pattern(const bt_config_t *config)
+{
+  const char *peer = bt_key_names(config)->peer;
+  size_t prefix_len = strlen(config->redis_key_prefix);
+  char *pattern = (char *) malloc(2 * prefix_len + strlen(peer) + 4);
+
+  if (NULL == pattern) {
+    syslog(LOG_ERR, "Cannot allocate memory for key pattern");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  size_t len = bt_glob_escape(config->redis_key_prefix, prefix_len, pattern);
+  sprintf(pattern + len, ":%s:*", peer);
+
+  return pattern;
+}
+
+/* Writes the hex representation of `bin` to `result` (not terminated). */
 void
-bt_bytearray_to_hexarray(int8_t *bin, size_t binsz, char **result)
+bt_write_hex(const int8_t *bin, size_t binsz, char *result)
 {
   const char *hex_str = "0123456789abcdef";
 
+  for (int i = 0; i < binsz; i++) {
+    result[i * 2 + 0] = hex_str[(bin[i] >> 4) & 0xF];
+    result[i * 2 + 1] = hex_str[bin[i] & 0x0F];
+  }
+}
+
+void
+bt_bytearray_to_hexarray(int8_t *bin, size_t binsz, char **result)
+{
   *result = (char *) malloc(binsz * 2 + 1);
   (*result)[binsz * 2] = 0;
 
@@ -40,10 +104,108 @@ bt_bytearray_to_hexarray(int8_t *bin, size_t binsz, char **result)
     return;
   }
 
-  for (int i = 0; i < binsz; i++) {
-    (*result)[i * 2 + 0] = hex_str[(bin[i] >> 4) & 0xF];
-    (*result)[i * 2 + 1] = hex_str[bin[i] & 0x0F];
+  bt_write_hex(bin, binsz, *result);
+}
+
+bool
+bt_hexarray_to_bytearray(const char *hex, size_t hexsz, int8_t *result)
+{
+  if (hexsz % 2 != 0) {
+    return false;
   }
+
+  for (int i = 0; i < hexsz / 2; i++) {
+    int high = g_ascii_xdigit_value(hex[i * 2 + 0]);
+    int low  = g_ascii_xdigit_value(hex[i * 2 + 1]);
+
+    if (high < 0 || low < 0) {
+      return false;
+    }
+
+    result[i] = (int8_t) ((high << 4) | low);
+  }
+
+  return true;
+}
+
+void
+bt_info_hash_key(const bt_config_t *config, const int8_t *info_hash,
+                 bt_info_hash_key_t *key)
+{
+  memcpy(key->info_hash, info_hash, 20);
+
+  if (BT_KEY_SCHEMA_LEGACY == config->redis_key_schema) {
+    bt_write_hex(info_hash, 20, key->str);
+    memcpy(key->pattern, key->str, 40);
+    key->len = key->pattern_len = 40;
+    return;
+  }
+
+  memcpy(key->str, info_hash, 20);
+  key->len = 20;
+
+  /* Raw bytes may contain glob characters, which must be escaped. */
+  key->pattern_len = bt_glob_escape((const char *) info_hash, 20, key->pattern);
+}
+
+size_t
+bt_write_compact_peer(const bt_config_t *config, const bt_peer_t *peer,
+                      char *value)
+{
+  uint32_t ipv4_addr = htonl(peer->ipv4_addr);
+  uint16_t port = htons(peer->port);
+
+  memcpy(value,     &ipv4_addr, 4);
+  memcpy(value + 4, &port, 2);
+
+  if (!config->redis_store_peer_stats) {
+    return BT_COMPACT_PEER_LEN;
+  }
+
+  int32_t key        = htonl(peer->key);
+  int64_t downloaded = htonll(peer->downloaded);
+  int64_t uploaded   = htonll(peer->uploaded);
+  int64_t left       = htonll(peer->left);
+
+  memcpy(value +  6, &key, 4);
+  memcpy(value + 10, &downloaded, 8);
+  memcpy(value + 18, &uploaded, 8);
+  memcpy(value + 26, &left, 8);
+
+  return BT_COMPACT_PEER_LEN + BT_COMPACT_PEER_STATS_LEN;
+}
+
+size_t
+bt_write_peer_value(const bt_config_t *config, const bt_peer_t *peer,
+                    char *value)
+{
+  /* The legacy schema stores the whole peer struct as it is in memory. */
+  if (BT_KEY_SCHEMA_LEGACY == config->redis_key_schema) {
+    memcpy(value, peer, sizeof(bt_peer_t));
+    return sizeof(bt_peer_t);
+  }
+
+  return bt_write_compact_peer(config, peer, value);
+}
+
+bt_peer_addr_t *
+bt_read_peer_value(const bt_config_t *config, const char *value, size_t len)
+{
+  if (BT_KEY_SCHEMA_LEGACY == config->redis_key_schema) {
+    if (len < sizeof(bt_peer_t)) {
+      return NULL;
+    }
+
+    const bt_peer_t *peer_data = (const bt_peer_t *) value;
+    return bt_new_peer_addr(peer_data->ipv4_addr, peer_data->port);
+  }
+
+  if (len < BT_COMPACT_PEER_LEN) {
+    return NULL;
+  }
+
+  return bt_new_peer_addr(ntohl(*((uint32_t *) value)),
+                          ntohs(*((uint16_t *) (value + 4))));
 }
 
 redisContext *
@@ -76,7 +238,7 @@ bt_redis_connect(const char *unix_sock, const char *host, int port,
   syslog(LOG_DEBUG, "Connection with Redis instance established");
 
   /* Switching to the configured database. */
-  reply = redisCommand(conn, "SELECT %d", db);
+  reply = bt_redis_command(conn, "SELECT %d", db);
 
   if (reply != NULL) {
     freeReplyObject(reply);
@@ -92,7 +254,7 @@ bt_redis_ping(redisContext *redis)
   bool ok = false;
   redisReply *reply;
 
-  reply = redisCommand(redis, "PING");
+  reply = bt_redis_command(redis, "PING");
 
   if (reply != NULL) {
     ok = (reply->type != REDIS_REPLY_ERROR);
@@ -102,15 +264,163 @@ bt_redis_ping(redisContext *redis)
   return ok;
 }
 
+/* Round trips of the current thread. */
+static GPrivate bt_redis_trips_key = G_PRIVATE_INIT(free);
+
+/* Returns the round trips of the current thread. */
+bt_redis_trips_t *
+bt_redis_trips(void)
+{
+  bt_redis_trips_t *trips = g_private_get(&bt_redis_trips_key);
+
+  if (NULL == trips) {
+    trips = (bt_redis_trips_t *) calloc(1, sizeof(bt_redis_trips_t));
+
+    if (NULL == trips) {
+      syslog(LOG_ERR, "Cannot allocate memory for Redis round trips");
+      exit(BT_EXIT_MALLOC_ERROR);
+    }
+
+    g_private_set(&bt_redis_trips_key, trips);
+  }
+
+  return trips;
+}
+
+/* Counts a round trip that started at `start`, or that failed. */
+void
+bt_redis_count_trip(bt_redis_trips_t *trips, int64_t start, bool ok)
+{
+  trips->total++;
+
+  if (ok) {
+    trips->latency += g_get_monotonic_time() - start;
+  } else {
+    trips->failures++;
+  }
+}
+
+void
+bt_redis_take_trips(bt_redis_trips_t *trips)
+{
+  bt_redis_trips_t *current = bt_redis_trips();
+
+  trips->total = current->total;
+  trips->failures = current->failures;
+  trips->latency = current->latency;
+
+  current->total = current->failures = current->latency = 0;
+}
+
+/* Returns the type of a reply, or -1 if there is none. */
+int
+bt_redis_reply_type(const void *reply)
+{
+  return NULL == reply ? -1 : ((const redisReply *) reply)->type;
+}
+
+void *
+bt_redis_command(redisContext *redis, const char *format, ...)
+{
+  va_list ap;
+
+  BT_PROBE2(redis__command, redis, format);
+
+  int64_t start = g_get_monotonic_time();
+
+  va_start(ap, format);
+  void *reply = redisvCommand(redis, format, ap);
+  va_end(ap);
+
+  bt_redis_count_trip(bt_redis_trips(), start, NULL != reply);
+  BT_PROBE3(redis__reply, redis, format, bt_redis_reply_type(reply));
+
+  return reply;
+}
+
+void *
+bt_redis_command_argv(redisContext *redis, int argc, const char **argv,
+                      const size_t *argvlen)
+{
+  BT_PROBE2(redis__command, redis, argv[0]);
+
+  int64_t start = g_get_monotonic_time();
+  void *reply = redisCommandArgv(redis, argc, argv, argvlen);
+
+  bt_redis_count_trip(bt_redis_trips(), start, NULL != reply);
+  BT_PROBE3(redis__reply, redis, argv[0], bt_redis_reply_type(reply));
+
+  return reply;
+}
+
+/* Starts timing a pipeline on its first command. */
+void
+bt_redis_append_trip(int status)
+{
+  bt_redis_trips_t *trips = bt_redis_trips();
+
+  if (REDIS_OK == status && 0 == trips->pending++) {
+    trips->pipeline_start = g_get_monotonic_time();
+  }
+}
+
+int
+bt_redis_append_command(redisContext *redis, const char *format, ...)
+{
+  va_list ap;
+
+  BT_PROBE2(redis__command, redis, format);
+
+  va_start(ap, format);
+  int status = redisvAppendCommand(redis, format, ap);
+  va_end(ap);
+
+  bt_redis_append_trip(status);
+
+  return status;
+}
+
+int
+bt_redis_append_command_argv(redisContext *redis, int argc, const char **argv,
+                             const size_t *argvlen)
+{
+  BT_PROBE2(redis__command, redis, argv[0]);
+
+  int status = redisAppendCommandArgv(redis, argc, argv, argvlen);
+
+  bt_redis_append_trip(status);
+
+  return status;
+}
+
+int
+bt_redis_get_reply(redisContext *redis, void **reply)
+{
+  int status = redisGetReply(redis, reply);
+  bt_redis_trips_t *trips = bt_redis_trips();
+
+  /* A pipeline is a single round trip, timed until its last reply. */
+  if (REDIS_OK != status || --trips->pending <= 0) {
+    bt_redis_count_trip(trips, trips->pipeline_start, REDIS_OK == status);
+    trips->pending = 0;
+  }
+
+  BT_PROBE3(redis__reply, redis, NULL,
+            REDIS_OK == status ? bt_redis_reply_type(*reply) : -1);
+
+  return status;
+}
+
 void
 bt_insert_connection(redisContext *redis, const bt_config_t *config,
                      int64_t connection_id)
 {
   redisReply *reply;
 
-  reply = redisCommand(redis, "SETEX %s:conn:%b %d 1",
-                       config->redis_key_prefix, &connection_id,
-                       sizeof(int64_t), BT_ACTIVE_CONNECTION_TTL);
+  reply = bt_redis_command(redis, "SETEX %s:%s:%b %d 1",
+                           config->redis_key_prefix, bt_key_names(config)->conn,
+                           &connection_id, sizeof(int64_t),
+                           BT_ACTIVE_CONNECTION_TTL);
 
   if (NULL == reply) {
     syslog(LOG_ERR, "Got a NULL reply from Redis");
@@ -133,9 +443,9 @@ bt_connection_valid(redisContext *redis, const bt_config_t *config,
   bool valid = false;
   redisReply *reply;
 
-  reply = redisCommand(redis, "GET %s:conn:%b",
-                       config->redis_key_prefix, &connection_id,
-                       sizeof(int64_t));
+  reply = bt_redis_command(redis, "GET %s:%s:%b",
+                           config->redis_key_prefix, bt_key_names(config)->conn,
+                           &connection_id, sizeof(int64_t));
 
   if (NULL == reply) {
     syslog(LOG_ERR, "Got a NULL reply from Redis");
@@ -176,16 +486,33 @@ bt_new_peer_addr(uint32_t ipv4_addr, uint16_t port)
 
 void
 bt_insert_peer(redisContext *redis, const bt_config_t *config,
-               const char *info_hash_str, const int8_t *peer_id,
+               const bt_info_hash_key_t *info_hash_key, const int8_t *peer_id,
                const bt_peer_t *peer_data, bool is_seeder)
 {
   redisReply *reply;
-  char *peer_prefix = is_seeder ? "sd" : "lc";
+  const bt_key_names_t *names = bt_key_names(config);
+  const char *peer_prefix = is_seeder ? names->seeder : names->leecher;
+
+  if (BT_PEER_STORAGE_SHM == config->announce_peer_storage) {
+    bt_shm_insert_peer(config, info_hash_key->info_hash, peer_id, peer_data,
+                       is_seeder);
+    return;
+  }
+
+  if (BT_PEER_STORAGE_SWARM == config->announce_peer_storage) {
+    bt_swarm_insert_peer(redis, config, info_hash_key, peer_id, peer_data,
+                         is_seeder);
+    return;
+  }
+
+  char value[BT_PEER_VALUE_MAX_LEN];
+  size_t value_len = bt_write_peer_value(config, peer_data, value);
 
-  reply = redisCommand(redis, "SETEX %s:pr:%s:%s:%b %d %b",
-                       config->redis_key_prefix, info_hash_str,
-                       peer_prefix, peer_id, (size_t) 20,
-                       config->announce_peer_ttl, peer_data, sizeof(bt_peer_t));
+  reply = bt_redis_command(redis, "SETEX %s:%s:%b:%s:%b %d %b",
+                           config->redis_key_prefix, names->peer,
+                           info_hash_key->str, info_hash_key->len,
+                           peer_prefix, peer_id, (size_t) 20,
+                           config->announce_peer_ttl, value, value_len);
 
   if (NULL == reply) {
     syslog(LOG_ERR, "Got a NULL reply from Redis");
@@ -203,15 +530,27 @@ bt_insert_peer(redisContext *redis, const bt_config_t *config,
 
 void
 bt_remove_peer(redisContext *redis, const bt_config_t *config,
-               const char *info_hash_str, const int8_t *peer_id,
+               const bt_info_hash_key_t *info_hash_key, const int8_t *peer_id,
                bool is_seeder)
 {
+  if (BT_PEER_STORAGE_SHM == config->announce_peer_storage) {
+    bt_shm_remove_peer(config, info_hash_key->info_hash, peer_id);
+    return;
+  }
+
+  if (BT_PEER_STORAGE_SWARM == config->announce_peer_storage) {
+    bt_swarm_remove_peer(redis, config, info_hash_key, peer_id, is_seeder);
+    return;
+  }
+
   redisReply *reply;
-  char *peer_prefix = is_seeder ? "sd" : "lc";
+  const bt_key_names_t *names = bt_key_names(config);
+  const char *peer_prefix = is_seeder ? names->seeder : names->leecher;
 
-  reply = redisCommand(redis, "DEL %s:pr:%s:%s:%b",
-                       config->redis_key_prefix, info_hash_str,
-                       peer_prefix, peer_id, (size_t) 20);
+  reply = bt_redis_command(redis, "DEL %s:%s:%b:%s:%b",
+                           config->redis_key_prefix, names->peer,
+                           info_hash_key->str, info_hash_key->len,
+                           peer_prefix, peer_id, (size_t) 20);
 
   if (NULL == reply) {
     syslog(LOG_ERR, "Got a NULL reply from Redis");
@@ -227,42 +566,70 @@ bt_remove_peer(redisContext *redis, const bt_config_t *config,
   freeReplyObject(reply);
 }
 
-void
-bt_promote_peer(redisContext *redis, const bt_config_t *config,
-                const char *info_hash_str, const int8_t *peer_id)
+bool
+bt_move_peer_to_seeders(redisContext *redis, const bt_config_t *config,
+                        const bt_info_hash_key_t *info_hash_key,
+                        const int8_t *peer_id)
 {
+  /* The shared memory table keeps its own download counters. */
+  if (BT_PEER_STORAGE_SHM == config->announce_peer_storage) {
+    bt_shm_promote_peer(config, info_hash_key->info_hash, peer_id);
+    return false;
+  }
+
+  if (BT_PEER_STORAGE_SWARM == config->announce_peer_storage) {
+    return bt_swarm_promote_peer(redis, config, info_hash_key, peer_id);
+  }
+
   redisReply *reply;
+  bool moved = false;
+  const bt_key_names_t *names = bt_key_names(config);
 
-  reply = redisCommand(redis, "RENAME %s:pr:%s:lc:%b %s:pr:%s:sd:%b",
-                       config->redis_key_prefix, info_hash_str, peer_id,
-                       (size_t) 20, config->redis_key_prefix, info_hash_str,
-                       peer_id, (size_t) 20);
+  reply = bt_redis_command(redis, "RENAME %s:%s:%b:%s:%b %s:%s:%b:%s:%b",
+                           config->redis_key_prefix, names->peer,
+                           info_hash_key->str, info_hash_key->len,
+                           names->leecher, peer_id, (size_t) 20,
+                           config->redis_key_prefix, names->peer,
+                           info_hash_key->str, info_hash_key->len,
+                           names->seeder, peer_id, (size_t) 20);
 
   if (NULL == reply) {
     syslog(LOG_ERR, "Got a NULL reply from Redis");
-    return;
+    return false;
   }
 
   if (REDIS_REPLY_ERROR == reply->type) {
     syslog(LOG_ERR, "Cannot promote peer");
   } else {
     syslog(LOG_DEBUG, "Peer promoted from leecher to seeder");
-
-    /* Increments the number of times this torrent was downloaded. */
-    bt_increment_downloads(redis, config, info_hash_str);
+    moved = true;
   }
 
   freeReplyObject(reply);
+
+  return moved;
+}
+
+void
+bt_promote_peer(redisContext *redis, const bt_config_t *config,
+                const bt_info_hash_key_t *info_hash_key, const int8_t *peer_id)
+{
+  /* Increments the number of times this torrent was downloaded. */
+  if (bt_move_peer_to_seeders(redis, config, info_hash_key, peer_id)) {
+    bt_increment_downloads(redis, config, info_hash_key);
+  }
 }
 
 void
 bt_increment_downloads(redisContext *redis, const bt_config_t *config,
-                       const char *info_hash_str)
+                       const bt_info_hash_key_t *info_hash_key)
 {
   redisReply *reply;
 
-  reply = redisCommand(redis, "HINCRBY %s:ih:%s downs 1",
-                       config->redis_key_prefix, info_hash_str);
+  reply = bt_redis_command(redis, "HINCRBY %s:%s:%b downs 1",
+                           config->redis_key_prefix,
+                           bt_key_names(config)->torrent,
+                           info_hash_key->str, info_hash_key->len);
 
   if (NULL == reply) {
     syslog(LOG_ERR, "Got a NULL reply from Redis");
@@ -278,15 +645,17 @@ bt_increment_downloads(redisContext *redis, const bt_config_t *config,
 
 bool
 bt_info_hash_blacklisted(redisContext *redis, const bt_config_t *config,
-                         const char *info_hash_str)
+                         const bt_info_hash_key_t *info_hash_key)
 {
   redisReply *reply;
   bool blacklisted = true;
+  const char *torrent_ns = bt_key_names(config)->torrent;
 
   switch (config->info_hash_restriction) {
   case BT_RESTRICTION_WHITELIST:
-    reply = redisCommand(redis, "SISMEMBER %s:ih:wl %s",
-                         config->redis_key_prefix, info_hash_str);
+    reply = bt_redis_command(redis, "SISMEMBER %s:%s:wl %b",
+                             config->redis_key_prefix, torrent_ns,
+                             info_hash_key->str, info_hash_key->len);
 
     if (NULL == reply) {
       syslog(LOG_ERR, "Got a NULL reply from Redis");
@@ -297,8 +666,9 @@ bt_info_hash_blacklisted(redisContext *redis, const bt_config_t *config,
     break;
 
   case BT_RESTRICTION_BLACKLIST:
-    reply = redisCommand(redis, "SISMEMBER %s:ih:bl %s",
-                         config->redis_key_prefix, info_hash_str);
+    reply = bt_redis_command(redis, "SISMEMBER %s:%s:bl %b",
+                             config->redis_key_prefix, torrent_ns,
+                             info_hash_key->str, info_hash_key->len);
 
     if (NULL == reply) {
       syslog(LOG_ERR, "Got a NULL reply from Redis");
@@ -319,37 +689,54 @@ bt_info_hash_blacklisted(redisContext *redis, const bt_config_t *config,
 /* Fills `stats` with the latests stats for a torrent. */
 void
 bt_get_torrent_stats(redisContext *redis, const bt_config_t *config,
-                     const char *info_hash_str, bt_torrent_stats_t *stats)
+                     const bt_info_hash_key_t *info_hash_key,
+                     bt_torrent_stats_t *stats)
 {
+  if (BT_PEER_STORAGE_SHM == config->announce_peer_storage) {
+    bt_shm_get_torrent_stats(config, info_hash_key->info_hash, stats);
+    return;
+  }
+
+  if (BT_PEER_STORAGE_SWARM == config->announce_peer_storage) {
+    bt_swarm_get_torrent_stats(redis, config, info_hash_key, stats);
+    return;
+  }
+
   redisReply *reply;
+  const bt_key_names_t *names = bt_key_names(config);
 
   /* Counts the number of seeders. */
-  redisAppendCommand(redis, "KEYS %s:pr:%s:sd:*",
-                     config->redis_key_prefix, info_hash_str);
+  bt_redis_append_command(redis, "KEYS %s:%s:%b:%s:*",
+                          config->redis_key_prefix, names->peer,
+                          info_hash_key->pattern, info_hash_key->pattern_len,
+                          names->seeder);
 
   /* Counts the number of leechers. */
-  redisAppendCommand(redis, "KEYS %s:pr:%s:lc:*",
-                     config->redis_key_prefix, info_hash_str);
+  bt_redis_append_command(redis, "KEYS %s:%s:%b:%s:*",
+                          config->redis_key_prefix, names->peer,
+                          info_hash_key->pattern, info_hash_key->pattern_len,
+                          names->leecher);
 
   /* Returns the number of times this torrent has been downloaded. */
-  redisAppendCommand(redis, "HGET %s:ih:%s downs",
-                     config->redis_key_prefix, info_hash_str);
+  bt_redis_append_command(redis, "HGET %s:%s:%b downs",
+                          config->redis_key_prefix, names->torrent,
+                          info_hash_key->str, info_hash_key->len);
 
-  if (redisGetReply(redis, (void **) &reply) == REDIS_OK) {
+  if (bt_redis_get_reply(redis, (void **) &reply) == REDIS_OK) {
     stats->seeders = reply->elements;
   }
   if (reply != NULL) {
     freeReplyObject(reply);
   }
 
-  if (redisGetReply(redis, (void **) &reply) == REDIS_OK) {
+  if (bt_redis_get_reply(redis, (void **) &reply) == REDIS_OK) {
     stats->leechers = reply->elements;
   }
   if (reply != NULL) {
     freeReplyObject(reply);
   }
 
-  if (redisGetReply(redis, (void **) &reply) == REDIS_OK) {
+  if (bt_redis_get_reply(redis, (void **) &reply) == REDIS_OK) {
     stats->downloads = !reply->str ? 0 : strtoimax(reply->str, NULL, 10);
   }
   if (reply != NULL) {
@@ -359,19 +746,32 @@ bt_get_torrent_stats(redisContext *redis, const bt_config_t *config,
 
 bt_list *
 bt_peer_list(redisContext *redis, const bt_config_t *config,
-             const char *info_hash_str, int32_t num_want,
-             int *peer_count, bool seeder)
+             const bt_info_hash_key_t *info_hash_key, int32_t num_want,
+             int *peer_count, bool seeder, int64_t group)
 {
+  if (BT_PEER_STORAGE_SHM == config->announce_peer_storage) {
+    return bt_shm_peer_list(config, info_hash_key->info_hash, num_want,
+                            peer_count, seeder, group);
+  }
+
+  if (BT_PEER_STORAGE_SWARM == config->announce_peer_storage) {
+    return bt_swarm_peer_list(redis, config, info_hash_key, num_want,
+                              peer_count, seeder, group);
+  }
+
   redisReply *reply;
 
   int count = 0;
   bt_list *list = NULL;
 
   /* We give seeders for leechers, and leechers for seeders. */
-  char *peer_prefix = seeder ? "sd" : "lc";
+  const bt_key_names_t *names = bt_key_names(config);
+  const char *peer_prefix = seeder ? names->seeder : names->leecher;
 
-  reply = redisCommand(redis, "KEYS %s:pr:%s:%s:*",
-                       config->redis_key_prefix, info_hash_str, peer_prefix);
+  reply = bt_redis_command(redis, "KEYS %s:%s:%b:%s:*",
+                           config->redis_key_prefix, names->peer,
+                           info_hash_key->pattern, info_hash_key->pattern_len,
+                           peer_prefix);
 
   if (NULL == reply) {
     syslog(LOG_ERR, "Got a NULL reply from Redis");
@@ -393,8 +793,8 @@ bt_peer_list(redisContext *redis, const bt_config_t *config,
 
     /* Pipelines the GET commands for all keys. */
     for (i = 0; i < upper_index; i++) {
-      redisAppendCommand(redis, "GET %b", reply->element[i]->str,
-                         reply->element[i]->len);
+      bt_redis_append_command(redis, "GET %b", reply->element[i]->str,
+                              reply->element[i]->len);
     }
 
     freeReplyObject(reply);
@@ -403,19 +803,25 @@ bt_peer_list(redisContext *redis, const bt_config_t *config,
     for (i = 0; i < upper_index; i++) {
 
       /* Extracts the peer address and appends it to the list. */
-      if (redisGetReply(redis, (void **) &reply) == REDIS_OK) {
-        bt_peer_t *peer_data = (bt_peer_t *) reply->str;
+      if (bt_redis_get_reply(redis, (void **) &reply) == REDIS_OK) {
+        bt_peer_addr_t *addr = NULL;
 
-        bt_peer_addr_t *addr = bt_new_peer_addr(peer_data->ipv4_addr,
-                                                peer_data->port);
+        /* The key might have expired since KEYS was issued. */
+        if (REDIS_REPLY_STRING == reply->type) {
+          addr = bt_read_peer_value(config, reply->str, reply->len);
+        }
         freeReplyObject(reply);
 
-        list = bt_list_prepend(list, addr);
-        count++;
+        if (NULL != addr) {
+          list = bt_list_prepend(list, addr);
+          count++;
+        }
       } else {
         syslog(LOG_INFO, "Unable to get peer data");
       }
     }
+  } else {
+    freeReplyObject(reply);
   }
 
   *peer_count = count;
@@ -60,6 +60,15 @@ typedef enum {
   BT_ACTION_ERROR    = 3
 } bt_action;
 
+/* Classes of incoming requests, budgeted and scheduled separately. */
+typedef enum {
+  BT_CLASS_CONNECT,
+  BT_CLASS_ANNOUNCE,
+  BT_CLASS_SCRAPE,
+  BT_CLASS_OTHER,    // Truncated packets and unknown actions
+  BT_CLASS_COUNT
+} bt_request_class;
+
 /* Types of announce events. */
 typedef enum {
   BT_EVENT_NONE      = 0,
@@ -149,6 +158,41 @@ typedef struct {
   uint16_t port;      // Peer port
 } bt_peer_t;
 
+/* Names of the Redis keys used by a key schema. */
+typedef struct {
+  const char *conn;    // Active connections
+  const char *peer;    // Peers of a torrent
+  const char *seeder;  // Seeders of a torrent (under `peer`)
+  const char *leecher; // Leechers of a torrent (under `peer`)
+  const char *torrent; // Torrent counters, whitelist and blacklist
+  const char *addrs;   // Addresses of the peers of a torrent (under `peer`)
+  const char *local;   // Peers of a torrent by locality group
+} bt_key_names_t;
+
+/* Length of a peer address stored by the compact key schema. */
+#define BT_COMPACT_PEER_LEN (6)
+
+/* Length of the optional peer stats stored after a compact peer address. */
+#define BT_COMPACT_PEER_STATS_LEN (28)
+
+/* Space needed to hold the value of a peer, whatever the key schema. */
+#define BT_PEER_VALUE_MAX_LEN \
+  MAX(sizeof(bt_peer_t), BT_COMPACT_PEER_LEN + BT_COMPACT_PEER_STATS_LEN)
+
+/*
+ * Fragment of a Redis key that identifies a torrent: the hex representation
+ * of the info hash for the legacy key schema, or its 20 raw bytes for the
+ * compact one. The pattern is the same fragment escaped to be used by KEYS.
+ * The raw info hash is kept along for storages that are not Redis.
+ */
+typedef struct {
+  int8_t info_hash[20];
+  char str[40];
+  size_t len;
+  char pattern[40];
+  size_t pattern_len;
+} bt_info_hash_key_t;
+
 
 /*
  * Redis.
@@ -163,6 +207,43 @@ bt_redis_connect(const char *unix_sock,  const char *host, int port,
 bool
 bt_redis_ping(redisContext *redis);
 
+/* Round trips to Redis made by a thread since they were last taken. */
+typedef struct {
+  int64_t total;
+  int64_t failures;         // Round trips that got no reply
+  int64_t latency;          // Sum over the others, in microseconds
+  int pending;              // Pipelined commands whose reply is not read yet
+  int64_t pipeline_start;   // Monotonic time of the first of them
+} bt_redis_trips_t;
+
+/*
+ * Wrappers of the hiredis functions of the same name that fire the
+ * `redis__command` and `redis__reply` probes. Pipelined replies are reported
+ * without their command, in the order commands were appended. Each command,
+ * or each pipeline until its last reply, counts as one round trip of the
+ * calling thread.
+ */
+void *
+bt_redis_command(redisContext *redis, const char *format, ...);
+
+void *
+bt_redis_command_argv(redisContext *redis, int argc, const char **argv,
+                      const size_t *argvlen);
+
+int
+bt_redis_append_command(redisContext *redis, const char *format, ...);
+
+int
+bt_redis_append_command_argv(redisContext *redis, int argc, const char **argv,
+                             const size_t *argvlen);
+
+int
+bt_redis_get_reply(redisContext *redis, void **reply);
+
+/* Moves the round trips of the calling thread to `trips`, then resets them. */
+void
+bt_redis_take_trips(bt_redis_trips_t *trips);
+
 
 /*
  * Connections.
@@ -183,19 +264,39 @@ bt_connection_valid(redisContext *redis, const bt_config_t *config,
  * Torrents.
  */
 
+/* Returns the key names used by the configured key schema. */
+const bt_key_names_t *
+bt_key_names(const bt_config_t *config);
+
+/*
+ * Returns the glob pattern, for SCAN, that matches the peer keys or sets of
+ * every torrent. The key prefix is escaped. Must be freed by the caller.
+ */
+char *
+bt_peer_key_pattern(const bt_config_t *config);
+
 /* Converts the info hash byte array to string. */
 void
 bt_bytearray_to_hexarray(int8_t *bin, size_t binsz, char **result);
 
+/* Converts an hex string to a byte array. Returns false if it is malformed. */
+bool
+bt_hexarray_to_bytearray(const char *hex, size_t hexsz, int8_t *result);
+
+/* Fills `key` with the Redis key fragment of the given info hash. */
+void
+bt_info_hash_key(const bt_config_t *config, const int8_t *info_hash,
+                 bt_info_hash_key_t *key);
+
 /* Increments the number of times a torrent has been downloaded. */
 void
 bt_increment_downloads(redisContext *redis, const bt_config_t *config,
-                       const char *info_hash_str);
+                       const bt_info_hash_key_t *info_hash_key);
 
 /* Returns whether the given torrent is blacklisted. */
 bool
 bt_info_hash_blacklisted(redisContext *redis, const bt_config_t *config,
-                         const char *info_hash_str);
+                         const bt_info_hash_key_t *info_hash_key);
 
 /*
  * Peer management.
@@ -209,32 +310,60 @@ bt_new_peer(bt_announce_req_t *request, uint32_t sockaddr);
 bt_peer_addr_t *
 bt_new_peer_addr(uint32_t ipv4_addr, uint16_t port);
 
+/* Writes the compact schema value of a peer to `value`. Returns its length. */
+size_t
+bt_write_compact_peer(const bt_config_t *config, const bt_peer_t *peer,
+                      char *value);
+
+/* Writes the value stored for a peer to `value`. Returns its length. */
+size_t
+bt_write_peer_value(const bt_config_t *config, const bt_peer_t *peer,
+                    char *value);
+
+/* Extracts the peer address from a value stored in Redis. */
+bt_peer_addr_t *
+bt_read_peer_value(const bt_config_t *config, const char *value, size_t len);
+
 /* Inserts a peer (seeder or leecher) to the swarm of a torrent. */
 void
 bt_insert_peer(redisContext *redis, const bt_config_t *config,
-               const char *info_hash_str, const int8_t *peer_id,
+               const bt_info_hash_key_t *info_hash_key, const int8_t *peer_id,
                const bt_peer_t *peer_data, bool is_seeder);
 
 /* Removes a peer from the swarm of a torrent. */
 void
 bt_remove_peer(redisContext *redis, const bt_config_t *config,
-               const char *info_hash_str, const int8_t *peer_id,
+               const bt_info_hash_key_t *info_hash_key, const int8_t *peer_id,
                bool is_seeder);
 
-/* Promotes a peer from leecher to seeder. */
+/*
+ * Moves a peer from leechers to seeders. Returns whether the download must
+ * still be counted, which the shared memory table does on its own.
+ */
+bool
+bt_move_peer_to_seeders(redisContext *redis, const bt_config_t *config,
+                        const bt_info_hash_key_t *info_hash_key,
+                        const int8_t *peer_id);
+
+/* Promotes a peer from leecher to seeder and counts the download. */
 void
 bt_promote_peer(redisContext *redis, const bt_config_t *config,
-                const char *info_hash_str, const int8_t *peer_id);
+                const bt_info_hash_key_t *info_hash_key, const int8_t *peer_id);
 
 /* Fills `stats` with the latests stats for a torrent. */
 void
 bt_get_torrent_stats(redisContext *redis, const bt_config_t *config,
-                     const char *info_hash_str, bt_torrent_stats_t *stats);
+                     const bt_info_hash_key_t *info_hash_key,
+                     bt_torrent_stats_t *stats);
 
-/* Returns a random list containing a random subset of leechers or seeders. */
+/*
+ * Returns a random list containing a random subset of leechers or seeders.
+ * Unless `group` is BT_LOCALITY_NONE, part of them come from that locality
+ * group, except with the 'keys' peer storage.
+ */
 bt_list *
 bt_peer_list(redisContext *redis, const bt_config_t *config,
-             const char *info_hash_str, int32_t num_want,
-             int *peer_count, bool seeder);
+             const bt_info_hash_key_t *info_hash_key, int32_t num_want,
+             int *peer_count, bool seeder, int64_t group);
 
 #endif // BTTRACKER_DATA_H_
@@ -59,3 +59,21 @@ bt_send_error(const bt_req_t *request, const char *msg)
 
   return resp_buffer;
 }
+
+void
+bt_reply_error(int sock, const char *buff, const struct sockaddr_in *to_addr,
+               socklen_t to_addr_len, const char *msg)
+{
+  bt_req_t request;
+  bt_read_request_data(buff, &request);
+
+  bt_response_buffer_t *resp_buffer = bt_send_error(&request, msg);
+
+  if (sendto(sock, resp_buffer->data, resp_buffer->length, 0,
+             (struct sockaddr *) to_addr, to_addr_len) == -1) {
+    syslog(LOG_ERR, "Error in sendto()");
+  }
+
+  free(resp_buffer->data);
+  free(resp_buffer);
+}
@@ -35,4 +35,9 @@
 bt_response_buffer_t *
 bt_send_error(const bt_req_t *request, const char *msg);
 
+/* Answers a raw request with an error message right away. */
+void
+bt_reply_error(int sock, const char *buff, const struct sockaddr_in *to_addr,
+               socklen_t to_addr_len, const char *msg);
+
 #endif // BTTRACKER_ERROR_H_
@@ -37,7 +37,8 @@ typedef enum {
   BT_EXIT_CONFIG_ERROR,  // Error when trying to load the config file.
   BT_EXIT_NETWORK_ERROR, // Network communication errors.
   BT_EXIT_MALLOC_ERROR,  // Memory allocation errors.
-  BT_EXIT_REDIS          // Redis failure.
+  BT_EXIT_REDIS,         // Redis failure.
+  BT_EXIT_SHM_ERROR      // Shared memory errors.
 } bt_exit;
 
 #endif // BTTRACKER_EXIT_H_
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Socket whose drops are counted, -1 until one is set. */
+static int bt_filter_sock = -1;
+
+#ifdef HAVE_LINUX_FILTER_H
+
+/* The filter sees datagrams from their UDP header on. */
+#define BT_UDP_HEADER_LEN (8)
+
+/* Offset of the jump from instruction `from` to instruction `to`. */
+#define BT_JUMP(from, to) ((to) - (from) - 1)
+
+/* Instructions the program jumps to. */
+enum {
+  BT_FILTER_CONNECT  = 6,
+  BT_FILTER_ANNOUNCE = 10,
+  BT_FILTER_SCRAPE   = 12,
+  BT_FILTER_ACCEPT   = 15,
+  BT_FILTER_DROP     = 16
+};
+
+static struct sock_filter bt_filter_code[] = {
+  /* 0-1: Every request starts with a 16-byte header. */
+  BPF_STMT(BPF_LD  | BPF_W   | BPF_LEN, 0),
+  BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K,
+           BT_UDP_HEADER_LEN + BT_MIN_REQUEST_LEN,
+           0, BT_JUMP(1, BT_FILTER_DROP)),
+
+  /* 2-5: Branches on the action. */
+  BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, BT_UDP_HEADER_LEN + 8),
+  BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, BT_ACTION_CONNECT,
+           BT_JUMP(3, BT_FILTER_CONNECT), 0),
+  BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, BT_ACTION_ANNOUNCE,
+           BT_JUMP(4, BT_FILTER_ANNOUNCE), 0),
+  BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, BT_ACTION_SCRAPE,
+           BT_JUMP(5, BT_FILTER_SCRAPE), BT_JUMP(5, BT_FILTER_DROP)),
+
+  /* 6-9: Connect requests carry the protocol magic. */
+  BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, BT_UDP_HEADER_LEN),
+  BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, BT_PROTOCOL_ID >> 32,
+           0, BT_JUMP(7, BT_FILTER_DROP)),
+  BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, BT_UDP_HEADER_LEN + 4),
+  BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, BT_PROTOCOL_ID & 0xffffffff,
+           BT_JUMP(9, BT_FILTER_ACCEPT), BT_JUMP(9, BT_FILTER_DROP)),
+
+  /* 10-11: Announces are at least 98 bytes long. */
+  BPF_STMT(BPF_LD  | BPF_W   | BPF_LEN, 0),
+  BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K,
+           BT_UDP_HEADER_LEN + BT_MIN_ANNOUNCE_LEN,
+           BT_JUMP(11, BT_FILTER_ACCEPT), BT_JUMP(11, BT_FILTER_DROP)),
+
+  /* 12-14: Scrapes carry between one and as many info hashes as fit. */
+  BPF_STMT(BPF_LD  | BPF_W   | BPF_LEN, 0),
+  BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K,
+           BT_UDP_HEADER_LEN + BT_MIN_SCRAPE_LEN,
+           0, BT_JUMP(13, BT_FILTER_DROP)),
+  BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K,
+           BT_UDP_HEADER_LEN + BT_RECV_BUFLEN,
+           BT_JUMP(14, BT_FILTER_DROP), BT_JUMP(14, BT_FILTER_ACCEPT)),
+
+  /* 15-16: Keeps the whole datagram, or none of it. */
+  BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+  BPF_STMT(BPF_RET | BPF_K, 0)
+};
+
+#endif
+
+void
+bt_attach_filter(const bt_config_t *config, int sock)
+{
+  bt_filter_sock = sock;
+
+  if (!config->bttracker_socket_filter) {
+    return;
+  }
+
+#ifdef HAVE_LINUX_FILTER_H
+  struct sock_fprog program = {
+    .len = G_N_ELEMENTS(bt_filter_code),
+    .filter = bt_filter_code
+  };
+
+  if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &program,
+                 sizeof(program)) == -1) {
+    syslog(LOG_ERR, "Cannot attach the filter to the UDP socket");
+    return;
+  }
+
+  syslog(LOG_DEBUG, "Filter attached to the UDP socket");
+#else
+  syslog(LOG_WARNING, "Socket filters are not supported on this system");
+#endif
+}
+
+void
+bt_filter_update_stats(void)
+{
+#if defined(SO_MEMINFO) && defined(HAVE_LINUX_SOCK_DIAG_H)
+  uint32_t meminfo[SK_MEMINFO_VARS];
+  socklen_t len = sizeof(meminfo);
+
+  if (-1 == bt_filter_sock ||
+      getsockopt(bt_filter_sock, SOL_SOCKET, SO_MEMINFO, meminfo, &len) == -1) {
+    return;
+  }
+
+  bt_stats_set(BT_STAT_KERNEL_DROPS, meminfo[SK_MEMINFO_DROPS]);
+#endif
+}
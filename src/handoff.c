@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Fills `addr` with the address of the Unix socket at `path`. */
+bool
+bt_handoff_addr(const char *path, struct sockaddr_un *addr)
+{
+  memset(addr, 0, sizeof(struct sockaddr_un));
+  addr->sun_family = AF_UNIX;
+
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    syslog(LOG_ERR, "Handoff socket path is too long");
+    return false;
+  }
+
+  strcpy(addr->sun_path, path);
+  return true;
+}
+
+int
+bt_handoff_receive(const char *path)
+{
+  struct sockaddr_un addr;
+
+  if (!bt_handoff_addr(path, &addr)) {
+    return -1;
+  }
+
+  int conn = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (-1 == conn) {
+    syslog(LOG_ERR, "Cannot create handoff socket");
+    return -1;
+  }
+
+  if (connect(conn, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+    syslog(LOG_DEBUG, "No running tracker to take the socket from");
+    close(conn);
+    return -1;
+  }
+
+  char byte;
+  struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+  char control[CMSG_SPACE(sizeof(int))];
+
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control,
+    .msg_controllen = sizeof(control)
+  };
+
+  int sock = -1;
+
+  if (recvmsg(conn, &msg, 0) == 1) {
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+    if (NULL != cmsg && SOL_SOCKET == cmsg->cmsg_level &&
+        SCM_RIGHTS == cmsg->cmsg_type) {
+      memcpy(&sock, CMSG_DATA(cmsg), sizeof(int));
+    }
+  }
+
+  close(conn);
+
+  if (-1 == sock) {
+    syslog(LOG_ERR, "Running tracker did not hand its socket off");
+  } else {
+    syslog(LOG_INFO, "Took the UDP socket over from the running tracker");
+  }
+
+  return sock;
+}
+
+/* Sends the UDP socket over a connected Unix socket. */
+bool
+bt_handoff_send(int conn, int sock)
+{
+  char byte = 0;
+  struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+  char control[CMSG_SPACE(sizeof(int))];
+
+  memset(control, 0, sizeof(control));
+
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control,
+    .msg_controllen = sizeof(control)
+  };
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &sock, sizeof(int));
+
+  return sendmsg(conn, &msg, 0) == 1;
+}
+
+/* Only there so that the signal interrupts recvfrom(). */
+void
+bt_handoff_on_signal(int signum)
+{
+}
+
+gpointer
+bt_handoff_thread(gpointer data)
+{
+  bt_handoff_t *handoff = (bt_handoff_t *) data;
+
+  while (true) {
+    int conn = accept(handoff->listen_sock, NULL, NULL);
+
+    if (-1 == conn) {
+      if (EINTR == errno || ECONNABORTED == errno) {
+        continue;
+      }
+
+      /* The listening socket was closed. */
+      break;
+    }
+
+    bool sent = bt_handoff_send(conn, handoff->sock);
+    close(conn);
+
+    if (sent) {
+      syslog(LOG_INFO, "Handed the UDP socket off to a new tracker");
+      __atomic_store_n(&handoff->handed_off, true, __ATOMIC_SEQ_CST);
+
+      /* Repeated, as the signal may land just before recvfrom() blocks. */
+      while (!__atomic_load_n(&handoff->stopped, __ATOMIC_SEQ_CST)) {
+        pthread_kill(handoff->receiver, BT_HANDOFF_SIGNAL);
+        g_usleep(BT_HANDOFF_KICK_INTERVAL);
+      }
+      break;
+    }
+
+    syslog(LOG_ERR, "Cannot hand the UDP socket off");
+  }
+
+  return NULL;
+}
+
+bt_handoff_t *
+bt_new_handoff(const char *path, int sock)
+{
+  struct sockaddr_un addr;
+
+  if (!bt_handoff_addr(path, &addr)) {
+    return NULL;
+  }
+
+  bt_handoff_t *handoff = (bt_handoff_t *) malloc(sizeof(bt_handoff_t));
+
+  if (NULL == handoff) {
+    syslog(LOG_ERR, "Cannot allocate memory for handoff");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  handoff->path = strdup(path);
+  handoff->sock = sock;
+  handoff->receiver = pthread_self();
+  handoff->handed_off = false;
+  handoff->stopped = false;
+  handoff->listen_sock = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  /* No SA_RESTART, so that a blocked recvfrom() fails with EINTR. */
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = bt_handoff_on_signal;
+  sigemptyset(&action.sa_mask);
+  sigaction(BT_HANDOFF_SIGNAL, &action, NULL);
+
+  /* Replaces the socket of the process we took over from, if any. */
+  unlink(path);
+
+  if (-1 == handoff->listen_sock ||
+      bind(handoff->listen_sock, (struct sockaddr *) &addr,
+           sizeof(addr)) == -1 ||
+      listen(handoff->listen_sock, 1) == -1) {
+    syslog(LOG_ERR, "Cannot listen for handoff requests on %s", path);
+
+    if (-1 != handoff->listen_sock) {
+      close(handoff->listen_sock);
+    }
+    free(handoff->path);
+    free(handoff);
+    return NULL;
+  }
+
+  handoff->thread = g_thread_new("handoff", bt_handoff_thread, handoff);
+
+  syslog(LOG_DEBUG, "Listening for handoff requests on %s", path);
+
+  return handoff;
+}
+
+void
+bt_free_handoff(bt_handoff_t *handoff)
+{
+  if (NULL == handoff) {
+    return;
+  }
+
+  /* Makes accept() fail, or the kicks stop, so the thread returns. */
+  __atomic_store_n(&handoff->stopped, true, __ATOMIC_SEQ_CST);
+  shutdown(handoff->listen_sock, SHUT_RDWR);
+  g_thread_join(handoff->thread);
+  close(handoff->listen_sock);
+
+  /* Otherwise the path now belongs to the new process. */
+  if (!handoff->handed_off) {
+    unlink(handoff->path);
+  }
+
+  free(handoff->path);
+  free(handoff);
+}
+
+bool
+bt_handoff_done(bt_handoff_t *handoff)
+{
+  if (!__atomic_load_n(&handoff->handed_off, __ATOMIC_SEQ_CST)) {
+    return false;
+  }
+
+  __atomic_store_n(&handoff->stopped, true, __ATOMIC_SEQ_CST);
+  return true;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BTTRACKER_HANDOFF_H_
+#define BTTRACKER_HANDOFF_H_
+
+/* Signal that interrupts the receive loop once the socket is handed off. */
+#define BT_HANDOFF_SIGNAL SIGUSR2
+
+/* Interval, in microseconds, between two interruptions of the receive loop. */
+#define BT_HANDOFF_KICK_INTERVAL 10000
+
+/*
+ * Hands the bound UDP socket over to a newer tracker process. The running
+ * process listens on a Unix socket; a new process connects to it, receives
+ * the UDP socket with SCM_RIGHTS and starts reading from it right away,
+ * while the old one stops reading, answers the requests it had queued and
+ * exits.
+ *
+ * The receive loop blocks in recvfrom() as usual. Once the socket is handed
+ * off, the handoff thread interrupts it with a signal until it notices.
+ */
+typedef struct {
+  char *path;          // Unix socket where new processes connect
+  int listen_sock;
+  int sock;            // UDP socket being handed off
+  pthread_t receiver;  // Thread running the receive loop
+  bool handed_off;
+  bool stopped;        // Set once the receive loop has stopped reading
+  GThread *thread;
+} bt_handoff_t;
+
+/*
+ * Asks the process listening on `path` for its UDP socket. Returns the
+ * socket, or -1 if no process is listening there.
+ */
+int
+bt_handoff_receive(const char *path);
+
+/*
+ * Starts accepting handoff requests for `sock` on `path`. Must be called
+ * from the thread running the receive loop.
+ */
+bt_handoff_t *
+bt_new_handoff(const char *path, int sock);
+
+/* Stops accepting handoff requests. */
+void
+bt_free_handoff(bt_handoff_t *handoff);
+
+/*
+ * Returns true once the UDP socket has been handed off to another process,
+ * after which the receive loop must stop reading from it.
+ */
+bool
+bt_handoff_done(bt_handoff_t *handoff);
+
+#endif // BTTRACKER_HANDOFF_H_
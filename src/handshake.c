@@ -34,14 +34,15 @@ bt_valid_request(redisContext *redis, const bt_config_t *config,
 {
   switch (req->action) {
   case BT_ACTION_CONNECT:
-    if (BT_PROTOCOL_ID == req->connection_id && packetlen >= 16) {
+    if (BT_PROTOCOL_ID == req->connection_id &&
+        packetlen >= BT_MIN_REQUEST_LEN) {
       return true;
     }
     syslog(LOG_ERR, "Invalid connect packet");
     break;
 
   case BT_ACTION_ANNOUNCE:
-    if (packetlen >= 20 &&
+    if (packetlen >= BT_MIN_ANNOUNCE_LEN &&
         bt_connection_valid(redis, config, req->connection_id)) {
       return true;
     }
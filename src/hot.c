@@ -0,0 +1,601 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* List of hot swarms, sorted by info hash. */
+typedef struct {
+  size_t length;
+  bt_hot_swarm_t swarms[];
+} bt_hot_list_t;
+
+static bt_hot_list_t *bt_hot_list = NULL;
+
+/*
+ * List replaced by the last merge. Workers might still be reading it, so it
+ * is only freed when the next merge replaces it, `Interval` seconds later.
+ */
+static bt_hot_list_t *bt_hot_list_retired = NULL;
+
+/* Sketches of all threads that counted a request. */
+static GMutex bt_hot_lock;
+static bt_hot_sketch_t **bt_hot_sketches = NULL;
+static size_t bt_hot_sketch_count = 0;
+
+/* Sketch of the current thread. */
+static GPrivate bt_hot_sketch_key = G_PRIVATE_INIT(NULL);
+
+/* Info hashes are SHA-1 digests, so any four of their bytes are uniform. */
+guint
+bt_hot_hash(gconstpointer info_hash)
+{
+  guint hash;
+  memcpy(&hash, info_hash, sizeof(hash));
+  return hash;
+}
+
+gboolean
+bt_hot_equal(gconstpointer a, gconstpointer b)
+{
+  return memcmp(a, b, 20) == 0;
+}
+
+bt_hot_sketch_t *
+bt_new_hot_sketch(int capacity)
+{
+  bt_hot_sketch_t *sketch = (bt_hot_sketch_t *)
+    malloc(sizeof(bt_hot_sketch_t));
+
+  if (NULL == sketch) {
+    syslog(LOG_ERR, "Cannot allocate memory for hot swarm sketch");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  sketch->capacity = MAX(1, capacity);
+  sketch->length = 0;
+  sketch->counters = (bt_hot_counter_t *)
+    calloc(sketch->capacity, sizeof(bt_hot_counter_t));
+  sketch->heap = (bt_hot_counter_t **)
+    calloc(sketch->capacity, sizeof(bt_hot_counter_t *));
+
+  if (NULL == sketch->counters || NULL == sketch->heap) {
+    syslog(LOG_ERR, "Cannot allocate memory for hot swarm sketch");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  sketch->index = g_hash_table_new(bt_hot_hash, bt_hot_equal);
+  g_mutex_init(&sketch->lock);
+
+  return sketch;
+}
+
+void
+bt_free_hot_sketch(bt_hot_sketch_t *sketch)
+{
+  if (NULL == sketch) {
+    return;
+  }
+
+  g_hash_table_destroy(sketch->index);
+  g_mutex_clear(&sketch->lock);
+  free(sketch->counters);
+  free(sketch->heap);
+  free(sketch);
+}
+
+/* Swaps two counters of the heap. */
+void
+bt_hot_heap_swap(bt_hot_sketch_t *sketch, int a, int b)
+{
+  bt_hot_counter_t *aux = sketch->heap[a];
+
+  sketch->heap[a] = sketch->heap[b];
+  sketch->heap[b] = aux;
+  sketch->heap[a]->slot = a;
+  sketch->heap[b]->slot = b;
+}
+
+/* Moves a counter whose count grew towards the leaves of the heap. */
+void
+bt_hot_sift_down(bt_hot_sketch_t *sketch, int slot)
+{
+  while (true) {
+    int smallest = slot;
+    int left = 2 * slot + 1, right = left + 1;
+
+    if (left < sketch->length &&
+        sketch->heap[left]->count < sketch->heap[smallest]->count) {
+      smallest = left;
+    }
+    if (right < sketch->length &&
+        sketch->heap[right]->count < sketch->heap[smallest]->count) {
+      smallest = right;
+    }
+
+    if (smallest == slot) {
+      return;
+    }
+
+    bt_hot_heap_swap(sketch, slot, smallest);
+    slot = smallest;
+  }
+}
+
+/* Moves a new counter towards the root of the heap. */
+void
+bt_hot_sift_up(bt_hot_sketch_t *sketch, int slot)
+{
+  while (slot > 0) {
+    int parent = (slot - 1) / 2;
+
+    if (sketch->heap[parent]->count <= sketch->heap[slot]->count) {
+      return;
+    }
+
+    bt_hot_heap_swap(sketch, slot, parent);
+    slot = parent;
+  }
+}
+
+void
+bt_hot_sketch_add(bt_hot_sketch_t *sketch, const int8_t *info_hash)
+{
+  g_mutex_lock(&sketch->lock);
+
+  bt_hot_counter_t *counter = (bt_hot_counter_t *)
+    g_hash_table_lookup(sketch->index, info_hash);
+
+  if (NULL != counter) {
+    counter->count++;
+    bt_hot_sift_down(sketch, counter->slot);
+  } else if (sketch->length < sketch->capacity) {
+    counter = &sketch->counters[sketch->length];
+    memcpy(counter->info_hash, info_hash, 20);
+    counter->count = 1;
+    counter->error = 0;
+    counter->slot = sketch->length;
+    sketch->heap[sketch->length++] = counter;
+
+    g_hash_table_insert(sketch->index, counter->info_hash, counter);
+    bt_hot_sift_up(sketch, counter->slot);
+  } else {
+    /* Takes over the least counted info hash, inheriting its count. */
+    counter = sketch->heap[0];
+    g_hash_table_remove(sketch->index, counter->info_hash);
+
+    memcpy(counter->info_hash, info_hash, 20);
+    counter->error = counter->count;
+    counter->count++;
+
+    g_hash_table_insert(sketch->index, counter->info_hash, counter);
+    bt_hot_sift_down(sketch, 0);
+  }
+
+  g_mutex_unlock(&sketch->lock);
+}
+
+void
+bt_hot_count(const bt_config_t *config, const int8_t *info_hash)
+{
+  if (0 == config->hot_size) {
+    return;
+  }
+
+  bt_hot_sketch_t *sketch = (bt_hot_sketch_t *)
+    g_private_get(&bt_hot_sketch_key);
+
+  if (NULL == sketch) {
+    sketch = bt_new_hot_sketch(config->hot_size * BT_HOT_SKETCH_FACTOR);
+    g_private_set(&bt_hot_sketch_key, sketch);
+
+    g_mutex_lock(&bt_hot_lock);
+    bt_hot_sketches = (bt_hot_sketch_t **)
+      realloc(bt_hot_sketches,
+              (bt_hot_sketch_count + 1) * sizeof(bt_hot_sketch_t *));
+
+    if (NULL == bt_hot_sketches) {
+      syslog(LOG_ERR, "Cannot allocate memory for hot swarm sketches");
+      exit(BT_EXIT_MALLOC_ERROR);
+    }
+
+    bt_hot_sketches[bt_hot_sketch_count++] = sketch;
+    g_mutex_unlock(&bt_hot_lock);
+  }
+
+  bt_hot_sketch_add(sketch, info_hash);
+}
+
+/* Orders swarms by info hash. */
+int
+bt_hot_info_hash_cmp(const void *a, const void *b)
+{
+  return memcmp(((const bt_hot_swarm_t *) a)->info_hash,
+                ((const bt_hot_swarm_t *) b)->info_hash, 20);
+}
+
+/* Orders swarms hottest first. */
+int
+bt_hot_count_cmp(const void *a, const void *b)
+{
+  uint32_t count_a = ((const bt_hot_swarm_t *) a)->count;
+  uint32_t count_b = ((const bt_hot_swarm_t *) b)->count;
+
+  return count_a < count_b ? 1 : (count_a > count_b ? -1 : 0);
+}
+
+size_t
+bt_hot_merge(const bt_config_t *config)
+{
+  GHashTable *totals = g_hash_table_new_full(bt_hot_hash, bt_hot_equal,
+                                             NULL, free);
+
+  /* Sums the counts of all threads, starting a new interval for each. */
+  g_mutex_lock(&bt_hot_lock);
+
+  for (size_t i = 0; i < bt_hot_sketch_count; i++) {
+    bt_hot_sketch_t *sketch = bt_hot_sketches[i];
+
+    g_mutex_lock(&sketch->lock);
+
+    for (int j = 0; j < sketch->length; j++) {
+      bt_hot_counter_t *counter = &sketch->counters[j];
+      bt_hot_swarm_t *swarm = (bt_hot_swarm_t *)
+        g_hash_table_lookup(totals, counter->info_hash);
+
+      if (NULL == swarm) {
+        swarm = (bt_hot_swarm_t *) malloc(sizeof(bt_hot_swarm_t));
+
+        if (NULL == swarm) {
+          syslog(LOG_ERR, "Cannot allocate memory for hot swarm");
+          exit(BT_EXIT_MALLOC_ERROR);
+        }
+
+        memcpy(swarm->info_hash, counter->info_hash, 20);
+        swarm->count = 0;
+        g_hash_table_insert(totals, swarm->info_hash, swarm);
+      }
+
+      swarm->count += counter->count;
+    }
+
+    g_hash_table_remove_all(sketch->index);
+    sketch->length = 0;
+
+    g_mutex_unlock(&sketch->lock);
+  }
+
+  g_mutex_unlock(&bt_hot_lock);
+
+  /* Keeps the hottest swarms that got enough requests. */
+  size_t total_count = g_hash_table_size(totals);
+  bt_hot_list_t *list = (bt_hot_list_t *)
+    malloc(sizeof(bt_hot_list_t) + total_count * sizeof(bt_hot_swarm_t));
+
+  if (NULL == list) {
+    syslog(LOG_ERR, "Cannot allocate memory for hot swarm list");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  GHashTableIter iter;
+  gpointer key, value;
+  size_t length = 0;
+
+  g_hash_table_iter_init(&iter, totals);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    list->swarms[length++] = *(bt_hot_swarm_t *) value;
+  }
+
+  g_hash_table_destroy(totals);
+
+  qsort(list->swarms, length, sizeof(bt_hot_swarm_t), bt_hot_count_cmp);
+
+  length = MIN(length, config->hot_size);
+  while (length > 0 &&
+         list->swarms[length - 1].count < config->hot_min_requests) {
+    length--;
+  }
+
+  list->length = length;
+  qsort(list->swarms, length, sizeof(bt_hot_swarm_t), bt_hot_info_hash_cmp);
+
+  free(bt_hot_list_retired);
+  bt_hot_list_retired = __atomic_exchange_n(&bt_hot_list, list,
+                                            __ATOMIC_ACQ_REL);
+
+  bt_stats_set(BT_STAT_HOT_SWARMS, length);
+
+  return length;
+}
+
+bool
+bt_hot_find(const bt_config_t *config, const int8_t *info_hash)
+{
+  const bt_hot_list_t *list = __atomic_load_n(&bt_hot_list, __ATOMIC_ACQUIRE);
+
+  if (0 == config->hot_size || NULL == list) {
+    return false;
+  }
+
+  size_t low = 0, high = list->length;
+
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    int cmp = memcmp(list->swarms[mid].info_hash, info_hash, 20);
+
+    if (0 == cmp) {
+      return true;
+    } else if (cmp < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  return false;
+}
+
+bool
+bt_write_hot_list(const char *path)
+{
+  const bt_hot_list_t *list = __atomic_load_n(&bt_hot_list, __ATOMIC_ACQUIRE);
+  size_t length = NULL != list ? list->length : 0;
+  bt_hot_swarm_t *swarms = (bt_hot_swarm_t *)
+    malloc(MAX(1, length) * sizeof(bt_hot_swarm_t));
+
+  if (NULL == swarms) {
+    syslog(LOG_ERR, "Cannot allocate memory for hot swarm list");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  if (length > 0) {
+    memcpy(swarms, list->swarms, length * sizeof(bt_hot_swarm_t));
+    qsort(swarms, length, sizeof(bt_hot_swarm_t), bt_hot_count_cmp);
+  }
+
+  /* Written aside and renamed, so readers never see a partial file. */
+  char tmp_path[PATH_MAX];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+  FILE *file = fopen(tmp_path, "w");
+  bool succeeded = NULL != file;
+
+  for (size_t i = 0; succeeded && i < length; i++) {
+    for (int j = 0; j < 20; j++) {
+      fprintf(file, "%02x", (uint8_t) swarms[i].info_hash[j]);
+    }
+    succeeded = fprintf(file, " %" PRIu32 "\n", swarms[i].count) > 0;
+  }
+
+  if (NULL != file) {
+    succeeded = fclose(file) == 0 && succeeded;
+  }
+
+  if (succeeded && rename(tmp_path, path) == -1) {
+    succeeded = false;
+  }
+
+  if (!succeeded) {
+    syslog(LOG_ERR, "Cannot write hot swarms to %s", path);
+    unlink(tmp_path);
+  }
+
+  free(swarms);
+
+  return succeeded;
+}
+
+void *
+bt_hot_thread(void *data)
+{
+  bt_config_t *config = (bt_config_t *) data;
+
+  while (true) {
+    sleep(MAX(1, config->hot_interval));
+
+    size_t length = bt_hot_merge(config);
+    syslog(LOG_DEBUG, "Found %zu hot swarms", length);
+
+    if (NULL != config->hot_path && '\0' != config->hot_path[0]) {
+      bt_write_hot_list(config->hot_path);
+    }
+  }
+
+  return NULL;
+}
+
+/* Frees a cached swarm. */
+void
+bt_hot_free_entry(gpointer data)
+{
+  bt_hot_entry_t *entry = (bt_hot_entry_t *) data;
+
+  free(entry->peers[0]);
+  free(entry->peers[1]);
+  free(entry);
+}
+
+bt_hot_cache_t *
+bt_new_hot_cache(const bt_config_t *config)
+{
+  if (0 == config->hot_size || 0 == config->hot_cache_time) {
+    return NULL;
+  }
+
+  bt_hot_cache_t *cache = (bt_hot_cache_t *) malloc(sizeof(bt_hot_cache_t));
+
+  if (NULL == cache) {
+    syslog(LOG_ERR, "Cannot allocate memory for hot swarm cache");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  cache->entries = g_hash_table_new_full(bt_hot_hash, bt_hot_equal, NULL,
+                                         bt_hot_free_entry);
+  cache->ttl = (int64_t) config->hot_cache_time * G_USEC_PER_SEC;
+  cache->max_entries = 2 * config->hot_size;
+
+  return cache;
+}
+
+void
+bt_free_hot_cache(bt_hot_cache_t *cache)
+{
+  if (NULL != cache) {
+    g_hash_table_destroy(cache->entries);
+    free(cache);
+  }
+}
+
+/* Returns the entry of a torrent, creating it if `create` is set. */
+bt_hot_entry_t *
+bt_hot_cache_entry(bt_hot_cache_t *cache, const int8_t *info_hash,
+                   bool create)
+{
+  bt_hot_entry_t *entry = (bt_hot_entry_t *)
+    g_hash_table_lookup(cache->entries, info_hash);
+
+  if (NULL != entry || !create) {
+    return entry;
+  }
+
+  /* Swarms that cooled down are only dropped once the table fills up. */
+  if (g_hash_table_size(cache->entries) >= cache->max_entries) {
+    g_hash_table_remove_all(cache->entries);
+  }
+
+  entry = (bt_hot_entry_t *) calloc(1, sizeof(bt_hot_entry_t));
+
+  if (NULL == entry) {
+    syslog(LOG_ERR, "Cannot allocate memory for hot swarm cache");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  memcpy(entry->info_hash, info_hash, 20);
+  g_hash_table_insert(cache->entries, entry->info_hash, entry);
+
+  return entry;
+}
+
+bool
+bt_hot_cached_stats(bt_hot_cache_t *cache, const int8_t *info_hash,
+                    bt_torrent_stats_t *stats, bool stale)
+{
+  bt_hot_entry_t *entry = bt_hot_cache_entry(cache, info_hash, false);
+
+  if (NULL == entry || 0 == entry->stats_until ||
+      (!stale && entry->stats_until <= g_get_monotonic_time())) {
+    return false;
+  }
+
+  *stats = entry->stats;
+  bt_stats_inc(BT_STAT_HOT_HITS);
+
+  return true;
+}
+
+void
+bt_hot_cache_stats(bt_hot_cache_t *cache, const int8_t *info_hash,
+                   const bt_torrent_stats_t *stats)
+{
+  bt_hot_entry_t *entry = bt_hot_cache_entry(cache, info_hash, true);
+
+  entry->stats = *stats;
+  entry->stats_until = g_get_monotonic_time() + cache->ttl;
+}
+
+/* Draws up to `num_want` of the cached peers at random. */
+bt_list *
+bt_hot_draw_peers(bt_hot_entry_t *entry, bool seeder, int32_t num_want,
+                  int *peer_count)
+{
+  bt_peer_addr_t *cached = entry->peers[seeder];
+  int total = entry->peer_count[seeder];
+  int count = MIN(MAX(0, num_want), total);
+  bt_list *peers = NULL;
+
+  /* Shuffles the cached peers a little bit to ensure all have a chance. */
+  for (int i = 0; i < count; i++) {
+    int j = randr(i, total - 1);
+    bt_peer_addr_t aux = cached[i];
+
+    cached[i] = cached[j];
+    cached[j] = aux;
+
+    peers = bt_list_prepend(peers, bt_new_peer_addr(cached[i].ipv4_addr,
+                                                    cached[i].port));
+  }
+
+  *peer_count = count;
+  return peers;
+}
+
+bool
+bt_hot_cached_peers(bt_hot_cache_t *cache, const int8_t *info_hash,
+                    bool seeder, int32_t num_want, bt_list **peers,
+                    int *peer_count, bool stale)
+{
+  bt_hot_entry_t *entry = bt_hot_cache_entry(cache, info_hash, false);
+
+  if (NULL == entry || 0 == entry->peers_until[seeder] ||
+      (!stale && entry->peers_until[seeder] <= g_get_monotonic_time())) {
+    return false;
+  }
+
+  *peers = bt_hot_draw_peers(entry, seeder, num_want, peer_count);
+  bt_stats_inc(BT_STAT_HOT_HITS);
+
+  return true;
+}
+
+bt_list *
+bt_hot_cache_peers(bt_hot_cache_t *cache, const int8_t *info_hash,
+                   bool seeder, bt_list *pool, int pool_count,
+                   int32_t num_want, int *peer_count)
+{
+  bt_hot_entry_t *entry = bt_hot_cache_entry(cache, info_hash, true);
+  bt_peer_addr_t *cached = (bt_peer_addr_t *)
+    malloc(MAX(1, pool_count) * sizeof(bt_peer_addr_t));
+
+  if (NULL == cached) {
+    syslog(LOG_ERR, "Cannot allocate memory for hot swarm cache");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  int count = 0;
+
+  for (bt_list *node = pool; NULL != node && count < pool_count;
+       node = node->next) {
+    cached[count++] = *(bt_peer_addr_t *) node->data;
+  }
+
+  free(entry->peers[seeder]);
+  entry->peers[seeder] = cached;
+  entry->peer_count[seeder] = count;
+  entry->peers_until[seeder] = g_get_monotonic_time() + cache->ttl;
+
+  return bt_hot_draw_peers(entry, seeder, num_want, peer_count);
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BTTRACKER_HOT_H_
+#define BTTRACKER_HOT_H_
+
+/*
+ * A few torrents get most of the announces. Each thread counts the info
+ * hashes it sees in a space-saving sketch, and the hot thread merges the
+ * sketches every `Interval` seconds into the list of the hottest swarms.
+ * Workers answer those from a short-lived local cache of their stats and
+ * peers, and hand out a longer announce interval for them.
+ */
+
+/* Counters kept by each sketch for every info hash of the hot list. */
+#define BT_HOT_SKETCH_FACTOR (8)
+
+/* Info hash counted by a sketch. */
+typedef struct {
+  int8_t info_hash[20];
+  uint32_t count;           // Upper bound of the requests seen
+  uint32_t error;           // How much `count` might overestimate
+  int slot;                 // Position in the heap of the sketch
+} bt_hot_counter_t;
+
+/*
+ * Space-saving sketch: keeps `capacity` counters, and the least counted
+ * info hash is replaced when a new one shows up. Any info hash seen more
+ * than 1/capacity of the time is guaranteed to be kept.
+ */
+typedef struct {
+  GMutex lock;              // Only contended while the sketch is merged
+  GHashTable *index;        // Info hash -> counter
+  bt_hot_counter_t *counters;
+  bt_hot_counter_t **heap;  // Min-heap of the counters in use
+  int length;
+  int capacity;
+} bt_hot_sketch_t;
+
+/* Info hash in the hot list. */
+typedef struct {
+  int8_t info_hash[20];
+  uint32_t count;           // Requests seen during the last interval
+} bt_hot_swarm_t;
+
+/* Cached stats and peers of a hot swarm. */
+typedef struct {
+  int8_t info_hash[20];
+  int64_t stats_until;      // Monotonic time, in microseconds
+  bt_torrent_stats_t stats;
+  int64_t peers_until[2];   // Indexed by whether the requester seeds
+  bt_peer_addr_t *peers[2];
+  int peer_count[2];
+} bt_hot_entry_t;
+
+/*
+ * Stats and peers of hot swarms read by a worker. Each worker has its own,
+ * so the cache needs no locking.
+ */
+typedef struct {
+  GHashTable *entries;      // Info hash -> entry
+  int64_t ttl;              // Lifetime of an entry, in microseconds
+  guint max_entries;
+} bt_hot_cache_t;
+
+/* Hash and equality of info hashes, for hash tables keyed by them. */
+guint
+bt_hot_hash(gconstpointer info_hash);
+
+gboolean
+bt_hot_equal(gconstpointer a, gconstpointer b);
+
+/* Creates a sketch that keeps `capacity` counters. */
+bt_hot_sketch_t *
+bt_new_hot_sketch(int capacity);
+
+/* Frees a sketch. */
+void
+bt_free_hot_sketch(bt_hot_sketch_t *sketch);
+
+/* Counts one request for an info hash. */
+void
+bt_hot_sketch_add(bt_hot_sketch_t *sketch, const int8_t *info_hash);
+
+/* Counts one request for an info hash in the sketch of the calling thread. */
+void
+bt_hot_count(const bt_config_t *config, const int8_t *info_hash);
+
+/*
+ * Merges and resets the sketches of all threads, then publishes the swarms
+ * seen at least `MinRequests` times, `Size` at most. Returns the number of
+ * hot swarms.
+ */
+size_t
+bt_hot_merge(const bt_config_t *config);
+
+/* Returns whether an info hash is in the hot list. */
+bool
+bt_hot_find(const bt_config_t *config, const int8_t *info_hash);
+
+/* Writes the hot list, hottest first, to `path` as text. */
+bool
+bt_write_hot_list(const char *path);
+
+/*
+ * Thread that periodically merges the sketches and writes the hot list.
+ * The argument `data` is a pointer to the `bt_config_t` object.
+ */
+void *
+bt_hot_thread(void *data);
+
+/* Creates the cache of a worker, or returns NULL if disabled. */
+bt_hot_cache_t *
+bt_new_hot_cache(const bt_config_t *config);
+
+/* Frees the cache of a worker. */
+void
+bt_free_hot_cache(bt_hot_cache_t *cache);
+
+/*
+ * Fills `stats` with the cached stats of a torrent. Returns false if none,
+ * or if they are too old and `stale` is not set.
+ */
+bool
+bt_hot_cached_stats(bt_hot_cache_t *cache, const int8_t *info_hash,
+                    bt_torrent_stats_t *stats, bool stale);
+
+/* Caches the stats of a hot torrent. */
+void
+bt_hot_cache_stats(bt_hot_cache_t *cache, const int8_t *info_hash,
+                   const bt_torrent_stats_t *stats);
+
+/*
+ * Sets `peers` to up to `num_want` peers drawn at random from those cached
+ * for a requester that seeds or not. Returns false if none are cached, or
+ * if they are too old and `stale` is not set.
+ */
+bool
+bt_hot_cached_peers(bt_hot_cache_t *cache, const int8_t *info_hash,
+                    bool seeder, int32_t num_want, bt_list **peers,
+                    int *peer_count, bool stale);
+
+/*
+ * Caches `pool`, the peers to hand out to requesters that seed or not, then
+ * draws up to `num_want` of them like `bt_hot_cached_peers`.
+ */
+bt_list *
+bt_hot_cache_peers(bt_hot_cache_t *cache, const int8_t *info_hash,
+                   bool seeder, bt_list *pool, int pool_count,
+                   int32_t num_want, int *peer_count);
+
+#endif // BTTRACKER_HOT_H_
@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Interval currently handed out, before jitter. */
+static volatile int32_t bt_interval_current = 0;
+
+/* Monotonic time of the last adaptation, in seconds. */
+static volatile int64_t bt_interval_adapted_at = 0;
+
+/* Returns the lower bound of the interval. */
+uint32_t
+bt_min_announce_interval(const bt_config_t *config)
+{
+  return config->announce_min_interval > 0
+    ? config->announce_min_interval : config->announce_wait_time;
+}
+
+uint32_t
+bt_max_announce_interval(const bt_config_t *config)
+{
+  return MAX(bt_min_announce_interval(config),
+             config->announce_max_interval > 0
+             ? config->announce_max_interval : config->announce_wait_time);
+}
+
+uint32_t
+bt_hot_max_announce_interval(const bt_config_t *config)
+{
+  return MAX(bt_max_announce_interval(config), config->hot_max_interval);
+}
+
+uint32_t
+bt_longest_announce_interval(const bt_config_t *config)
+{
+  return config->hot_size > 0
+    ? bt_hot_max_announce_interval(config) : bt_max_announce_interval(config);
+}
+
+/* Returns whether requests wait in the queues or on Redis for too long. */
+bool
+bt_interval_overloaded(const bt_config_t *config)
+{
+  int64_t queued = bt_stats_get(BT_STAT_QUEUED_CONNECT) +
+    bt_stats_get(BT_STAT_QUEUED_ANNOUNCE) +
+    bt_stats_get(BT_STAT_QUEUED_SCRAPE) +
+    bt_stats_get(BT_STAT_QUEUED_OTHER);
+
+  return (config->announce_load_queue_threshold > 0 &&
+          queued > config->announce_load_queue_threshold) ||
+    (config->announce_load_latency_threshold > 0 &&
+     bt_stats_get(BT_STAT_REDIS_LATENCY) >
+     config->announce_load_latency_threshold * 1000LL);
+}
+
+void
+bt_interval_adapt(const bt_config_t *config, int64_t now)
+{
+  int64_t adapted_at = bt_interval_adapted_at;
+
+  /* Only one thread adapts the interval each period. */
+  if (now - adapted_at < BT_INTERVAL_ADAPT_PERIOD ||
+      !__sync_bool_compare_and_swap(&bt_interval_adapted_at, adapted_at, now)) {
+    return;
+  }
+
+  int32_t min = bt_min_announce_interval(config);
+  int32_t max = bt_max_announce_interval(config);
+  int32_t step = config->announce_interval_step > 0
+    ? config->announce_interval_step : max - min;
+
+  int32_t current = bt_interval_current;
+  int32_t target = bt_interval_overloaded(config)
+    ? max : CLAMP((int32_t) config->announce_wait_time, min, max);
+
+  if (0 == current) {
+    current = CLAMP((int32_t) config->announce_wait_time, min, max);
+  }
+
+  if (current < target) {
+    current = MIN(target, current + step);
+  } else if (current > target) {
+    current = MAX(target, current - step);
+  }
+
+  if (current != bt_interval_current) {
+    syslog(LOG_INFO, "Announce interval is now %" PRId32 " seconds", current);
+  }
+
+  bt_interval_current = current;
+  bt_stats_set(BT_STAT_ANNOUNCE_INTERVAL, current);
+}
+
+/* Returns the interval currently handed out, before jitter. */
+int32_t
+bt_interval_base(const bt_config_t *config)
+{
+  int32_t min = bt_min_announce_interval(config);
+  int32_t max = bt_max_announce_interval(config);
+
+  bt_interval_adapt(config, g_get_monotonic_time() / G_USEC_PER_SEC);
+
+  int32_t current = bt_interval_current;
+
+  if (0 == current) {
+    current = CLAMP((int32_t) config->announce_wait_time, min, max);
+  }
+
+  return current;
+}
+
+int32_t
+bt_interval_spread(const bt_config_t *config, int32_t current, int32_t max)
+{
+  int32_t min = bt_min_announce_interval(config);
+  int32_t jitter = (int64_t) current * config->announce_interval_jitter / 100;
+
+  if (jitter > 0) {
+    current += (int32_t) randr(0, 2 * jitter) - jitter;
+  }
+
+  return CLAMP(current, min, max);
+}
+
+int32_t
+bt_announce_interval(const bt_config_t *config)
+{
+  return bt_interval_spread(config, bt_interval_base(config),
+                            bt_max_announce_interval(config));
+}
+
+int32_t
+bt_hot_announce_interval(const bt_config_t *config)
+{
+  double factor = MAX(1.0, config->hot_interval_factor);
+  int64_t current = (int64_t) (bt_interval_base(config) * factor);
+  int32_t max = bt_hot_max_announce_interval(config);
+
+  return bt_interval_spread(config, (int32_t) MIN(current, max), max);
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BTTRACKER_INTERVAL_H_
+#define BTTRACKER_INTERVAL_H_
+
+/* How often, in seconds, the announce interval is adapted to the load. */
+#define BT_INTERVAL_ADAPT_PERIOD (1)
+
+/*
+ * Returns the interval to send in an announce response. It grows towards
+ * `MaxInterval` while the tracker is overloaded, shrinks back towards
+ * `WaitTime` afterwards, and is spread randomly by `IntervalJitter` so
+ * clients do not re-announce in lockstep.
+ */
+int32_t
+bt_announce_interval(const bt_config_t *config);
+
+/*
+ * Returns the interval to send to the peers of a hot swarm: the current
+ * one stretched by `IntervalFactor` of [HotSwarms], up to its own
+ * `MaxInterval`.
+ */
+int32_t
+bt_hot_announce_interval(const bt_config_t *config);
+
+/*
+ * Moves the current interval one step towards its target, at most once per
+ * `BT_INTERVAL_ADAPT_PERIOD` of the monotonic time `now`, in seconds.
+ */
+void
+bt_interval_adapt(const bt_config_t *config, int64_t now);
+
+/*
+ * Spreads an interval by `IntervalJitter`, between `MinInterval` and
+ * `max`.
+ */
+int32_t
+bt_interval_spread(const bt_config_t *config, int32_t current, int32_t max);
+
+/* Returns the upper bound of the interval sent to most swarms. */
+uint32_t
+bt_max_announce_interval(const bt_config_t *config);
+
+/*
+ * Returns the upper bound of the interval sent to hot swarms, which is
+ * `MaxInterval` of [Announce] unless [HotSwarms] sets a larger one.
+ */
+uint32_t
+bt_hot_max_announce_interval(const bt_config_t *config);
+
+/*
+ * Returns the largest interval ever sent, which the lifetime of peers must
+ * cover.
+ */
+uint32_t
+bt_longest_announce_interval(const bt_config_t *config);
+
+#endif // BTTRACKER_INTERVAL_H_
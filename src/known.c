@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Frees a known swarm. */
+void
+bt_known_free_entry(gpointer data)
+{
+  bt_known_entry_t *entry = (bt_known_entry_t *) data;
+
+  free(entry->peers[0]);
+  free(entry->peers[1]);
+  free(entry);
+}
+
+bt_known_cache_t *
+bt_new_known_cache(const bt_config_t *config)
+{
+  if (!bt_breaker_enabled(config) || 0 == config->breaker_known_swarms) {
+    return NULL;
+  }
+
+  bt_known_cache_t *cache = (bt_known_cache_t *)
+    malloc(sizeof(bt_known_cache_t));
+
+  if (NULL == cache) {
+    syslog(LOG_ERR, "Cannot allocate memory for known swarm cache");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  cache->entries = g_hash_table_new_full(bt_hot_hash, bt_hot_equal, NULL,
+                                         bt_known_free_entry);
+  g_queue_init(&cache->order);
+  cache->max_entries = config->breaker_known_swarms;
+  cache->max_peers = config->breaker_known_peers;
+
+  return cache;
+}
+
+void
+bt_free_known_cache(bt_known_cache_t *cache)
+{
+  if (NULL != cache) {
+    g_queue_clear(&cache->order);
+    g_hash_table_destroy(cache->entries);
+    free(cache);
+  }
+}
+
+/* Returns the entry of a torrent, moved to the end of the order of use. */
+bt_known_entry_t *
+bt_known_entry(bt_known_cache_t *cache, const int8_t *info_hash)
+{
+  bt_known_entry_t *entry = (bt_known_entry_t *)
+    g_hash_table_lookup(cache->entries, info_hash);
+
+  if (NULL != entry) {
+    g_queue_unlink(&cache->order, entry->link);
+    g_queue_push_tail_link(&cache->order, entry->link);
+    return entry;
+  }
+
+  if (g_hash_table_size(cache->entries) >= cache->max_entries) {
+    bt_known_entry_t *oldest = (bt_known_entry_t *)
+      g_queue_pop_head(&cache->order);
+
+    g_hash_table_remove(cache->entries, oldest->info_hash);
+  }
+
+  entry = (bt_known_entry_t *) calloc(1, sizeof(bt_known_entry_t));
+
+  if (NULL == entry) {
+    syslog(LOG_ERR, "Cannot allocate memory for known swarm cache");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  memcpy(entry->info_hash, info_hash, 20);
+  g_queue_push_tail(&cache->order, entry);
+  entry->link = g_queue_peek_tail_link(&cache->order);
+  g_hash_table_insert(cache->entries, entry->info_hash, entry);
+
+  return entry;
+}
+
+void
+bt_known_store_stats(bt_known_cache_t *cache, const int8_t *info_hash,
+                     const bt_torrent_stats_t *stats)
+{
+  bt_known_entry_t *entry = bt_known_entry(cache, info_hash);
+
+  entry->stats = *stats;
+  entry->has_stats = true;
+}
+
+bool
+bt_known_stats(bt_known_cache_t *cache, const int8_t *info_hash,
+               bt_torrent_stats_t *stats)
+{
+  bt_known_entry_t *entry = (bt_known_entry_t *)
+    g_hash_table_lookup(cache->entries, info_hash);
+
+  if (NULL == entry || !entry->has_stats) {
+    return false;
+  }
+
+  *stats = entry->stats;
+  return true;
+}
+
+/* Returns whether `peers` holds the address `addr` among its first `count`. */
+bool
+bt_known_has_peer(const bt_peer_addr_t *peers, int count,
+                  const bt_peer_addr_t *addr)
+{
+  for (int i = 0; i < count; i++) {
+    if (peers[i].ipv4_addr == addr->ipv4_addr && peers[i].port == addr->port) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void
+bt_known_store_peers(bt_known_cache_t *cache, const int8_t *info_hash,
+                     bool seeder, bt_list *peers, int peer_count)
+{
+  if (cache->max_peers <= 0 || peer_count <= 0) {
+    return;
+  }
+
+  bt_known_entry_t *entry = bt_known_entry(cache, info_hash);
+  bt_peer_addr_t *known = (bt_peer_addr_t *)
+    malloc(cache->max_peers * sizeof(bt_peer_addr_t));
+
+  if (NULL == known) {
+    syslog(LOG_ERR, "Cannot allocate memory for known swarm cache");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  /* Peers just handed out go first, then the older ones they leave room for. */
+  int count = 0;
+
+  for (bt_list *node = peers; NULL != node && count < cache->max_peers;
+       node = node->next) {
+    known[count++] = *(bt_peer_addr_t *) node->data;
+  }
+
+  int fresh = count;
+  bt_peer_addr_t *older = entry->peers[seeder];
+
+  for (int i = 0; i < entry->peer_count[seeder] && count < cache->max_peers;
+       i++) {
+    if (!bt_known_has_peer(known, fresh, &older[i])) {
+      known[count++] = older[i];
+    }
+  }
+
+  free(older);
+  entry->peers[seeder] = known;
+  entry->peer_count[seeder] = count;
+}
+
+bool
+bt_known_peers(bt_known_cache_t *cache, const int8_t *info_hash,
+               bool seeder, int32_t num_want, bt_list **peers,
+               int *peer_count)
+{
+  bt_known_entry_t *entry = (bt_known_entry_t *)
+    g_hash_table_lookup(cache->entries, info_hash);
+
+  if (NULL == entry || 0 == entry->peer_count[seeder]) {
+    return false;
+  }
+
+  bt_peer_addr_t *known = entry->peers[seeder];
+  int total = entry->peer_count[seeder];
+  int count = MIN(MAX(0, num_want), total);
+
+  *peers = NULL;
+
+  /* Moves the drawn peers to the front, like the cache of hot swarms. */
+  for (int i = 0; i < count; i++) {
+    int j = randr(i, total - 1);
+    bt_peer_addr_t aux = known[i];
+
+    known[i] = known[j];
+    known[j] = aux;
+
+    *peers = bt_list_prepend(*peers, bt_new_peer_addr(known[i].ipv4_addr,
+                                                      known[i].port));
+  }
+
+  *peer_count = count;
+  return true;
+}
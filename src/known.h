@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BTTRACKER_KNOWN_H_
+#define BTTRACKER_KNOWN_H_
+
+/*
+ * Last stats and peers each worker read from Redis for the swarms it served,
+ * so that requests still get real answers while the breaker is open. The
+ * announces of a swarm go to the worker that owns its shard, and each
+ * worker only touches its own cache, so it needs no locking. Once it keeps
+ * `KnownSwarms` swarms, the one served the longest time ago is dropped.
+ */
+
+/* Last known stats and peers of a swarm. */
+typedef struct {
+  int8_t info_hash[20];
+  bool has_stats;
+  bt_torrent_stats_t stats;
+  bt_peer_addr_t *peers[2];   // Indexed by whether the requester seeds
+  int peer_count[2];
+  GList *link;                // Node of the entry in `order`
+} bt_known_entry_t;
+
+/* Last known data of the swarms served by a worker. */
+typedef struct {
+  GHashTable *entries;        // Info hash -> entry
+  GQueue order;               // Entries, least recently served first
+  guint max_entries;
+  int max_peers;              // Peers kept for each kind of requester
+} bt_known_cache_t;
+
+/* Creates the cache of a worker, or returns NULL if disabled. */
+bt_known_cache_t *
+bt_new_known_cache(const bt_config_t *config);
+
+/* Frees the cache of a worker. */
+void
+bt_free_known_cache(bt_known_cache_t *cache);
+
+/* Remembers the stats of a torrent. */
+void
+bt_known_store_stats(bt_known_cache_t *cache, const int8_t *info_hash,
+                     const bt_torrent_stats_t *stats);
+
+/* Fills `stats` with the last known ones. Returns false if none. */
+bool
+bt_known_stats(bt_known_cache_t *cache, const int8_t *info_hash,
+               bt_torrent_stats_t *stats);
+
+/*
+ * Remembers `peers`, handed out to a requester that seeds or not. They are
+ * kept ahead of those remembered before, up to `KnownPeers` in total.
+ */
+void
+bt_known_store_peers(bt_known_cache_t *cache, const int8_t *info_hash,
+                     bool seeder, bt_list *peers, int peer_count);
+
+/*
+ * Sets `peers` to up to `num_want` of the last known peers for a requester
+ * that seeds or not, drawn at random. Returns false if none.
+ */
+bool
+bt_known_peers(bt_known_cache_t *cache, const int8_t *info_hash,
+               bool seeder, int32_t num_want, bt_list **peers,
+               int *peer_count);
+
+#endif // BTTRACKER_KNOWN_H_
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Groups of the configured prefixes, indexed by prefix length. */
+static GHashTable *bt_locality_prefixes[33];
+
+/* Groups from the table are told apart from those of `PrefixLength`. */
+#define BT_LOCALITY_TABLE_GROUP (1LL << 32)
+
+/* Returns the first `len` bits of an address. */
+uint32_t
+bt_locality_mask(uint32_t ipv4_addr, int len)
+{
+  return 0 == len ? 0 : ipv4_addr & (0xffffffffU << (32 - len));
+}
+
+/* Parses a line of the table. Returns false if malformed. */
+bool
+bt_locality_parse_line(const char *line, uint32_t *network, int *len,
+                       char *name, size_t name_size)
+{
+  char addr_str[INET_ADDRSTRLEN], name_str[64];
+  struct in_addr addr;
+
+  if (sscanf(line, " %15[0-9.]/%d %63s", addr_str, len, name_str) != 3 ||
+      *len < 0 || *len > 32 || inet_pton(AF_INET, addr_str, &addr) != 1) {
+    return false;
+  }
+
+  *network = bt_locality_mask(ntohl(addr.s_addr), *len);
+  snprintf(name, name_size, "%s", name_str);
+
+  return true;
+}
+
+bool
+bt_load_locality(const bt_config_t *config)
+{
+  const char *path = config->announce_locality_groups;
+  char *contents = NULL;
+
+  if (NULL == path || '\0' == path[0]) {
+    return true;
+  }
+
+  if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+    syslog(LOG_ERR, "Cannot read locality groups from %s", path);
+    return false;
+  }
+
+  GHashTable *names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                            NULL);
+  gchar **lines = g_strsplit(contents, "\n", -1);
+  int prefixes = 0;
+  bool loaded = true;
+
+  for (int i = 0; NULL != lines[i]; i++) {
+    char *line = g_strstrip(lines[i]);
+    char name[64];
+    uint32_t network;
+    int len;
+
+    if ('\0' == line[0] || '#' == line[0]) {
+      continue;
+    }
+
+    if (!bt_locality_parse_line(line, &network, &len, name, sizeof(name))) {
+      syslog(LOG_ERR, "Invalid locality group at line %d: %s", i + 1, line);
+      loaded = false;
+      break;
+    }
+
+    /* Prefixes with the same name make up a single group. */
+    gpointer group;
+
+    if (!g_hash_table_lookup_extended(names, name, NULL, &group)) {
+      group = GINT_TO_POINTER(g_hash_table_size(names));
+      g_hash_table_insert(names, g_strdup(name), group);
+    }
+
+    if (NULL == bt_locality_prefixes[len]) {
+      bt_locality_prefixes[len] = g_hash_table_new(g_direct_hash,
+                                                   g_direct_equal);
+    }
+
+    /* Values are offset by one, as a NULL value means no group. */
+    g_hash_table_insert(bt_locality_prefixes[len], GUINT_TO_POINTER(network),
+                        GINT_TO_POINTER(GPOINTER_TO_INT(group) + 1));
+    prefixes++;
+  }
+
+  if (loaded) {
+    syslog(LOG_INFO, "Loaded %d prefixes in %u locality groups", prefixes,
+           g_hash_table_size(names));
+  } else {
+    bt_free_locality();
+  }
+
+  g_hash_table_destroy(names);
+  g_strfreev(lines);
+  g_free(contents);
+
+  return loaded;
+}
+
+void
+bt_free_locality(void)
+{
+  for (int len = 0; len <= 32; len++) {
+    if (NULL != bt_locality_prefixes[len]) {
+      g_hash_table_destroy(bt_locality_prefixes[len]);
+      bt_locality_prefixes[len] = NULL;
+    }
+  }
+}
+
+int64_t
+bt_locality_group(const bt_config_t *config, uint32_t ipv4_addr)
+{
+  if (0 == config->announce_locality_share) {
+    return BT_LOCALITY_NONE;
+  }
+
+  /* The longest matching prefix wins. */
+  for (int len = 32; len >= 0; len--) {
+    if (NULL == bt_locality_prefixes[len]) {
+      continue;
+    }
+
+    gpointer group = g_hash_table_lookup(bt_locality_prefixes[len],
+      GUINT_TO_POINTER(bt_locality_mask(ipv4_addr, len)));
+
+    if (NULL != group) {
+      return BT_LOCALITY_TABLE_GROUP + GPOINTER_TO_INT(group) - 1;
+    }
+  }
+
+  int len = config->announce_locality_prefix_len;
+
+  if (len > 0 && len <= 32) {
+    return bt_locality_mask(ipv4_addr, len);
+  }
+
+  return BT_LOCALITY_NONE;
+}
+
+int32_t
+bt_locality_quota(const bt_config_t *config, int32_t num_want)
+{
+  uint32_t share = MIN(100, config->announce_locality_share);
+
+  /* Rounds up, so a share always gets at least one peer. */
+  return (num_want * share + 99) / 100;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BTTRACKER_LOCALITY_H_
+#define BTTRACKER_LOCALITY_H_
+
+/*
+ * Locality groups: addresses that share a network prefix, either one from a
+ * configured table of prefixes or simply the same leading bits. Announces
+ * fill part of their peers from the group of the requester, so that peers
+ * on the same network find each other, and the rest at random.
+ */
+
+/* Group of addresses that belong to no group. */
+#define BT_LOCALITY_NONE (-1)
+
+/*
+ * Loads the table of prefixes at `LocalityGroups`, if any. Each line holds
+ * a prefix such as "10.0.0.0/8" and the name of its group, and prefixes may
+ * nest. Returns false if the table cannot be loaded.
+ */
+bool
+bt_load_locality(const bt_config_t *config);
+
+/* Frees the table of prefixes. */
+void
+bt_free_locality(void);
+
+/*
+ * Returns the group of an address, in host byte order, or BT_LOCALITY_NONE
+ * if locality is disabled or the address is not part of any group.
+ */
+int64_t
+bt_locality_group(const bt_config_t *config, uint32_t ipv4_addr);
+
+/* Returns how many of `num_want` peers should come from the same group. */
+int32_t
+bt_locality_quota(const bt_config_t *config, int32_t num_want);
+
+#endif // BTTRACKER_LOCALITY_H_
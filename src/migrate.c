@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Converts a keyspace written with the legacy key schema to the compact one.
+ * The target prefix and key schema are read from the configuration file, and
+ * the source prefix defaults to the same prefix. The remaining TTL of every
+ * peer is preserved. Active connections are not migrated, since they expire
+ * in a couple of minutes anyway.
+ */
+
+/* Number of keys requested on each SCAN iteration. */
+#define BT_MIGRATE_BATCH (1000)
+
+/* Configuration data. */
+bt_config_t config;
+
+/* Returns the keys found by a SCAN iteration and updates the cursor. */
+redisReply *
+bt_migrate_scan(redisContext *redis, const char *pattern, char *cursor)
+{
+  redisReply *reply = redisCommand(redis, "SCAN %s MATCH %s COUNT %d",
+                                   cursor, pattern, BT_MIGRATE_BATCH);
+
+  if (NULL == reply || REDIS_REPLY_ARRAY != reply->type ||
+      2 != reply->elements) {
+    syslog(LOG_ERR, "Cannot scan keys matching %s", pattern);
+    exit(BT_EXIT_REDIS);
+  }
+
+  snprintf(cursor, 32, "%s", reply->element[0]->str);
+  return reply;
+}
+
+/* Reads and discards `count` pipelined replies. Returns the failures. */
+int
+bt_migrate_drain(redisContext *redis, int count)
+{
+  redisReply *reply;
+  int failures = 0;
+
+  for (int i = 0; i < count; i++) {
+    if (redisGetReply(redis, (void **) &reply) != REDIS_OK) {
+      syslog(LOG_ERR, "Connection with Redis lost");
+      exit(BT_EXIT_REDIS);
+    }
+
+    if (REDIS_REPLY_ERROR == reply->type) {
+      failures++;
+    }
+    freeReplyObject(reply);
+  }
+
+  return failures;
+}
+
+/* Converts all peers. Returns the number of migrated peers. */
+int
+bt_migrate_peers(redisContext *redis, const char *src_prefix)
+{
+  const bt_key_names_t *names = bt_key_names(&config);
+  size_t prefix_len = strlen(src_prefix);
+  char cursor[32] = "0";
+  int migrated = 0;
+
+  /* <prefix>:pr:<40 hex chars>:<sd|lc>:<20 bytes> */
+  size_t key_len = prefix_len + 4 + 40 + 4 + 20;
+
+  char *pattern = g_strdup_printf("%s:pr:*", src_prefix);
+
+  do {
+    redisReply *scan = bt_migrate_scan(redis, pattern, cursor);
+    redisReply *keys = scan->element[1];
+
+    /* Pipelines the value and the remaining TTL of every key. */
+    for (int i = 0; i < keys->elements; i++) {
+      redisAppendCommand(redis, "GET %b",
+                         keys->element[i]->str, keys->element[i]->len);
+      redisAppendCommand(redis, "PTTL %b",
+                         keys->element[i]->str, keys->element[i]->len);
+    }
+
+    int pending = 0;
+
+    for (int i = 0; i < keys->elements; i++) {
+      redisReply *value, *pttl;
+      const char *key = keys->element[i]->str;
+
+      if (redisGetReply(redis, (void **) &value) != REDIS_OK ||
+          redisGetReply(redis, (void **) &pttl) != REDIS_OK) {
+        syslog(LOG_ERR, "Connection with Redis lost");
+        exit(BT_EXIT_REDIS);
+      }
+
+      int8_t info_hash[20];
+      bool valid_len = keys->element[i]->len == key_len;
+      bool is_seeder = valid_len &&
+        strncmp(key + prefix_len + 44, ":sd:", 4) == 0;
+
+      if (valid_len && REDIS_REPLY_STRING == value->type &&
+          value->len == sizeof(bt_peer_t) &&
+          bt_hexarray_to_bytearray(key + prefix_len + 4, 40, info_hash) &&
+          (is_seeder || strncmp(key + prefix_len + 44, ":lc:", 4) == 0)) {
+
+        bt_peer_t peer;
+        memcpy(&peer, value->str, sizeof(bt_peer_t));
+
+        char compact_value[BT_COMPACT_PEER_LEN + BT_COMPACT_PEER_STATS_LEN];
+        size_t value_len = bt_write_compact_peer(&config, &peer, compact_value);
+
+        /* Peers without a TTL get a full one. */
+        long long ttl = pttl->integer > 0
+          ? pttl->integer : config.announce_peer_ttl * 1000LL;
+
+        redisAppendCommand(redis, "SET %s:%s:%b:%s:%b %b PX %lld",
+                           config.redis_key_prefix, names->peer,
+                           info_hash, (size_t) 20,
+                           is_seeder ? names->seeder : names->leecher,
+                           key + prefix_len + 48, (size_t) 20,
+                           compact_value, value_len, ttl);
+        redisAppendCommand(redis, "DEL %b", key, keys->element[i]->len);
+
+        pending += 2;
+        migrated++;
+      } else if (REDIS_REPLY_STRING == value->type) {
+        syslog(LOG_WARNING, "Skipping malformed peer key");
+      }
+
+      freeReplyObject(value);
+      freeReplyObject(pttl);
+    }
+
+    freeReplyObject(scan);
+
+    if (bt_migrate_drain(redis, pending) > 0) {
+      syslog(LOG_ERR, "Cannot store some of the migrated peers");
+    }
+  } while (strcmp(cursor, "0") != 0);
+
+  g_free(pattern);
+  return migrated;
+}
+
+/* Converts all download counters. Returns the number of migrated torrents. */
+int
+bt_migrate_torrents(redisContext *redis, const char *src_prefix)
+{
+  const bt_key_names_t *names = bt_key_names(&config);
+  size_t prefix_len = strlen(src_prefix);
+  char cursor[32] = "0";
+  int migrated = 0;
+
+  /* <prefix>:ih:<40 hex chars> */
+  size_t key_len = prefix_len + 4 + 40;
+
+  char *pattern = g_strdup_printf("%s:ih:*", src_prefix);
+
+  do {
+    redisReply *scan = bt_migrate_scan(redis, pattern, cursor);
+    redisReply *keys = scan->element[1];
+
+    for (int i = 0; i < keys->elements; i++) {
+      redisAppendCommand(redis, "HGET %b downs",
+                         keys->element[i]->str, keys->element[i]->len);
+    }
+
+    int pending = 0;
+
+    for (int i = 0; i < keys->elements; i++) {
+      redisReply *downs;
+      const char *key = keys->element[i]->str;
+      int8_t info_hash[20];
+
+      if (redisGetReply(redis, (void **) &downs) != REDIS_OK) {
+        syslog(LOG_ERR, "Connection with Redis lost");
+        exit(BT_EXIT_REDIS);
+      }
+
+      /* Whitelist and blacklist sets have shorter keys. */
+      if (keys->element[i]->len == key_len &&
+          REDIS_REPLY_STRING == downs->type &&
+          bt_hexarray_to_bytearray(key + prefix_len + 4, 40, info_hash)) {
+
+        /* Adds up to any counter already written by the compact schema. */
+        redisAppendCommand(redis, "HINCRBY %s:%s:%b downs %s",
+                           config.redis_key_prefix, names->torrent,
+                           info_hash, (size_t) 20, downs->str);
+        redisAppendCommand(redis, "DEL %b", key, keys->element[i]->len);
+
+        pending += 2;
+        migrated++;
+      }
+
+      freeReplyObject(downs);
+    }
+
+    freeReplyObject(scan);
+
+    if (bt_migrate_drain(redis, pending) > 0) {
+      syslog(LOG_ERR, "Cannot store some of the migrated torrents");
+    }
+  } while (strcmp(cursor, "0") != 0);
+
+  g_free(pattern);
+  return migrated;
+}
+
+/* Converts the whitelist (`wl`) or the blacklist (`bl`). */
+int
+bt_migrate_restriction_set(redisContext *redis, const char *src_prefix,
+                           const char *set_name)
+{
+  const bt_key_names_t *names = bt_key_names(&config);
+  int migrated = 0, pending = 0;
+
+  redisReply *members = redisCommand(redis, "SMEMBERS %s:ih:%s",
+                                     src_prefix, set_name);
+
+  if (NULL == members || REDIS_REPLY_ARRAY != members->type) {
+    syslog(LOG_ERR, "Cannot read the %s set", set_name);
+    exit(BT_EXIT_REDIS);
+  }
+
+  for (int i = 0; i < members->elements; i++) {
+    int8_t info_hash[20];
+
+    if (members->element[i]->len != 40 ||
+        !bt_hexarray_to_bytearray(members->element[i]->str, 40, info_hash)) {
+      syslog(LOG_WARNING, "Skipping malformed info hash in %s set", set_name);
+      continue;
+    }
+
+    redisAppendCommand(redis, "SADD %s:%s:%s %b", config.redis_key_prefix,
+                       names->torrent, set_name, info_hash, (size_t) 20);
+    pending++;
+    migrated++;
+  }
+
+  if (members->elements > 0) {
+    redisAppendCommand(redis, "DEL %s:ih:%s", src_prefix, set_name);
+    pending++;
+  }
+
+  freeReplyObject(members);
+
+  if (bt_migrate_drain(redis, pending) > 0) {
+    syslog(LOG_ERR, "Cannot store some of the migrated %s members", set_name);
+  }
+
+  return migrated;
+}
+
+int
+main(int argc, char *argv[])
+{
+  openlog(PACKAGE "-migrate", LOG_PID | LOG_PERROR | LOG_CONS, LOG_LOCAL0);
+
+  if (argc != 2 && argc != 3) {
+    syslog(LOG_ERR, "Usage: %s-migrate <config_file> [legacy_key_prefix]",
+           PACKAGE_NAME);
+    exit(BT_EXIT_CONFIG_ERROR);
+  }
+
+  /* Reads the configuration file. */
+  if (!bt_load_config(argv[1], &config)) {
+    exit(BT_EXIT_CONFIG_ERROR);
+  }
+
+  if (BT_KEY_SCHEMA_COMPACT != config.redis_key_schema) {
+    syslog(LOG_ERR, "KeySchema must be set to 'compact' in %s", argv[1]);
+    exit(BT_EXIT_CONFIG_ERROR);
+  }
+
+  const char *src_prefix = argc == 3 ? argv[2] : config.redis_key_prefix;
+
+  redisContext *redis =
+    bt_redis_connect(config.redis_socket_path, config.redis_host,
+                     config.redis_port, config.redis_timeout * 1000,
+                     config.redis_db);
+
+  if (NULL == redis) {
+    exit(BT_EXIT_REDIS);
+  }
+
+  syslog(LOG_INFO, "Migrating keys from %s:* to the compact key schema",
+         src_prefix);
+
+  int peers    = bt_migrate_peers(redis, src_prefix);
+  int torrents = bt_migrate_torrents(redis, src_prefix);
+  int listed   = bt_migrate_restriction_set(redis, src_prefix, "wl") +
+                 bt_migrate_restriction_set(redis, src_prefix, "bl");
+
+  syslog(LOG_INFO, "Migrated %d peers, %d torrents and %d listed info hashes",
+         peers, torrents, listed);
+
+  redisFree(redis);
+  closelog();
+
+  return BT_EXIT_OK;
+}
@@ -64,6 +64,25 @@ bt_read_request_data(const char *buffer, bt_req_t *req)
   req->transaction_id = ntohl (*((int32_t *) (buffer + 12)));
 }
 
+bt_request_class
+bt_classify_request(const char *buffer, size_t buflen)
+{
+  bt_req_t req;
+
+  if (buflen < 16) {
+    return BT_CLASS_OTHER;
+  }
+
+  bt_read_request_data(buffer, &req);
+
+  switch (req.action) {
+  case BT_ACTION_CONNECT:  return BT_CLASS_CONNECT;
+  case BT_ACTION_ANNOUNCE: return BT_CLASS_ANNOUNCE;
+  case BT_ACTION_SCRAPE:   return BT_CLASS_SCRAPE;
+  default:                 return BT_CLASS_OTHER;
+  }
+}
+
 void
 bt_write_error_data(char *resp_buffer, bt_req_t *req, const char* msg)
 {
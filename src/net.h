@@ -42,10 +42,19 @@
 /* 64-bit integer that identifies the UDP-based tracker protocol. */
 #define BT_PROTOCOL_ID (0x41727101980LL)
 
+/* Smallest valid request of each action, as per BEP 15. */
+#define BT_MIN_REQUEST_LEN  (16)
+#define BT_MIN_ANNOUNCE_LEN (98)
+#define BT_MIN_SCRAPE_LEN   (36)
+
 /* Fills request struct with buffer data. */
 void
 bt_read_request_data(const char *buffer, bt_req_t *req);
 
+/* Returns the class of a raw request, based on its action. */
+bt_request_class
+bt_classify_request(const char *buffer, size_t buflen);
+
 /* Writes the error response data to an output buffer. */
 void
 bt_write_error_data(char *resp_buffer, bt_req_t *req, const char* msg);
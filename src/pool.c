@@ -35,11 +35,55 @@ bt_free_redis(void *redis)
   redisFree((redisContext *) redis);
 }
 
+/* Redis connection of the current thread. */
+static GPrivate redis_key = G_PRIVATE_INIT(bt_free_redis);
+
+/* Reports the Redis round trips of the current thread to the breaker. */
 void
-bt_request_processor(void *job_params, void *pool_params)
+bt_record_redis_trips(const bt_config_t *config)
 {
-  static GPrivate redis_key = G_PRIVATE_INIT(bt_free_redis);
+  bt_redis_trips_t trips;
+  bt_redis_take_trips(&trips);
 
+  if (bt_breaker_enabled(config)) {
+    bt_breaker_record_trips(&trips);
+  }
+}
+
+void
+bt_request_processor_idle(void *pool_params)
+{
+  bt_config_t *config = (bt_config_t *) pool_params;
+  bt_worker_t *worker = bt_current_worker();
+  redisContext *redis = g_private_get(&redis_key);
+
+  /* Refreshes wait for the breaker to close, like the buffered writes. */
+  if (NULL != worker && NULL != worker->refresh && NULL != redis &&
+      !(bt_breaker_enabled(config) && bt_breaker_open())) {
+    bt_refresh_flush(worker->refresh, redis, config);
+  }
+
+  bt_record_redis_trips(config);
+  bt_trace_flush();
+}
+
+/* Keeps the response sent for a job, or forgets the job if NULL. */
+void
+bt_remember_response(const bt_job_params_t *params, const char *data,
+                     size_t length)
+{
+  bt_worker_t *worker = bt_current_worker();
+
+  if (NULL != worker && NULL != worker->group->responses) {
+    bt_respcache_store(worker->group->responses, params->buff,
+                       params->buflen, &params->from_addr,
+                       g_get_monotonic_time(), data, length);
+  }
+}
+
+void
+bt_request_processor(void *job_params, void *pool_params)
+{
   /* Data to be sent to the client. */
   bt_response_buffer_t *resp_buffer = NULL;
 
@@ -53,15 +97,42 @@ bt_request_processor(void *job_params, void *pool_params)
   bt_job_params_t *params = (bt_job_params_t *) job_params;
   bt_config_t *config = (bt_config_t *) pool_params;
 
+  /* Skips requests the client has most likely retransmitted by now. */
+  int64_t waited = g_get_monotonic_time() - params->received_at;
+
+  if (config->thread_queue_deadline > 0 &&
+      waited > config->thread_queue_deadline * 1000LL) {
+    syslog(LOG_DEBUG, "Dropping request queued for %" PRId64 "ms",
+           waited / 1000);
+    bt_stats_inc(BT_STAT_EXPIRED);
+    BT_PROBE2(drop, params, BT_STAT_EXPIRED);
+
+    /* A retransmit still in time gets handled. */
+    bt_remember_response(params, NULL, 0);
+
+    free(params->buff);
+    free(params);
+    return;
+  }
+
+  BT_PROBE3(dequeue, params, params->class, waited);
+  bt_trace_begin(config, params->received_at, params->enqueued_at);
+
   /* Fills object with data in buffer. */
   bt_read_request_data(params->buff, &request);
 
   int redis_timeout = config->redis_timeout * 1000;
   redisContext *redis = g_private_get(&redis_key);
+  bool breaker = bt_breaker_enabled(config);
+
+  /* While the breaker is open, requests are answered without Redis. */
+  bool stale = breaker && bt_breaker_open();
 
-  /* Connects to the Redis instance where the data should be stored. */
-  if (!redis) {
+  if (stale) {
+    redis = NULL;
+  } else if (!redis) {
   redis_connect:
+    /* Connects to the Redis instance where the data should be stored. */
     redis = bt_redis_connect(config->redis_socket_path, config->redis_host,
                              config->redis_port, redis_timeout,
                              config->redis_db);
@@ -70,30 +141,55 @@ bt_request_processor(void *job_params, void *pool_params)
     if (!redis) {
       error = "Tracker temporarily unavailable: data storage is not working";
       request.action = BT_ACTION_ERROR;
+
+      if (breaker) {
+        bt_breaker_record(false, 0);
+      }
     }
 
     /* Stores the new redis context in thread local storage. */
     g_private_replace(&redis_key, redis);
   } else {
-    if (!bt_redis_ping(redis)) {
+    int64_t ping_start = g_get_monotonic_time();
+    bool ping_ok = bt_redis_ping(redis);
+    int64_t ping_time = g_get_monotonic_time() - ping_start;
+
+    if (!ping_ok) {
       goto redis_connect;
     }
+
+    /* The ping doubles as a probe of the Redis round trip time. */
+    bt_stats_average(BT_STAT_REDIS_LATENCY, ping_time);
   }
 
+  /* Announces and scrapes carry their (first) info hash at offset 16. */
+  const char *info_hash = params->buflen >= 36 &&
+    (BT_ACTION_ANNOUNCE == request.action ||
+     BT_ACTION_SCRAPE == request.action) ? params->buff + 16 : NULL;
+
+  BT_PROBE3(handler__entry, params, request.action, info_hash);
+
   /* Dispatches the request to the appropriate handler function. */
   switch (request.action) {
   case BT_ACTION_CONNECT:
-    resp_buffer = bt_handle_connection(&request, config, params->buflen, redis);
+    resp_buffer = stale
+      ? bt_handle_stale_connection(&request, config, params->buflen)
+      : bt_handle_connection(&request, config, params->buflen, redis);
     break;
 
   case BT_ACTION_ANNOUNCE:
-    resp_buffer = bt_handle_announce(&request, config, params->buff,
-      params->buflen, params->from_addr, redis);
+    resp_buffer = stale
+      ? bt_handle_stale_announce(&request, config, params->buff,
+                                 params->buflen, &params->from_addr)
+      : bt_handle_announce(&request, config, params->buff,
+                           params->buflen, &params->from_addr, redis);
     break;
 
   case BT_ACTION_SCRAPE:
-    resp_buffer = bt_handle_scrape(&request, config, params->buff,
-      params->buflen, redis);
+    resp_buffer = stale
+      ? bt_handle_stale_scrape(&request, config, params->buff, params->buflen)
+      : bt_handle_scrape(&request, config, params->buff, params->buflen,
+                         redis);
     break;
 
   case BT_ACTION_ERROR:
@@ -101,29 +197,48 @@ bt_request_processor(void *job_params, void *pool_params)
     break;
   }
 
+  BT_PROBE3(handler__exit, params, request.action, info_hash);
+  bt_trace_mark(BT_TRACE_SERIALIZE);
+
   if (resp_buffer != NULL) {
     syslog(LOG_DEBUG, "Sending response back to the client");
     if (sendto(params->sock, resp_buffer->data, resp_buffer->length, 0,
-               (struct sockaddr *) params->from_addr, params->from_addr_len) == -1) {
+               (struct sockaddr *) &params->from_addr,
+               params->from_addr_len) == -1) {
       syslog(LOG_ERR, "Error in sendto()");
     }
 
+    BT_PROBE2(send, params, resp_buffer->length);
+    bt_trace_mark(BT_TRACE_SEND);
+
+    /* Errors due to the tracker itself might be gone on a retransmit. */
+    if (BT_ACTION_ERROR != request.action) {
+      bt_remember_response(params, resp_buffer->data, resp_buffer->length);
+    } else {
+      bt_remember_response(params, NULL, 0);
+    }
+
     /* Destroys response data. */
     free(resp_buffer->data);
     free(resp_buffer);
+  } else {
+    bt_remember_response(params, NULL, 0);
+  }
+
+  /* Busy workers never idle, so deferred writes are bounded here too. */
+  bt_worker_t *worker = bt_current_worker();
+
+  if (NULL != worker && NULL != worker->refresh && NULL != redis) {
+    bt_refresh_flush_expired(worker->refresh, redis, config);
   }
 
+  /* The breaker watches the round trips of handlers, the ping included. */
+  bt_record_redis_trips(config);
+
+  bt_stats_inc(BT_STAT_PROCESSED);
+  bt_trace_end(config, request.action);
+
   /* Frees the cloned input buffer. */
   free(params->buff);
   free(params);
 }
-
-GThreadPool *
-bt_new_request_processor_pool(bt_config_t *config)
-{
-  syslog(LOG_DEBUG, "Creating thread pool with %d workers", config->thread_max);
-
-  g_thread_pool_set_max_idle_time(config->thread_max_idle_time * 1000);
-  return g_thread_pool_new(bt_request_processor, config,
-                           config->thread_max, true, NULL);
-}
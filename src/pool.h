@@ -36,12 +36,25 @@ typedef struct {
   char *buff;
   size_t buflen;
   int sock;
-  struct sockaddr_in *from_addr;
+  struct sockaddr_in from_addr;
   size_t from_addr_len;
+  int64_t received_at; // Monotonic time, in microseconds
+  int64_t enqueued_at; // Monotonic time it was pushed to a worker
+  bt_request_class class;
 } bt_job_params_t;
 
-/* Creates a new thread pool to answer the incoming requests. */
-GThreadPool *
-bt_new_request_processor_pool(bt_config_t *config);
+/*
+ * Answers a request. The argument `job_params` is a `bt_job_params_t` object,
+ * freed by this function, and `pool_params` is the `bt_config_t` object.
+ */
+void
+bt_request_processor(void *job_params, void *pool_params);
+
+/*
+ * Called by worker threads when they run out of requests, to send any work
+ * that was deferred. The argument `pool_params` is the `bt_config_t`.
+ */
+void
+bt_request_processor_idle(void *pool_params);
 
 #endif // BTTRACKER_POOL_H_
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BTTRACKER_PROBES_H_
+#define BTTRACKER_PROBES_H_
+
+/*
+ * USDT probes of the `bttracker` provider, for perf and bpftrace. They are
+ * only compiled in with `./configure --enable-usdt`, and each one is then a
+ * single no-op instruction until a tracer attaches to it. Scripts using
+ * them live in the bpftrace directory.
+ */
+#ifdef BT_ENABLE_USDT
+#define BT_PROBE1(name, a)       DTRACE_PROBE1(bttracker, name, a)
+#define BT_PROBE2(name, a, b)    DTRACE_PROBE2(bttracker, name, a, b)
+#define BT_PROBE3(name, a, b, c) DTRACE_PROBE3(bttracker, name, a, b, c)
+#else
+#define BT_PROBE1(name, a)       do { (void) (a); } while (0)
+#define BT_PROBE2(name, a, b)    do { (void) (a); (void) (b); } while (0)
+#define BT_PROBE3(name, a, b, c) \
+  do { (void) (a); (void) (b); (void) (c); } while (0)
+#endif
+
+#endif // BTTRACKER_PROBES_H_
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+bt_ratelimit_t *
+bt_new_ratelimit(const bt_config_t *config)
+{
+  if (config->ratelimit_connect_rate <= 0 &&
+      config->ratelimit_announce_rate <= 0 &&
+      config->ratelimit_scrape_rate <= 0) {
+    return NULL;
+  }
+
+  bt_ratelimit_t *limiter = (bt_ratelimit_t *) malloc(sizeof(bt_ratelimit_t));
+
+  if (NULL == limiter) {
+    syslog(LOG_ERR, "Cannot allocate memory for rate limiter");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  limiter->rate[BT_CLASS_CONNECT]   = config->ratelimit_connect_rate;
+  limiter->rate[BT_CLASS_ANNOUNCE]  = config->ratelimit_announce_rate;
+  limiter->rate[BT_CLASS_SCRAPE]    = config->ratelimit_scrape_rate;
+  limiter->burst[BT_CLASS_CONNECT]  = MAX(1, config->ratelimit_connect_burst);
+  limiter->burst[BT_CLASS_ANNOUNCE] = MAX(1, config->ratelimit_announce_burst);
+  limiter->burst[BT_CLASS_SCRAPE]   = MAX(1, config->ratelimit_scrape_burst);
+
+  /* Malformed packets are rejected later on by the request validation. */
+  limiter->rate[BT_CLASS_OTHER]     = 0;
+  limiter->burst[BT_CLASS_OTHER]    = 1;
+
+  /* Table size is a hard bound on the number of tracked addresses. */
+  uint32_t table_size = MAX(config->ratelimit_table_size,
+                            BT_RATELIMIT_SHARDS * BT_RATELIMIT_WAYS);
+  limiter->sets = table_size / (BT_RATELIMIT_SHARDS * BT_RATELIMIT_WAYS);
+
+  for (int i = 0; i < BT_RATELIMIT_SHARDS; i++) {
+    bt_ratelimit_shard_t *shard = &limiter->shards[i];
+
+    g_mutex_init(&shard->lock);
+    shard->buckets = (bt_bucket_t *)
+      calloc(limiter->sets * BT_RATELIMIT_WAYS, sizeof(bt_bucket_t));
+
+    if (NULL == shard->buckets) {
+      syslog(LOG_ERR, "Cannot allocate memory for rate limiter buckets");
+      exit(BT_EXIT_MALLOC_ERROR);
+    }
+  }
+
+  syslog(LOG_DEBUG, "Rate limiting up to %d source addresses",
+         limiter->sets * BT_RATELIMIT_SHARDS * BT_RATELIMIT_WAYS);
+
+  return limiter;
+}
+
+void
+bt_free_ratelimit(bt_ratelimit_t *limiter)
+{
+  if (NULL == limiter) {
+    return;
+  }
+
+  for (int i = 0; i < BT_RATELIMIT_SHARDS; i++) {
+    g_mutex_clear(&limiter->shards[i].lock);
+    free(limiter->shards[i].buckets);
+  }
+
+  free(limiter);
+}
+
+/* Returns the bucket of an address, evicting the least recently seen one. */
+bt_bucket_t *
+bt_ratelimit_bucket(bt_ratelimit_t *limiter, bt_bucket_t *set,
+                    uint32_t ipv4_addr, int64_t now)
+{
+  bt_bucket_t *victim = &set[0];
+
+  for (int i = 0; i < BT_RATELIMIT_WAYS; i++) {
+    if (set[i].last_seen != 0 && set[i].ipv4_addr == ipv4_addr) {
+      return &set[i];
+    }
+
+    if (set[i].last_seen < victim->last_seen) {
+      victim = &set[i];
+    }
+  }
+
+  /* New addresses start with full buckets. */
+  victim->ipv4_addr = ipv4_addr;
+  victim->last_seen = now;
+
+  for (int i = 0; i < BT_CLASS_COUNT; i++) {
+    victim->tokens[i] = limiter->burst[i];
+  }
+
+  return victim;
+}
+
+bool
+bt_ratelimit_allow(bt_ratelimit_t *limiter, uint32_t ipv4_addr,
+                   bt_request_class type, int64_t now)
+{
+  if (limiter->rate[type] <= 0) {
+    return true;
+  }
+
+  /* Fibonacci hashing: the high bits of the product are the well mixed ones. */
+  uint64_t hash = ipv4_addr * 0x9E3779B97F4A7C15ULL;
+  uint32_t shard_index = hash >> (64 - BT_RATELIMIT_SHARD_BITS);
+  bt_ratelimit_shard_t *shard = &limiter->shards[shard_index];
+  uint32_t set_index = (hash >> 28) % limiter->sets;
+
+  g_mutex_lock(&shard->lock);
+
+  bt_bucket_t *bucket =
+    bt_ratelimit_bucket(limiter, &shard->buckets[set_index * BT_RATELIMIT_WAYS],
+                        ipv4_addr, now);
+
+  /* Refills all buckets of this address with the elapsed time. */
+  float elapsed = (now - bucket->last_seen) / (float) G_USEC_PER_SEC;
+
+  if (elapsed > 0) {
+    for (int i = 0; i < BT_CLASS_COUNT; i++) {
+      bucket->tokens[i] = MIN(limiter->burst[i],
+                              bucket->tokens[i] + elapsed * limiter->rate[i]);
+    }
+    bucket->last_seen = now;
+  }
+
+  bool allowed = bucket->tokens[type] >= 1;
+
+  if (allowed) {
+    bucket->tokens[type] -= 1;
+  }
+
+  g_mutex_unlock(&shard->lock);
+
+  return allowed;
+}
+
+bool
+bt_ratelimit_accept(bt_ratelimit_t *limiter, const char *buff, size_t buflen,
+                    const struct sockaddr_in *from_addr)
+{
+  bt_request_class type = bt_classify_request(buff, buflen);
+
+  if (bt_ratelimit_allow(limiter, from_addr->sin_addr.s_addr, type,
+                         g_get_monotonic_time())) {
+    return true;
+  }
+
+  syslog(LOG_DEBUG, "Source address over its request budget");
+  return false;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BTTRACKER_RATELIMIT_H_
+#define BTTRACKER_RATELIMIT_H_
+
+/* Number of shards of the table of token buckets. */
+#define BT_RATELIMIT_SHARD_BITS (4)
+#define BT_RATELIMIT_SHARDS (1 << BT_RATELIMIT_SHARD_BITS)
+
+/* Number of source addresses that compete for the same slot of a shard. */
+#define BT_RATELIMIT_WAYS (4)
+
+/* Token buckets of a single source address. */
+typedef struct {
+  uint32_t ipv4_addr;                 // Source address, in network byte order
+  int64_t last_seen;                  // Last refill, in microseconds
+  float tokens[BT_CLASS_COUNT];       // Available tokens for each class
+} bt_bucket_t;
+
+/* Slice of the table of token buckets protected by its own lock. */
+typedef struct {
+  GMutex lock;
+  bt_bucket_t *buckets;
+} bt_ratelimit_shard_t;
+
+/* Bounded table of per-address token buckets. */
+typedef struct {
+  float rate[BT_CLASS_COUNT];         // Tokens added per second (0: no limit)
+  float burst[BT_CLASS_COUNT];        // Maximum number of tokens
+  uint32_t sets;                      // Number of slots in each shard
+  bt_ratelimit_shard_t shards[BT_RATELIMIT_SHARDS];
+} bt_ratelimit_t;
+
+/* Creates the rate limiter, or returns NULL if no limit is configured. */
+bt_ratelimit_t *
+bt_new_ratelimit(const bt_config_t *config);
+
+/* Frees the rate limiter. */
+void
+bt_free_ratelimit(bt_ratelimit_t *limiter);
+
+/*
+ * Consumes a token from the bucket of the given address. Returns false if the
+ * budget for this class of requests is exhausted. `now` is a monotonic
+ * timestamp in microseconds.
+ */
+bool
+bt_ratelimit_allow(bt_ratelimit_t *limiter, uint32_t ipv4_addr,
+                   bt_request_class type, int64_t now);
+
+/* Returns whether an incoming packet is within the budget of its source. */
+bool
+bt_ratelimit_accept(bt_ratelimit_t *limiter, const char *buff, size_t buflen,
+                    const struct sockaddr_in *from_addr);
+
+#endif // BTTRACKER_RATELIMIT_H_
@@ -0,0 +1,418 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* 64-bit FNV-1a hash. */
+uint64_t
+bt_refresh_hash(uint64_t hash, const void *data, size_t len)
+{
+  const uint8_t *bytes = (const uint8_t *) data;
+
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+  }
+
+  return hash;
+}
+
+/* Returns the cache key of a peer, never 0. */
+uint64_t
+bt_refresh_key(const bt_info_hash_key_t *info_hash_key, const int8_t *peer_id)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  hash = bt_refresh_hash(hash, info_hash_key->info_hash, 20);
+  hash = bt_refresh_hash(hash, peer_id, 20);
+
+  return 0 == hash ? 1 : hash;
+}
+
+/*
+ * Hashes what would be stored for a peer: its address and whether it is a
+ * seeder, plus its counters when StorePeerStats is set.
+ */
+uint64_t
+bt_refresh_fingerprint(const bt_config_t *config, const bt_peer_t *peer,
+                       bool is_seeder)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  hash = bt_refresh_hash(hash, &peer->ipv4_addr, sizeof(peer->ipv4_addr));
+  hash = bt_refresh_hash(hash, &peer->port, sizeof(peer->port));
+  hash = bt_refresh_hash(hash, &is_seeder, sizeof(is_seeder));
+
+  if (config->redis_store_peer_stats) {
+    hash = bt_refresh_hash(hash, &peer->key, sizeof(peer->key));
+    hash = bt_refresh_hash(hash, &peer->downloaded, sizeof(peer->downloaded));
+    hash = bt_refresh_hash(hash, &peer->uploaded, sizeof(peer->uploaded));
+    hash = bt_refresh_hash(hash, &peer->left, sizeof(peer->left));
+  }
+
+  return hash;
+}
+
+bt_refresh_cache_t *
+bt_new_refresh_cache(const bt_config_t *config)
+{
+  /* Writes to shared memory are as cheap as a refresh. */
+  if (0 == config->announce_refresh_cache_size ||
+      BT_PEER_STORAGE_SHM == config->announce_peer_storage) {
+    return NULL;
+  }
+
+  bt_refresh_cache_t *cache =
+    (bt_refresh_cache_t *) malloc(sizeof(bt_refresh_cache_t));
+
+  if (NULL == cache) {
+    syslog(LOG_ERR, "Cannot allocate memory for refresh cache");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  cache->size = 1;
+  while (cache->size < config->announce_refresh_cache_size) {
+    cache->size <<= 1;
+  }
+
+  cache->batch_size = MAX(1, config->announce_refresh_batch_size);
+  cache->pending_len = 0;
+  cache->oldest_pending = 0;
+  cache->entries = (bt_refresh_entry_t *)
+    calloc(cache->size, sizeof(bt_refresh_entry_t));
+  cache->pending = (bt_refresh_pending_t *)
+    malloc(cache->batch_size * sizeof(bt_refresh_pending_t));
+  cache->downloads_len = 0;
+  cache->downloads = (bt_refresh_download_t *)
+    malloc(cache->batch_size * sizeof(bt_refresh_download_t));
+
+  if (NULL == cache->entries || NULL == cache->pending ||
+      NULL == cache->downloads) {
+    syslog(LOG_ERR, "Cannot allocate memory for refresh cache");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  return cache;
+}
+
+void
+bt_free_refresh_cache(bt_refresh_cache_t *cache)
+{
+  if (NULL != cache) {
+    free(cache->pending);
+    free(cache->downloads);
+    free(cache->entries);
+    free(cache);
+  }
+}
+
+bool
+bt_refresh_peer(bt_refresh_cache_t *cache, redisContext *redis,
+                const bt_config_t *config,
+                const bt_info_hash_key_t *info_hash_key,
+                const int8_t *peer_id, const bt_peer_t *peer, bool is_seeder)
+{
+  uint64_t key = bt_refresh_key(info_hash_key, peer_id);
+  bt_refresh_entry_t *entry = &cache->entries[key & (cache->size - 1)];
+  int64_t now = g_get_monotonic_time();
+
+  /* Unknown or changed peers, or peers that might have expired already. */
+  if (cache->pending_len == cache->batch_size || entry->key != key ||
+      entry->fingerprint != bt_refresh_fingerprint(config, peer, is_seeder) ||
+      now / G_USEC_PER_SEC - entry->touched_at >= config->announce_peer_ttl) {
+    return false;
+  }
+
+  entry->touched_at = now / G_USEC_PER_SEC;
+
+  if (0 == cache->pending_len && 0 == cache->downloads_len) {
+    cache->oldest_pending = now;
+  }
+
+  bt_refresh_pending_t *pending = &cache->pending[cache->pending_len++];
+
+  pending->info_hash_key = *info_hash_key;
+  memcpy(pending->peer_id, peer_id, 20);
+  pending->peer = *peer;
+  pending->is_seeder = is_seeder;
+  pending->rewrite = false;
+
+  if (cache->pending_len == cache->batch_size) {
+    bt_refresh_flush(cache, redis, config);
+  } else {
+    bt_refresh_flush_expired(cache, redis, config);
+  }
+
+  return true;
+}
+
+void
+bt_refresh_remember(bt_refresh_cache_t *cache, const bt_config_t *config,
+                    const bt_info_hash_key_t *info_hash_key,
+                    const int8_t *peer_id, const bt_peer_t *peer,
+                    bool is_seeder)
+{
+  uint64_t key = bt_refresh_key(info_hash_key, peer_id);
+  bt_refresh_entry_t *entry = &cache->entries[key & (cache->size - 1)];
+
+  entry->key = key;
+  entry->fingerprint = bt_refresh_fingerprint(config, peer, is_seeder);
+  entry->touched_at = g_get_monotonic_time() / G_USEC_PER_SEC;
+}
+
+void
+bt_refresh_forget(bt_refresh_cache_t *cache,
+                  const bt_info_hash_key_t *info_hash_key,
+                  const int8_t *peer_id)
+{
+  uint64_t key = bt_refresh_key(info_hash_key, peer_id);
+  bt_refresh_entry_t *entry = &cache->entries[key & (cache->size - 1)];
+
+  if (entry->key == key) {
+    entry->key = 0;
+  }
+
+  /* A refresh sent later would bring back what is about to be changed. */
+  for (size_t i = 0; i < cache->pending_len; i++) {
+    bt_refresh_pending_t *pending = &cache->pending[i];
+
+    if (memcmp(pending->peer_id, peer_id, 20) == 0 &&
+        memcmp(pending->info_hash_key.info_hash,
+               info_hash_key->info_hash, 20) == 0) {
+      *pending = cache->pending[--cache->pending_len];
+      i--;
+    }
+  }
+}
+
+void
+bt_refresh_count_download(bt_refresh_cache_t *cache, redisContext *redis,
+                          const bt_config_t *config,
+                          const bt_info_hash_key_t *info_hash_key)
+{
+  for (size_t i = 0; i < cache->downloads_len; i++) {
+    bt_refresh_download_t *download = &cache->downloads[i];
+
+    if (memcmp(download->info_hash_key.info_hash,
+               info_hash_key->info_hash, 20) == 0) {
+      download->count++;
+      bt_stats_inc(BT_STAT_MERGED_DOWNLOADS);
+      bt_refresh_flush_expired(cache, redis, config);
+      return;
+    }
+  }
+
+  /* A failed flush left no room, so this one is counted right away. */
+  if (cache->downloads_len == cache->batch_size) {
+    bt_increment_downloads(redis, config, info_hash_key);
+    return;
+  }
+
+  if (0 == cache->pending_len && 0 == cache->downloads_len) {
+    cache->oldest_pending = g_get_monotonic_time();
+  }
+
+  bt_refresh_download_t *download = &cache->downloads[cache->downloads_len++];
+
+  download->info_hash_key = *info_hash_key;
+  download->count = 1;
+
+  if (cache->downloads_len == cache->batch_size) {
+    bt_refresh_flush(cache, redis, config);
+  } else {
+    bt_refresh_flush_expired(cache, redis, config);
+  }
+}
+
+/* Appends the commands that extend the life of a stored peer. */
+int
+bt_refresh_append(redisContext *redis, const bt_config_t *config,
+                  const bt_refresh_pending_t *pending)
+{
+  const bt_key_names_t *names = bt_key_names(config);
+  const bt_info_hash_key_t *ihk = &pending->info_hash_key;
+  const char *peer_set = pending->is_seeder ? names->seeder : names->leecher;
+
+  if (BT_PEER_STORAGE_SWARM != config->announce_peer_storage) {
+    bt_redis_append_command(redis, "EXPIRE %s:%s:%b:%s:%b %d",
+                            config->redis_key_prefix, names->peer,
+                            ihk->str, ihk->len, peer_set,
+                            pending->peer_id, (size_t) 20,
+                            config->announce_peer_ttl);
+    return 1;
+  }
+
+  /* Only the score changes; the address is already on the hash. */
+  bt_redis_append_command(redis, "ZADD %s:%s:%b:%s %lld %b",
+                          config->redis_key_prefix, names->peer,
+                          ihk->str, ihk->len, peer_set, (long long) time(NULL),
+                          pending->peer_id, (size_t) 20);
+
+  bt_redis_append_command(redis, "EXPIRE %s:%s:%b:%s %d",
+                          config->redis_key_prefix, names->peer,
+                          ihk->str, ihk->len, peer_set,
+                          config->announce_peer_ttl);
+
+  bt_redis_append_command(redis, "EXPIRE %s:%s:%b:%s %d",
+                          config->redis_key_prefix, names->peer,
+                          ihk->str, ihk->len, names->addrs,
+                          config->announce_peer_ttl);
+
+  return 3 + bt_swarm_append_local(redis, config, ihk, pending->peer_id,
+                                   pending->peer.ipv4_addr, pending->is_seeder,
+                                   false);
+}
+
+/* Keeps what Redis did not acknowledge for the next flush. */
+void
+bt_refresh_requeue(bt_refresh_cache_t *cache, size_t downloads_done)
+{
+  /* Downloads already counted must not be counted twice. */
+  cache->downloads_len -= downloads_done;
+  memmove(cache->downloads, cache->downloads + downloads_done,
+          cache->downloads_len * sizeof(bt_refresh_download_t));
+
+  /*
+   * A refresh may have been applied without its reply being read, which
+   * hides whether the peer had vanished, so peers are written in full.
+   */
+  for (size_t i = 0; i < cache->pending_len; i++) {
+    cache->pending[i].rewrite = true;
+  }
+
+  cache->oldest_pending = g_get_monotonic_time();
+}
+
+void
+bt_refresh_flush(bt_refresh_cache_t *cache, redisContext *redis,
+                 const bt_config_t *config)
+{
+  size_t count = cache->pending_len;
+  size_t downloads_len = cache->downloads_len;
+  int replies[MAX(1, count)];
+  bool vanished[MAX(1, count)];
+
+  if (0 == count && 0 == downloads_len) {
+    return;
+  }
+
+  /* Each torrent gets a single increment for all its downloads. */
+  for (size_t i = 0; i < downloads_len; i++) {
+    const bt_info_hash_key_t *ihk = &cache->downloads[i].info_hash_key;
+
+    bt_redis_append_command(redis, "HINCRBY %s:%s:%b downs %lld",
+                            config->redis_key_prefix,
+                            bt_key_names(config)->torrent,
+                            ihk->str, ihk->len,
+                            (long long) cache->downloads[i].count);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    replies[i] = cache->pending[i].rewrite
+      ? 0 : bt_refresh_append(redis, config, &cache->pending[i]);
+  }
+
+  for (size_t i = 0; i < downloads_len; i++) {
+    redisReply *reply;
+
+    if (bt_redis_get_reply(redis, (void **) &reply) != REDIS_OK) {
+      syslog(LOG_ERR, "Got a NULL reply from Redis");
+      bt_refresh_requeue(cache, i);
+      return;
+    }
+
+    if (REDIS_REPLY_INTEGER != reply->type) {
+      syslog(LOG_ERR, "Cannot update download counter for torrent");
+    }
+
+    freeReplyObject(reply);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    vanished[i] = cache->pending[i].rewrite;
+
+    for (int j = 0; j < replies[i]; j++) {
+      redisReply *reply;
+
+      if (bt_redis_get_reply(redis, (void **) &reply) != REDIS_OK) {
+        syslog(LOG_ERR, "Got a NULL reply from Redis");
+        bt_refresh_requeue(cache, downloads_len);
+        return;
+      }
+
+      /*
+       * EXPIRE answers 0 for missing keys, and ZADD answers 1 for members
+       * it had to add: both mean the stored peer is gone.
+       */
+      if (0 == j && REDIS_REPLY_INTEGER == reply->type) {
+        vanished[i] = BT_PEER_STORAGE_SWARM == config->announce_peer_storage
+          ? 1 == reply->integer : 0 == reply->integer;
+      }
+
+      freeReplyObject(reply);
+    }
+  }
+
+  /* Only the peers that vanished are left to write. */
+  cache->downloads_len = 0;
+  cache->pending_len = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    if (vanished[i]) {
+      cache->pending[cache->pending_len++] = cache->pending[i];
+    }
+  }
+
+  /* Peers are written again once no reply of the pipeline is pending. */
+  for (size_t i = 0; i < cache->pending_len; i++) {
+    bt_refresh_pending_t *pending = &cache->pending[i];
+
+    bt_insert_peer(redis, config, &pending->info_hash_key, pending->peer_id,
+                   &pending->peer, pending->is_seeder);
+
+    if (redis->err) {
+      cache->pending_len -= i;
+      memmove(cache->pending, cache->pending + i,
+              cache->pending_len * sizeof(bt_refresh_pending_t));
+      bt_refresh_requeue(cache, 0);
+      return;
+    }
+  }
+
+  cache->pending_len = 0;
+  bt_stats_add(BT_STAT_PEER_REFRESHES, count);
+}
+
+void
+bt_refresh_flush_expired(bt_refresh_cache_t *cache, redisContext *redis,
+                         const bt_config_t *config)
+{
+  if (cache->pending_len + cache->downloads_len > 0 && g_get_monotonic_time() -
+      cache->oldest_pending >= config->announce_refresh_delay * 1000LL) {
+    bt_refresh_flush(cache, redis, config);
+  }
+}
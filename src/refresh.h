@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BTTRACKER_REFRESH_H_
+#define BTTRACKER_REFRESH_H_
+
+/*
+ * Most announces are periodic refreshes from peers whose data did not
+ * change. Each worker remembers the peers it wrote recently, so those
+ * announces only extend the life of what is already stored, in batches,
+ * instead of rewriting it. Completions are counted the same way, merged per
+ * torrent. Workers own the announces of their torrents, so the cache needs
+ * no locking.
+ */
+
+/* Peer written or refreshed recently. */
+typedef struct {
+  uint64_t key;          // Hash of the info hash and peer ID, 0 if empty
+  uint64_t fingerprint;  // Hash of the stored data
+  int64_t touched_at;    // Monotonic time of the last write, in seconds
+} bt_refresh_entry_t;
+
+/* Refresh waiting to be sent to Redis. */
+typedef struct {
+  bt_info_hash_key_t info_hash_key;
+  int8_t peer_id[20];
+  bt_peer_t peer;
+  bool is_seeder;
+  bool rewrite;          // A flush failed midway, so the peer is written in full
+} bt_refresh_pending_t;
+
+/* Downloads of a torrent waiting to be counted. */
+typedef struct {
+  bt_info_hash_key_t info_hash_key;
+  int64_t count;
+} bt_refresh_download_t;
+
+/* Cache of recent writes plus pending refreshes and downloads. */
+typedef struct {
+  bt_refresh_entry_t *entries;
+  size_t size;                   // Power of two
+  bt_refresh_pending_t *pending;
+  size_t pending_len;
+  bt_refresh_download_t *downloads;
+  size_t downloads_len;
+  size_t batch_size;
+  int64_t oldest_pending;        // Monotonic time, in microseconds
+} bt_refresh_cache_t;
+
+/* Creates a cache, or returns NULL if disabled in the configuration. */
+bt_refresh_cache_t *
+bt_new_refresh_cache(const bt_config_t *config);
+
+/* Frees a cache. Pending refreshes are dropped. */
+void
+bt_free_refresh_cache(bt_refresh_cache_t *cache);
+
+/*
+ * Queues a refresh for a peer whose stored data is known to be up to date.
+ * Returns false if the peer must be written in full instead.
+ */
+bool
+bt_refresh_peer(bt_refresh_cache_t *cache, redisContext *redis,
+                const bt_config_t *config,
+                const bt_info_hash_key_t *info_hash_key,
+                const int8_t *peer_id, const bt_peer_t *peer, bool is_seeder);
+
+/* Records that a peer was just written in full. */
+void
+bt_refresh_remember(bt_refresh_cache_t *cache, const bt_config_t *config,
+                    const bt_info_hash_key_t *info_hash_key,
+                    const int8_t *peer_id, const bt_peer_t *peer,
+                    bool is_seeder);
+
+/*
+ * Forgets a peer whose stored data is about to change, dropping any refresh
+ * of it still waiting to be sent.
+ */
+void
+bt_refresh_forget(bt_refresh_cache_t *cache,
+                  const bt_info_hash_key_t *info_hash_key,
+                  const int8_t *peer_id);
+
+/* Queues a download of a torrent, merged with those already queued. */
+void
+bt_refresh_count_download(bt_refresh_cache_t *cache, redisContext *redis,
+                          const bt_config_t *config,
+                          const bt_info_hash_key_t *info_hash_key);
+
+/*
+ * Sends the pending refreshes and downloads in one pipeline. Peers that
+ * vanished from Redis in the meantime are written in full again. If Redis
+ * stops answering, whatever it did not acknowledge stays queued for the next
+ * flush.
+ */
+void
+bt_refresh_flush(bt_refresh_cache_t *cache, redisContext *redis,
+                 const bt_config_t *config);
+
+/* Sends the pending work if the oldest of it waited long enough. */
+void
+bt_refresh_flush_expired(bt_refresh_cache_t *cache, redisContext *redis,
+                         const bt_config_t *config);
+
+#endif // BTTRACKER_REFRESH_H_
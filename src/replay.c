@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Replays a capture file against a tracker, at the captured pace, N times
+ * faster or as fast as possible. Each captured source address is mapped to
+ * one of a fixed number of loopback addresses (127.0.0.1 and up), so the
+ * tracker still sees distinct clients. Connection IDs handed out by the
+ * tracker replace the captured ones, so announces and scrapes still pass
+ * validation.
+ */
+
+/* Number of loopback addresses used when none is given. */
+#define BT_REPLAY_DEFAULT_SOURCES (256)
+
+/* Loopback endpoint standing in for some of the captured clients. */
+typedef struct {
+  int sock;               // -1 until first used
+  char connection_id[8];  // Last one handed out by the tracker
+  bool connected;
+} bt_replay_source_t;
+
+/* Replay state. */
+typedef struct {
+  bt_replay_source_t *sources;
+  uint32_t source_count;
+  struct sockaddr_in tracker;
+  uint64_t sent;
+  uint64_t answered;
+  uint64_t errors;
+} bt_replay_t;
+
+/* Returns the endpoint a captured address is mapped to. */
+bt_replay_source_t *
+bt_replay_source(bt_replay_t *replay, uint32_t ipv4_addr)
+{
+  /* Same multiplicative hash for every run, so replays are repeatable. */
+  uint32_t hash = ntohl(ipv4_addr) * 2654435761U;
+  uint32_t index = ((uint64_t) hash * replay->source_count) >> 32;
+  bt_replay_source_t *source = &replay->sources[index];
+
+  if (-1 == source->sock) {
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK + index);
+
+    source->sock = socket(AF_INET, SOCK_DGRAM, 0);
+
+    if (-1 == source->sock ||
+        fcntl(source->sock, F_SETFL, O_NONBLOCK) == -1 ||
+        bind(source->sock, (struct sockaddr *) &local, sizeof(local)) == -1) {
+      syslog(LOG_ERR, "Cannot bind a socket to 127.0.0.1 + %" PRIu32, index);
+      exit(BT_EXIT_NETWORK_ERROR);
+    }
+  }
+
+  return source;
+}
+
+/* Reads the responses waiting on an endpoint. */
+void
+bt_replay_drain(bt_replay_t *replay, bt_replay_source_t *source)
+{
+  char buff[BT_RECV_BUFLEN];
+  ssize_t len;
+
+  while ((len = recv(source->sock, buff, sizeof(buff), 0)) >= 8) {
+    uint32_t action;
+    memcpy(&action, buff, sizeof(action));
+    action = ntohl(action);
+
+    /* Later requests of the clients behind it use the new ID. */
+    if (BT_ACTION_CONNECT == action && len >= 16) {
+      memcpy(source->connection_id, buff + 8, 8);
+      source->connected = true;
+    } else if (BT_ACTION_ERROR == action) {
+      replay->errors++;
+    }
+
+    replay->answered++;
+  }
+}
+
+/* Sends a captured datagram on behalf of its client. */
+void
+bt_replay_datagram(bt_replay_t *replay, const bt_capture_record_t *record,
+                   char *buff)
+{
+  bt_replay_source_t *source = bt_replay_source(replay, record->ipv4_addr);
+
+  /* Requests other than connect start with a connection ID. */
+  if (record->length >= 16 && source->connected) {
+    uint32_t action;
+    memcpy(&action, buff + 8, sizeof(action));
+
+    if (BT_ACTION_CONNECT != ntohl(action)) {
+      memcpy(buff, source->connection_id, 8);
+    }
+  }
+
+  if (sendto(source->sock, buff, record->length, 0,
+             (struct sockaddr *) &replay->tracker,
+             sizeof(replay->tracker)) == -1) {
+    syslog(LOG_WARNING, "Cannot send datagram to the tracker");
+  } else {
+    replay->sent++;
+  }
+
+  bt_replay_drain(replay, source);
+}
+
+int
+main(int argc, char *argv[])
+{
+  openlog(PACKAGE "-replay", LOG_PID | LOG_PERROR | LOG_CONS, LOG_LOCAL0);
+
+  if (argc < 4 || argc > 6) {
+    syslog(LOG_ERR, "Usage: %s-replay <capture_file> <host> <port> "
+           "[speed (0 for unpaced)] [sources]", PACKAGE_NAME);
+    exit(BT_EXIT_CONFIG_ERROR);
+  }
+
+  double speed = argc > 4 ? strtod(argv[4], NULL) : 1;
+
+  bt_replay_t replay;
+  memset(&replay, 0, sizeof(replay));
+  replay.source_count = argc > 5 ? strtoul(argv[5], NULL, 10)
+    : BT_REPLAY_DEFAULT_SOURCES;
+
+  if (speed < 0 || replay.source_count < 1 || replay.source_count > 0xFFFFFE) {
+    syslog(LOG_ERR, "Invalid speed or number of sources");
+    exit(BT_EXIT_CONFIG_ERROR);
+  }
+
+  struct addrinfo hints, *tracker_addr;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+
+  if (getaddrinfo(argv[2], argv[3], &hints, &tracker_addr) != 0) {
+    syslog(LOG_ERR, "Cannot resolve %s:%s", argv[2], argv[3]);
+    exit(BT_EXIT_NETWORK_ERROR);
+  }
+
+  memcpy(&replay.tracker, tracker_addr->ai_addr, sizeof(replay.tracker));
+  freeaddrinfo(tracker_addr);
+
+  FILE *file = fopen(argv[1], "rb");
+  bt_capture_header_t header;
+
+  if (NULL == file || fread(&header, sizeof(header), 1, file) != 1 ||
+      memcmp(header.magic, BT_CAPTURE_MAGIC, 8) != 0 ||
+      header.version != BT_CAPTURE_VERSION ||
+      header.byte_order != BT_SNAPSHOT_BYTE_ORDER) {
+    syslog(LOG_ERR, "%s is not a compatible capture file", argv[1]);
+    exit(BT_EXIT_CONFIG_ERROR);
+  }
+
+  replay.sources = (bt_replay_source_t *)
+    calloc(replay.source_count, sizeof(bt_replay_source_t));
+
+  if (NULL == replay.sources) {
+    syslog(LOG_ERR, "Cannot allocate memory for sources");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  for (uint32_t i = 0; i < replay.source_count; i++) {
+    replay.sources[i].sock = -1;
+  }
+
+  bt_capture_record_t record;
+  char buff[BT_RECV_BUFLEN];
+  int64_t started_at = g_get_monotonic_time();
+
+  while (fread(&record, sizeof(record), 1, file) == 1) {
+    if (record.length > sizeof(buff) ||
+        fread(buff, 1, record.length, file) != record.length) {
+      syslog(LOG_ERR, "Truncated capture file");
+      break;
+    }
+
+    /* Waits until the datagram is due at the requested pace. */
+    if (speed > 0) {
+      int64_t due = started_at + (int64_t) (record.offset / speed);
+      int64_t now = g_get_monotonic_time();
+
+      if (due > now) {
+        usleep(due - now);
+      }
+    }
+
+    bt_replay_datagram(&replay, &record, buff);
+  }
+
+  fclose(file);
+
+  double elapsed = (g_get_monotonic_time() - started_at) / 1e6;
+
+  /* Gives the tracker a second to answer the last requests. */
+  for (int round = 0; round < 10; round++) {
+    usleep(100000);
+
+    for (uint32_t i = 0; i < replay.source_count; i++) {
+      if (-1 != replay.sources[i].sock) {
+        bt_replay_drain(&replay, &replay.sources[i]);
+      }
+    }
+  }
+
+  syslog(LOG_INFO, "Replayed %" PRIu64 " datagrams in %.2fs (%.0f/s): %"
+         PRIu64 " answered, %" PRIu64 " errors", replay.sent, elapsed,
+         elapsed > 0 ? replay.sent / elapsed : 0.0, replay.answered,
+         replay.errors);
+
+  for (uint32_t i = 0; i < replay.source_count; i++) {
+    if (-1 != replay.sources[i].sock) {
+      close(replay.sources[i].sock);
+    }
+  }
+
+  free(replay.sources);
+
+  return BT_EXIT_OK;
+}
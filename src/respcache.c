@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+bt_respcache_t *
+bt_new_respcache(const bt_config_t *config)
+{
+  if (0 == config->respcache_ttl) {
+    return NULL;
+  }
+
+  bt_respcache_t *cache = (bt_respcache_t *) malloc(sizeof(bt_respcache_t));
+
+  if (NULL == cache) {
+    syslog(LOG_ERR, "Cannot allocate memory for response cache");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  cache->ttl = config->respcache_ttl * G_USEC_PER_SEC;
+
+  /* Table size bounds the memory used to BT_RESPCACHE_MAX_LEN per entry. */
+  uint32_t table_size = MAX(config->respcache_table_size,
+                            BT_RESPCACHE_SHARDS * BT_RESPCACHE_WAYS);
+  cache->sets = table_size / (BT_RESPCACHE_SHARDS * BT_RESPCACHE_WAYS);
+
+  for (int i = 0; i < BT_RESPCACHE_SHARDS; i++) {
+    bt_respcache_shard_t *shard = &cache->shards[i];
+
+    g_mutex_init(&shard->lock);
+    shard->entries = (bt_cached_response_t *)
+      calloc(cache->sets * BT_RESPCACHE_WAYS, sizeof(bt_cached_response_t));
+
+    if (NULL == shard->entries) {
+      syslog(LOG_ERR, "Cannot allocate memory for response cache entries");
+      exit(BT_EXIT_MALLOC_ERROR);
+    }
+  }
+
+  syslog(LOG_DEBUG, "Caching up to %d responses",
+         cache->sets * BT_RESPCACHE_SHARDS * BT_RESPCACHE_WAYS);
+
+  return cache;
+}
+
+void
+bt_free_respcache(bt_respcache_t *cache)
+{
+  if (NULL == cache) {
+    return;
+  }
+
+  for (int i = 0; i < BT_RESPCACHE_SHARDS; i++) {
+    bt_respcache_shard_t *shard = &cache->shards[i];
+
+    for (int j = 0; j < cache->sets * BT_RESPCACHE_WAYS; j++) {
+      free(shard->entries[j].data);
+    }
+
+    g_mutex_clear(&shard->lock);
+    free(shard->entries);
+  }
+
+  free(cache);
+}
+
+/* Fills the identity of the request in `buff` into `key`. */
+void
+bt_respcache_key(const char *buff, const struct sockaddr_in *from_addr,
+                 bt_cached_response_t *key)
+{
+  bt_req_t request;
+  bt_read_request_data(buff, &request);
+
+  key->ipv4_addr      = from_addr->sin_addr.s_addr;
+  key->port           = from_addr->sin_port;
+  key->action         = request.action;
+  key->transaction_id = request.transaction_id;
+  key->connection_id  = request.connection_id;
+}
+
+/* Locks the shard of `key` and returns the set of slots it belongs in. */
+bt_cached_response_t *
+bt_respcache_set(bt_respcache_t *cache, const bt_cached_response_t *key,
+                 GMutex **lock)
+{
+  /* Fibonacci hashing: the high bits of the product are the well mixed ones. */
+  uint64_t hash = ((uint64_t) key->ipv4_addr << 32 |
+                   (uint64_t) key->port << 16) ^ (uint32_t) key->transaction_id;
+  hash *= 0x9E3779B97F4A7C15ULL;
+
+  bt_respcache_shard_t *shard =
+    &cache->shards[hash >> (64 - BT_RESPCACHE_SHARD_BITS)];
+  uint32_t set_index = (hash >> 28) % cache->sets;
+
+  *lock = &shard->lock;
+  g_mutex_lock(*lock);
+
+  return &shard->entries[set_index * BT_RESPCACHE_WAYS];
+}
+
+/* Returns whether a live entry holds the request identified by `key`. */
+bool
+bt_respcache_match(const bt_cached_response_t *entry,
+                   const bt_cached_response_t *key, int64_t now)
+{
+  return entry->expires_at > now &&
+    entry->ipv4_addr == key->ipv4_addr && entry->port == key->port &&
+    entry->transaction_id == key->transaction_id &&
+    entry->action == key->action &&
+    entry->connection_id == key->connection_id;
+}
+
+/*
+ * Returns the entry of `key`. If not found, takes over the slot closest to
+ * expiring when `insert` is true, or returns NULL otherwise.
+ */
+bt_cached_response_t *
+bt_respcache_entry(bt_cached_response_t *set, const bt_cached_response_t *key,
+                   int64_t now, bool insert, bool *found)
+{
+  bt_cached_response_t *victim = &set[0];
+
+  for (int i = 0; i < BT_RESPCACHE_WAYS; i++) {
+    if (bt_respcache_match(&set[i], key, now)) {
+      *found = true;
+      return &set[i];
+    }
+
+    if (set[i].expires_at < victim->expires_at) {
+      victim = &set[i];
+    }
+  }
+
+  *found = false;
+
+  if (!insert) {
+    return NULL;
+  }
+
+  free(victim->data);
+  *victim = *key;
+  victim->data = NULL;
+  victim->length = 0;
+
+  return victim;
+}
+
+bt_respcache_status
+bt_respcache_lookup(bt_respcache_t *cache, const char *buff, size_t buflen,
+                    const struct sockaddr_in *from_addr, int64_t now,
+                    char *response, size_t *length)
+{
+  bt_cached_response_t key;
+  GMutex *lock;
+  bool found;
+
+  if (buflen < 16) {
+    return BT_RESPCACHE_MISS;
+  }
+
+  bt_respcache_key(buff, from_addr, &key);
+
+  bt_cached_response_t *set = bt_respcache_set(cache, &key, &lock);
+  bt_cached_response_t *entry =
+    bt_respcache_entry(set, &key, now, true, &found);
+  bt_respcache_status status = BT_RESPCACHE_MISS;
+
+  if (!found) {
+    /* Marks the request as being answered until the response is stored. */
+    entry->expires_at = now + cache->ttl;
+  } else if (NULL == entry->data) {
+    status = BT_RESPCACHE_IN_FLIGHT;
+  } else {
+    memcpy(response, entry->data, entry->length);
+    *length = entry->length;
+    status = BT_RESPCACHE_HIT;
+  }
+
+  g_mutex_unlock(lock);
+
+  return status;
+}
+
+void
+bt_respcache_store(bt_respcache_t *cache, const char *buff, size_t buflen,
+                   const struct sockaddr_in *from_addr, int64_t now,
+                   const char *response, size_t length)
+{
+  bt_cached_response_t key;
+  GMutex *lock;
+  bool found;
+  char *data = NULL;
+
+  if (buflen < 16) {
+    return;
+  }
+
+  bt_respcache_key(buff, from_addr, &key);
+
+  /* Copies the response outside the lock. */
+  if (NULL != response && length <= BT_RESPCACHE_MAX_LEN) {
+    data = (char *) malloc(length);
+
+    if (NULL == data) {
+      syslog(LOG_ERR, "Cannot allocate memory for cached response");
+      exit(BT_EXIT_MALLOC_ERROR);
+    }
+    memcpy(data, response, length);
+  }
+
+  bt_cached_response_t *set = bt_respcache_set(cache, &key, &lock);
+  bt_cached_response_t *entry =
+    bt_respcache_entry(set, &key, now, NULL != data, &found);
+
+  /* Forgotten right away if there is nothing to answer retransmits with. */
+  if (NULL != entry) {
+    free(entry->data);
+    entry->data = data;
+    entry->length = length;
+    entry->expires_at = NULL != data ? now + cache->ttl : 0;
+  }
+
+  g_mutex_unlock(lock);
+}
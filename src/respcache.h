@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BTTRACKER_RESPCACHE_H_
+#define BTTRACKER_RESPCACHE_H_
+
+/* Number of shards of the table of responses. */
+#define BT_RESPCACHE_SHARD_BITS (4)
+#define BT_RESPCACHE_SHARDS (1 << BT_RESPCACHE_SHARD_BITS)
+
+/* Number of requests that compete for the same slot of a shard. */
+#define BT_RESPCACHE_WAYS (4)
+
+/* Largest response kept, larger ones are always computed again. */
+#define BT_RESPCACHE_MAX_LEN (2048)
+
+/*
+ * Response sent to a request, identified by its source and header. Clients
+ * resend a request with the same header when the answer is late, so this is
+ * enough to tell a retransmit from a new request.
+ */
+typedef struct {
+  uint32_t ipv4_addr;       // Source address, in network byte order
+  uint16_t port;            // Source port, in network byte order
+  int32_t action;
+  int32_t transaction_id;
+  int64_t connection_id;
+  int64_t expires_at;       // Monotonic time it is forgotten at, 0 if free
+  char *data;               // Response sent, NULL while being answered
+  size_t length;
+} bt_cached_response_t;
+
+/* Slice of the table of responses protected by its own lock. */
+typedef struct {
+  GMutex lock;
+  bt_cached_response_t *entries;
+} bt_respcache_shard_t;
+
+/* Bounded table of the responses sent in the last few seconds. */
+typedef struct {
+  int64_t ttl;              // Lifetime of an entry, in microseconds
+  uint32_t sets;            // Number of slots in each shard
+  bt_respcache_shard_t shards[BT_RESPCACHE_SHARDS];
+} bt_respcache_t;
+
+/* Result of looking a request up. */
+typedef enum {
+  BT_RESPCACHE_MISS,        // New request, now marked as being answered
+  BT_RESPCACHE_HIT,         // Retransmit of a request already answered
+  BT_RESPCACHE_IN_FLIGHT    // Retransmit of a request being answered
+} bt_respcache_status;
+
+/* Creates the response cache, or returns NULL if it is disabled. */
+bt_respcache_t *
+bt_new_respcache(const bt_config_t *config);
+
+/* Frees the response cache. */
+void
+bt_free_respcache(bt_respcache_t *cache);
+
+/*
+ * Looks up the request in `buff`. On a hit, the response is copied to
+ * `response`, which must hold BT_RESPCACHE_MAX_LEN bytes, and its length
+ * to `length`. `now` is a monotonic timestamp in microseconds.
+ */
+bt_respcache_status
+bt_respcache_lookup(bt_respcache_t *cache, const char *buff, size_t buflen,
+                    const struct sockaddr_in *from_addr, int64_t now,
+                    char *response, size_t *length);
+
+/*
+ * Keeps the response sent to the request in `buff`. A NULL `response`
+ * forgets the request instead, so that a retransmit is answered anew.
+ */
+void
+bt_respcache_store(bt_respcache_t *cache, const char *buff, size_t buflen,
+                   const struct sockaddr_in *from_addr, int64_t now,
+                   const char *response, size_t length);
+
+#endif // BTTRACKER_RESPCACHE_H_
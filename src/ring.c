@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Based on the bounded MPMC queue by Dmitry Vyukov. A slot whose sequence
+ * equals the enqueue position is free for the producer holding that
+ * position; one whose sequence is the dequeue position plus one holds an
+ * item for the consumer holding that position. Once done, each side moves
+ * the sequence on to the position the other side will come with.
+ */
+
+void
+bt_ring_init(bt_ring_t *ring, size_t capacity)
+{
+  size_t size = 2;
+
+  while (size < capacity) {
+    size <<= 1;
+  }
+
+  ring->cells = (bt_ring_cell_t *) malloc(size * sizeof(bt_ring_cell_t));
+
+  if (NULL == ring->cells) {
+    syslog(LOG_ERR, "Cannot allocate memory for ring");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  for (size_t i = 0; i < size; i++) {
+    ring->cells[i].sequence = i;
+    ring->cells[i].item = NULL;
+    ring->cells[i].stamp = 0;
+  }
+
+  ring->mask = size - 1;
+  ring->enqueue_pos = 0;
+  ring->dequeue_pos = 0;
+}
+
+void
+bt_ring_clear(bt_ring_t *ring)
+{
+  free(ring->cells);
+  ring->cells = NULL;
+}
+
+bool
+bt_ring_push(bt_ring_t *ring, void *item, int64_t stamp)
+{
+  bt_ring_cell_t *cell;
+  size_t pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+
+  while (true) {
+    cell = &ring->cells[pos & ring->mask];
+    size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+
+    if (0 == diff) {
+      if (__atomic_compare_exchange_n(&ring->enqueue_pos, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+    }
+  }
+
+  cell->item = item;
+  __atomic_store_n(&cell->stamp, stamp, __ATOMIC_RELAXED);
+  __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+void *
+bt_ring_pop(bt_ring_t *ring)
+{
+  void *item;
+  return bt_ring_pop_batch(ring, &item, 1) > 0 ? item : NULL;
+}
+
+size_t
+bt_ring_pop_batch(bt_ring_t *ring, void **items, size_t max)
+{
+  size_t count;
+  size_t pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+
+  while (true) {
+    bt_ring_cell_t *cell = &ring->cells[pos & ring->mask];
+    size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t) sequence - (intptr_t) (pos + 1);
+
+    if (diff < 0) {
+      return 0;
+    } else if (diff > 0) {
+      pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+      continue;
+    }
+
+    /* Counts the items ready past the head, then claims them all at once. */
+    for (count = 1; count < max && count <= ring->mask; count++) {
+      cell = &ring->cells[(pos + count) & ring->mask];
+      sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+
+      if (sequence != pos + count + 1) {
+        break;
+      }
+    }
+
+    if (__atomic_compare_exchange_n(&ring->dequeue_pos, &pos, pos + count,
+                                    true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    bt_ring_cell_t *cell = &ring->cells[(pos + i) & ring->mask];
+
+    items[i] = cell->item;
+    __atomic_store_n(&cell->sequence, pos + i + ring->mask + 1,
+                     __ATOMIC_RELEASE);
+  }
+
+  return count;
+}
+
+bool
+bt_ring_peek(bt_ring_t *ring, int64_t *stamp)
+{
+  size_t pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_ACQUIRE);
+  bt_ring_cell_t *cell = &ring->cells[pos & ring->mask];
+
+  if (__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) != pos + 1) {
+    return false;
+  }
+
+  *stamp = __atomic_load_n(&cell->stamp, __ATOMIC_RELAXED);
+  return true;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BTTRACKER_RING_H_
+#define BTTRACKER_RING_H_
+
+/* Assumed size of a cache line, to keep the ring positions apart. */
+#define BT_RING_CACHE_LINE 64
+
+/* Slot of a ring. */
+typedef struct {
+  size_t sequence;  // Tells whether the slot is free or holds an item
+  void *item;
+  int64_t stamp;    // Copied from the producer, readable before popping
+} bt_ring_cell_t;
+
+/*
+ * Bounded lock-free queue for many producers and many consumers. Each slot
+ * carries a sequence number that tells producers and consumers whose turn
+ * it is, so pushing or popping costs a single compare-and-swap.
+ */
+typedef struct {
+  bt_ring_cell_t *cells;
+  size_t mask;                                          // Capacity minus one
+  char pad0[BT_RING_CACHE_LINE];
+  size_t enqueue_pos;
+  char pad1[BT_RING_CACHE_LINE - sizeof(size_t)];
+  size_t dequeue_pos;
+  char pad2[BT_RING_CACHE_LINE - sizeof(size_t)];
+} bt_ring_t;
+
+/* Initializes a ring holding at least `capacity` items. */
+void
+bt_ring_init(bt_ring_t *ring, size_t capacity);
+
+/* Frees the slots of a ring. Items still in it are not freed. */
+void
+bt_ring_clear(bt_ring_t *ring);
+
+/* Adds an item to the tail. Returns false if the ring is full. */
+bool
+bt_ring_push(bt_ring_t *ring, void *item, int64_t stamp);
+
+/* Removes the item at the head, or returns NULL if the ring is empty. */
+void *
+bt_ring_pop(bt_ring_t *ring);
+
+/*
+ * Removes up to `max` items from the head with a single compare-and-swap.
+ * Returns the number of items stored in `items`.
+ */
+size_t
+bt_ring_pop_batch(bt_ring_t *ring, void **items, size_t max);
+
+/*
+ * Returns true if an item is ready at the head, and its stamp in `stamp`.
+ * Consumers may race to it, so a pop right after may still fail.
+ */
+bool
+bt_ring_peek(bt_ring_t *ring, int64_t *stamp);
+
+#endif // BTTRACKER_RING_H_
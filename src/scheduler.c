@@ -0,0 +1,303 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Gauges that hold the queue depth of each class. */
+static const bt_stat bt_sched_depth_stats[BT_CLASS_COUNT] = {
+  BT_STAT_QUEUED_CONNECT,
+  BT_STAT_QUEUED_ANNOUNCE,
+  BT_STAT_QUEUED_SCRAPE,
+  BT_STAT_QUEUED_OTHER
+};
+
+void
+bt_sched_init(bt_sched_t *sched, const bt_config_t *config, guint max_length)
+{
+  /* Any class may take up the whole bound. */
+  size_t capacity = max_length > 0 ? max_length : BT_SCHED_RING_SIZE;
+
+  for (int i = 0; i < BT_CLASS_COUNT; i++) {
+    bt_ring_init(&sched->rings[i], capacity);
+    sched->credits[i] = 0;
+  }
+
+  sched->weights[BT_CLASS_CONNECT]  = MAX(1, config->sched_connect_weight);
+  sched->weights[BT_CLASS_ANNOUNCE] = MAX(1, config->sched_announce_weight);
+  sched->weights[BT_CLASS_SCRAPE]   = MAX(1, config->sched_scrape_weight);
+  sched->weights[BT_CLASS_OTHER]    = 1;
+
+  sched->length     = 0;
+  sched->max_length = max_length;
+  sched->policy     = config->sched_policy;
+
+  g_mutex_init(&sched->lock);
+  g_cond_init(&sched->cond);
+  sched->parked   = 0;
+  sched->stopping = false;
+}
+
+void
+bt_sched_clear(bt_sched_t *sched)
+{
+  bt_job_params_t *params;
+
+  while ((params = bt_sched_pop(sched, BT_SCHED_ANY)) != NULL) {
+    free(params->buff);
+    free(params);
+  }
+
+  for (int i = 0; i < BT_CLASS_COUNT; i++) {
+    bt_ring_clear(&sched->rings[i]);
+  }
+
+  g_cond_clear(&sched->cond);
+  g_mutex_clear(&sched->lock);
+}
+
+bool
+bt_sched_push(bt_sched_t *sched, bt_job_params_t *params)
+{
+  bt_request_class class = params->class;
+
+  /* Counted before it is queued, so that the length never runs short. */
+  guint length = __atomic_add_fetch(&sched->length, 1, __ATOMIC_SEQ_CST);
+
+  /* Bounds the memory used by pending jobs under overload. */
+  if ((sched->max_length > 0 && length > sched->max_length) ||
+      !bt_ring_push(&sched->rings[class], params, params->received_at)) {
+    __atomic_sub_fetch(&sched->length, 1, __ATOMIC_SEQ_CST);
+
+    syslog(LOG_DEBUG, "Request queue is full, dropping job");
+    bt_stats_inc(BT_STAT_QUEUE_FULL);
+    BT_PROBE2(drop, params, BT_STAT_QUEUE_FULL);
+
+    free(params->buff);
+    free(params);
+    return false;
+  }
+
+  BT_PROBE2(enqueue, params, class);
+
+  bt_stats_inc(bt_sched_depth_stats[class]);
+
+  /*
+   * Parked threads count themselves before they check the length, which
+   * was raised above, so either they see the job or we see them.
+   */
+  if (__atomic_load_n(&sched->parked, __ATOMIC_SEQ_CST) > 0) {
+    g_mutex_lock(&sched->lock);
+    g_cond_signal(&sched->cond);
+    g_mutex_unlock(&sched->lock);
+  }
+
+  return true;
+}
+
+/* Returns the class whose oldest job arrived first. */
+int
+bt_sched_pick_fifo(bt_sched_t *sched, guint class_mask)
+{
+  int picked = -1;
+  int64_t oldest = 0, received_at;
+
+  for (int i = 0; i < BT_CLASS_COUNT; i++) {
+    if ((class_mask & (1 << i)) &&
+        bt_ring_peek(&sched->rings[i], &received_at) &&
+        (picked < 0 || received_at < oldest)) {
+      picked = i;
+      oldest = received_at;
+    }
+  }
+
+  return picked;
+}
+
+/* Returns the first class with pending jobs, in order of priority. */
+int
+bt_sched_pick_strict(bt_sched_t *sched, guint class_mask)
+{
+  int64_t received_at;
+
+  for (int i = 0; i < BT_CLASS_COUNT; i++) {
+    if ((class_mask & (1 << i)) &&
+        bt_ring_peek(&sched->rings[i], &received_at)) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/*
+ * Smooth weighted round-robin: every class with pending jobs earns its
+ * weight in credits, and the richest one pays back the sum of the weights.
+ * Returns the richest class, and in `pending` the classes with jobs, so
+ * that `bt_sched_charge` can settle the credits once the jobs are taken.
+ */
+int
+bt_sched_pick_weighted(bt_sched_t *sched, guint class_mask, guint *pending)
+{
+  int picked = -1, best = 0;
+  int64_t received_at;
+
+  *pending = 0;
+
+  for (int i = 0; i < BT_CLASS_COUNT; i++) {
+    if (!(class_mask & (1 << i)) ||
+        !bt_ring_peek(&sched->rings[i], &received_at)) {
+      continue;
+    }
+
+    int credits = __atomic_load_n(&sched->credits[i], __ATOMIC_RELAXED) +
+                  sched->weights[i];
+    *pending |= 1 << i;
+
+    if (picked < 0 || credits > best) {
+      picked = i;
+      best = credits;
+    }
+  }
+
+  return picked;
+}
+
+/*
+ * Settles the credits for `count` jobs of class `picked`, as if it had been
+ * picked that many times in a row. Thieves may race with the owner here,
+ * which only makes the shares approximate for a while.
+ */
+void
+bt_sched_charge(bt_sched_t *sched, int picked, guint pending, guint count)
+{
+  int total = 0;
+
+  for (int i = 0; i < BT_CLASS_COUNT; i++) {
+    if (pending & (1 << i)) {
+      __atomic_add_fetch(&sched->credits[i], sched->weights[i] * count,
+                         __ATOMIC_RELAXED);
+      total += sched->weights[i];
+    }
+  }
+
+  __atomic_sub_fetch(&sched->credits[picked], total * count, __ATOMIC_RELAXED);
+}
+
+bt_job_params_t *
+bt_sched_pop(bt_sched_t *sched, guint class_mask)
+{
+  bt_job_params_t *params;
+  return bt_sched_pop_batch(sched, class_mask, &params, 1) > 0 ? params : NULL;
+}
+
+guint
+bt_sched_pop_batch(bt_sched_t *sched, guint class_mask,
+                   bt_job_params_t **jobs, guint max)
+{
+  void *items[BT_SCHED_MAX_BATCH];
+  guint pending = 0;
+  size_t count = 0;
+  int class;
+
+  max = CLAMP(max, 1, BT_SCHED_MAX_BATCH);
+
+  /* A pop only fails if another thread took the jobs seen by the pick. */
+  do {
+    switch (sched->policy) {
+    case BT_SCHED_STRICT:
+      class = bt_sched_pick_strict(sched, class_mask);
+      break;
+
+    case BT_SCHED_WEIGHTED:
+      class = bt_sched_pick_weighted(sched, class_mask, &pending);
+      break;
+
+    case BT_SCHED_FIFO:
+    default:
+      class = bt_sched_pick_fifo(sched, class_mask);
+      break;
+    }
+
+    if (class < 0) {
+      return 0;
+    }
+
+    count = bt_ring_pop_batch(&sched->rings[class], items, max);
+  } while (0 == count);
+
+  __atomic_sub_fetch(&sched->length, count, __ATOMIC_SEQ_CST);
+
+  if (BT_SCHED_WEIGHTED == sched->policy) {
+    bt_sched_charge(sched, class, pending, count);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    jobs[i] = (bt_job_params_t *) items[i];
+  }
+
+  bt_stats_add(bt_sched_depth_stats[class], -(int64_t) count);
+
+  return count;
+}
+
+bool
+bt_sched_wait(bt_sched_t *sched, int64_t timeout)
+{
+  int64_t deadline = g_get_monotonic_time() + timeout;
+
+  g_mutex_lock(&sched->lock);
+  __atomic_add_fetch(&sched->parked, 1, __ATOMIC_SEQ_CST);
+
+  while (0 == __atomic_load_n(&sched->length, __ATOMIC_SEQ_CST) &&
+         !sched->stopping) {
+    if (!g_cond_wait_until(&sched->cond, &sched->lock, deadline)) {
+      break;
+    }
+  }
+
+  __atomic_sub_fetch(&sched->parked, 1, __ATOMIC_SEQ_CST);
+  bool running = !sched->stopping;
+  g_mutex_unlock(&sched->lock);
+
+  return running;
+}
+
+void
+bt_sched_stop(bt_sched_t *sched)
+{
+  g_mutex_lock(&sched->lock);
+  sched->stopping = true;
+  g_cond_broadcast(&sched->cond);
+  g_mutex_unlock(&sched->lock);
+}
+
+guint
+bt_sched_length(bt_sched_t *sched)
+{
+  return __atomic_load_n(&sched->length, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BTTRACKER_SCHEDULER_H_
+#define BTTRACKER_SCHEDULER_H_
+
+/* Masks of classes that can be popped from the queues. */
+#define BT_SCHED_ANY       ((1 << BT_CLASS_COUNT) - 1)
+#define BT_SCHED_STEALABLE (BT_SCHED_ANY & ~(1 << BT_CLASS_ANNOUNCE))
+
+/* Capacity of each queue when the number of pending jobs is not limited. */
+#define BT_SCHED_RING_SIZE 65536
+
+/* Maximum number of jobs taken from the queues at once. */
+#define BT_SCHED_MAX_BATCH 32
+
+/*
+ * Per-class queues of requests waiting for a worker thread. Jobs are pushed
+ * and popped without locks; the mutex is only taken to park a thread with
+ * nothing to do, or to wake one up.
+ */
+typedef struct {
+  bt_ring_t rings[BT_CLASS_COUNT];
+  int weights[BT_CLASS_COUNT];
+  int credits[BT_CLASS_COUNT];   // Updated atomically, thieves pop too
+  guint length;                  // Total number of pending jobs
+  guint max_length;              // Maximum number of pending jobs (0: none)
+  bt_sched_policy policy;
+  GMutex lock;
+  GCond cond;                    // Signaled when a job is queued
+  int parked;                    // Number of threads waiting on `cond`
+  bool stopping;
+} bt_sched_t;
+
+/* Initializes the queues. */
+void
+bt_sched_init(bt_sched_t *sched, const bt_config_t *config, guint max_length);
+
+/* Frees the jobs still queued and the resources used by the queues. */
+void
+bt_sched_clear(bt_sched_t *sched);
+
+/* Queues a job according to its class, or drops it if the queue is full. */
+bool
+bt_sched_push(bt_sched_t *sched, bt_job_params_t *params);
+
+/*
+ * Returns the next job of one of the classes in `class_mask` without
+ * blocking, or NULL if there is none.
+ */
+bt_job_params_t *
+bt_sched_pop(bt_sched_t *sched, guint class_mask);
+
+/*
+ * Like `bt_sched_pop`, but takes up to `max` jobs of the same class at once
+ * and stores them in `jobs`. Returns the number of jobs taken.
+ */
+guint
+bt_sched_pop_batch(bt_sched_t *sched, guint class_mask,
+                   bt_job_params_t **jobs, guint max);
+
+/*
+ * Blocks until a job is queued, `timeout` microseconds elapse or the queues
+ * are stopped. Returns false in the latter case.
+ */
+bool
+bt_sched_wait(bt_sched_t *sched, int64_t timeout);
+
+/* Wakes up all threads waiting on the queues and makes them return. */
+void
+bt_sched_stop(bt_sched_t *sched);
+
+/* Returns the number of pending jobs. */
+guint
+bt_sched_length(bt_sched_t *sched);
+
+#endif // BTTRACKER_SCHEDULER_H_
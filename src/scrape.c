@@ -70,6 +70,8 @@ bt_handle_scrape(const bt_req_t *request, const bt_config_t *config,
     return NULL;
   }
 
+  bt_trace_mark(BT_TRACE_VALIDATE);
+
   /* Unpacks the data retrieved via network socket. */
   bt_scrape_req_t scrape_request;
   bt_read_scrape_request_data(buff, buflen, &scrape_request);
@@ -78,15 +80,23 @@ bt_handle_scrape(const bt_req_t *request, const bt_config_t *config,
 
   bt_list *scrape_entries = NULL;
 
+  /* Stats of hot swarms are served from a local cache. */
+  bt_worker_t *worker = bt_current_worker();
+  bt_hot_cache_t *hot_cache = NULL != worker ? worker->hot : NULL;
+
   for (uint8_t i = 0; i < scrape_request.info_hash_len; i++) {
-    char *info_hash_str;
+    bt_info_hash_key_t info_hash_key;
     int8_t *info_hash = (int8_t *) scrape_request.info_hash + i * 20;
 
-    bt_bytearray_to_hexarray(info_hash, 20, &info_hash_str);
-    if (bt_info_hash_blacklisted(redis, config, info_hash_str)) {
-      syslog(LOG_DEBUG, "Blacklisted info hash: %s", info_hash_str);
+    bt_info_hash_key(config, info_hash, &info_hash_key);
+    bt_hot_count(config, info_hash);
 
+    if (bt_info_hash_blacklisted(redis, config, &info_hash_key)) {
+      char *info_hash_str;
+      bt_bytearray_to_hexarray(info_hash, 20, &info_hash_str);
+      syslog(LOG_DEBUG, "Blacklisted info hash: %s", info_hash_str);
       free(info_hash_str);
+
       bt_list_free(scrape_entries);
 
       return bt_send_error(request, "Blacklisted info hash");
@@ -94,13 +104,30 @@ bt_handle_scrape(const bt_req_t *request, const bt_config_t *config,
 
     bt_torrent_stats_t *stats = (bt_torrent_stats_t *)
       malloc(sizeof(bt_torrent_stats_t));
-    bt_get_torrent_stats(redis, config, info_hash_str, stats);
 
-    scrape_entries = bt_list_prepend(scrape_entries, stats);
+    bool is_hot = NULL != hot_cache && bt_hot_find(config, info_hash);
 
-    free(info_hash_str);
+    /* A hot swarm cache or a recent census spares a round trip to Redis. */
+    if ((!is_hot || !bt_hot_cached_stats(hot_cache, info_hash, stats, false)) &&
+        !bt_census_find(config, info_hash, stats)) {
+      bt_get_torrent_stats(redis, config, &info_hash_key, stats);
+      bt_snapshot_merge_stats(config, info_hash, stats);
+
+      if (is_hot) {
+        bt_hot_cache_stats(hot_cache, info_hash, stats);
+      }
+    }
+
+    if (NULL != worker && NULL != worker->known) {
+      bt_known_store_stats(worker->known, info_hash, stats);
+    }
+
+    scrape_entries = bt_list_prepend(scrape_entries, stats);
   }
 
+  /* Restriction checks are interleaved with the reads of the counters. */
+  bt_trace_mark(BT_TRACE_STATS);
+
   /* Fixed announce response fields. */
   bt_scrape_resp_t response_header = {
     .action = request->action,
@@ -110,3 +137,48 @@ bt_handle_scrape(const bt_req_t *request, const bt_config_t *config,
 
   return bt_serialize_scrape_response(&response_header);
 }
+
+bt_response_buffer_t *
+bt_handle_stale_scrape(const bt_req_t *request, const bt_config_t *config,
+                       char *buff, size_t buflen)
+{
+  /* Connection IDs and restrictions cannot be checked without Redis. */
+  if (buflen < 8) {
+    syslog(LOG_ERR, "Invalid scrape packet");
+    return NULL;
+  }
+
+  bt_scrape_req_t scrape_request;
+  bt_read_scrape_request_data(buff, buflen, &scrape_request);
+
+  syslog(LOG_DEBUG, "Handling scrape without Redis");
+
+  bt_list *scrape_entries = NULL;
+
+  for (uint8_t i = 0; i < scrape_request.info_hash_len; i++) {
+    int8_t *info_hash = (int8_t *) scrape_request.info_hash + i * 20;
+
+    bt_torrent_stats_t *stats = (bt_torrent_stats_t *)
+      malloc(sizeof(bt_torrent_stats_t));
+
+    if (NULL == stats) {
+      syslog(LOG_ERR, "Cannot allocate memory for scrape entry");
+      exit(BT_EXIT_MALLOC_ERROR);
+    }
+
+    bt_hot_count(config, info_hash);
+    bt_stale_torrent_stats(config, info_hash, stats);
+
+    scrape_entries = bt_list_prepend(scrape_entries, stats);
+  }
+
+  bt_stats_inc(BT_STAT_STALE_ANSWERS);
+
+  bt_scrape_resp_t response_header = {
+    .action = request->action,
+    .transaction_id = request->transaction_id,
+    .scrape_entries = bt_list_reverse(scrape_entries)
+  };
+
+  return bt_serialize_scrape_response(&response_header);
+}
@@ -36,4 +36,12 @@ bt_response_buffer_t *
 bt_handle_scrape(const bt_req_t *request, const bt_config_t *config,
                  char *buff, size_t buflen, redisContext *redis);
 
+/*
+ * Returns the response data to a scrape request while Redis is left alone,
+ * from the stats at hand.
+ */
+bt_response_buffer_t *
+bt_handle_stale_scrape(const bt_req_t *request, const bt_config_t *config,
+                       char *buff, size_t buflen);
+
 #endif // BTTRACKER_SCRAPE_H_
@@ -0,0 +1,570 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Table mapped by this process. */
+typedef struct {
+  void *map;
+  size_t size;
+  bt_shm_header_t *header;
+  bt_shm_bucket_t *buckets;
+  char *torrents;
+  size_t torrent_size;
+} bt_shm_t;
+
+static bt_shm_t *bt_shm = NULL;
+
+/* Returns the size of a torrent slot and its peers. */
+size_t
+bt_shm_torrent_size(uint32_t peers_per_torrent)
+{
+  return BT_SHM_ALIGN(sizeof(bt_shm_torrent_t) +
+                      peers_per_torrent * sizeof(bt_shm_peer_t));
+}
+
+/* Returns the total size of a table. */
+size_t
+bt_shm_size(uint32_t bucket_count, uint32_t peers_per_torrent)
+{
+  return BT_SHM_ALIGN(sizeof(bt_shm_header_t)) +
+    BT_SHM_ALIGN((size_t) bucket_count * sizeof(bt_shm_bucket_t)) +
+    (size_t) bucket_count * BT_SHM_WAYS * bt_shm_torrent_size(peers_per_torrent);
+}
+
+/* Initializes a table that was just created. */
+bool
+bt_shm_init(bt_shm_t *shm, uint32_t bucket_count, uint32_t peers_per_torrent)
+{
+  pthread_mutexattr_t attr;
+
+  if (pthread_mutexattr_init(&attr) != 0 ||
+      pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) != 0 ||
+      pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST) != 0) {
+    syslog(LOG_ERR, "Cannot create process-shared mutexes");
+    return false;
+  }
+
+  for (uint32_t i = 0; i < bucket_count; i++) {
+    pthread_mutex_init(&shm->buckets[i].lock, &attr);
+    shm->buckets[i].dirty_torrent = -1;
+    shm->buckets[i].dirty_peer = -1;
+  }
+
+  pthread_mutexattr_destroy(&attr);
+
+  /* Slots are zeroed by ftruncate(), which marks them as unused. */
+  shm->header->version = BT_SHM_VERSION;
+  shm->header->bucket_count = bucket_count;
+  shm->header->peers_per_torrent = peers_per_torrent;
+
+  __atomic_store_n(&shm->header->magic, BT_SHM_MAGIC, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+bool
+bt_shm_open(const bt_config_t *config)
+{
+  uint32_t bucket_count = MAX(1, config->shm_buckets);
+  uint32_t peers_per_torrent = CLAMP(config->shm_peers_per_torrent, 1,
+                                     BT_SHM_MAX_PEERS_PER_TORRENT);
+  size_t size = bt_shm_size(bucket_count, peers_per_torrent);
+  const char *name = NULL != config->shm_name ? config->shm_name : "/bttracker";
+  bool created = true;
+
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+  if (-1 == fd && EEXIST == errno) {
+    created = false;
+    fd = shm_open(name, O_RDWR, 0600);
+  }
+
+  if (-1 == fd) {
+    syslog(LOG_ERR, "Cannot open shared memory object %s", name);
+    return false;
+  }
+
+  if (created && ftruncate(fd, size) == -1) {
+    syslog(LOG_ERR, "Cannot size shared memory object %s", name);
+    close(fd);
+    shm_unlink(name);
+    return false;
+  }
+
+  /* The creator might still be sizing the object. */
+  struct stat st;
+
+  for (int i = 0; i < 100 && fstat(fd, &st) == 0 && st.st_size < size; i++) {
+    usleep(10000);
+  }
+
+  if (fstat(fd, &st) == -1 || st.st_size != size) {
+    syslog(LOG_ERR, "Shared memory object %s does not match the configured "
+           "Buckets and PeersPerTorrent", name);
+    close(fd);
+    return false;
+  }
+
+  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (MAP_FAILED == map) {
+    syslog(LOG_ERR, "Cannot map shared memory object %s", name);
+    return false;
+  }
+
+  bt_shm_t *shm = (bt_shm_t *) malloc(sizeof(bt_shm_t));
+
+  if (NULL == shm) {
+    syslog(LOG_ERR, "Cannot allocate memory for shared memory table");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  shm->map = map;
+  shm->size = size;
+  shm->header = (bt_shm_header_t *) map;
+  shm->buckets = (bt_shm_bucket_t *)
+    ((char *) map + BT_SHM_ALIGN(sizeof(bt_shm_header_t)));
+  shm->torrents = (char *) shm->buckets +
+    BT_SHM_ALIGN((size_t) bucket_count * sizeof(bt_shm_bucket_t));
+  shm->torrent_size = bt_shm_torrent_size(peers_per_torrent);
+
+  if (created && !bt_shm_init(shm, bucket_count, peers_per_torrent)) {
+    munmap(map, size);
+    free(shm);
+    shm_unlink(name);
+    return false;
+  }
+
+  /* Waits for the creator to finish initializing the table. */
+  for (int i = 0; i < 100 && BT_SHM_MAGIC !=
+         __atomic_load_n(&shm->header->magic, __ATOMIC_ACQUIRE); i++) {
+    usleep(10000);
+  }
+
+  if (BT_SHM_MAGIC != __atomic_load_n(&shm->header->magic, __ATOMIC_ACQUIRE) ||
+      BT_SHM_VERSION != shm->header->version ||
+      bucket_count != shm->header->bucket_count ||
+      peers_per_torrent != shm->header->peers_per_torrent) {
+    syslog(LOG_ERR, "Shared memory object %s is not a compatible table", name);
+    munmap(map, size);
+    free(shm);
+    return false;
+  }
+
+  bt_shm = shm;
+
+  syslog(LOG_INFO, "%s shared swarm table %s (%zu bytes)",
+         created ? "Created" : "Attached to", name, size);
+
+  return true;
+}
+
+void
+bt_shm_close(void)
+{
+  if (NULL != bt_shm) {
+    munmap(bt_shm->map, bt_shm->size);
+    free(bt_shm);
+    bt_shm = NULL;
+  }
+}
+
+/* Returns a torrent slot of a bucket. */
+bt_shm_torrent_t *
+bt_shm_torrent(uint32_t bucket, int way)
+{
+  return (bt_shm_torrent_t *) (bt_shm->torrents + bt_shm->torrent_size *
+                               ((size_t) bucket * BT_SHM_WAYS + way));
+}
+
+/* Returns the bucket an info hash belongs to. */
+uint32_t
+bt_shm_bucket_index(const int8_t *info_hash)
+{
+  /* Info hashes are SHA-1 digests, so any of their bytes are uniform. */
+  uint32_t hash;
+  memcpy(&hash, info_hash + 4, sizeof(hash));
+
+  return hash % bt_shm->header->bucket_count;
+}
+
+/*
+ * Locks a bucket. If its last holder died, drops whatever it was writing,
+ * since that slot might be torn, and marks the bucket consistent again.
+ */
+bt_shm_bucket_t *
+bt_shm_lock(uint32_t index)
+{
+  bt_shm_bucket_t *bucket = &bt_shm->buckets[index];
+  int rc = pthread_mutex_lock(&bucket->lock);
+
+  if (EOWNERDEAD == rc) {
+    syslog(LOG_WARNING, "Recovering swarm bucket left locked by a dead "
+           "process");
+
+    if (bucket->dirty_torrent >= 0 && bucket->dirty_torrent < BT_SHM_WAYS) {
+      bt_shm_torrent_t *torrent = bt_shm_torrent(index, bucket->dirty_torrent);
+
+      if (bucket->dirty_peer >= 0 &&
+          bucket->dirty_peer < bt_shm->header->peers_per_torrent) {
+        torrent->peers[bucket->dirty_peer].used = 0;
+      } else {
+        torrent->used = 0;
+      }
+    }
+
+    bucket->dirty_torrent = bucket->dirty_peer = -1;
+    pthread_mutex_consistent(&bucket->lock);
+  } else if (0 != rc) {
+    syslog(LOG_ERR, "Cannot lock swarm bucket");
+    exit(BT_EXIT_SHM_ERROR);
+  }
+
+  return bucket;
+}
+
+/* Records the slot about to be written, in case the process dies. */
+void
+bt_shm_mark_dirty(bt_shm_bucket_t *bucket, int way, int peer)
+{
+  bucket->dirty_torrent = way;
+  bucket->dirty_peer = peer;
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void
+bt_shm_unlock(bt_shm_bucket_t *bucket)
+{
+  bucket->dirty_torrent = bucket->dirty_peer = -1;
+  pthread_mutex_unlock(&bucket->lock);
+}
+
+/*
+ * Returns the way holding a torrent, or -1. With `create`, takes over a
+ * free, expired or least recently seen way when the torrent is missing.
+ */
+int
+bt_shm_find_torrent(bt_shm_bucket_t *bucket, uint32_t index,
+                    const int8_t *info_hash, uint32_t cutoff, bool create)
+{
+  int victim = 0;
+  uint32_t victim_seen = UINT32_MAX;
+
+  for (int way = 0; way < BT_SHM_WAYS; way++) {
+    bt_shm_torrent_t *torrent = bt_shm_torrent(index, way);
+
+    if (torrent->used && torrent->last_seen >= cutoff &&
+        memcmp(torrent->info_hash, info_hash, 20) == 0) {
+      return way;
+    }
+
+    uint32_t seen = torrent->used ? torrent->last_seen : 0;
+
+    if (seen < victim_seen) {
+      victim = way;
+      victim_seen = seen;
+    }
+  }
+
+  if (!create) {
+    return -1;
+  }
+
+  bt_shm_torrent_t *torrent = bt_shm_torrent(index, victim);
+
+  bt_shm_mark_dirty(bucket, victim, -1);
+  memset(torrent, 0, bt_shm->torrent_size);
+  memcpy(torrent->info_hash, info_hash, 20);
+  torrent->last_seen = time(NULL);
+  torrent->used = 1;
+
+  return victim;
+}
+
+/* Returns the slot of a live peer, or -1. */
+int
+bt_shm_find_peer(bt_shm_torrent_t *torrent, const int8_t *peer_id,
+                 uint32_t cutoff)
+{
+  for (uint32_t i = 0; i < bt_shm->header->peers_per_torrent; i++) {
+    bt_shm_peer_t *peer = &torrent->peers[i];
+
+    if (peer->used && peer->last_seen >= cutoff &&
+        memcmp(peer->peer_id, peer_id, 20) == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+void
+bt_shm_insert_peer(const bt_config_t *config, const int8_t *info_hash,
+                   const int8_t *peer_id, const bt_peer_t *peer_data,
+                   bool is_seeder)
+{
+  uint32_t now = time(NULL);
+  uint32_t cutoff = now - config->announce_peer_ttl;
+  uint32_t index = bt_shm_bucket_index(info_hash);
+  bt_shm_bucket_t *bucket = bt_shm_lock(index);
+
+  int way = bt_shm_find_torrent(bucket, index, info_hash, cutoff, true);
+  bt_shm_torrent_t *torrent = bt_shm_torrent(index, way);
+  int slot = bt_shm_find_peer(torrent, peer_id, cutoff);
+
+  /* Otherwise reuses a free or expired slot, or the least recent one. */
+  if (slot < 0) {
+    uint32_t oldest = UINT32_MAX;
+
+    for (uint32_t i = 0; i < bt_shm->header->peers_per_torrent; i++) {
+      bt_shm_peer_t *peer = &torrent->peers[i];
+      uint32_t seen = peer->used ? peer->last_seen : 0;
+
+      if (seen < oldest) {
+        slot = i;
+        oldest = seen;
+      }
+    }
+  }
+
+  bt_shm_peer_t *peer = &torrent->peers[slot];
+
+  bt_shm_mark_dirty(bucket, way, slot);
+  memcpy(peer->peer_id, peer_id, 20);
+  peer->ipv4_addr = peer_data->ipv4_addr;
+  peer->port = peer_data->port;
+  peer->seeder = is_seeder;
+  peer->last_seen = now;
+  peer->used = 1;
+
+  torrent->last_seen = now;
+
+  bt_shm_unlock(bucket);
+
+  syslog(LOG_DEBUG, "Peer data stored successfully");
+}
+
+void
+bt_shm_remove_peer(const bt_config_t *config, const int8_t *info_hash,
+                   const int8_t *peer_id)
+{
+  uint32_t cutoff = time(NULL) - config->announce_peer_ttl;
+  uint32_t index = bt_shm_bucket_index(info_hash);
+  bt_shm_bucket_t *bucket = bt_shm_lock(index);
+
+  int way = bt_shm_find_torrent(bucket, index, info_hash, cutoff, false);
+  int slot = way < 0 ? -1
+    : bt_shm_find_peer(bt_shm_torrent(index, way), peer_id, cutoff);
+
+  if (slot >= 0) {
+    bt_shm_torrent(index, way)->peers[slot].used = 0;
+    syslog(LOG_DEBUG, "Peer data removed successfully");
+  } else {
+    syslog(LOG_ERR, "Cannot remove peer data");
+  }
+
+  bt_shm_unlock(bucket);
+}
+
+bool
+bt_shm_promote_peer(const bt_config_t *config, const int8_t *info_hash,
+                    const int8_t *peer_id)
+{
+  uint32_t now = time(NULL);
+  uint32_t cutoff = now - config->announce_peer_ttl;
+  uint32_t index = bt_shm_bucket_index(info_hash);
+  bt_shm_bucket_t *bucket = bt_shm_lock(index);
+  bool promoted = false;
+
+  int way = bt_shm_find_torrent(bucket, index, info_hash, cutoff, false);
+  bt_shm_torrent_t *torrent = way < 0 ? NULL : bt_shm_torrent(index, way);
+  int slot = NULL == torrent ? -1 : bt_shm_find_peer(torrent, peer_id, cutoff);
+
+  if (slot >= 0 && !torrent->peers[slot].seeder) {
+    torrent->peers[slot].seeder = 1;
+    torrent->peers[slot].last_seen = now;
+    torrent->downloads++;
+    promoted = true;
+  }
+
+  bt_shm_unlock(bucket);
+
+  if (promoted) {
+    syslog(LOG_DEBUG, "Peer promoted from leecher to seeder");
+  } else {
+    syslog(LOG_ERR, "Cannot promote peer");
+  }
+
+  return promoted;
+}
+
+void
+bt_shm_get_torrent_stats(const bt_config_t *config, const int8_t *info_hash,
+                         bt_torrent_stats_t *stats)
+{
+  uint32_t cutoff = time(NULL) - config->announce_peer_ttl;
+  uint32_t index = bt_shm_bucket_index(info_hash);
+  bt_shm_bucket_t *bucket = bt_shm_lock(index);
+
+  stats->seeders = stats->leechers = stats->downloads = 0;
+
+  int way = bt_shm_find_torrent(bucket, index, info_hash, cutoff, false);
+
+  if (way >= 0) {
+    bt_shm_torrent_t *torrent = bt_shm_torrent(index, way);
+
+    for (uint32_t i = 0; i < bt_shm->header->peers_per_torrent; i++) {
+      bt_shm_peer_t *peer = &torrent->peers[i];
+
+      if (peer->used && peer->last_seen >= cutoff) {
+        if (peer->seeder) {
+          stats->seeders++;
+        } else {
+          stats->leechers++;
+        }
+      }
+    }
+
+    stats->downloads = torrent->downloads;
+  }
+
+  bt_shm_unlock(bucket);
+}
+
+bt_list *
+bt_shm_peer_list(const bt_config_t *config, const int8_t *info_hash,
+                 int32_t num_want, int *peer_count, bool seeder,
+                 int64_t group)
+{
+  uint32_t cutoff = time(NULL) - config->announce_peer_ttl;
+  uint32_t index = bt_shm_bucket_index(info_hash);
+  uint32_t slots = bt_shm->header->peers_per_torrent;
+  bt_list *list = NULL;
+  int count = 0;
+
+  /* Part of the peers come from the locality group of the requester. */
+  int32_t local_want = BT_LOCALITY_NONE == group
+    ? 0 : bt_locality_quota(config, num_want);
+  bool picked[slots];
+
+  bt_shm_bucket_t *bucket = bt_shm_lock(index);
+  int way = bt_shm_find_torrent(bucket, index, info_hash, cutoff, false);
+
+  if (way >= 0) {
+    bt_shm_torrent_t *torrent = bt_shm_torrent(index, way);
+
+    /* Starts at a random slot so all peers have a chance. */
+    uint32_t start = randr(0, slots - 1);
+
+    memset(picked, 0, sizeof(picked));
+
+    /* First pass for close peers, second pass for any peer. */
+    for (int pass = local_want > 0 ? 0 : 1; pass < 2; pass++) {
+      int32_t pass_want = 0 == pass ? local_want : num_want;
+
+      for (uint32_t i = 0; i < slots && count < pass_want; i++) {
+        uint32_t slot = (start + i) % slots;
+        bt_shm_peer_t *peer = &torrent->peers[slot];
+
+        if (!peer->used || peer->last_seen < cutoff || picked[slot] ||
+            (bool) peer->seeder != seeder) {
+          continue;
+        }
+
+        if (0 == pass && bt_locality_group(config, peer->ipv4_addr) != group) {
+          continue;
+        }
+
+        list = bt_list_prepend(list, bt_new_peer_addr(peer->ipv4_addr,
+                                                      peer->port));
+        picked[slot] = true;
+        count++;
+      }
+
+      if (0 == pass) {
+        bt_stats_add(BT_STAT_LOCAL_PEERS, count);
+      }
+    }
+  }
+
+  bt_shm_unlock(bucket);
+
+  *peer_count = count;
+  return list;
+}
+
+void
+bt_shm_foreach_torrent(const bt_config_t *config, bt_shm_torrent_fn fn,
+                       void *data)
+{
+  uint32_t cutoff = time(NULL) - config->announce_peer_ttl;
+  uint32_t slots = bt_shm->header->peers_per_torrent;
+
+  for (uint32_t index = 0; index < bt_shm->header->bucket_count; index++) {
+    int8_t info_hashes[BT_SHM_WAYS][20];
+    bt_torrent_stats_t stats[BT_SHM_WAYS];
+    int count = 0;
+
+    bt_shm_bucket_t *bucket = bt_shm_lock(index);
+
+    for (int way = 0; way < BT_SHM_WAYS; way++) {
+      bt_shm_torrent_t *torrent = bt_shm_torrent(index, way);
+
+      if (!torrent->used || torrent->last_seen < cutoff) {
+        continue;
+      }
+
+      bt_torrent_stats_t *torrent_stats = &stats[count];
+      torrent_stats->seeders = torrent_stats->leechers = 0;
+      torrent_stats->downloads = torrent->downloads;
+
+      for (uint32_t i = 0; i < slots; i++) {
+        bt_shm_peer_t *peer = &torrent->peers[i];
+
+        if (peer->used && peer->last_seen >= cutoff) {
+          if (peer->seeder) {
+            torrent_stats->seeders++;
+          } else {
+            torrent_stats->leechers++;
+          }
+        }
+      }
+
+      memcpy(info_hashes[count++], torrent->info_hash, 20);
+    }
+
+    bt_shm_unlock(bucket);
+
+    /* Called without the lock, so `fn` cannot stall other processes. */
+    for (int i = 0; i < count; i++) {
+      fn(info_hashes[i], &stats[i], data);
+    }
+  }
+}
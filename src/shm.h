@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BTTRACKER_SHM_H_
+#define BTTRACKER_SHM_H_
+
+/* Identifies an initialized table and its layout. */
+#define BT_SHM_MAGIC   (0x4254534857524d31ULL)
+#define BT_SHM_VERSION (1)
+
+/* Number of torrents held by each bucket. */
+#define BT_SHM_WAYS (4)
+
+/* Bounds the peer slots of a torrent, which lookups scan on the stack. */
+#define BT_SHM_MAX_PEERS_PER_TORRENT (4096)
+
+/* Alignment of the regions of the table, to keep buckets apart. */
+#define BT_SHM_ALIGN(size) (((size) + 63) & ~((size_t) 63))
+
+/*
+ * Swarm table in POSIX shared memory, shared by all tracker processes on a
+ * host. Torrents are hashed to buckets, each guarded by a robust
+ * process-shared mutex so a process dying while holding it does not block
+ * the others. Peers are never actively expired: those not seen for
+ * `PeerTTL` are ignored and their slots reused.
+ */
+typedef struct {
+  uint64_t magic;              // Set once the table is initialized
+  uint32_t version;
+  uint32_t bucket_count;
+  uint32_t peers_per_torrent;
+  uint32_t reserved;
+} bt_shm_header_t;
+
+/* Bucket lock, plus what was being written when it was last taken. */
+typedef struct {
+  pthread_mutex_t lock;
+  int32_t dirty_torrent;       // Way being written, -1 if none
+  int32_t dirty_peer;          // Peer slot being written, -1 if none
+} bt_shm_bucket_t;
+
+/* Peer slot. */
+typedef struct {
+  uint32_t ipv4_addr;
+  uint16_t port;
+  uint8_t seeder;
+  uint8_t used;
+  uint32_t last_seen;          // Unix time of its last announce
+  int8_t peer_id[20];
+} bt_shm_peer_t;
+
+/* Torrent slot, followed by `peers_per_torrent` peer slots. */
+typedef struct {
+  int8_t info_hash[20];
+  uint32_t used;
+  uint32_t downloads;
+  uint32_t last_seen;
+  bt_shm_peer_t peers[];
+} bt_shm_torrent_t;
+
+/* Creates or attaches to the table named in the configuration. */
+bool
+bt_shm_open(const bt_config_t *config);
+
+/* Detaches from the table. The table itself outlives the process. */
+void
+bt_shm_close(void);
+
+/* Adds or refreshes a peer in the swarm of a torrent. */
+void
+bt_shm_insert_peer(const bt_config_t *config, const int8_t *info_hash,
+                   const int8_t *peer_id, const bt_peer_t *peer_data,
+                   bool is_seeder);
+
+/* Removes a peer from the swarm of a torrent. */
+void
+bt_shm_remove_peer(const bt_config_t *config, const int8_t *info_hash,
+                   const int8_t *peer_id);
+
+/*
+ * Turns a leecher into a seeder and counts the download. Returns false if
+ * the peer was unknown.
+ */
+bool
+bt_shm_promote_peer(const bt_config_t *config, const int8_t *info_hash,
+                    const int8_t *peer_id);
+
+/* Fills `stats` with the number of live peers and downloads of a torrent. */
+void
+bt_shm_get_torrent_stats(const bt_config_t *config, const int8_t *info_hash,
+                         bt_torrent_stats_t *stats);
+
+/*
+ * Returns a random subset of the live leechers or seeders of a torrent, part
+ * of them from locality group `group` unless it is BT_LOCALITY_NONE.
+ */
+bt_list *
+bt_shm_peer_list(const bt_config_t *config, const int8_t *info_hash,
+                 int32_t num_want, int *peer_count, bool seeder,
+                 int64_t group);
+
+/* Function called with the stats of each torrent of the table. */
+typedef void (*bt_shm_torrent_fn)(const int8_t *info_hash,
+                                  const bt_torrent_stats_t *stats, void *data);
+
+/* Calls `fn` for every live torrent of the table, one bucket at a time. */
+void
+bt_shm_foreach_torrent(const bt_config_t *config, bt_shm_torrent_fn fn,
+                       void *data);
+
+#endif // BTTRACKER_SHM_H_
@@ -0,0 +1,635 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Snapshot mapped at startup. */
+typedef struct {
+  void *map;
+  size_t size;
+  const bt_snapshot_header_t *header;
+  const bt_snapshot_torrent_t *torrents;
+  const bt_snapshot_peer_t *peers;
+} bt_snapshot_t;
+
+static bt_snapshot_t *bt_snapshot = NULL;
+
+/* Peer collected while writing a snapshot. */
+typedef struct {
+  int8_t info_hash[20];
+  bool seeder;
+  bt_snapshot_peer_t peer;
+} bt_snapshot_entry_t;
+
+/* Growable array of collected peers. */
+typedef struct {
+  bt_snapshot_entry_t *entries;
+  size_t length;
+  size_t capacity;
+} bt_snapshot_entries_t;
+
+/*
+ * Checks that the counts in the header match the size of the file, and that
+ * the peers of every torrent lie within the file.
+ */
+bool
+bt_snapshot_valid(const bt_snapshot_header_t *header, size_t size)
+{
+  if (memcmp(header->magic, BT_SNAPSHOT_MAGIC, 8) != 0 ||
+      header->version != BT_SNAPSHOT_VERSION ||
+      header->byte_order != BT_SNAPSHOT_BYTE_ORDER) {
+    return false;
+  }
+
+  /* Divides rather than multiplies, so that huge counts cannot overflow. */
+  size_t left = size - sizeof(bt_snapshot_header_t);
+
+  if (header->torrent_count > left / sizeof(bt_snapshot_torrent_t)) {
+    return false;
+  }
+
+  left -= header->torrent_count * sizeof(bt_snapshot_torrent_t);
+
+  if (header->peer_count != left / sizeof(bt_snapshot_peer_t) ||
+      0 != left % sizeof(bt_snapshot_peer_t)) {
+    return false;
+  }
+
+  const bt_snapshot_torrent_t *torrents =
+    (const bt_snapshot_torrent_t *) (header + 1);
+
+  for (uint64_t i = 0; i < header->torrent_count; i++) {
+    uint64_t peers = (uint64_t) torrents[i].seeders + torrents[i].leechers;
+
+    if (torrents[i].first_peer > header->peer_count ||
+        peers > header->peer_count - torrents[i].first_peer) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool
+bt_load_snapshot(const bt_config_t *config)
+{
+  if (NULL == config->snapshot_path || '\0' == config->snapshot_path[0]) {
+    return false;
+  }
+
+  int fd = open(config->snapshot_path, O_RDONLY);
+
+  if (-1 == fd) {
+    syslog(LOG_INFO, "No snapshot found at %s", config->snapshot_path);
+    return false;
+  }
+
+  struct stat st;
+
+  if (fstat(fd, &st) == -1 || st.st_size < sizeof(bt_snapshot_header_t)) {
+    syslog(LOG_ERR, "Invalid snapshot file");
+    close(fd);
+    return false;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (MAP_FAILED == map) {
+    syslog(LOG_ERR, "Cannot map snapshot file");
+    return false;
+  }
+
+  const bt_snapshot_header_t *header = (const bt_snapshot_header_t *) map;
+
+  if (!bt_snapshot_valid(header, st.st_size)) {
+    syslog(LOG_ERR, "Ignoring incompatible snapshot file");
+    munmap(map, st.st_size);
+    return false;
+  }
+
+  /* Nothing in it would be served anyway. */
+  if (header->newest_seen < (int64_t) time(NULL) - config->announce_peer_ttl) {
+    syslog(LOG_INFO, "Ignoring stale snapshot file");
+    munmap(map, st.st_size);
+    return false;
+  }
+
+  bt_snapshot_t *snapshot = (bt_snapshot_t *) malloc(sizeof(bt_snapshot_t));
+
+  if (NULL == snapshot) {
+    syslog(LOG_ERR, "Cannot allocate memory for snapshot");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  snapshot->map = map;
+  snapshot->size = st.st_size;
+  snapshot->header = header;
+  snapshot->torrents = (const bt_snapshot_torrent_t *) (header + 1);
+  snapshot->peers = (const bt_snapshot_peer_t *)
+    (snapshot->torrents + header->torrent_count);
+
+  /* Pages are faulted in as torrents are looked up. */
+  madvise(map, st.st_size, MADV_RANDOM);
+
+  bt_snapshot = snapshot;
+
+  syslog(LOG_INFO, "Loaded snapshot with %" PRIu64 " torrents and %" PRIu64
+         " peers", header->torrent_count, header->peer_count);
+
+  return true;
+}
+
+void
+bt_free_snapshot(void)
+{
+  if (NULL != bt_snapshot) {
+    munmap(bt_snapshot->map, bt_snapshot->size);
+    free(bt_snapshot);
+    bt_snapshot = NULL;
+  }
+}
+
+const bt_snapshot_torrent_t *
+bt_snapshot_find(const bt_config_t *config, const int8_t *info_hash)
+{
+  bt_snapshot_t *snapshot = bt_snapshot;
+
+  if (NULL == snapshot) {
+    return NULL;
+  }
+
+  /* Served only until its most recent peer would have expired. */
+  if (snapshot->header->newest_seen <
+      (int64_t) time(NULL) - config->announce_peer_ttl) {
+    return NULL;
+  }
+
+  size_t low = 0, high = snapshot->header->torrent_count;
+
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    int cmp = memcmp(snapshot->torrents[mid].info_hash, info_hash, 20);
+
+    if (0 == cmp) {
+      return &snapshot->torrents[mid];
+    } else if (cmp < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  return NULL;
+}
+
+/* Returns whether an address is already part of a peer list. */
+bool
+bt_peer_list_contains(bt_list *peers, uint32_t ipv4_addr, uint16_t port)
+{
+  for (bt_list *it = peers; it != NULL; it = bt_list_next(it)) {
+    bt_peer_addr_t *addr = (bt_peer_addr_t *) it->data;
+
+    if ((uint32_t) addr->ipv4_addr == ipv4_addr && addr->port == port) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bt_list *
+bt_snapshot_complement(const bt_config_t *config, const int8_t *info_hash,
+                       bt_list *peers, int *peer_count, int32_t num_want)
+{
+  const bt_snapshot_torrent_t *torrent = bt_snapshot_find(config, info_hash);
+
+  if (NULL == torrent || *peer_count >= num_want) {
+    return peers;
+  }
+
+  uint32_t total = torrent->seeders + torrent->leechers;
+  uint32_t cutoff = time(NULL) - config->announce_peer_ttl;
+
+  if (0 == total) {
+    return peers;
+  }
+
+  /* Starts at a random peer so all of them have a chance. */
+  uint32_t start = randr(0, total - 1);
+
+  for (uint32_t i = 0; i < total && *peer_count < num_want; i++) {
+    const bt_snapshot_peer_t *peer =
+      &bt_snapshot->peers[torrent->first_peer + (start + i) % total];
+
+    if (peer->last_seen < cutoff ||
+        bt_peer_list_contains(peers, peer->ipv4_addr, peer->port)) {
+      continue;
+    }
+
+    peers = bt_list_prepend(peers, bt_new_peer_addr(peer->ipv4_addr,
+                                                    peer->port));
+    (*peer_count)++;
+  }
+
+  return peers;
+}
+
+void
+bt_snapshot_merge_stats(const bt_config_t *config, const int8_t *info_hash,
+                        bt_torrent_stats_t *stats)
+{
+  const bt_snapshot_torrent_t *torrent = bt_snapshot_find(config, info_hash);
+
+  if (NULL != torrent) {
+    stats->seeders = MAX(stats->seeders, (int32_t) torrent->seeders);
+    stats->leechers = MAX(stats->leechers, (int32_t) torrent->leechers);
+    stats->downloads = MAX(stats->downloads, (int32_t) torrent->downloads);
+  }
+}
+
+/* Appends a peer to the array of collected peers. */
+void
+bt_snapshot_entries_append(bt_snapshot_entries_t *entries,
+                           const bt_snapshot_entry_t *entry)
+{
+  if (entries->length == entries->capacity) {
+    entries->capacity = MAX(1024, entries->capacity * 2);
+    entries->entries = (bt_snapshot_entry_t *)
+      realloc(entries->entries, entries->capacity * sizeof(bt_snapshot_entry_t));
+
+    if (NULL == entries->entries) {
+      syslog(LOG_ERR, "Cannot allocate memory for snapshot");
+      exit(BT_EXIT_MALLOC_ERROR);
+    }
+  }
+
+  entries->entries[entries->length++] = *entry;
+}
+
+/* Orders peers by info hash, seeders first. */
+int
+bt_snapshot_entry_cmp(const void *a, const void *b)
+{
+  const bt_snapshot_entry_t *x = (const bt_snapshot_entry_t *) a;
+  const bt_snapshot_entry_t *y = (const bt_snapshot_entry_t *) b;
+  int cmp = memcmp(x->info_hash, y->info_hash, 20);
+
+  return 0 != cmp ? cmp : (int) y->seeder - (int) x->seeder;
+}
+
+/*
+ * Collects the live peers of a sorted set of peers. Returns false if Redis
+ * stopped answering.
+ */
+bool
+bt_snapshot_collect_set(redisContext *redis, const bt_config_t *config,
+                        const char *key, size_t key_len, long long cutoff,
+                        bt_snapshot_entries_t *entries)
+{
+  const bt_key_names_t *names = bt_key_names(config);
+  size_t batch_size = MAX(1, config->announce_reaper_batch_size);
+  size_t base_len = bt_swarm_key_base_len(key, key_len);
+
+  /* Recovers the info hash and the kind of peers held by the set. */
+  bt_snapshot_entry_t entry;
+
+  if (!bt_swarm_parse_key(config, key, key_len, entry.info_hash,
+                          &entry.seeder)) {
+    return true;
+  }
+
+  /* The hash of addresses sits next to the set. */
+  size_t addrs_key_len = base_len + strlen(names->addrs);
+  char *addrs_key = (char *) malloc(addrs_key_len);
+  const char **argv = (const char **) malloc((batch_size + 2) * sizeof(char *));
+  size_t *argvlen = (size_t *) malloc((batch_size + 2) * sizeof(size_t));
+
+  if (NULL == addrs_key || NULL == argv || NULL == argvlen) {
+    syslog(LOG_ERR, "Cannot allocate memory for snapshot");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  memcpy(addrs_key, key, base_len);
+  memcpy(addrs_key + base_len, names->addrs, strlen(names->addrs));
+
+  bool succeeded = true;
+
+  /*
+   * Pages by score rather than by offset, which Redis would have to walk
+   * from the start every time: each page starts at the score of the last
+   * member read, skipping the members with that score already read.
+   */
+  long long min_score = cutoff, skip = 0;
+
+  while (true) {
+    redisReply *members = bt_redis_command(redis, "ZRANGEBYSCORE %b %lld +inf "
+                                           "WITHSCORES LIMIT %lld %lld",
+                                           key, key_len, min_score, skip,
+                                           (long long) batch_size);
+
+    if (NULL == members) {
+      succeeded = false;
+      break;
+    }
+
+    /* Members and scores alternate in the reply. */
+    size_t count = REDIS_REPLY_ARRAY == members->type
+      ? members->elements / 2 : 0;
+
+    if (0 == count) {
+      freeReplyObject(members);
+      break;
+    }
+
+    argv[0] = "HMGET";
+    argvlen[0] = 5;
+    argv[1] = addrs_key;
+    argvlen[1] = addrs_key_len;
+
+    for (size_t i = 0; i < count; i++) {
+      argv[i + 2] = members->element[2 * i]->str;
+      argvlen[i + 2] = members->element[2 * i]->len;
+    }
+
+    redisReply *values = bt_redis_command_argv(redis, count + 2, argv, argvlen);
+
+    if (NULL == values) {
+      freeReplyObject(members);
+      succeeded = false;
+      break;
+    }
+
+    for (size_t i = 0; REDIS_REPLY_ARRAY == values->type &&
+           i < values->elements && i < count; i++) {
+      redisReply *value = values->element[i];
+      bt_peer_addr_t *addr = REDIS_REPLY_STRING == value->type
+        ? bt_read_peer_value(config, value->str, value->len) : NULL;
+
+      if (NULL == addr) {
+        continue;
+      }
+
+      entry.peer.ipv4_addr = addr->ipv4_addr;
+      entry.peer.port = addr->port;
+      entry.peer.reserved = 0;
+      entry.peer.last_seen = strtoul(members->element[2 * i + 1]->str,
+                                     NULL, 10);
+      free(addr);
+
+      bt_snapshot_entries_append(entries, &entry);
+    }
+
+    freeReplyObject(values);
+
+    /* Scores are announce times, so many members share the last one. */
+    long long last_score = strtoll(members->element[2 * count - 1]->str,
+                                   NULL, 10);
+    size_t ties = 0;
+
+    for (size_t i = count; i > 0; i--, ties++) {
+      if (strtoll(members->element[2 * i - 1]->str, NULL, 10) != last_score) {
+        break;
+      }
+    }
+
+    freeReplyObject(members);
+
+    if (count < batch_size) {
+      break;
+    }
+
+    skip = last_score == min_score ? skip + count : (long long) ties;
+    min_score = last_score;
+  }
+
+  free(argvlen);
+  free(argv);
+  free(addrs_key);
+
+  return succeeded;
+}
+
+/* Fills the download counters of the torrents, pipelining the reads. */
+void
+bt_snapshot_fill_downloads(redisContext *redis, const bt_config_t *config,
+                           bt_snapshot_torrent_t *torrents, size_t count)
+{
+  size_t batch_size = MAX(1, config->announce_reaper_batch_size);
+  const char *torrent_ns = bt_key_names(config)->torrent;
+
+  for (size_t start = 0; start < count; start += batch_size) {
+    size_t end = MIN(count, start + batch_size);
+
+    for (size_t i = start; i < end; i++) {
+      bt_info_hash_key_t info_hash_key;
+      bt_info_hash_key(config, torrents[i].info_hash, &info_hash_key);
+
+      bt_redis_append_command(redis, "HGET %s:%s:%b downs",
+                              config->redis_key_prefix, torrent_ns,
+                              info_hash_key.str, info_hash_key.len);
+    }
+
+    for (size_t i = start; i < end; i++) {
+      redisReply *reply;
+      torrents[i].downloads = 0;
+
+      if (bt_redis_get_reply(redis, (void **) &reply) != REDIS_OK) {
+        return;
+      }
+
+      if (REDIS_REPLY_STRING == reply->type) {
+        torrents[i].downloads = strtoul(reply->str, NULL, 10);
+      }
+
+      freeReplyObject(reply);
+    }
+  }
+}
+
+bool
+bt_write_snapshot(redisContext *redis, const bt_config_t *config,
+                  const char *path)
+{
+  long long cutoff = (long long) time(NULL) - config->announce_peer_ttl;
+  bt_snapshot_entries_t entries = { NULL, 0, 0 };
+  char *pattern = bt_peer_key_pattern(config);
+  char cursor[32] = "0";
+
+  /* Collects the live peers of all swarms. */
+  do {
+    redisReply *reply =
+      bt_redis_command(redis, "SCAN %s MATCH %s COUNT %u TYPE zset",
+                       cursor, pattern,
+                       MAX(1, config->announce_reaper_batch_size));
+
+    if (NULL == reply || REDIS_REPLY_ARRAY != reply->type ||
+        2 != reply->elements) {
+      syslog(LOG_ERR, "Cannot scan peer sets");
+      if (NULL != reply) {
+        freeReplyObject(reply);
+      }
+      free(entries.entries);
+      free(pattern);
+      return false;
+    }
+
+    snprintf(cursor, sizeof(cursor), "%s", reply->element[0]->str);
+
+    redisReply *keys = reply->element[1];
+
+    for (size_t i = 0; i < keys->elements; i++) {
+      if (!bt_snapshot_collect_set(redis, config, keys->element[i]->str,
+                                   keys->element[i]->len, cutoff, &entries)) {
+        syslog(LOG_ERR, "Got a NULL reply from Redis");
+        freeReplyObject(reply);
+        free(entries.entries);
+        free(pattern);
+        return false;
+      }
+    }
+
+    freeReplyObject(reply);
+  } while (strcmp(cursor, "0") != 0);
+
+  free(pattern);
+
+  qsort(entries.entries, entries.length, sizeof(bt_snapshot_entry_t),
+        bt_snapshot_entry_cmp);
+
+  /* Groups the peers by torrent. */
+  bt_snapshot_torrent_t *torrents = NULL;
+  size_t torrent_count = 0, torrent_capacity = 0;
+  int64_t newest_seen = 0;
+
+  for (size_t i = 0; i < entries.length; i++) {
+    bt_snapshot_entry_t *entry = &entries.entries[i];
+
+    if (0 == torrent_count || memcmp(torrents[torrent_count - 1].info_hash,
+                                     entry->info_hash, 20) != 0) {
+      if (torrent_count == torrent_capacity) {
+        torrent_capacity = MAX(1024, torrent_capacity * 2);
+        torrents = (bt_snapshot_torrent_t *)
+          realloc(torrents, torrent_capacity * sizeof(bt_snapshot_torrent_t));
+
+        if (NULL == torrents) {
+          syslog(LOG_ERR, "Cannot allocate memory for snapshot");
+          exit(BT_EXIT_MALLOC_ERROR);
+        }
+      }
+
+      bt_snapshot_torrent_t *torrent = &torrents[torrent_count++];
+      memset(torrent, 0, sizeof(bt_snapshot_torrent_t));
+      memcpy(torrent->info_hash, entry->info_hash, 20);
+      torrent->first_peer = i;
+    }
+
+    if (entry->seeder) {
+      torrents[torrent_count - 1].seeders++;
+    } else {
+      torrents[torrent_count - 1].leechers++;
+    }
+
+    newest_seen = MAX(newest_seen, (int64_t) entry->peer.last_seen);
+  }
+
+  bt_snapshot_fill_downloads(redis, config, torrents, torrent_count);
+
+  bt_snapshot_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, BT_SNAPSHOT_MAGIC, 8);
+  header.version = BT_SNAPSHOT_VERSION;
+  header.byte_order = BT_SNAPSHOT_BYTE_ORDER;
+  header.created_at = time(NULL);
+  header.newest_seen = newest_seen;
+  header.torrent_count = torrent_count;
+  header.peer_count = entries.length;
+
+  /* Written aside and renamed, so readers never see a partial file. */
+  char tmp_path[PATH_MAX];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+  FILE *file = fopen(tmp_path, "wb");
+  bool succeeded = NULL != file &&
+    fwrite(&header, sizeof(header), 1, file) == 1 &&
+    fwrite(torrents, sizeof(bt_snapshot_torrent_t), torrent_count,
+           file) == torrent_count;
+
+  for (size_t i = 0; succeeded && i < entries.length; i++) {
+    succeeded = fwrite(&entries.entries[i].peer, sizeof(bt_snapshot_peer_t),
+                       1, file) == 1;
+  }
+
+  if (NULL != file) {
+    succeeded = fflush(file) == 0 && fsync(fileno(file)) == 0 && succeeded;
+    succeeded = fclose(file) == 0 && succeeded;
+  }
+
+  if (succeeded && rename(tmp_path, path) == -1) {
+    succeeded = false;
+  }
+
+  if (succeeded) {
+    syslog(LOG_INFO, "Wrote snapshot with %zu torrents and %zu peers",
+           torrent_count, entries.length);
+  } else {
+    syslog(LOG_ERR, "Cannot write snapshot to %s", path);
+    unlink(tmp_path);
+  }
+
+  free(torrents);
+  free(entries.entries);
+
+  return succeeded;
+}
+
+void *
+bt_snapshot_thread(void *data)
+{
+  bt_config_t *config = (bt_config_t *) data;
+  redisContext *redis = NULL;
+
+  while (true) {
+    sleep(MAX(1, config->snapshot_interval));
+
+    if (NULL == redis) {
+      redis = bt_redis_connect(config->redis_socket_path, config->redis_host,
+                               config->redis_port,
+                               config->redis_timeout * 1000, config->redis_db);
+    }
+
+    if (NULL != redis &&
+        !bt_write_snapshot(redis, config, config->snapshot_path) &&
+        redis->err) {
+      redisFree(redis);
+      redis = NULL;
+    }
+  }
+
+  return NULL;
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BTTRACKER_SNAPSHOT_H_
+#define BTTRACKER_SNAPSHOT_H_
+
+/* Identifies snapshot files and their layout. */
+#define BT_SNAPSHOT_MAGIC   "BTSNAP\0\0"
+#define BT_SNAPSHOT_VERSION (1)
+
+/* Written by the host that created the file, to detect foreign ones. */
+#define BT_SNAPSHOT_BYTE_ORDER (0x01020304)
+
+/*
+ * Snapshot file layout: this header, then the torrents sorted by info hash,
+ * then the peers of each torrent, seeders first. Integers are stored in the
+ * byte order of the host.
+ */
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  int64_t created_at;     // Unix time
+  int64_t newest_seen;    // Most recent announce in the file
+  uint64_t torrent_count;
+  uint64_t peer_count;
+} bt_snapshot_header_t;
+
+/* Torrent entry of a snapshot. */
+typedef struct {
+  int8_t info_hash[20];
+  uint32_t downloads;
+  uint64_t first_peer;    // Index of its first peer
+  uint32_t seeders;
+  uint32_t leechers;
+} bt_snapshot_torrent_t;
+
+/* Peer entry of a snapshot. */
+typedef struct {
+  uint32_t ipv4_addr;
+  uint32_t last_seen;     // Unix time of its last announce
+  uint16_t port;
+  uint16_t reserved;
+} bt_snapshot_peer_t;
+
+/*
+ * Maps the snapshot file set in the configuration, if any, so announces and
+ * scrapes can be answered from it while the swarms are being rebuilt.
+ * Returns false if there is no usable snapshot.
+ */
+bool
+bt_load_snapshot(const bt_config_t *config);
+
+/* Unmaps the snapshot loaded by `bt_load_snapshot()`. */
+void
+bt_free_snapshot(void);
+
+/* Returns the snapshot entry of a torrent, or NULL. */
+const bt_snapshot_torrent_t *
+bt_snapshot_find(const bt_config_t *config, const int8_t *info_hash);
+
+/*
+ * Appends to `peers` live peers of a torrent found in the snapshot, up to
+ * `num_want` peers in total, skipping those already in the list.
+ */
+bt_list *
+bt_snapshot_complement(const bt_config_t *config, const int8_t *info_hash,
+                       bt_list *peers, int *peer_count, int32_t num_want);
+
+/* Raises the counters in `stats` to those found in the snapshot. */
+void
+bt_snapshot_merge_stats(const bt_config_t *config, const int8_t *info_hash,
+                        bt_torrent_stats_t *stats);
+
+/* Writes a snapshot of all swarms to `path`. */
+bool
+bt_write_snapshot(redisContext *redis, const bt_config_t *config,
+                  const char *path);
+
+/*
+ * Thread that periodically writes a snapshot. The argument `data` is a
+ * pointer to the `bt_config_t` object.
+ */
+void *
+bt_snapshot_thread(void *data);
+
+#endif // BTTRACKER_SNAPSHOT_H_
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+void
+bt_spin_init(bt_spin_t *spin, uint32_t window, bt_stat stat)
+{
+  spin->window = window;
+  spin->since = 0;
+  spin->until = 0;
+  spin->stat = stat;
+}
+
+void
+bt_spin_begin(bt_spin_t *spin)
+{
+  if (spin->window > 0) {
+    spin->since = g_get_monotonic_time();
+    spin->until = spin->since + spin->window;
+  }
+}
+
+bool
+bt_spin_active(bt_spin_t *spin)
+{
+  if (0 == spin->until) {
+    return false;
+  }
+
+  if (g_get_monotonic_time() < spin->until) {
+    return true;
+  }
+
+  bt_stats_add(spin->stat, spin->until - spin->since);
+  spin->until = 0;
+
+  return false;
+}
+
+void
+bt_spin_end(bt_spin_t *spin)
+{
+  if (0 != spin->until) {
+    bt_stats_add(spin->stat, g_get_monotonic_time() - spin->since);
+    bt_stats_inc(BT_STAT_SPIN_HITS);
+    spin->until = 0;
+  }
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BTTRACKER_SPIN_H_
+#define BTTRACKER_SPIN_H_
+
+/*
+ * Window during which a thread that just finished some work keeps polling
+ * for more without blocking, so that work arriving shortly after is picked
+ * up without the latency of a wake-up. The time spent polling is added to
+ * a counter, as it is CPU burnt for nothing when no work comes.
+ */
+typedef struct {
+  int64_t window;  // Length of the window in microseconds, 0 to never spin
+  int64_t since;   // When the current window started
+  int64_t until;   // When the current window ends, 0 if not spinning
+  bt_stat stat;    // Counter of the time spent spinning
+} bt_spin_t;
+
+/* Initializes a spin window of `window` microseconds. */
+void
+bt_spin_init(bt_spin_t *spin, uint32_t window, bt_stat stat);
+
+/* Opens the window, as some work was just done. */
+void
+bt_spin_begin(bt_spin_t *spin);
+
+/*
+ * Returns true while the window is open. Once it closes, accounts for the
+ * time spent in it and returns false, so the caller can block.
+ */
+bool
+bt_spin_active(bt_spin_t *spin);
+
+/* Closes the window, as work showed up while it was open. */
+void
+bt_spin_end(bt_spin_t *spin);
+
+#endif // BTTRACKER_SPIN_H_
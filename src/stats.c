@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Current value of each counter. */
+static volatile int64_t bt_stats[BT_STAT_COUNT];
+
+void
+bt_stats_add(bt_stat stat, int64_t value)
+{
+  __sync_fetch_and_add(&bt_stats[stat], value);
+}
+
+void
+bt_stats_set(bt_stat stat, int64_t value)
+{
+  __atomic_store_n(&bt_stats[stat], value, __ATOMIC_RELAXED);
+}
+
+void
+bt_stats_average(bt_stat stat, int64_t sample)
+{
+  int64_t average = __atomic_load_n(&bt_stats[stat], __ATOMIC_RELAXED);
+
+  /* Samples lost to concurrent updates do not matter for an average. */
+  average = 0 == average ? sample : average + (sample - average) / 8;
+  __atomic_store_n(&bt_stats[stat], average, __ATOMIC_RELAXED);
+}
+
+int64_t
+bt_stats_get(bt_stat stat)
+{
+  return __sync_fetch_and_add(&bt_stats[stat], 0);
+}
+
+const char *
+bt_stat_str(bt_stat stat)
+{
+  switch (stat) {
+  case BT_STAT_RECEIVED:     return "received";
+  case BT_STAT_RATE_LIMITED: return "rate_limited";
+  case BT_STAT_QUEUE_FULL:   return "queue_full";
+  case BT_STAT_EXPIRED:      return "expired";
+  case BT_STAT_PROCESSED:    return "processed";
+  case BT_STAT_REAPED:       return "reaped";
+  case BT_STAT_PEER_WRITES:  return "peer_writes";
+  case BT_STAT_PEER_REFRESHES: return "peer_refreshes";
+  case BT_STAT_RECEIVE_SPIN: return "receive_spin_us";
+  case BT_STAT_WORKER_SPIN:  return "worker_spin_us";
+  case BT_STAT_SPIN_HITS:    return "spin_hits";
+  case BT_STAT_CACHE_HITS:   return "cache_hits";
+  case BT_STAT_CACHE_MERGED: return "cache_merged";
+  case BT_STAT_LOCAL_PEERS:  return "local_peers";
+  case BT_STAT_HOT_HITS:     return "hot_cache_hits";
+  case BT_STAT_MERGED_DOWNLOADS: return "merged_downloads";
+  case BT_STAT_STALE_ANSWERS: return "stale_answers";
+  case BT_STAT_KNOWN_HITS:   return "known_hits";
+  case BT_STAT_DROPPED_WRITES: return "dropped_writes";
+  case BT_STAT_QUEUED_CONNECT:  return "queued_connect";
+  case BT_STAT_QUEUED_ANNOUNCE: return "queued_announce";
+  case BT_STAT_QUEUED_SCRAPE:   return "queued_scrape";
+  case BT_STAT_QUEUED_OTHER:    return "queued_other";
+  case BT_STAT_REDIS_LATENCY:   return "redis_latency_us";
+  case BT_STAT_ANNOUNCE_INTERVAL: return "announce_interval";
+  case BT_STAT_KERNEL_DROPS:    return "kernel_drops";
+  case BT_STAT_HOT_SWARMS:      return "hot_swarms";
+  case BT_STAT_BREAKER_OPEN:    return "breaker_open";
+  case BT_STAT_BUFFERED_WRITES: return "buffered_writes";
+  default:                   return "unknown";
+  }
+}
+
+void *
+bt_stats_report_thread(void *data)
+{
+  bt_config_t *config = (bt_config_t *) data;
+
+  while (true) {
+    sleep(config->bttracker_stats_interval);
+
+    bt_filter_update_stats();
+    GString *line = g_string_new("Stats:");
+
+    for (int i = 0; i < BT_STAT_COUNT; i++) {
+      g_string_append_printf(line, " %s=%" PRId64, bt_stat_str(i),
+                             bt_stats_get(i));
+    }
+
+    syslog(LOG_INFO, "%s", line->str);
+    g_string_free(line, true);
+  }
+
+  return NULL;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BTTRACKER_STATS_H_
+#define BTTRACKER_STATS_H_
+
+/* Counters kept by the tracker. */
+typedef enum {
+  BT_STAT_RECEIVED,     // Datagrams read from the socket
+  BT_STAT_RATE_LIMITED, // Datagrams over the budget of their source
+  BT_STAT_QUEUE_FULL,   // Datagrams dropped because the queue was full
+  BT_STAT_EXPIRED,      // Jobs dropped because they waited for too long
+  BT_STAT_PROCESSED,    // Jobs handled by the worker threads
+  BT_STAT_REAPED,       // Stale peers removed by the reaper
+  BT_STAT_PEER_WRITES,  // Announces that wrote the whole peer
+  BT_STAT_PEER_REFRESHES, // Announces that only extended a peer's life
+  BT_STAT_RECEIVE_SPIN, // Microseconds the receiver spent polling the socket
+  BT_STAT_WORKER_SPIN,  // Microseconds the workers spent polling their queues
+  BT_STAT_SPIN_HITS,    // Datagrams and jobs found while spinning
+  BT_STAT_CACHE_HITS,   // Retransmits answered from the response cache
+  BT_STAT_CACHE_MERGED, // Retransmits left to the original request
+  BT_STAT_LOCAL_PEERS,  // Peers handed out from the requester's group
+  BT_STAT_HOT_HITS,     // Stats and peer lists read from the hot swarm cache
+  BT_STAT_MERGED_DOWNLOADS, // Downloads counted along with an earlier one
+  BT_STAT_STALE_ANSWERS, // Requests answered while Redis was left alone
+  BT_STAT_KNOWN_HITS,   // Stale stats and peer lists last known by a worker
+  BT_STAT_DROPPED_WRITES, // Writes lost because the replay buffer was full
+
+  // Gauges
+  BT_STAT_QUEUED_CONNECT,  // Connect requests waiting for a thread
+  BT_STAT_QUEUED_ANNOUNCE, // Announce requests waiting for a thread
+  BT_STAT_QUEUED_SCRAPE,   // Scrape requests waiting for a thread
+  BT_STAT_QUEUED_OTHER,    // Unknown requests waiting for a thread
+  BT_STAT_REDIS_LATENCY,   // Moving average of a Redis round trip, in us
+  BT_STAT_ANNOUNCE_INTERVAL, // Announce interval before jitter, in seconds
+  BT_STAT_KERNEL_DROPS,    // Datagrams dropped by the kernel on the socket
+  BT_STAT_HOT_SWARMS,      // Swarms in the hot list
+  BT_STAT_BREAKER_OPEN,    // Whether Redis is being left alone
+  BT_STAT_BUFFERED_WRITES, // Writes waiting for Redis to come back
+  BT_STAT_COUNT
+} bt_stat;
+
+/* Increments a counter by `value`. Safe to call from any thread. */
+void
+bt_stats_add(bt_stat stat, int64_t value);
+
+/* Sets the current value of a gauge. */
+void
+bt_stats_set(bt_stat stat, int64_t value);
+
+/* Folds a sample into a gauge that holds a moving average. */
+void
+bt_stats_average(bt_stat stat, int64_t sample);
+
+/* Increments a counter by one. */
+#define bt_stats_inc(stat) bt_stats_add(stat, 1)
+
+/* Returns the current value of a counter. */
+int64_t
+bt_stats_get(bt_stat stat);
+
+/* Returns a string representation of the given counter. */
+const char *
+bt_stat_str(bt_stat stat);
+
+/*
+ * Thread that logs all counters every few seconds. The argument `data` is a
+ * pointer to the `bt_config_t` object.
+ */
+void *
+bt_stats_report_thread(void *data);
+
+#endif // BTTRACKER_STATS_H_
@@ -0,0 +1,737 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+size_t
+bt_swarm_key_base_len(const char *key, size_t key_len)
+{
+  size_t base_len = key_len;
+
+  /* Set names never contain colons, unlike binary info hashes. */
+  while (base_len > 0 && key[base_len - 1] != ':') {
+    base_len--;
+  }
+
+  return base_len;
+}
+
+bool
+bt_swarm_parse_key(const bt_config_t *config, const char *key, size_t key_len,
+                   int8_t *info_hash, bool *seeder)
+{
+  const bt_key_names_t *names = bt_key_names(config);
+  size_t prefix_len = strlen(config->redis_key_prefix) +
+    strlen(names->peer) + 2;
+  size_t base_len = bt_swarm_key_base_len(key, key_len);
+
+  if (base_len <= prefix_len) {
+    return false;
+  }
+
+  const char *info_hash_str = key + prefix_len;
+  size_t info_hash_len = base_len - prefix_len - 1;
+
+  if (BT_KEY_SCHEMA_COMPACT == config->redis_key_schema) {
+    if (20 != info_hash_len) {
+      return false;
+    }
+    memcpy(info_hash, info_hash_str, 20);
+  } else if (!bt_hexarray_to_bytearray(info_hash_str, info_hash_len,
+                                       info_hash)) {
+    return false;
+  }
+
+  *seeder = key_len - base_len == strlen(names->seeder) &&
+    memcmp(key + base_len, names->seeder, key_len - base_len) == 0;
+
+  return true;
+}
+
+/* Returns the oldest announce time of a live peer. */
+int64_t
+bt_swarm_cutoff(const bt_config_t *config)
+{
+  return (int64_t) time(NULL) - config->announce_peer_ttl;
+}
+
+int
+bt_swarm_append_local(redisContext *redis, const bt_config_t *config,
+                      const bt_info_hash_key_t *info_hash_key,
+                      const int8_t *peer_id, uint32_t ipv4_addr,
+                      bool is_seeder, bool trim)
+{
+  const bt_key_names_t *names = bt_key_names(config);
+  const char *peer_set = is_seeder ? names->seeder : names->leecher;
+  const char *other_set = is_seeder ? names->leecher : names->seeder;
+  long long group = bt_locality_group(config, ipv4_addr);
+
+  if (BT_LOCALITY_NONE == group) {
+    return 0;
+  }
+
+  bt_redis_append_command(redis, "ZADD %s:%s:%b:%s:%lld %lld %b",
+                          config->redis_key_prefix, names->local,
+                          info_hash_key->str, info_hash_key->len, peer_set,
+                          group, (long long) time(NULL), peer_id, (size_t) 20);
+
+  bt_redis_append_command(redis, "EXPIRE %s:%s:%b:%s:%lld %d",
+                          config->redis_key_prefix, names->local,
+                          info_hash_key->str, info_hash_key->len, peer_set,
+                          group, config->announce_peer_ttl);
+
+  if (!trim) {
+    return 2;
+  }
+
+  /* The reaper does not see these sets, so writers trim them. */
+  bt_redis_append_command(redis, "ZREMRANGEBYSCORE %s:%s:%b:%s:%lld -inf (%lld",
+                          config->redis_key_prefix, names->local,
+                          info_hash_key->str, info_hash_key->len, peer_set,
+                          group, (long long) bt_swarm_cutoff(config));
+
+  bt_redis_append_command(redis, "ZREM %s:%s:%b:%s:%lld %b",
+                          config->redis_key_prefix, names->local,
+                          info_hash_key->str, info_hash_key->len, other_set,
+                          group, peer_id, (size_t) 20);
+  return 4;
+}
+
+void
+bt_swarm_insert_peer(redisContext *redis, const bt_config_t *config,
+                     const bt_info_hash_key_t *info_hash_key,
+                     const int8_t *peer_id, const bt_peer_t *peer_data,
+                     bool is_seeder)
+{
+  redisReply *reply;
+  const bt_key_names_t *names = bt_key_names(config);
+  const char *peer_set = is_seeder ? names->seeder : names->leecher;
+  const char *other_set = is_seeder ? names->leecher : names->seeder;
+
+  char value[BT_PEER_VALUE_MAX_LEN];
+  size_t value_len = bt_write_peer_value(config, peer_data, value);
+
+  bt_redis_append_command(redis, "ZADD %s:%s:%b:%s %lld %b",
+                          config->redis_key_prefix, names->peer,
+                          info_hash_key->str, info_hash_key->len, peer_set,
+                          (long long) time(NULL), peer_id, (size_t) 20);
+
+  /* A peer is either a seeder or a leecher, never both. */
+  bt_redis_append_command(redis, "ZREM %s:%s:%b:%s %b",
+                          config->redis_key_prefix, names->peer,
+                          info_hash_key->str, info_hash_key->len, other_set,
+                          peer_id, (size_t) 20);
+
+  bt_redis_append_command(redis, "HSET %s:%s:%b:%s %b %b",
+                          config->redis_key_prefix, names->peer,
+                          info_hash_key->str, info_hash_key->len, names->addrs,
+                          peer_id, (size_t) 20, value, value_len);
+
+  /* Torrents nobody announces anymore vanish as a whole. */
+  bt_redis_append_command(redis, "EXPIRE %s:%s:%b:%s %d",
+                          config->redis_key_prefix, names->peer,
+                          info_hash_key->str, info_hash_key->len, peer_set,
+                          config->announce_peer_ttl);
+
+  bt_redis_append_command(redis, "EXPIRE %s:%s:%b:%s %d",
+                          config->redis_key_prefix, names->peer,
+                          info_hash_key->str, info_hash_key->len, names->addrs,
+                          config->announce_peer_ttl);
+
+  int replies = 5 + bt_swarm_append_local(redis, config, info_hash_key,
+                                          peer_id, peer_data->ipv4_addr,
+                                          is_seeder, true);
+
+  for (int i = 0; i < replies; i++) {
+    if (bt_redis_get_reply(redis, (void **) &reply) != REDIS_OK) {
+      syslog(LOG_ERR, "Got a NULL reply from Redis");
+      return;
+    }
+
+    if (REDIS_REPLY_ERROR == reply->type) {
+      syslog(LOG_ERR, "Cannot store peer data: %s", reply->str);
+    }
+
+    freeReplyObject(reply);
+  }
+
+  syslog(LOG_DEBUG, "Peer data stored successfully");
+}
+
+void
+bt_swarm_remove_peer(redisContext *redis, const bt_config_t *config,
+                     const bt_info_hash_key_t *info_hash_key,
+                     const int8_t *peer_id, bool is_seeder)
+{
+  redisReply *reply;
+  const bt_key_names_t *names = bt_key_names(config);
+  const char *peer_set = is_seeder ? names->seeder : names->leecher;
+
+  bt_redis_append_command(redis, "ZREM %s:%s:%b:%s %b",
+                          config->redis_key_prefix, names->peer,
+                          info_hash_key->str, info_hash_key->len, peer_set,
+                          peer_id, (size_t) 20);
+
+  bt_redis_append_command(redis, "HDEL %s:%s:%b:%s %b",
+                          config->redis_key_prefix, names->peer,
+                          info_hash_key->str, info_hash_key->len, names->addrs,
+                          peer_id, (size_t) 20);
+
+  for (int i = 0; i < 2; i++) {
+    if (bt_redis_get_reply(redis, (void **) &reply) != REDIS_OK) {
+      syslog(LOG_ERR, "Got a NULL reply from Redis");
+      return;
+    }
+
+    if (0 == i && REDIS_REPLY_INTEGER == reply->type && 1 == reply->integer) {
+      syslog(LOG_DEBUG, "Peer data removed successfully");
+    } else if (0 == i) {
+      syslog(LOG_ERR, "Cannot remove peer data");
+    }
+
+    freeReplyObject(reply);
+  }
+}
+
+bool
+bt_swarm_promote_peer(redisContext *redis, const bt_config_t *config,
+                      const bt_info_hash_key_t *info_hash_key,
+                      const int8_t *peer_id)
+{
+  redisReply *reply;
+  const bt_key_names_t *names = bt_key_names(config);
+  bool promoted = false;
+
+  reply = bt_redis_command(redis, "ZREM %s:%s:%b:%s %b",
+                           config->redis_key_prefix, names->peer,
+                           info_hash_key->str, info_hash_key->len,
+                           names->leecher, peer_id, (size_t) 20);
+
+  if (NULL == reply) {
+    syslog(LOG_ERR, "Got a NULL reply from Redis");
+    return false;
+  }
+
+  promoted = REDIS_REPLY_INTEGER == reply->type && 1 == reply->integer;
+  freeReplyObject(reply);
+
+  if (!promoted) {
+    syslog(LOG_ERR, "Cannot promote peer");
+    return false;
+  }
+
+  bt_redis_append_command(redis, "ZADD %s:%s:%b:%s %lld %b",
+                          config->redis_key_prefix, names->peer,
+                          info_hash_key->str, info_hash_key->len,
+                          names->seeder, (long long) time(NULL), peer_id,
+                          (size_t) 20);
+
+  /* The seeders set may have been created just now. */
+  bt_redis_append_command(redis, "EXPIRE %s:%s:%b:%s %d",
+                          config->redis_key_prefix, names->peer,
+                          info_hash_key->str, info_hash_key->len,
+                          names->seeder, config->announce_peer_ttl);
+
+  for (int i = 0; i < 2; i++) {
+    if (bt_redis_get_reply(redis, (void **) &reply) != REDIS_OK) {
+      syslog(LOG_ERR, "Got a NULL reply from Redis");
+      return false;
+    }
+
+    if (REDIS_REPLY_ERROR == reply->type) {
+      syslog(LOG_ERR, "Cannot promote peer: %s", reply->str);
+    }
+
+    freeReplyObject(reply);
+  }
+
+  syslog(LOG_DEBUG, "Peer promoted from leecher to seeder");
+  return true;
+}
+
+/* Returns the number of members of a set counted by ZCOUNT, or -1. */
+long long
+bt_swarm_read_count(redisContext *redis)
+{
+  redisReply *reply;
+
+  if (bt_redis_get_reply(redis, (void **) &reply) != REDIS_OK) {
+    syslog(LOG_ERR, "Got a NULL reply from Redis");
+    return -1;
+  }
+
+  long long count = REDIS_REPLY_INTEGER == reply->type ? reply->integer : 0;
+  freeReplyObject(reply);
+
+  return count;
+}
+
+void
+bt_swarm_get_torrent_stats(redisContext *redis, const bt_config_t *config,
+                           const bt_info_hash_key_t *info_hash_key,
+                           bt_torrent_stats_t *stats)
+{
+  redisReply *reply;
+  const bt_key_names_t *names = bt_key_names(config);
+  long long cutoff = bt_swarm_cutoff(config);
+
+  stats->seeders = stats->leechers = stats->downloads = 0;
+
+  /* Stale peers are not counted, even if the reaper did not run yet. */
+  bt_redis_append_command(redis, "ZCOUNT %s:%s:%b:%s %lld +inf",
+                          config->redis_key_prefix, names->peer,
+                          info_hash_key->str, info_hash_key->len,
+                          names->seeder, cutoff);
+
+  bt_redis_append_command(redis, "ZCOUNT %s:%s:%b:%s %lld +inf",
+                          config->redis_key_prefix, names->peer,
+                          info_hash_key->str, info_hash_key->len,
+                          names->leecher, cutoff);
+
+  bt_redis_append_command(redis, "HGET %s:%s:%b downs",
+                          config->redis_key_prefix, names->torrent,
+                          info_hash_key->str, info_hash_key->len);
+
+  long long seeders = bt_swarm_read_count(redis);
+  long long leechers = bt_swarm_read_count(redis);
+
+  stats->seeders = MAX(0, seeders);
+  stats->leechers = MAX(0, leechers);
+
+  if (bt_redis_get_reply(redis, (void **) &reply) == REDIS_OK) {
+    if (REDIS_REPLY_STRING == reply->type) {
+      stats->downloads = strtoimax(reply->str, NULL, 10);
+    }
+    freeReplyObject(reply);
+  }
+}
+
+/* Longest key read when listing peers. */
+#define BT_SWARM_KEY_MAX_LEN (256)
+
+/* Number of windows at random ranks a sample of a set is read in. */
+#define BT_SWARM_SAMPLE_WINDOWS (4)
+
+/*
+ * Writes <prefix>:<ns>:<info hash>:<set> to `key`, which holds
+ * BT_SWARM_KEY_MAX_LEN bytes. Returns its length, or 0 if it is too long.
+ */
+size_t
+bt_swarm_set_key(const bt_config_t *config, const char *ns,
+                 const bt_info_hash_key_t *info_hash_key, const char *set,
+                 char *key)
+{
+  size_t prefix_len = strlen(config->redis_key_prefix) + strlen(ns) + 2;
+
+  if (prefix_len + info_hash_key->len + strlen(set) + 2 >
+      BT_SWARM_KEY_MAX_LEN) {
+    return 0;
+  }
+
+  sprintf(key, "%s:%s:", config->redis_key_prefix, ns);
+  memcpy(key + prefix_len, info_hash_key->str, info_hash_key->len);
+
+  return prefix_len + info_hash_key->len +
+    sprintf(key + prefix_len + info_hash_key->len, ":%s", set);
+}
+
+/*
+ * Appends the ZRANGEs reading `wanted` of the `live` peers of a set, ranked
+ * after its `stale` ones. The live ranks are cut in even slices and a window
+ * is read at a random rank of each, which costs O(log N) plus its length
+ * whatever the size of the set. Returns the number of commands appended.
+ */
+int
+bt_swarm_append_sample(redisContext *redis, const char *key, size_t key_len,
+                       long long stale, long long live, long long wanted)
+{
+  int windows = (int) MIN(BT_SWARM_SAMPLE_WINDOWS, wanted);
+  long long first = stale;
+
+  for (int i = 0; i < windows; i++) {
+    long long slice = live / windows + (i < live % windows ? 1 : 0);
+    long long length = wanted / windows + (i < wanted % windows ? 1 : 0);
+
+    /* randr may return one past its upper bound. */
+    long long offset = MIN((long long) randr(0, slice - length),
+                           slice - length);
+
+    bt_redis_append_command(redis, "ZRANGE %b %lld %lld", key, key_len,
+                             first + offset, first + offset + length - 1);
+    first += slice;
+  }
+
+  return windows;
+}
+
+bt_list *
+bt_swarm_peer_list(redisContext *redis, const bt_config_t *config,
+                   const bt_info_hash_key_t *info_hash_key, int32_t num_want,
+                   int *peer_count, bool seeder, int64_t group)
+{
+  redisReply *replies[2 * BT_SWARM_SAMPLE_WINDOWS];
+  bt_list *list = NULL;
+  int count = 0;
+
+  /* We give seeders for leechers, and leechers for seeders. */
+  const bt_key_names_t *names = bt_key_names(config);
+  const char *peer_set = seeder ? names->seeder : names->leecher;
+  long long cutoff = bt_swarm_cutoff(config);
+
+  /* Part of the peers come from the locality group of the requester. */
+  int32_t local_want = BT_LOCALITY_NONE == group
+    ? 0 : bt_locality_quota(config, num_want);
+
+  *peer_count = 0;
+
+  if (num_want <= 0) {
+    return NULL;
+  }
+
+  char key[BT_SWARM_KEY_MAX_LEN], local_key[BT_SWARM_KEY_MAX_LEN];
+  char addrs_key[BT_SWARM_KEY_MAX_LEN], local_set[32];
+  size_t key_len = bt_swarm_set_key(config, names->peer, info_hash_key,
+                                    peer_set, key);
+  size_t addrs_key_len = bt_swarm_set_key(config, names->peer, info_hash_key,
+                                          names->addrs, addrs_key);
+
+  snprintf(local_set, sizeof(local_set), "%s:%lld", peer_set,
+           (long long) group);
+  size_t local_key_len = bt_swarm_set_key(config, names->local, info_hash_key,
+                                          local_set, local_key);
+
+  if (0 == key_len || 0 == addrs_key_len || 0 == local_key_len) {
+    syslog(LOG_ERR, "Key prefix is too long");
+    return NULL;
+  }
+
+  /* Live peers rank after the stale ones the reaper did not remove yet. */
+  bt_redis_append_command(redis, "ZCOUNT %b -inf (%lld", key, key_len, cutoff);
+  bt_redis_append_command(redis, "ZCOUNT %b %lld +inf", key, key_len, cutoff);
+
+  if (local_want > 0) {
+    bt_redis_append_command(redis, "ZCOUNT %b -inf (%lld", local_key,
+                            local_key_len, cutoff);
+    bt_redis_append_command(redis, "ZCOUNT %b %lld +inf", local_key,
+                            local_key_len, cutoff);
+  }
+
+  long long stale = bt_swarm_read_count(redis);
+  long long live = bt_swarm_read_count(redis);
+  long long local_stale = local_want > 0 ? bt_swarm_read_count(redis) : 0;
+  long long local_live = local_want > 0 ? bt_swarm_read_count(redis) : 0;
+
+  if (stale < 0 || live <= 0 || local_stale < 0 || local_live < 0) {
+    return NULL;
+  }
+
+  /* Reads windows at random ranks rather than the whole sets. */
+  long long wanted = MIN(live, num_want);
+  long long local_wanted = MIN(local_live, local_want);
+
+  int windows = bt_swarm_append_sample(redis, key, key_len, stale, live,
+                                       wanted);
+  int total_windows = windows + (local_wanted > 0
+    ? bt_swarm_append_sample(redis, local_key, local_key_len, local_stale,
+                             local_live, local_wanted) : 0);
+
+  for (int i = 0; i < total_windows; i++) {
+    if (bt_redis_get_reply(redis, (void **) &replies[i]) != REDIS_OK) {
+      syslog(LOG_ERR, "Got a NULL reply from Redis");
+
+      while (i-- > 0) {
+        freeReplyObject(replies[i]);
+      }
+      return NULL;
+    }
+  }
+
+  /* Fetches the addresses of all peers in the windows at once. */
+  size_t argc = 2;
+  size_t max_argc = wanted + local_wanted + 2;
+  const char **argv = (const char **) malloc(max_argc * sizeof(char *));
+  size_t *argvlen = (size_t *) malloc(max_argc * sizeof(size_t));
+
+  if (NULL == argv || NULL == argvlen) {
+    syslog(LOG_ERR, "Cannot allocate memory for peer list");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  argv[0] = "HMGET";
+  argvlen[0] = 5;
+  argv[1] = addrs_key;
+  argvlen[1] = addrs_key_len;
+
+  /* Close peers come first. */
+  for (int i = windows; i < total_windows; i++) {
+    for (size_t j = 0; REDIS_REPLY_ARRAY == replies[i]->type &&
+           j < replies[i]->elements && argc < max_argc; j++) {
+      argv[argc] = replies[i]->element[j]->str;
+      argvlen[argc++] = replies[i]->element[j]->len;
+    }
+  }
+
+  size_t local_count = argc - 2;
+
+  /* The rest are random peers not picked already. */
+  for (int i = 0; i < windows; i++) {
+    for (size_t j = 0; REDIS_REPLY_ARRAY == replies[i]->type &&
+           j < replies[i]->elements && argc - 2 < num_want; j++) {
+      redisReply *member = replies[i]->element[j];
+      bool picked = false;
+
+      for (size_t k = 2; k < local_count + 2 && !picked; k++) {
+        picked = argvlen[k] == member->len &&
+          memcmp(argv[k], member->str, member->len) == 0;
+      }
+
+      if (!picked) {
+        argv[argc] = member->str;
+        argvlen[argc++] = member->len;
+      }
+    }
+  }
+
+  redisReply *addrs = NULL;
+
+  if (argc > 2) {
+    addrs = bt_redis_command_argv(redis, argc, argv, argvlen);
+
+    if (NULL == addrs) {
+      syslog(LOG_ERR, "Got a NULL reply from Redis");
+    }
+  }
+
+  free(argv);
+  free(argvlen);
+
+  for (int i = 0; i < total_windows; i++) {
+    freeReplyObject(replies[i]);
+  }
+
+  if (NULL == addrs) {
+    return NULL;
+  }
+
+  bt_stats_add(BT_STAT_LOCAL_PEERS, local_count);
+
+  if (REDIS_REPLY_ARRAY == addrs->type) {
+    for (size_t i = 0; i < addrs->elements; i++) {
+      redisReply *value = addrs->element[i];
+      bt_peer_addr_t *addr = NULL;
+
+      /* The peer might have been reaped in the meantime. */
+      if (REDIS_REPLY_STRING == value->type) {
+        addr = bt_read_peer_value(config, value->str, value->len);
+      }
+
+      if (NULL != addr) {
+        list = bt_list_prepend(list, addr);
+        count++;
+      }
+    }
+  }
+
+  freeReplyObject(addrs);
+
+  *peer_count = count;
+  return list;
+}
+
+/*
+ * Removes the stale members of a sorted set of peers, and their addresses.
+ * Returns the number of peers removed, or -1 if Redis stopped answering.
+ */
+int64_t
+bt_swarm_reap_set(redisContext *redis, const bt_config_t *config,
+                  const char *key, size_t key_len, long long cutoff)
+{
+  const bt_key_names_t *names = bt_key_names(config);
+  size_t batch_size = MAX(1, config->announce_reaper_batch_size);
+  int64_t reaped = 0;
+
+  /* The hash of addresses sits next to the set: <...>:<ih>:<addrs>. */
+  size_t base_len = bt_swarm_key_base_len(key, key_len);
+
+  if (0 == base_len) {
+    return 0;
+  }
+
+  size_t addrs_key_len = base_len + strlen(names->addrs);
+  char *addrs_key = (char *) malloc(addrs_key_len);
+
+  const char **argv = (const char **) malloc((batch_size + 2) * sizeof(char *));
+  size_t *argvlen = (size_t *) malloc((batch_size + 2) * sizeof(size_t));
+
+  if (NULL == addrs_key || NULL == argv || NULL == argvlen) {
+    syslog(LOG_ERR, "Cannot allocate memory for reaper");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  memcpy(addrs_key, key, base_len);
+  memcpy(addrs_key + base_len, names->addrs, strlen(names->addrs));
+
+  while (true) {
+    redisReply *reply = bt_redis_command(redis, "ZRANGEBYSCORE %b -inf (%lld "
+                                         "LIMIT 0 %lld", key, key_len, cutoff,
+                                         (long long) batch_size);
+
+    if (NULL == reply) {
+      reaped = -1;
+      break;
+    }
+
+    size_t stale = REDIS_REPLY_ARRAY == reply->type ? reply->elements : 0;
+
+    if (0 == stale) {
+      freeReplyObject(reply);
+      break;
+    }
+
+    for (size_t i = 0; i < stale; i++) {
+      argv[i + 2] = reply->element[i]->str;
+      argvlen[i + 2] = reply->element[i]->len;
+    }
+
+    argv[0] = "HDEL";
+    argvlen[0] = 4;
+    argv[1] = addrs_key;
+    argvlen[1] = addrs_key_len;
+    bt_redis_append_command_argv(redis, stale + 2, argv, argvlen);
+
+    argv[0] = "ZREM";
+    argvlen[0] = 4;
+    argv[1] = key;
+    argvlen[1] = key_len;
+    bt_redis_append_command_argv(redis, stale + 2, argv, argvlen);
+
+    freeReplyObject(reply);
+
+    for (int i = 0; i < 2; i++) {
+      if (bt_redis_get_reply(redis, (void **) &reply) != REDIS_OK) {
+        reaped = -1;
+        break;
+      }
+
+      if (1 == i && REDIS_REPLY_INTEGER == reply->type) {
+        reaped += reply->integer;
+      }
+
+      freeReplyObject(reply);
+    }
+
+    if (reaped < 0 || stale < batch_size) {
+      break;
+    }
+  }
+
+  free(argvlen);
+  free(argv);
+  free(addrs_key);
+
+  return reaped;
+}
+
+bool
+bt_swarm_reap(redisContext *redis, const bt_config_t *config)
+{
+  char *pattern = bt_peer_key_pattern(config);
+  long long cutoff = bt_swarm_cutoff(config);
+  char cursor[32] = "0";
+  int64_t total = 0;
+
+  do {
+    redisReply *reply =
+      bt_redis_command(redis, "SCAN %s MATCH %s COUNT %u TYPE zset",
+                       cursor, pattern,
+                       MAX(1, config->announce_reaper_batch_size));
+
+    if (NULL == reply) {
+      syslog(LOG_ERR, "Got a NULL reply from Redis");
+      free(pattern);
+      return false;
+    }
+
+    if (REDIS_REPLY_ARRAY != reply->type || 2 != reply->elements) {
+      syslog(LOG_ERR, "Cannot scan peer sets");
+      freeReplyObject(reply);
+      free(pattern);
+      return false;
+    }
+
+    snprintf(cursor, sizeof(cursor), "%s", reply->element[0]->str);
+
+    redisReply *keys = reply->element[1];
+
+    for (size_t i = 0; i < keys->elements; i++) {
+      int64_t reaped = bt_swarm_reap_set(redis, config, keys->element[i]->str,
+                                         keys->element[i]->len, cutoff);
+
+      if (reaped < 0) {
+        syslog(LOG_ERR, "Got a NULL reply from Redis");
+        freeReplyObject(reply);
+        free(pattern);
+        return false;
+      }
+
+      total += reaped;
+    }
+
+    freeReplyObject(reply);
+  } while (strcmp(cursor, "0") != 0);
+
+  free(pattern);
+  bt_stats_add(BT_STAT_REAPED, total);
+  syslog(LOG_DEBUG, "Reaped %" PRId64 " stale peers", total);
+
+  return true;
+}
+
+void *
+bt_swarm_reaper_thread(void *data)
+{
+  bt_config_t *config = (bt_config_t *) data;
+  redisContext *redis = NULL;
+
+  while (true) {
+    sleep(MAX(1, config->announce_reaper_interval));
+
+    if (NULL == redis) {
+      redis = bt_redis_connect(config->redis_socket_path, config->redis_host,
+                               config->redis_port,
+                               config->redis_timeout * 1000, config->redis_db);
+    }
+
+    if (NULL != redis && !bt_swarm_reap(redis, config)) {
+      redisFree(redis);
+      redis = NULL;
+    }
+  }
+
+  return NULL;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BTTRACKER_SWARM_H_
+#define BTTRACKER_SWARM_H_
+
+/*
+ * Swarm peer storage: the seeders and leechers of a torrent live on two
+ * sorted sets keyed by peer ID and scored by the time of their last
+ * announce, and their addresses on a hash. Peers whose score is older than
+ * `PeerTTL` are ignored by readers and removed in batches by the reaper.
+ */
+
+/*
+ * Returns the length of the part of a peer set key that precedes the set
+ * name, colon included, or 0 if the key is malformed.
+ */
+size_t
+bt_swarm_key_base_len(const char *key, size_t key_len);
+
+/*
+ * Recovers the info hash of a peer set key and whether the set holds
+ * seeders. Returns false if the key is malformed.
+ */
+bool
+bt_swarm_parse_key(const bt_config_t *config, const char *key, size_t key_len,
+                   int8_t *info_hash, bool *seeder);
+
+/*
+ * Appends the commands that add a peer to the set of its locality group, on
+ * top of the set of all peers, and returns their number. `trim` also drops
+ * the stale members of the set and the peer from the set of its former kind.
+ */
+int
+bt_swarm_append_local(redisContext *redis, const bt_config_t *config,
+                      const bt_info_hash_key_t *info_hash_key,
+                      const int8_t *peer_id, uint32_t ipv4_addr,
+                      bool is_seeder, bool trim);
+
+/* Adds or refreshes a peer in the swarm of a torrent. */
+void
+bt_swarm_insert_peer(redisContext *redis, const bt_config_t *config,
+                     const bt_info_hash_key_t *info_hash_key,
+                     const int8_t *peer_id, const bt_peer_t *peer_data,
+                     bool is_seeder);
+
+/* Removes a peer from the swarm of a torrent. */
+void
+bt_swarm_remove_peer(redisContext *redis, const bt_config_t *config,
+                     const bt_info_hash_key_t *info_hash_key,
+                     const int8_t *peer_id, bool is_seeder);
+
+/* Moves a peer from leechers to seeders. Returns false if it was unknown. */
+bool
+bt_swarm_promote_peer(redisContext *redis, const bt_config_t *config,
+                      const bt_info_hash_key_t *info_hash_key,
+                      const int8_t *peer_id);
+
+/* Fills `stats` with the number of live peers and downloads of a torrent. */
+void
+bt_swarm_get_torrent_stats(redisContext *redis, const bt_config_t *config,
+                           const bt_info_hash_key_t *info_hash_key,
+                           bt_torrent_stats_t *stats);
+
+/*
+ * Returns a random subset of the live leechers or seeders of a torrent, part
+ * of them from locality group `group` unless it is BT_LOCALITY_NONE.
+ */
+bt_list *
+bt_swarm_peer_list(redisContext *redis, const bt_config_t *config,
+                   const bt_info_hash_key_t *info_hash_key, int32_t num_want,
+                   int *peer_count, bool seeder, int64_t group);
+
+/* Removes all stale peers. Returns false if Redis stopped answering. */
+bool
+bt_swarm_reap(redisContext *redis, const bt_config_t *config);
+
+/*
+ * Thread that periodically removes stale peers. The argument `data` is a
+ * pointer to the `bt_config_t` object.
+ */
+void *
+bt_swarm_reaper_thread(void *data);
+
+#endif // BTTRACKER_SWARM_H_
@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Trace file, or -1 when tracing is disabled. */
+static int bt_trace_fd = -1;
+
+/* Serializes writes from different threads to the trace file. */
+static GMutex bt_trace_lock;
+
+/* Last request and thread IDs handed out. */
+static uint64_t bt_trace_last_request = 0;
+static uint32_t bt_trace_last_thread = 0;
+
+/* Tracing state of a thread. */
+typedef struct {
+  uint32_t thread;
+  bool active;                         // A request is being traced
+  bool sampled;
+  uint64_t request_id;
+  int64_t stamps[BT_TRACE_STAGES];     // End of each stage, 0 if skipped
+  size_t length;
+  bt_trace_span_t spans[BT_TRACE_BUFFER_LEN];
+} bt_trace_thread_t;
+
+void
+bt_trace_free_thread(void *data)
+{
+  bt_trace_thread_t *state = (bt_trace_thread_t *) data;
+
+  /* Runs in the exiting thread, so its spans can still be written. */
+  if (state->length > 0) {
+    size_t size = state->length * sizeof(bt_trace_span_t);
+
+    g_mutex_lock(&bt_trace_lock);
+
+    if (-1 != bt_trace_fd && write(bt_trace_fd, state->spans, size) != size) {
+      syslog(LOG_ERR, "Cannot write to trace file");
+    }
+
+    g_mutex_unlock(&bt_trace_lock);
+  }
+
+  free(state);
+}
+
+/* Tracing state of the current thread. */
+static GPrivate bt_trace_key = G_PRIVATE_INIT(bt_trace_free_thread);
+
+const char *
+bt_trace_stage_str(bt_trace_stage stage)
+{
+  switch (stage) {
+  case BT_TRACE_RECEIVE:     return "receive";
+  case BT_TRACE_ENQUEUE:     return "enqueue";
+  case BT_TRACE_DEQUEUE:     return "dequeue";
+  case BT_TRACE_VALIDATE:    return "validate";
+  case BT_TRACE_RESTRICT:    return "restrict";
+  case BT_TRACE_PEER_UPDATE: return "peer_update";
+  case BT_TRACE_PEER_SAMPLE: return "peer_sample";
+  case BT_TRACE_STATS:       return "stats";
+  case BT_TRACE_SERIALIZE:   return "serialize";
+  case BT_TRACE_SEND:        return "send";
+  default:                   return "unknown";
+  }
+}
+
+bool
+bt_trace_open(const bt_config_t *config)
+{
+  if (NULL == config->trace_path || '\0' == config->trace_path[0]) {
+    return false;
+  }
+
+  int fd = open(config->trace_path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+
+  if (-1 == fd) {
+    syslog(LOG_ERR, "Cannot open trace file %s", config->trace_path);
+    return false;
+  }
+
+  /* Request and thread IDs start over, so every run has its own header. */
+  bt_trace_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, BT_TRACE_MAGIC, 8);
+  header.version = BT_TRACE_VERSION;
+  header.byte_order = BT_SNAPSHOT_BYTE_ORDER;
+  header.started_at = time(NULL);
+
+  if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+    syslog(LOG_ERR, "Cannot write to trace file %s", config->trace_path);
+    close(fd);
+    return false;
+  }
+
+  bt_trace_fd = fd;
+
+  syslog(LOG_INFO, "Tracing requests to %s", config->trace_path);
+
+  return true;
+}
+
+void
+bt_trace_close(void)
+{
+  if (-1 != bt_trace_fd) {
+    bt_trace_flush();
+
+    g_mutex_lock(&bt_trace_lock);
+    close(bt_trace_fd);
+    bt_trace_fd = -1;
+    g_mutex_unlock(&bt_trace_lock);
+  }
+}
+
+/* Returns the tracing state of the current thread, creating it if needed. */
+bt_trace_thread_t *
+bt_trace_thread(void)
+{
+  bt_trace_thread_t *state = g_private_get(&bt_trace_key);
+
+  if (NULL == state) {
+    state = (bt_trace_thread_t *) malloc(sizeof(bt_trace_thread_t));
+
+    if (NULL == state) {
+      syslog(LOG_ERR, "Cannot allocate memory for tracing");
+      exit(BT_EXIT_MALLOC_ERROR);
+    }
+
+    state->thread = __atomic_add_fetch(&bt_trace_last_thread, 1,
+                                       __ATOMIC_RELAXED);
+    state->active = false;
+    state->length = 0;
+
+    g_private_set(&bt_trace_key, state);
+  }
+
+  return state;
+}
+
+void
+bt_trace_begin(const bt_config_t *config, int64_t received_at,
+               int64_t enqueued_at)
+{
+  if (-1 == bt_trace_fd) {
+    return;
+  }
+
+  bt_trace_thread_t *state = bt_trace_thread();
+
+  /* Every request is timed, so slow ones can be kept even if unsampled. */
+  state->active = true;
+  state->sampled = config->trace_sample_rate > 0 &&
+    randr(0, 999999) < config->trace_sample_rate * 1000000;
+  state->request_id = __atomic_add_fetch(&bt_trace_last_request, 1,
+                                         __ATOMIC_RELAXED);
+
+  memset(state->stamps, 0, sizeof(state->stamps));
+  state->stamps[BT_TRACE_RECEIVE] = received_at;
+  state->stamps[BT_TRACE_ENQUEUE] = enqueued_at;
+  state->stamps[BT_TRACE_DEQUEUE] = g_get_monotonic_time();
+}
+
+void
+bt_trace_mark(bt_trace_stage stage)
+{
+  if (-1 == bt_trace_fd) {
+    return;
+  }
+
+  bt_trace_thread_t *state = g_private_get(&bt_trace_key);
+
+  if (NULL != state && state->active) {
+    state->stamps[stage] = g_get_monotonic_time();
+  }
+}
+
+void
+bt_trace_end(const bt_config_t *config, int32_t action)
+{
+  if (-1 == bt_trace_fd) {
+    return;
+  }
+
+  bt_trace_thread_t *state = g_private_get(&bt_trace_key);
+
+  if (NULL == state || !state->active) {
+    return;
+  }
+
+  state->active = false;
+
+  int64_t *stamps = state->stamps;
+  int64_t total = g_get_monotonic_time() - stamps[BT_TRACE_RECEIVE];
+  bool slow = config->trace_slow_threshold > 0 &&
+    total >= config->trace_slow_threshold * 1000LL;
+
+  if (!state->sampled && !slow) {
+    return;
+  }
+
+  /* Each stage starts where the last one that ran ended. */
+  int64_t start = stamps[BT_TRACE_RECEIVE];
+
+  for (int stage = 0; stage < BT_TRACE_STAGES; stage++) {
+    if (0 == stamps[stage]) {
+      continue;
+    }
+
+    if (BT_TRACE_BUFFER_LEN == state->length) {
+      bt_trace_flush();
+    }
+
+    bt_trace_span_t *span = &state->spans[state->length++];
+    span->request_id = state->request_id;
+    span->start = start;
+    span->end = stamps[stage];
+    span->thread = state->thread;
+    span->stage = stage;
+    span->action = action;
+
+    start = stamps[stage];
+  }
+}
+
+void
+bt_trace_flush(void)
+{
+  bt_trace_thread_t *state = g_private_get(&bt_trace_key);
+
+  if (NULL == state || 0 == state->length) {
+    return;
+  }
+
+  size_t size = state->length * sizeof(bt_trace_span_t);
+
+  g_mutex_lock(&bt_trace_lock);
+
+  if (-1 != bt_trace_fd && write(bt_trace_fd, state->spans, size) != size) {
+    syslog(LOG_ERR, "Cannot write to trace file");
+  }
+
+  g_mutex_unlock(&bt_trace_lock);
+
+  state->length = 0;
+}
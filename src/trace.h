@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BTTRACKER_TRACE_H_
+#define BTTRACKER_TRACE_H_
+
+/* Identifies trace files and their layout. */
+#define BT_TRACE_MAGIC   "BTTRACE\0"
+#define BT_TRACE_VERSION (2)
+
+/* Number of spans a thread buffers before writing them to the file. */
+#define BT_TRACE_BUFFER_LEN (1024)
+
+/* Stages of a request, in the order they happen. */
+typedef enum {
+  BT_TRACE_RECEIVE,     // Datagram read from the socket
+  BT_TRACE_ENQUEUE,     // Rate limited and pushed to a worker
+  BT_TRACE_DEQUEUE,     // Picked up by a worker
+  BT_TRACE_VALIDATE,    // Connection ID checked
+  BT_TRACE_RESTRICT,    // Info hash checked against the lists
+  BT_TRACE_PEER_UPDATE, // Requesting peer stored
+  BT_TRACE_PEER_SAMPLE, // Peers to hand out read
+  BT_TRACE_STATS,       // Torrent counters read
+  BT_TRACE_SERIALIZE,   // Response built
+  BT_TRACE_SEND,        // Response sent
+  BT_TRACE_STAGES
+} bt_trace_stage;
+
+/*
+ * Trace file layout: each run appends this header, then its spans in the
+ * order threads flushed them. Integers are stored in the byte order of the
+ * host.
+ */
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;    // BT_SNAPSHOT_BYTE_ORDER as written by the host
+  int64_t started_at;     // Unix time the run opened the file
+} bt_trace_header_t;
+
+/* Time spent by a request in one stage. */
+typedef struct {
+  uint64_t request_id;
+  int64_t start;          // Monotonic time, in microseconds
+  int64_t end;
+  uint32_t thread;
+  uint16_t stage;
+  uint16_t action;
+} bt_trace_span_t;
+
+/* Returns the name of a stage. */
+const char *
+bt_trace_stage_str(bt_trace_stage stage);
+
+/*
+ * Opens the trace file set in the configuration and enables tracing.
+ * Returns false if tracing is disabled or the file cannot be opened.
+ */
+bool
+bt_trace_open(const bt_config_t *config);
+
+/* Closes the trace file. Spans still buffered by other threads are lost. */
+void
+bt_trace_close(void);
+
+/*
+ * Starts tracing the request the current thread is about to handle, given
+ * when it was received and pushed to the worker.
+ */
+void
+bt_trace_begin(const bt_config_t *config, int64_t received_at,
+               int64_t enqueued_at);
+
+/* Records the end of a stage of the current request. */
+void
+bt_trace_mark(bt_trace_stage stage);
+
+/*
+ * Ends the current request, buffering its spans if it was sampled or
+ * slower than `SlowThreshold`.
+ */
+void
+bt_trace_end(const bt_config_t *config, int32_t action);
+
+/* Writes the spans buffered by the current thread to the trace file. */
+void
+bt_trace_flush(void);
+
+#endif // BTTRACKER_TRACE_H_
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Converts a trace file written by the tracker to the Chrome trace event
+ * format, which chrome://tracing and Perfetto can load. Each request
+ * becomes a row of its thread, with one slice per stage, and each run of
+ * the tracker a process of its own.
+ */
+
+/* Returns the name of a request action. */
+const char *
+bt_trace2json_action_str(uint16_t action)
+{
+  switch (action) {
+  case BT_ACTION_CONNECT:  return "connect";
+  case BT_ACTION_ANNOUNCE: return "announce";
+  case BT_ACTION_SCRAPE:   return "scrape";
+  default:                 return "error";
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  openlog(PACKAGE "-trace2json", LOG_PID | LOG_PERROR | LOG_CONS, LOG_LOCAL0);
+
+  if (argc != 2) {
+    syslog(LOG_ERR, "Usage: %s-trace2json <trace_file>", PACKAGE_NAME);
+    exit(BT_EXIT_CONFIG_ERROR);
+  }
+
+  FILE *file = fopen(argv[1], "rb");
+
+  if (NULL == file) {
+    syslog(LOG_ERR, "Cannot open %s", argv[1]);
+    exit(BT_EXIT_CONFIG_ERROR);
+  }
+
+  bt_trace_span_t span;
+  uint64_t count = 0;
+  uint32_t runs = 0;
+
+  printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+  /* Each run starts with a header and becomes a process of its own. */
+  while (fread(&span, sizeof(span.request_id), 1, file) == 1) {
+    if (memcmp(&span, BT_TRACE_MAGIC, 8) == 0) {
+      bt_trace_header_t header;
+      memcpy(header.magic, BT_TRACE_MAGIC, 8);
+
+      if (fread((char *) &header + 8, sizeof(header) - 8, 1, file) != 1 ||
+          header.version != BT_TRACE_VERSION ||
+          header.byte_order != BT_SNAPSHOT_BYTE_ORDER) {
+        syslog(LOG_ERR, "%s is not a compatible trace file", argv[1]);
+        exit(BT_EXIT_CONFIG_ERROR);
+      }
+
+      runs++;
+
+      printf("%s\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%" PRIu32
+             ",\"args\":{\"name\":\"run started at %" PRId64 "\"}}",
+             1 == runs ? "" : ",", runs, header.started_at);
+      continue;
+    }
+
+    if (0 == runs) {
+      syslog(LOG_ERR, "%s is not a compatible trace file", argv[1]);
+      exit(BT_EXIT_CONFIG_ERROR);
+    }
+
+    if (fread((char *) &span + sizeof(span.request_id),
+              sizeof(span) - sizeof(span.request_id), 1, file) != 1) {
+      break;
+    }
+
+    const char *stage = bt_trace_stage_str(span.stage);
+    const char *action = bt_trace2json_action_str(span.action);
+
+    printf(",\n{\"name\":\"%s\",\"cat\":\"%s\",\"pid\":%" PRIu32
+           ",\"tid\":%" PRIu32 ",\"ts\":%" PRId64 ",", stage, action, runs,
+           span.thread, span.start);
+
+    /* The datagram arrival has no duration. */
+    if (BT_TRACE_RECEIVE == span.stage) {
+      printf("\"ph\":\"i\",\"s\":\"t\",");
+    } else {
+      printf("\"ph\":\"X\",\"dur\":%" PRId64 ",", span.end - span.start);
+    }
+
+    printf("\"args\":{\"request\":%" PRIu64 "}}", span.request_id);
+    count++;
+  }
+
+  printf("\n]}\n");
+  fclose(file);
+
+  syslog(LOG_INFO, "Converted %" PRIu64 " spans of %" PRIu32 " runs", count,
+         runs);
+
+  return BT_EXIT_OK;
+}
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Worker running the current thread. */
+static GPrivate bt_worker_key = G_PRIVATE_INIT(NULL);
+
+bt_worker_t *
+bt_current_worker(void)
+{
+  return (bt_worker_t *) g_private_get(&bt_worker_key);
+}
+
+int
+bt_worker_shard(const char *info_hash)
+{
+  /* Info hashes are SHA-1 digests, so their leading bits are uniform. */
+  const uint8_t *bytes = (const uint8_t *) info_hash;
+  return ((bytes[0] << 8) | bytes[1]) % BT_WORKER_SHARDS;
+}
+
+/*
+ * Takes a connect or scrape job from the most loaded sibling. Announces are
+ * never stolen since they must be handled by the owner of the torrent.
+ */
+bt_job_params_t *
+bt_worker_steal(bt_worker_t *worker)
+{
+  bt_workers_t *group = worker->group;
+  bt_worker_t *victim = NULL;
+  guint victim_length = 0;
+
+  for (int i = 1; i < group->count; i++) {
+    bt_worker_t *other = &group->workers[(worker->index + i) % group->count];
+    guint length = bt_sched_length(&other->sched);
+
+    if (length > victim_length) {
+      victim = other;
+      victim_length = length;
+    }
+  }
+
+  return NULL == victim ? NULL : bt_sched_pop(&victim->sched,
+                                              BT_SCHED_STEALABLE);
+}
+
+gpointer
+bt_worker_thread(gpointer data)
+{
+  bt_worker_t *worker = (bt_worker_t *) data;
+  bt_config_t *config = worker->group->config;
+
+  g_private_set(&bt_worker_key, worker);
+
+  /* Allocated once pinned, so it lives on the NUMA node of the worker. */
+  bt_pin_worker(config, worker->index);
+  worker->refresh = bt_new_refresh_cache(config);
+  worker->hot = bt_new_hot_cache(config);
+  worker->known = bt_new_known_cache(config);
+
+  syslog(LOG_DEBUG, "Worker %d started", worker->index);
+
+  /* Keeps polling the queues for a while after each job. */
+  bt_spin_t spin;
+  bt_spin_init(&spin, config->thread_worker_spin_time, BT_STAT_WORKER_SPIN);
+  bool worked = false;
+
+  bt_job_params_t *batch[BT_WORKER_BATCH];
+
+  while (true) {
+    guint count = bt_sched_pop_batch(&worker->sched, BT_SCHED_ANY, batch,
+                                     BT_WORKER_BATCH);
+
+    if (0 == count && NULL != (batch[0] = bt_worker_steal(worker))) {
+      count = 1;
+    }
+
+    if (count > 0) {
+      bt_spin_end(&spin);
+
+      for (guint i = 0; i < count; i++) {
+        bt_request_processor(batch[i], config);
+      }
+
+      worked = true;
+      continue;
+    }
+
+    /* Sends what was left waiting for a batch before polling for more. */
+    if (worked && spin.window > 0) {
+      bt_request_processor_idle(config);
+      bt_spin_begin(&spin);
+      worked = false;
+      continue;
+    }
+
+    if (bt_spin_active(&spin)) {
+      continue;
+    }
+
+    /* Nothing to do: sends what was left waiting for a batch, also on exit. */
+    bt_request_processor_idle(config);
+
+    if (!bt_sched_wait(&worker->sched, BT_WORKER_STEAL_INTERVAL)) {
+      break;
+    }
+  }
+
+  syslog(LOG_DEBUG, "Worker %d stopped", worker->index);
+  return NULL;
+}
+
+bt_workers_t *
+bt_new_workers(bt_config_t *config)
+{
+  bt_workers_t *group = (bt_workers_t *) malloc(sizeof(bt_workers_t));
+
+  if (NULL == group) {
+    syslog(LOG_ERR, "Cannot allocate memory for workers");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  group->config = config;
+  group->count = MAX(1, config->thread_max);
+  group->responses = bt_new_respcache(config);
+  group->workers = (bt_worker_t *) calloc(group->count, sizeof(bt_worker_t));
+
+  if (NULL == group->workers) {
+    syslog(LOG_ERR, "Cannot allocate memory for workers");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  /* Shards are dealt to workers in turns, and never move afterwards. */
+  for (int i = 0; i < BT_WORKER_SHARDS; i++) {
+    group->owners[i] = i % group->count;
+  }
+
+  /* The queue bound is split evenly among the workers. */
+  guint max_length = 0;
+
+  if (config->thread_max_queue_len > 0) {
+    max_length = MAX(1, config->thread_max_queue_len / group->count);
+  }
+
+  for (int i = 0; i < group->count; i++) {
+    bt_worker_t *worker = &group->workers[i];
+
+    worker->index = i;
+    worker->group = group;
+    bt_sched_init(&worker->sched, config, max_length);
+  }
+
+  for (int i = 0; i < group->count; i++) {
+    bt_worker_t *worker = &group->workers[i];
+    worker->thread = g_thread_new("worker", bt_worker_thread, worker);
+  }
+
+  syslog(LOG_DEBUG, "Started %d workers", group->count);
+
+  return group;
+}
+
+void
+bt_free_workers(bt_workers_t *group)
+{
+  if (NULL == group) {
+    return;
+  }
+
+  for (int i = 0; i < group->count; i++) {
+    bt_sched_stop(&group->workers[i].sched);
+  }
+
+  for (int i = 0; i < group->count; i++) {
+    g_thread_join(group->workers[i].thread);
+    bt_sched_clear(&group->workers[i].sched);
+    bt_free_refresh_cache(group->workers[i].refresh);
+    bt_free_hot_cache(group->workers[i].hot);
+    bt_free_known_cache(group->workers[i].known);
+  }
+
+  bt_free_respcache(group->responses);
+  free(group->workers);
+  free(group);
+}
+
+bt_worker_t *
+bt_workers_route(bt_workers_t *group, bt_job_params_t *params)
+{
+  bt_worker_t *worker = NULL;
+
+  /* The info hash starts at offset 16 of an announce request. */
+  if (BT_CLASS_ANNOUNCE == params->class && params->buflen >= 36) {
+    int shard = bt_worker_shard(params->buff + 16);
+    worker = &group->workers[group->owners[shard]];
+  } else {
+    guint min_length = G_MAXUINT;
+
+    for (int i = 0; i < group->count; i++) {
+      guint length = bt_sched_length(&group->workers[i].sched);
+
+      if (length < min_length) {
+        worker = &group->workers[i];
+        min_length = length;
+      }
+    }
+  }
+
+  return worker;
+}
+
+bool
+bt_workers_push(bt_workers_t *group, bt_job_params_t *params)
+{
+  return bt_sched_push(&bt_workers_route(group, params)->sched, params);
+}
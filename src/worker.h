@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BTTRACKER_WORKER_H_
+#define BTTRACKER_WORKER_H_
+
+/* Number of slices the info hash space is divided into. */
+#define BT_WORKER_SHARDS 4096
+
+/* How often, in microseconds, an idle worker looks for jobs to steal. */
+#define BT_WORKER_STEAL_INTERVAL 10000
+
+/*
+ * Jobs a worker takes from its queues at once. Kept small, as jobs taken
+ * can no longer be stolen by idle siblings.
+ */
+#define BT_WORKER_BATCH 8
+
+struct bt_workers_s;
+
+/*
+ * Thread that answers requests. Announces for a given info hash are always
+ * handled by the same worker, so per-torrent state kept by a worker is only
+ * ever written by a single thread.
+ *
+ * Shards are dealt once at startup and never moved, since moving one would
+ * let two workers write the state of its torrents. Only connects and scrapes
+ * can be stolen, so the announces of a very busy shard are bound to the
+ * speed of its owner; hot swarm caching is what keeps such shards cheap.
+ */
+typedef struct {
+  int index;
+  GThread *thread;
+  bt_sched_t sched;              // Jobs routed to this worker
+  bt_refresh_cache_t *refresh;   // Peers written by this worker, or NULL
+  bt_hot_cache_t *hot;           // Stats and peers of hot swarms, or NULL
+  bt_known_cache_t *known;       // Last stats and peers served, or NULL
+  struct bt_workers_s *group;
+} bt_worker_t;
+
+/* Set of workers plus the table that maps info hash shards to them. */
+typedef struct bt_workers_s {
+  bt_config_t *config;
+  int count;
+  bt_worker_t *workers;
+  bt_respcache_t *responses;      // Responses recently sent, or NULL
+  uint16_t owners[BT_WORKER_SHARDS];
+} bt_workers_t;
+
+/* Starts `config->thread_max` workers. */
+bt_workers_t *
+bt_new_workers(bt_config_t *config);
+
+/* Stops all workers, waiting for the jobs they are running to finish. */
+void
+bt_free_workers(bt_workers_t *group);
+
+/* Returns the shard an info hash belongs to. */
+int
+bt_worker_shard(const char *info_hash);
+
+/*
+ * Returns the worker a job goes to: announces go to the owner of their info
+ * hash, everything else to the least loaded worker.
+ */
+bt_worker_t *
+bt_workers_route(bt_workers_t *group, bt_job_params_t *params);
+
+/* Queues a job on the worker it is routed to. */
+bool
+bt_workers_push(bt_workers_t *group, bt_job_params_t *params);
+
+/* Returns the worker running the calling thread, or NULL. */
+bt_worker_t *
+bt_current_worker(void);
+
+#endif // BTTRACKER_WORKER_H_
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "minunit.h"
+
+char *
+test_affinity_cpu_list()
+{
+  cpu_set_t set;
+
+  mu_assert("error, cannot parse list", bt_parse_cpu_list("0-3,8, 10\n", &set));
+  mu_assert("error, unexpected CPU count", CPU_COUNT(&set) == 6);
+  mu_assert("error, range not set", CPU_ISSET(0, &set) && CPU_ISSET(3, &set));
+  mu_assert("error, single CPU not set", CPU_ISSET(8, &set) && CPU_ISSET(10, &set));
+  mu_assert("error, unlisted CPU set", !CPU_ISSET(4, &set) && !CPU_ISSET(9, &set));
+
+  return NULL;
+}
+
+char *
+test_affinity_invalid_cpu_list()
+{
+  cpu_set_t set;
+
+  mu_assert("error, empty list accepted", !bt_parse_cpu_list("", &set));
+  mu_assert("error, reversed range accepted", !bt_parse_cpu_list("3-1", &set));
+  mu_assert("error, trailing comma accepted", !bt_parse_cpu_list("1,", &set));
+  mu_assert("error, garbage accepted", !bt_parse_cpu_list("1;2", &set));
+  mu_assert("error, huge CPU accepted", !bt_parse_cpu_list("1-100000", &set));
+
+  return NULL;
+}
+
+char *
+all_tests()
+{
+  mu_run_test(test_affinity_cpu_list);
+  mu_run_test(test_affinity_invalid_cpu_list);
+
+  return NULL;
+}
@@ -45,13 +45,14 @@ Port=1234\n\
 \n\
 [Threading]\n\
 MaxThreads=4\n\
-MaxIdleTime=300\n\
 \n\
 [Announce]\n\
 InfoHashRestriction=none\n\
 WaitTime=1800\n\
 PeerTTL=1920\n\
 MaxNumWant=80\n\
+PeerStorage=swarm\n\
+ReaperInterval=30\n\
 \n\
 [Redis]\n\
 SocketPath=/tmp/redis.sock\n\
@@ -59,7 +60,9 @@ Host=127.0.0.1\n\
 Port=6379\n\
 Timeout=500\n\
 DB=1\n\
-KeyPrefix=bttracker";
+KeyPrefix=bttracker\n\
+KeySchema=compact\n\
+StorePeerStats=true";
 
   write(fd, text, strlen(text));
   close(fd);
@@ -83,11 +86,12 @@ test_load_config_valid_file()
   mu_assert("error, unexpected bttracker_log_level_mask", config.bttracker_log_level_mask == LOG_INFO);
 
   mu_assert("error, unexpected thread_max", config.thread_max == 4);
-  mu_assert("error, unexpected thread_max_idle_time", config.thread_max_idle_time == 300);
 
   mu_assert("error, unexpected announce_wait_time", config.announce_wait_time == 1800);
   mu_assert("error, unexpected announce_peer_ttl", config.announce_peer_ttl == 1920);
   mu_assert("error, unexpected announce_max_numwant", config.announce_max_numwant == 80);
+  mu_assert("error, unexpected announce_peer_storage", config.announce_peer_storage == BT_PEER_STORAGE_SWARM);
+  mu_assert("error, unexpected announce_reaper_interval", config.announce_reaper_interval == 30);
 
   mu_assert("error, unexpected redis_socket_path", strcmp(config.redis_socket_path, "/tmp/redis.sock") == 0);
   mu_assert("error, unexpected redis_host", strcmp(config.redis_host, "127.0.0.1") == 0);
@@ -95,6 +99,8 @@ test_load_config_valid_file()
   mu_assert("error, unexpected redis_timeout", config.redis_timeout == 500);
   mu_assert("error, unexpected redis_db", config.redis_db == 1);
   mu_assert("error, unexpected redis_key_prefix", strcmp(config.redis_key_prefix, "bttracker") == 0);
+  mu_assert("error, unexpected redis_key_schema", config.redis_key_schema == BT_KEY_SCHEMA_COMPACT);
+  mu_assert("error, unexpected redis_store_peer_stats", config.redis_store_peer_stats == true);
   mu_assert("error, unexpected info_hash_restriction", config.info_hash_restriction== BT_RESTRICTION_NONE);
 
   return NULL;
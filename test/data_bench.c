@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measures how long the Redis work of an announce takes against a fake
+ * Redis that is healthy, slow, flaky or stalled. Every scenario replays the
+ * same announces with the same seed, so runs can be compared.
+ *
+ *   data_bench [keys|swarm] [announces]
+ */
+
+#include "fakeredis.h"
+
+#define BENCH_TORRENTS 100
+#define BENCH_PEERS    200
+#define BENCH_NUMWANT  50
+#define BENCH_TIMEOUT  1000000
+
+typedef struct {
+  const char *name;
+  bt_fakeredis_faults_t faults;
+  uint32_t stall_every;  // Stalls Redis once every this many announces
+  uint32_t stall_us;
+} bench_scenario_t;
+
+const bench_scenario_t bench_scenarios[] = {
+  { "baseline",        { 0 } },
+  { "latency 200us",   { .latency_us = 200, .jitter_us = 100 } },
+  { "tail 1% +10ms",   { .tail_rate = 0.01, .tail_us = 10000 } },
+  { "errors 1%",       { .error_rate = 0.01 } },
+  { "disconnects .1%", { .disconnect_rate = 0.001 } },
+  { "stall 50ms",      { 0 }, 5000, 50000 }
+};
+
+int
+bench_compare(const void *a, const void *b)
+{
+  int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+  return x < y ? -1 : x > y;
+}
+
+/* Latency at a given quantile of the sorted samples. */
+int64_t
+bench_quantile(const int64_t *samples, size_t count, double quantile)
+{
+  return samples[MIN((size_t) (quantile * count), count - 1)];
+}
+
+/* The Redis work of one announce, as done by a worker thread. */
+void
+bench_announce(redisContext **redis, const bt_config_t *config,
+               uint16_t port, uint32_t *reconnects)
+{
+  /* Workers ping their connection first and reconnect if it is broken. */
+  if (NULL == *redis || !bt_redis_ping(*redis)) {
+    redisFree(*redis);
+    *redis = bt_redis_connect(NULL, "127.0.0.1", port, BENCH_TIMEOUT, 0);
+    (*reconnects)++;
+
+    if (NULL == *redis) {
+      return;
+    }
+  }
+
+  int8_t info_hash[20], peer_id[20];
+  memset(info_hash, 0, sizeof(info_hash));
+  memset(peer_id, 0, sizeof(peer_id));
+
+  uint32_t torrent = randr(0, BENCH_TORRENTS - 1);
+  uint32_t peer = randr(0, BENCH_PEERS - 1);
+  memcpy(info_hash, &torrent, sizeof(torrent));
+  memcpy(peer_id, &peer, sizeof(peer));
+
+  bt_info_hash_key_t key;
+  bt_info_hash_key(config, info_hash, &key);
+
+  bt_peer_t peer_data;
+  memset(&peer_data, 0, sizeof(peer_data));
+  peer_data.ipv4_addr = 0x0a000000 | peer;
+  peer_data.port = 6881;
+
+  bool seeder = peer % 4 == 0;
+  bt_insert_peer(*redis, config, &key, peer_id, &peer_data, seeder);
+
+  bt_torrent_stats_t stats;
+  bt_get_torrent_stats(*redis, config, &key, &stats);
+
+  int count;
+  bt_list_free(bt_peer_list(*redis, config, &key, BENCH_NUMWANT, &count,
+                            !seeder, BT_LOCALITY_NONE));
+}
+
+int
+main(int argc, char **argv)
+{
+  bt_config_t config;
+  memset(&config, 0, sizeof(config));
+
+  config.redis_key_prefix = "bttracker";
+  config.redis_key_schema = BT_KEY_SCHEMA_COMPACT;
+  config.announce_peer_ttl = 1800;
+  config.announce_peer_storage =
+    argc > 1 && strcmp(argv[1], "keys") == 0
+      ? BT_PEER_STORAGE_KEYS : BT_PEER_STORAGE_SWARM;
+
+  size_t announces = argc > 2 ? strtoul(argv[2], NULL, 10) : 20000;
+  int64_t *samples = (int64_t *) malloc(MAX(announces, 1) * sizeof(int64_t));
+
+  if (NULL == samples) {
+    fprintf(stderr, "Cannot allocate memory for samples\n");
+    return 1;
+  }
+
+  bt_fakeredis_t *server = bt_fakeredis_start(1);
+
+  if (NULL == server) {
+    fprintf(stderr, "Cannot start fake Redis\n");
+    return 1;
+  }
+
+  uint16_t port = bt_fakeredis_port(server);
+  redisContext *redis = NULL;
+  uint32_t reconnects = 0;
+
+  /* Fills the swarms before measuring anything. */
+  srand(1);
+  for (size_t i = 0; i < BENCH_TORRENTS * BENCH_PEERS / 2; i++) {
+    bench_announce(&redis, &config, port, &reconnects);
+  }
+
+  printf("%-16s %9s %9s %9s %9s %9s %9s %6s\n", "scenario", "p50 us",
+         "p90 us", "p99 us", "p99.9 us", "max us", "ann/s", "recon");
+
+  for (size_t s = 0; s < G_N_ELEMENTS(bench_scenarios); s++) {
+    const bench_scenario_t *scenario = &bench_scenarios[s];
+
+    bt_fakeredis_set_faults(server, &scenario->faults);
+    reconnects = 0;
+    srand(2);
+
+    int64_t started_at = g_get_monotonic_time();
+
+    for (size_t i = 0; i < announces; i++) {
+      if (scenario->stall_every > 0 && i % scenario->stall_every == 0) {
+        bt_fakeredis_stall(server, scenario->stall_us);
+      }
+
+      int64_t start = g_get_monotonic_time();
+      bench_announce(&redis, &config, port, &reconnects);
+      samples[i] = g_get_monotonic_time() - start;
+    }
+
+    double elapsed = (g_get_monotonic_time() - started_at) /
+      (double) G_USEC_PER_SEC;
+
+    qsort(samples, announces, sizeof(int64_t), bench_compare);
+
+    printf("%-16s %9" PRId64 " %9" PRId64 " %9" PRId64 " %9" PRId64
+           " %9" PRId64 " %9.0f %6u\n", scenario->name,
+           bench_quantile(samples, announces, 0.5),
+           bench_quantile(samples, announces, 0.9),
+           bench_quantile(samples, announces, 0.99),
+           bench_quantile(samples, announces, 0.999),
+           samples[announces - 1], announces / elapsed, reconnects);
+  }
+
+  redisFree(redis);
+  bt_fakeredis_stop(server);
+  free(samples);
+
+  return 0;
+}
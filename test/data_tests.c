@@ -0,0 +1,837 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "minunit.h"
+#include "fakeredis.h"
+
+/* Raw info hashes with glob characters, which KEYS patterns must escape. */
+#define INFO_HASH_A "*?[]\\abcdefghijklmno"
+#define INFO_HASH_B "x?[]\\abcdefghijklmno"
+
+#define PEER_ID_A "-BT0001-aaaaaaaaaaaa"
+#define PEER_ID_B "-BT0001-bbbbbbbbbbbb"
+
+void
+data_config(bt_config_t *config, bt_peer_storage storage)
+{
+  memset(config, 0, sizeof(bt_config_t));
+
+  config->redis_key_prefix      = "bttracker";
+  config->redis_key_schema      = BT_KEY_SCHEMA_COMPACT;
+  config->announce_peer_storage = storage;
+  config->announce_peer_ttl     = 1800;
+}
+
+redisContext *
+data_connect(bt_fakeredis_t *server)
+{
+  return bt_redis_connect(NULL, "127.0.0.1", bt_fakeredis_port(server), 500000, 0);
+}
+
+void
+data_peer(bt_peer_t *peer, uint32_t ipv4_addr, uint16_t port)
+{
+  memset(peer, 0, sizeof(bt_peer_t));
+  peer->ipv4_addr = ipv4_addr;
+  peer->port = port;
+}
+
+/* Microseconds taken by a PING. */
+int64_t
+data_ping_time(redisContext *redis)
+{
+  int64_t start = g_get_monotonic_time();
+  bt_redis_ping(redis);
+  return g_get_monotonic_time() - start;
+}
+
+char *
+data_check_swarm(bt_peer_storage storage)
+{
+  bt_config_t config;
+  data_config(&config, storage);
+
+  bt_fakeredis_t *server = bt_fakeredis_start(1);
+  redisContext *redis = data_connect(server);
+  mu_assert("error, cannot connect to fake Redis", redis != NULL);
+
+  bt_info_hash_key_t key_a, key_b;
+  bt_info_hash_key(&config, (const int8_t *) INFO_HASH_A, &key_a);
+  bt_info_hash_key(&config, (const int8_t *) INFO_HASH_B, &key_b);
+
+  bt_peer_t peer_a, peer_b;
+  data_peer(&peer_a, 0x7f000001, 6881);
+  data_peer(&peer_b, 0x7f000002, 6882);
+
+  bt_insert_peer(redis, &config, &key_a, (const int8_t *) PEER_ID_A, &peer_a, false);
+  bt_insert_peer(redis, &config, &key_a, (const int8_t *) PEER_ID_B, &peer_b, true);
+  bt_insert_peer(redis, &config, &key_b, (const int8_t *) PEER_ID_A, &peer_a, true);
+
+  bt_torrent_stats_t stats = { 0 };
+  bt_get_torrent_stats(redis, &config, &key_a, &stats);
+  mu_assert("error, wrong number of seeders", stats.seeders == 1);
+  mu_assert("error, wrong number of leechers", stats.leechers == 1);
+  mu_assert("error, wrong number of downloads", stats.downloads == 0);
+
+  int count = 0;
+  bt_list *peers = bt_peer_list(redis, &config, &key_a, 10, &count, false,
+                                BT_LOCALITY_NONE);
+  mu_assert("error, wrong number of peers", count == 1 && bt_list_length(peers) == 1);
+  mu_assert("error, wrong peer address", ((bt_peer_addr_t *) peers->data)->ipv4_addr == 0x7f000001);
+  mu_assert("error, wrong peer port", ((bt_peer_addr_t *) peers->data)->port == 6881);
+  bt_list_free(peers);
+
+  bt_promote_peer(redis, &config, &key_a, (const int8_t *) PEER_ID_A);
+  bt_get_torrent_stats(redis, &config, &key_a, &stats);
+  mu_assert("error, seeder not promoted", stats.seeders == 2 && stats.leechers == 0);
+  mu_assert("error, download not counted", stats.downloads == 1);
+
+  bt_remove_peer(redis, &config, &key_a, (const int8_t *) PEER_ID_B, true);
+  bt_get_torrent_stats(redis, &config, &key_a, &stats);
+  mu_assert("error, seeder not removed", stats.seeders == 1);
+
+  bt_get_torrent_stats(redis, &config, &key_b, &stats);
+  mu_assert("error, other torrent changed", stats.seeders == 1 && stats.leechers == 0);
+
+  redisFree(redis);
+  bt_fakeredis_stop(server);
+  return NULL;
+}
+
+char *
+test_data_keys_storage()
+{
+  return data_check_swarm(BT_PEER_STORAGE_KEYS);
+}
+
+char *
+test_data_swarm_storage()
+{
+  return data_check_swarm(BT_PEER_STORAGE_SWARM);
+}
+
+char *
+test_data_swarm_promotion()
+{
+  bt_config_t config;
+  data_config(&config, BT_PEER_STORAGE_SWARM);
+
+  bt_fakeredis_t *server = bt_fakeredis_start(1);
+  redisContext *redis = data_connect(server);
+  mu_assert("error, cannot connect to fake Redis", redis != NULL);
+
+  const bt_key_names_t *names = bt_key_names(&config);
+  bt_info_hash_key_t key;
+  bt_info_hash_key(&config, (const int8_t *) INFO_HASH_A, &key);
+
+  bt_peer_t peer;
+  data_peer(&peer, 0x7f000001, 6881);
+
+  /* The first seeder of a torrent creates its seeders set by promotion. */
+  bt_insert_peer(redis, &config, &key, (const int8_t *) PEER_ID_A, &peer, false);
+  bt_promote_peer(redis, &config, &key, (const int8_t *) PEER_ID_A);
+
+  redisReply *reply = redisCommand(redis, "PTTL bttracker:%s:%b:%s", names->peer,
+                                   key.str, key.len, names->seeder);
+  mu_assert("error, seeders set does not expire", reply != NULL && reply->integer > 0);
+  freeReplyObject(reply);
+
+  /* Replies of the wrong type are not taken for counts. */
+  freeReplyObject(redisCommand(redis, "SET bttracker:%s:%b:%s x", names->peer,
+                               key.str, key.len, names->leecher));
+
+  bt_torrent_stats_t stats = { 0 };
+  bt_get_torrent_stats(redis, &config, &key, &stats);
+  mu_assert("error, wrong number of seeders", stats.seeders == 1);
+  mu_assert("error, error counted as leechers", stats.leechers == 0);
+  mu_assert("error, wrong number of downloads", stats.downloads == 1);
+
+  redisFree(redis);
+  bt_fakeredis_stop(server);
+  return NULL;
+}
+
+/* Rewrites part of a snapshot file. */
+void
+data_patch_file(const char *path, long offset, const void *data, size_t len)
+{
+  FILE *file = fopen(path, "r+b");
+  fseek(file, offset, SEEK_SET);
+  fwrite(data, len, 1, file);
+  fclose(file);
+}
+
+char *
+test_data_reaper_prefix()
+{
+  bt_config_t config;
+  data_config(&config, BT_PEER_STORAGE_SWARM);
+  config.redis_key_prefix = "bt*";
+
+  bt_fakeredis_t *server = bt_fakeredis_start(1);
+  redisContext *redis = data_connect(server);
+  mu_assert("error, cannot connect to fake Redis", redis != NULL);
+
+  const bt_key_names_t *names = bt_key_names(&config);
+  bt_info_hash_key_t key;
+  bt_info_hash_key(&config, (const int8_t *) INFO_HASH_A, &key);
+
+  bt_peer_t peer;
+  data_peer(&peer, 0x7f000001, 6881);
+  bt_insert_peer(redis, &config, &key, (const int8_t *) PEER_ID_A, &peer, false);
+
+  freeReplyObject(redisCommand(redis, "ZADD bt*:%s:%b:%s 1 stale", names->peer,
+                               key.str, key.len, names->leecher));
+  freeReplyObject(redisCommand(redis, "ZADD btother:%s:x:%s 1 stale", names->peer,
+                               names->leecher));
+
+  mu_assert("error, reaper failed", bt_swarm_reap(redis, &config));
+
+  redisReply *reply = redisCommand(redis, "ZCOUNT bt*:%s:%b:%s -inf +inf", names->peer,
+                                   key.str, key.len, names->leecher);
+  mu_assert("error, stale peer not reaped", reply != NULL && reply->integer == 1);
+  freeReplyObject(reply);
+
+  /* Glob characters of the prefix do not reach the keys of others. */
+  reply = redisCommand(redis, "ZCOUNT btother:%s:x:%s -inf +inf", names->peer,
+                       names->leecher);
+  mu_assert("error, foreign set reaped", reply != NULL && reply->integer == 1);
+  freeReplyObject(reply);
+
+  redisFree(redis);
+  bt_fakeredis_stop(server);
+  return NULL;
+}
+
+char *
+test_data_snapshot()
+{
+  bt_config_t config;
+  data_config(&config, BT_PEER_STORAGE_SWARM);
+  config.announce_reaper_batch_size = 2;
+
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/bttracker-snapshot-%d", (int) getpid());
+  config.snapshot_path = path;
+
+  bt_fakeredis_t *server = bt_fakeredis_start(1);
+  redisContext *redis = data_connect(server);
+  mu_assert("error, cannot connect to fake Redis", redis != NULL);
+
+  bt_info_hash_key_t key_a, key_b;
+  bt_info_hash_key(&config, (const int8_t *) INFO_HASH_A, &key_a);
+  bt_info_hash_key(&config, (const int8_t *) INFO_HASH_B, &key_b);
+
+  /* Announced within the same second, so the pages end on tied scores. */
+  for (int i = 0; i < 7; i++) {
+    char peer_id[21];
+    bt_peer_t peer;
+
+    snprintf(peer_id, sizeof(peer_id), "-BT0001-%012d", i);
+    data_peer(&peer, 0x0a000001 + i, 6881);
+    bt_insert_peer(redis, &config, &key_a, (const int8_t *) peer_id, &peer, i < 2);
+  }
+
+  bt_peer_t peer;
+  data_peer(&peer, 0x0b000001, 6881);
+  bt_insert_peer(redis, &config, &key_b, (const int8_t *) PEER_ID_A, &peer, false);
+
+  mu_assert("error, snapshot not written", bt_write_snapshot(redis, &config, path));
+  mu_assert("error, snapshot not loaded", bt_load_snapshot(&config));
+
+  const bt_snapshot_torrent_t *torrent =
+    bt_snapshot_find(&config, (const int8_t *) INFO_HASH_A);
+  mu_assert("error, torrent not found", torrent != NULL);
+  mu_assert("error, wrong number of seeders", torrent->seeders == 2);
+  mu_assert("error, peers read twice or missed", torrent->leechers == 5);
+
+  int count = 0;
+  bt_list *peers = bt_snapshot_complement(&config, (const int8_t *) INFO_HASH_A,
+                                          NULL, &count, 50);
+  mu_assert("error, wrong number of peers", count == 7 && bt_list_length(peers) == 7);
+  bt_list_free(peers);
+
+  bt_snapshot_torrent_t saved = *torrent;
+  bt_free_snapshot();
+
+  /* A torrent whose peers run past the end of the file. */
+  uint64_t first_peer = 7;
+  data_patch_file(path, sizeof(bt_snapshot_header_t) +
+                  offsetof(bt_snapshot_torrent_t, first_peer),
+                  &first_peer, sizeof(first_peer));
+  mu_assert("error, peers out of bounds loaded", !bt_load_snapshot(&config));
+
+  /* Counts that overflow the expected size of the file. */
+  data_patch_file(path, sizeof(bt_snapshot_header_t), &saved, sizeof(saved));
+  uint64_t counts[2] = { UINT64_MAX / 8, 1 };
+  data_patch_file(path, offsetof(bt_snapshot_header_t, torrent_count),
+                  counts, sizeof(counts));
+  mu_assert("error, overflowing counts loaded", !bt_load_snapshot(&config));
+
+  unlink(path);
+  redisFree(redis);
+  bt_fakeredis_stop(server);
+  return NULL;
+}
+
+char *
+test_data_swarm_sample()
+{
+  bt_config_t config;
+  data_config(&config, BT_PEER_STORAGE_SWARM);
+
+  bt_fakeredis_t *server = bt_fakeredis_start(1);
+  redisContext *redis = data_connect(server);
+  mu_assert("error, cannot connect to fake Redis", redis != NULL);
+
+  const bt_key_names_t *names = bt_key_names(&config);
+  bt_info_hash_key_t key;
+  bt_info_hash_key(&config, (const int8_t *) INFO_HASH_A, &key);
+
+  /* Ten leechers the reaper did not get to yet, then twenty live ones. */
+  for (int i = 0; i < 30; i++) {
+    char peer_id[21];
+    bt_peer_t peer;
+
+    snprintf(peer_id, sizeof(peer_id), "-BT0001-%012d", i);
+    data_peer(&peer, 0x0a000000 + i, 6881);
+    bt_insert_peer(redis, &config, &key, (const int8_t *) peer_id, &peer, false);
+
+    if (i < 10) {
+      freeReplyObject(redisCommand(redis, "ZADD bttracker:%s:%b:%s %d %b", names->peer,
+                                   key.str, key.len, names->leecher, i + 1,
+                                   peer_id, (size_t) 20));
+    }
+  }
+
+  uint32_t seen = 0;
+
+  for (int round = 0; round < 50; round++) {
+    int count = 0;
+    uint32_t picked = 0;
+    bt_list *peers = bt_peer_list(redis, &config, &key, 8, &count, false,
+                                  BT_LOCALITY_NONE);
+
+    for (bt_list *node = peers; NULL != node; node = node->next) {
+      uint32_t addr = ((bt_peer_addr_t *) node->data)->ipv4_addr & 0xff;
+
+      mu_assert("error, stale peer picked", addr >= 10);
+      mu_assert("error, peer picked twice", !(picked & (1 << addr)));
+      picked |= 1 << addr;
+    }
+
+    mu_assert("error, wrong number of peers", count == 8 && bt_list_length(peers) == 8);
+    seen |= picked;
+    bt_list_free(peers);
+  }
+
+  mu_assert("error, sample not spread over the swarm", seen == 0x3ffffc00);
+
+  int count = 0;
+  bt_list *peers = bt_peer_list(redis, &config, &key, 50, &count, false,
+                                BT_LOCALITY_NONE);
+  mu_assert("error, live peers missing", count == 20);
+  bt_list_free(peers);
+
+  redisFree(redis);
+  bt_fakeredis_stop(server);
+  return NULL;
+}
+
+char *
+test_data_locality()
+{
+  bt_config_t config;
+  data_config(&config, BT_PEER_STORAGE_SWARM);
+  config.announce_locality_share = 50;
+  config.announce_locality_prefix_len = 24;
+
+  bt_fakeredis_t *server = bt_fakeredis_start(1);
+  redisContext *redis = data_connect(server);
+  mu_assert("error, cannot connect to fake Redis", redis != NULL);
+
+  bt_info_hash_key_t key;
+  bt_info_hash_key(&config, (const int8_t *) INFO_HASH_A, &key);
+
+  /* Two leechers on the network of the requester, eight elsewhere. */
+  for (int i = 0; i < 10; i++) {
+    char peer_id[21];
+    bt_peer_t peer;
+
+    snprintf(peer_id, sizeof(peer_id), "-BT0001-%012d", i);
+    data_peer(&peer, (i < 2 ? 0x0a000000 : 0x0a010000) + i + 1, 6881);
+    bt_insert_peer(redis, &config, &key, (const int8_t *) peer_id, &peer, false);
+  }
+
+  int64_t group = bt_locality_group(&config, 0x0a000063);
+  mu_assert("error, wrong locality group", group == bt_locality_group(&config, 0x0a0000fe));
+  mu_assert("error, distinct networks grouped", group != bt_locality_group(&config, 0x0a010063));
+
+  for (int round = 0; round < 10; round++) {
+    int count = 0, near = 0;
+    bt_list *peers = bt_peer_list(redis, &config, &key, 4, &count, false, group);
+    uint32_t seen = 0;
+
+    for (bt_list *node = peers; NULL != node; node = node->next) {
+      uint32_t addr = ((bt_peer_addr_t *) node->data)->ipv4_addr;
+
+      near += (addr & 0xffffff00) == 0x0a000000;
+      mu_assert("error, peer picked twice", !(seen & (1 << (addr & 0xff))));
+      seen |= 1 << (addr & 0xff);
+    }
+
+    mu_assert("error, wrong number of peers", count == 4 && bt_list_length(peers) == 4);
+    mu_assert("error, close peers not picked", near == 2);
+    bt_list_free(peers);
+  }
+
+  redisFree(redis);
+  bt_fakeredis_stop(server);
+  return NULL;
+}
+
+char *
+test_data_batched_downloads()
+{
+  bt_config_t config;
+  data_config(&config, BT_PEER_STORAGE_SWARM);
+  config.announce_refresh_cache_size = 16;
+  config.announce_refresh_batch_size = 4;
+  config.announce_refresh_delay = 60000;
+
+  bt_fakeredis_t *server = bt_fakeredis_start(1);
+  redisContext *redis = data_connect(server);
+  mu_assert("error, cannot connect to fake Redis", redis != NULL);
+
+  bt_refresh_cache_t *cache = bt_new_refresh_cache(&config);
+  bt_info_hash_key_t key_a, key_b;
+  bt_info_hash_key(&config, (const int8_t *) INFO_HASH_A, &key_a);
+  bt_info_hash_key(&config, (const int8_t *) INFO_HASH_B, &key_b);
+
+  bt_peer_t peer_a;
+  data_peer(&peer_a, 0x7f000001, 6881);
+  bt_insert_peer(redis, &config, &key_a, (const int8_t *) PEER_ID_A, &peer_a, true);
+
+  /* A burst of completions takes a single slot of the batch. */
+  for (int i = 0; i < 10; i++) {
+    bt_refresh_count_download(cache, redis, &config, &key_a);
+  }
+  bt_refresh_count_download(cache, redis, &config, &key_b);
+
+  bt_torrent_stats_t stats = { 0 };
+  bt_get_torrent_stats(redis, &config, &key_a, &stats);
+  mu_assert("error, downloads not deferred", stats.downloads == 0);
+  mu_assert("error, downloads not merged", cache->downloads_len == 2);
+
+  bt_refresh_flush(cache, redis, &config);
+  bt_get_torrent_stats(redis, &config, &key_a, &stats);
+  mu_assert("error, wrong number of downloads", stats.downloads == 10);
+  bt_get_torrent_stats(redis, &config, &key_b, &stats);
+  mu_assert("error, other torrent not counted", stats.downloads == 1);
+
+  bt_free_refresh_cache(cache);
+  redisFree(redis);
+  bt_fakeredis_stop(server);
+  return NULL;
+}
+
+char *
+test_data_refresh_forget()
+{
+  bt_config_t config;
+  data_config(&config, BT_PEER_STORAGE_SWARM);
+  config.announce_refresh_cache_size = 16;
+  config.announce_refresh_batch_size = 4;
+  config.announce_refresh_delay = 60000;
+
+  bt_fakeredis_t *server = bt_fakeredis_start(1);
+  redisContext *redis = data_connect(server);
+  mu_assert("error, cannot connect to fake Redis", redis != NULL);
+
+  bt_refresh_cache_t *cache = bt_new_refresh_cache(&config);
+  bt_info_hash_key_t key;
+  bt_info_hash_key(&config, (const int8_t *) INFO_HASH_A, &key);
+
+  bt_peer_t peer_a, peer_b;
+  data_peer(&peer_a, 0x7f000001, 6881);
+  data_peer(&peer_b, 0x7f000002, 6882);
+  bt_insert_peer(redis, &config, &key, (const int8_t *) PEER_ID_A, &peer_a, false);
+  bt_refresh_remember(cache, &config, &key, (const int8_t *) PEER_ID_A, &peer_a, false);
+  bt_insert_peer(redis, &config, &key, (const int8_t *) PEER_ID_B, &peer_b, false);
+  bt_refresh_remember(cache, &config, &key, (const int8_t *) PEER_ID_B, &peer_b, false);
+
+  mu_assert("error, refresh not deferred",
+            bt_refresh_peer(cache, redis, &config, &key,
+                            (const int8_t *) PEER_ID_A, &peer_a, false));
+  mu_assert("error, refresh not deferred",
+            bt_refresh_peer(cache, redis, &config, &key,
+                            (const int8_t *) PEER_ID_B, &peer_b, false));
+
+  /* Peer A stops, peer B completes, both before the batch goes out. */
+  bt_refresh_forget(cache, &key, (const int8_t *) PEER_ID_A);
+  bt_remove_peer(redis, &config, &key, (const int8_t *) PEER_ID_A, false);
+  bt_refresh_forget(cache, &key, (const int8_t *) PEER_ID_B);
+  bt_promote_peer(redis, &config, &key, (const int8_t *) PEER_ID_B);
+  mu_assert("error, forgotten refreshes still pending", cache->pending_len == 0);
+
+  bt_refresh_flush(cache, redis, &config);
+
+  bt_torrent_stats_t stats = { 0 };
+  bt_get_torrent_stats(redis, &config, &key, &stats);
+  mu_assert("error, stopped peer brought back", stats.leechers == 0);
+  mu_assert("error, wrong number of seeders", stats.seeders == 1);
+
+  bt_free_refresh_cache(cache);
+  redisFree(redis);
+  bt_fakeredis_stop(server);
+  return NULL;
+}
+
+char *
+test_data_refresh_failed_flush()
+{
+  bt_config_t config;
+  data_config(&config, BT_PEER_STORAGE_SWARM);
+  config.announce_refresh_cache_size = 16;
+  config.announce_refresh_batch_size = 4;
+  config.announce_refresh_delay = 60000;
+
+  bt_fakeredis_t *server = bt_fakeredis_start(1);
+  redisContext *redis = data_connect(server);
+  mu_assert("error, cannot connect to fake Redis", redis != NULL);
+
+  bt_refresh_cache_t *cache = bt_new_refresh_cache(&config);
+  bt_info_hash_key_t key;
+  bt_info_hash_key(&config, (const int8_t *) INFO_HASH_A, &key);
+
+  bt_peer_t peer;
+  data_peer(&peer, 0x7f000001, 6881);
+  bt_insert_peer(redis, &config, &key, (const int8_t *) PEER_ID_A, &peer, false);
+  bt_refresh_remember(cache, &config, &key, (const int8_t *) PEER_ID_A, &peer, false);
+
+  bt_refresh_peer(cache, redis, &config, &key, (const int8_t *) PEER_ID_A, &peer, false);
+  bt_refresh_count_download(cache, redis, &config, &key);
+  bt_refresh_count_download(cache, redis, &config, &key);
+
+  /* Nothing Redis did not acknowledge is lost. */
+  bt_fakeredis_faults_t faults = { .disconnect_rate = 1 };
+  bt_fakeredis_set_faults(server, &faults);
+  bt_refresh_flush(cache, redis, &config);
+  mu_assert("error, downloads lost", cache->downloads_len == 1 && cache->downloads[0].count == 2);
+  mu_assert("error, refresh lost", cache->pending_len == 1 && cache->pending[0].rewrite);
+
+  memset(&faults, 0, sizeof(faults));
+  bt_fakeredis_set_faults(server, &faults);
+  redisFree(redis);
+  redis = data_connect(server);
+
+  /* The peer vanished meanwhile, which the refresh must not hide. */
+  bt_remove_peer(redis, &config, &key, (const int8_t *) PEER_ID_A, false);
+  bt_refresh_flush(cache, redis, &config);
+  mu_assert("error, queue not emptied", cache->downloads_len == 0 && cache->pending_len == 0);
+
+  bt_torrent_stats_t stats = { 0 };
+  bt_get_torrent_stats(redis, &config, &key, &stats);
+  mu_assert("error, wrong number of downloads", stats.downloads == 2);
+  mu_assert("error, refreshed peer not written", stats.leechers == 1);
+
+  int count = 0;
+  bt_list *peers = bt_peer_list(redis, &config, &key, 10, &count, false, BT_LOCALITY_NONE);
+  mu_assert("error, refreshed peer has no address", count == 1);
+  bt_list_free(peers);
+
+  bt_free_refresh_cache(cache);
+  redisFree(redis);
+  bt_fakeredis_stop(server);
+  return NULL;
+}
+
+char *
+test_data_breaker()
+{
+  bt_config_t config;
+  data_config(&config, BT_PEER_STORAGE_SWARM);
+  config.breaker_error_rate = 50;
+  config.breaker_min_requests = 4;
+  config.breaker_buffer_size = 2;
+
+  bt_fakeredis_t *server = bt_fakeredis_start(1);
+  redisContext *redis = data_connect(server);
+  mu_assert("error, cannot connect to fake Redis", redis != NULL);
+
+  /* Too few round trips to tell. */
+  bt_breaker_record(true, 100);
+  bt_breaker_record(false, 0);
+  mu_assert("error, breaker opened early", !bt_breaker_evaluate(&config) && !bt_breaker_open());
+
+  for (int i = 0; i < 4; i++) {
+    bt_breaker_record(i % 2 == 0, 100);
+  }
+  mu_assert("error, breaker not opened", bt_breaker_evaluate(&config) && bt_breaker_open());
+
+  bt_buffered_write_t write;
+  memset(&write, 0, sizeof(write));
+  bt_info_hash_key(&config, (const int8_t *) INFO_HASH_A, &write.info_hash_key);
+  memcpy(write.peer_id, PEER_ID_A, 20);
+  data_peer(&write.peer, 0x7f000001, 6881);
+
+  write.kind = BT_WRITE_INSERT;
+  mu_assert("error, insert not buffered", bt_breaker_buffer(&config, &write));
+  write.kind = BT_WRITE_PROMOTE;
+  mu_assert("error, promote not buffered", bt_breaker_buffer(&config, &write));
+  write.kind = BT_WRITE_REMOVE;
+  mu_assert("error, full buffer took a write", !bt_breaker_buffer(&config, &write));
+
+  mu_assert("error, breaker not closed", bt_breaker_close(redis, &config) && !bt_breaker_open());
+
+  bt_torrent_stats_t stats = { 0 };
+  bt_get_torrent_stats(redis, &config, &write.info_hash_key, &stats);
+  mu_assert("error, writes not replayed", stats.seeders == 1 && stats.leechers == 0);
+  mu_assert("error, download not replayed", stats.downloads == 1);
+
+  /* Writes Redis fails to take are kept for the next attempt. */
+  for (int i = 0; i < 4; i++) {
+    bt_breaker_record(false, 0);
+  }
+  mu_assert("error, breaker not reopened", bt_breaker_evaluate(&config) && bt_breaker_open());
+
+  bt_info_hash_key(&config, (const int8_t *) INFO_HASH_B, &write.info_hash_key);
+  write.kind = BT_WRITE_INSERT;
+  mu_assert("error, insert not buffered", bt_breaker_buffer(&config, &write));
+  write.kind = BT_WRITE_PROMOTE;
+  mu_assert("error, promote not buffered", bt_breaker_buffer(&config, &write));
+
+  bt_fakeredis_faults_t faults = { .disconnect_rate = 1 };
+  bt_fakeredis_set_faults(server, &faults);
+  mu_assert("error, breaker closed on failure", !bt_breaker_close(redis, &config) && bt_breaker_open());
+  mu_assert("error, failed writes lost", bt_stats_get(BT_STAT_BUFFERED_WRITES) == 2);
+
+  memset(&faults, 0, sizeof(faults));
+  bt_fakeredis_set_faults(server, &faults);
+  redisFree(redis);
+  redis = data_connect(server);
+
+  mu_assert("error, breaker not closed", bt_breaker_close(redis, &config) && !bt_breaker_open());
+  bt_get_torrent_stats(redis, &config, &write.info_hash_key, &stats);
+  mu_assert("error, failed writes not replayed", stats.seeders == 1 && stats.downloads == 1);
+
+  redisFree(redis);
+  bt_fakeredis_stop(server);
+  return NULL;
+}
+
+char *
+test_data_redis_trips()
+{
+  bt_config_t config;
+  data_config(&config, BT_PEER_STORAGE_SWARM);
+  config.breaker_error_rate = 50;
+  config.breaker_min_requests = 2;
+
+  bt_fakeredis_t *server = bt_fakeredis_start(1);
+  redisContext *redis = data_connect(server);
+  bt_redis_trips_t trips;
+  redisReply *reply;
+
+  bt_redis_take_trips(&trips);
+
+  /* A pipeline is a single round trip. */
+  mu_assert("error, ping failed", bt_redis_ping(redis));
+  for (int i = 0; i < 3; i++) {
+    bt_redis_append_command(redis, "PING");
+  }
+  for (int i = 0; i < 3; i++) {
+    mu_assert("error, pipelined ping failed", bt_redis_get_reply(redis, (void **) &reply) == REDIS_OK);
+    freeReplyObject(reply);
+  }
+
+  bt_redis_take_trips(&trips);
+  mu_assert("error, wrong number of round trips", trips.total == 2 && trips.failures == 0);
+
+  bt_redis_take_trips(&trips);
+  mu_assert("error, round trips not reset", trips.total == 0);
+
+  /* Failed round trips of the handlers open the breaker. */
+  bt_fakeredis_faults_t faults = { .disconnect_rate = 1 };
+  bt_fakeredis_set_faults(server, &faults);
+  mu_assert("error, disconnect not seen", !bt_redis_ping(redis));
+  mu_assert("error, dead connection answered", !bt_redis_ping(redis));
+
+  bt_redis_take_trips(&trips);
+  mu_assert("error, failures not counted", trips.total == 2 && trips.failures == 2);
+
+  bt_breaker_record_trips(&trips);
+  mu_assert("error, breaker not opened", bt_breaker_evaluate(&config) && bt_breaker_open());
+
+  memset(&faults, 0, sizeof(faults));
+  bt_fakeredis_set_faults(server, &faults);
+  redisFree(redis);
+  redis = data_connect(server);
+  mu_assert("error, breaker not closed", bt_breaker_close(redis, &config) && !bt_breaker_open());
+
+  redisFree(redis);
+  bt_fakeredis_stop(server);
+  return NULL;
+}
+
+char *
+test_data_connections()
+{
+  bt_config_t config;
+  data_config(&config, BT_PEER_STORAGE_KEYS);
+
+  bt_fakeredis_t *server = bt_fakeredis_start(1);
+  redisContext *redis = data_connect(server);
+
+  int64_t connection_id = 0x0123456789abcdefLL;
+  bt_insert_connection(redis, &config, connection_id);
+  mu_assert("error, connection not stored", bt_connection_valid(redis, &config, connection_id));
+
+  redisReply *reply = redisCommand(redis, "PTTL bttracker:c:%b", &connection_id, sizeof(int64_t));
+  mu_assert("error, connection does not expire", reply != NULL && reply->integer > 0);
+  freeReplyObject(reply);
+
+  redisFree(redis);
+  bt_fakeredis_stop(server);
+  return NULL;
+}
+
+char *
+test_data_whitelist()
+{
+  bt_config_t config;
+  data_config(&config, BT_PEER_STORAGE_KEYS);
+  config.info_hash_restriction = BT_RESTRICTION_WHITELIST;
+
+  bt_fakeredis_t *server = bt_fakeredis_start(1);
+  redisContext *redis = data_connect(server);
+
+  bt_info_hash_key_t key;
+  bt_info_hash_key(&config, (const int8_t *) INFO_HASH_A, &key);
+  mu_assert("error, unlisted torrent allowed", bt_info_hash_blacklisted(redis, &config, &key));
+
+  freeReplyObject(redisCommand(redis, "SADD bttracker:i:wl %b", key.str, key.len));
+  mu_assert("error, listed torrent refused", !bt_info_hash_blacklisted(redis, &config, &key));
+
+  redisFree(redis);
+  bt_fakeredis_stop(server);
+  return NULL;
+}
+
+char *
+test_data_injected_errors()
+{
+  bt_fakeredis_t *server = bt_fakeredis_start(1);
+  redisContext *redis = data_connect(server);
+  bt_fakeredis_faults_t faults = { .error_rate = 1 };
+
+  bt_fakeredis_set_faults(server, &faults);
+  mu_assert("error, injected error not seen", !bt_redis_ping(redis));
+
+  memset(&faults, 0, sizeof(faults));
+  bt_fakeredis_set_faults(server, &faults);
+  mu_assert("error, ping failed without faults", bt_redis_ping(redis));
+
+  redisFree(redis);
+  bt_fakeredis_stop(server);
+  return NULL;
+}
+
+char *
+test_data_injected_latency()
+{
+  bt_fakeredis_t *server = bt_fakeredis_start(1);
+  redisContext *redis = data_connect(server);
+  bt_fakeredis_faults_t faults = { .latency_us = 20000 };
+
+  bt_fakeredis_set_faults(server, &faults);
+  mu_assert("error, latency not injected", data_ping_time(redis) >= 20000);
+
+  faults = (bt_fakeredis_faults_t) { .tail_rate = 1, .tail_us = 10000 };
+  bt_fakeredis_set_faults(server, &faults);
+  mu_assert("error, tail latency not injected", data_ping_time(redis) >= 10000);
+
+  memset(&faults, 0, sizeof(faults));
+  bt_fakeredis_set_faults(server, &faults);
+  bt_fakeredis_stall(server, 30000);
+  mu_assert("error, stall not injected", data_ping_time(redis) >= 30000);
+  mu_assert("error, stall did not end", data_ping_time(redis) < 30000);
+
+  redisFree(redis);
+  bt_fakeredis_stop(server);
+  return NULL;
+}
+
+char *
+test_data_injected_disconnect()
+{
+  bt_fakeredis_t *server = bt_fakeredis_start(1);
+  redisContext *redis = data_connect(server);
+  bt_fakeredis_faults_t faults = { .disconnect_rate = 1 };
+
+  bt_fakeredis_set_faults(server, &faults);
+  mu_assert("error, disconnect not seen", !bt_redis_ping(redis));
+
+  memset(&faults, 0, sizeof(faults));
+  bt_fakeredis_set_faults(server, &faults);
+  mu_assert("error, closed connection still usable", !bt_redis_ping(redis));
+  redisFree(redis);
+
+  redis = data_connect(server);
+  mu_assert("error, cannot reconnect", bt_redis_ping(redis));
+
+  redisFree(redis);
+  bt_fakeredis_stop(server);
+  return NULL;
+}
+
+char *
+all_tests()
+{
+  mu_run_test(test_data_keys_storage);
+  mu_run_test(test_data_swarm_storage);
+  mu_run_test(test_data_swarm_promotion);
+  mu_run_test(test_data_reaper_prefix);
+  mu_run_test(test_data_snapshot);
+  mu_run_test(test_data_swarm_sample);
+  mu_run_test(test_data_locality);
+  mu_run_test(test_data_batched_downloads);
+  mu_run_test(test_data_refresh_forget);
+  mu_run_test(test_data_refresh_failed_flush);
+  mu_run_test(test_data_breaker);
+  mu_run_test(test_data_redis_trips);
+  mu_run_test(test_data_connections);
+  mu_run_test(test_data_whitelist);
+  mu_run_test(test_data_injected_errors);
+  mu_run_test(test_data_injected_latency);
+  mu_run_test(test_data_injected_disconnect);
+
+  return NULL;
+}
@@ -0,0 +1,1740 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <netinet/tcp.h>
+#include <sys/timerfd.h>
+
+#include "fakeredis.h"
+
+/* Most clients served at once. */
+#define BT_FAKEREDIS_MAX_CLIENTS 64
+
+/* Types of the values held in the keyspace. */
+typedef enum {
+  BT_FAKEREDIS_STRING,
+  BT_FAKEREDIS_HASH,
+  BT_FAKEREDIS_SET,
+  BT_FAKEREDIS_ZSET
+} bt_fakeredis_type;
+
+/* Binary safe string: keys, values, fields and command arguments. */
+typedef struct {
+  const char *data;
+  size_t len;
+} bt_fakeredis_str_t;
+
+/* Value stored under a key. */
+typedef struct {
+  bt_fakeredis_type type;
+  bt_fakeredis_str_t *string; // Value of a string
+  GHashTable *fields;         // Fields of a hash, members of a set or zset
+  int64_t expires_at;         // Monotonic time in microseconds, 0 for never
+} bt_fakeredis_value_t;
+
+/* Growable byte buffer. */
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+} bt_fakeredis_buf_t;
+
+/* Reply waiting to be sent, or a connection waiting to be closed. */
+typedef struct bt_fakeredis_reply {
+  int64_t due;        // Monotonic time at which it may be sent
+  bool close;         // Closes the connection instead of sending data
+  char *data;
+  size_t len;
+  size_t sent;
+  struct bt_fakeredis_reply *next;
+} bt_fakeredis_reply_t;
+
+/* Connected client. */
+typedef struct {
+  int fd;
+  bool closing;       // No more commands are read once a close is queued
+  bool blocked;       // The socket cannot take more data for now
+  bt_fakeredis_buf_t in;
+  bt_fakeredis_reply_t *head;
+  bt_fakeredis_reply_t *tail;
+} bt_fakeredis_client_t;
+
+struct bt_fakeredis {
+  int listen_sock;
+  int timer;          // Fires when the next delayed reply is due
+  int stop_pipe[2];
+  uint16_t port;
+  GThread *thread;
+
+  GMutex lock;        // Guards the faults and the stall
+  bt_fakeredis_faults_t faults;
+  int64_t stalled_until;
+
+  /* Only touched by the server thread. */
+  unsigned int seed;
+  GHashTable *keys;
+  bt_fakeredis_client_t *clients[BT_FAKEREDIS_MAX_CLIENTS];
+  int client_count;
+  bt_fakeredis_str_t *argv;
+  int argv_cap;
+  bt_fakeredis_buf_t out;
+};
+
+/* Handler of a command, which writes its reply to `out`. */
+typedef void (*bt_fakeredis_command_fn)(bt_fakeredis_t *server,
+                                        bt_fakeredis_buf_t *out, int argc,
+                                        const bt_fakeredis_str_t *argv);
+
+void *
+bt_fakeredis_alloc(size_t size)
+{
+  void *ptr = malloc(size);
+
+  if (NULL == ptr) {
+    syslog(LOG_ERR, "Cannot allocate memory for fake Redis");
+    exit(BT_EXIT_MALLOC_ERROR);
+  }
+
+  return ptr;
+}
+
+/*
+ * Strings.
+ */
+
+bt_fakeredis_str_t *
+bt_fakeredis_str_new(const char *data, size_t len)
+{
+  bt_fakeredis_str_t *str = bt_fakeredis_alloc(sizeof(bt_fakeredis_str_t) +
+                                               len + 1);
+  char *copy = (char *) (str + 1);
+
+  memcpy(copy, data, len);
+  copy[len] = 0;
+
+  str->data = copy;
+  str->len = len;
+  return str;
+}
+
+guint
+bt_fakeredis_str_hash(gconstpointer ptr)
+{
+  const bt_fakeredis_str_t *str = (const bt_fakeredis_str_t *) ptr;
+  guint hash = 2166136261U;
+
+  for (size_t i = 0; i < str->len; i++) {
+    hash = (hash ^ (uint8_t) str->data[i]) * 16777619U;
+  }
+
+  return hash;
+}
+
+gboolean
+bt_fakeredis_str_equal(gconstpointer a, gconstpointer b)
+{
+  const bt_fakeredis_str_t *x = (const bt_fakeredis_str_t *) a;
+  const bt_fakeredis_str_t *y = (const bt_fakeredis_str_t *) b;
+
+  return x->len == y->len && memcmp(x->data, y->data, x->len) == 0;
+}
+
+/* Whether `str` is, case aside, the given C string. */
+bool
+bt_fakeredis_str_is(const bt_fakeredis_str_t *str, const char *name)
+{
+  return strlen(name) == str->len &&
+    strncasecmp(str->data, name, str->len) == 0;
+}
+
+/* Parses a whole string as an integer. */
+bool
+bt_fakeredis_str_integer(const bt_fakeredis_str_t *str, long long *value)
+{
+  char buf[32], *end;
+
+  if (0 == str->len || str->len >= sizeof(buf)) {
+    return false;
+  }
+
+  memcpy(buf, str->data, str->len);
+  buf[str->len] = 0;
+
+  errno = 0;
+  *value = strtoll(buf, &end, 10);
+  return 0 == errno && 0 == *end;
+}
+
+/* Parses a whole string as a score, optionally preceded by `(`. */
+bool
+bt_fakeredis_str_score(const bt_fakeredis_str_t *str, double *value,
+                       bool *exclusive)
+{
+  char buf[64], *end;
+  size_t skip = (NULL != exclusive && str->len > 0 && '(' == str->data[0]);
+
+  if (NULL != exclusive) {
+    *exclusive = skip;
+  }
+
+  if (str->len - skip == 0 || str->len - skip >= sizeof(buf)) {
+    return false;
+  }
+
+  memcpy(buf, str->data + skip, str->len - skip);
+  buf[str->len - skip] = 0;
+
+  *value = strtod(buf, &end);
+  return 0 == *end && *value == *value;
+}
+
+/*
+ * Matches a string against a glob-style pattern, as KEYS and SCAN do: `*`,
+ * `?`, character classes and backslash escapes are supported.
+ */
+bool
+bt_fakeredis_match(const char *pattern, size_t pattern_len, const char *str,
+                   size_t str_len)
+{
+  while (pattern_len > 0) {
+    switch (*pattern) {
+    case '*':
+      for (size_t i = 0; i <= str_len; i++) {
+        if (bt_fakeredis_match(pattern + 1, pattern_len - 1, str + i,
+                               str_len - i)) {
+          return true;
+        }
+      }
+      return false;
+
+    case '?':
+      if (0 == str_len) {
+        return false;
+      }
+      break;
+
+    case '[': {
+      if (0 == str_len) {
+        return false;
+      }
+
+      pattern++;
+      pattern_len--;
+
+      bool negate = pattern_len > 0 && '^' == *pattern;
+      bool matched = false;
+      uint8_t c = (uint8_t) *str;
+
+      if (negate) {
+        pattern++;
+        pattern_len--;
+      }
+
+      while (pattern_len > 0 && ']' != *pattern) {
+        if ('\\' == *pattern && pattern_len > 1) {
+          pattern++;
+          pattern_len--;
+          matched |= (c == (uint8_t) *pattern);
+        } else if (pattern_len > 2 && '-' == pattern[1] && ']' != pattern[2]) {
+          uint8_t low = (uint8_t) MIN(pattern[0], pattern[2]);
+          uint8_t high = (uint8_t) MAX(pattern[0], pattern[2]);
+
+          matched |= (c >= low && c <= high);
+          pattern += 2;
+          pattern_len -= 2;
+        } else {
+          matched |= (c == (uint8_t) *pattern);
+        }
+
+        pattern++;
+        pattern_len--;
+      }
+
+      if (matched == negate) {
+        return false;
+      }
+
+      /* Unterminated classes end the pattern. */
+      if (0 == pattern_len) {
+        return 1 == str_len;
+      }
+      break;
+    }
+
+    case '\\':
+      if (pattern_len > 1) {
+        pattern++;
+        pattern_len--;
+      }
+      /* Falls through. */
+
+    default:
+      if (0 == str_len || *pattern != *str) {
+        return false;
+      }
+    }
+
+    pattern++;
+    pattern_len--;
+    str++;
+    str_len--;
+  }
+
+  return 0 == str_len;
+}
+
+/*
+ * Replies.
+ */
+
+void
+bt_fakeredis_append(bt_fakeredis_buf_t *buf, const char *data, size_t len)
+{
+  if (buf->len + len > buf->cap) {
+    buf->cap = MAX(buf->len + len, buf->cap * 2);
+    buf->data = realloc(buf->data, buf->cap);
+
+    if (NULL == buf->data) {
+      syslog(LOG_ERR, "Cannot allocate memory for fake Redis buffer");
+      exit(BT_EXIT_MALLOC_ERROR);
+    }
+  }
+
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+}
+
+void
+bt_fakeredis_appendf(bt_fakeredis_buf_t *buf, const char *format, ...)
+{
+  char line[128];
+  va_list ap;
+
+  va_start(ap, format);
+  int len = vsnprintf(line, sizeof(line), format, ap);
+  va_end(ap);
+
+  bt_fakeredis_append(buf, line, MIN((size_t) len, sizeof(line) - 1));
+}
+
+void
+bt_fakeredis_reply_bulk(bt_fakeredis_buf_t *out, const char *data, size_t len)
+{
+  bt_fakeredis_appendf(out, "$%zu\r\n", len);
+  bt_fakeredis_append(out, data, len);
+  bt_fakeredis_append(out, "\r\n", 2);
+}
+
+void
+bt_fakeredis_reply_score(bt_fakeredis_buf_t *out, double score)
+{
+  char buf[64];
+  int len = snprintf(buf, sizeof(buf), "%.17g", score);
+
+  bt_fakeredis_reply_bulk(out, buf, len);
+}
+
+#define bt_fakeredis_reply_ok(out)      bt_fakeredis_appendf(out, "+OK\r\n")
+#define bt_fakeredis_reply_nil(out)     bt_fakeredis_appendf(out, "$-1\r\n")
+#define bt_fakeredis_reply_int(out, n)  bt_fakeredis_appendf(out, ":%lld\r\n", \
+                                                             (long long) (n))
+#define bt_fakeredis_reply_array(out, n) bt_fakeredis_appendf(out, "*%zu\r\n", \
+                                                              (size_t) (n))
+#define bt_fakeredis_reply_error(out, msg) \
+  bt_fakeredis_appendf(out, "-%s\r\n", msg)
+
+#define BT_FAKEREDIS_WRONGTYPE \
+  "WRONGTYPE Operation against a key holding the wrong kind of value"
+
+#define BT_FAKEREDIS_NOT_INTEGER \
+  "ERR value is not an integer or out of range"
+
+/*
+ * Keyspace.
+ */
+
+void
+bt_fakeredis_free_value(gpointer ptr)
+{
+  bt_fakeredis_value_t *value = (bt_fakeredis_value_t *) ptr;
+
+  free(value->string);
+  if (NULL != value->fields) {
+    g_hash_table_destroy(value->fields);
+  }
+  free(value);
+}
+
+bt_fakeredis_value_t *
+bt_fakeredis_new_value(bt_fakeredis_type type)
+{
+  bt_fakeredis_value_t *value =
+    bt_fakeredis_alloc(sizeof(bt_fakeredis_value_t));
+
+  value->type = type;
+  value->string = NULL;
+  value->fields = NULL;
+  value->expires_at = 0;
+
+  /* Members of sets are their own values. */
+  if (BT_FAKEREDIS_STRING != type) {
+    GDestroyNotify free_value = BT_FAKEREDIS_SET == type ? NULL : free;
+
+    value->fields = g_hash_table_new_full(bt_fakeredis_str_hash,
+                                          bt_fakeredis_str_equal, free,
+                                          free_value);
+  }
+
+  return value;
+}
+
+bool
+bt_fakeredis_expired(const bt_fakeredis_value_t *value, int64_t now)
+{
+  return 0 != value->expires_at && value->expires_at <= now;
+}
+
+/* Returns the value stored under `key`, dropping it if it has expired. */
+bt_fakeredis_value_t *
+bt_fakeredis_lookup(bt_fakeredis_t *server, const bt_fakeredis_str_t *key)
+{
+  bt_fakeredis_value_t *value = g_hash_table_lookup(server->keys, key);
+
+  if (NULL != value && bt_fakeredis_expired(value, g_get_monotonic_time())) {
+    g_hash_table_remove(server->keys, key);
+    return NULL;
+  }
+
+  return value;
+}
+
+/* Stores `value` under `key`, replacing whatever was there. */
+void
+bt_fakeredis_store(bt_fakeredis_t *server, const bt_fakeredis_str_t *key,
+                   bt_fakeredis_value_t *value)
+{
+  g_hash_table_replace(server->keys, bt_fakeredis_str_new(key->data, key->len),
+                       value);
+}
+
+/*
+ * Finds the value of `key` when it has the given type, creating it if
+ * asked to. Replies with an error and returns false if it has another type.
+ */
+bool
+bt_fakeredis_fetch(bt_fakeredis_t *server, bt_fakeredis_buf_t *out,
+                   const bt_fakeredis_str_t *key, bt_fakeredis_type type,
+                   bool create, bt_fakeredis_value_t **value)
+{
+  *value = bt_fakeredis_lookup(server, key);
+
+  if (NULL != *value && type != (*value)->type) {
+    bt_fakeredis_reply_error(out, BT_FAKEREDIS_WRONGTYPE);
+    return false;
+  }
+
+  if (NULL == *value && create) {
+    *value = bt_fakeredis_new_value(type);
+    bt_fakeredis_store(server, key, *value);
+  }
+
+  return true;
+}
+
+/* Drops collections left empty, as Redis does. */
+void
+bt_fakeredis_prune(bt_fakeredis_t *server, const bt_fakeredis_str_t *key,
+                   bt_fakeredis_value_t *value)
+{
+  if (NULL != value && g_hash_table_size(value->fields) == 0) {
+    g_hash_table_remove(server->keys, key);
+  }
+}
+
+const char *
+bt_fakeredis_type_name(bt_fakeredis_type type)
+{
+  switch (type) {
+  case BT_FAKEREDIS_HASH: return "hash";
+  case BT_FAKEREDIS_SET:  return "set";
+  case BT_FAKEREDIS_ZSET: return "zset";
+  default:                return "string";
+  }
+}
+
+/* Replies with the live keys matching `pattern` and, if given, `type`. */
+void
+bt_fakeredis_reply_keys(bt_fakeredis_t *server, bt_fakeredis_buf_t *out,
+                        const bt_fakeredis_str_t *pattern,
+                        const bt_fakeredis_str_t *type)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+  GList *matches = NULL;
+  size_t count = 0;
+  int64_t now = g_get_monotonic_time();
+
+  g_hash_table_iter_init(&iter, server->keys);
+
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    bt_fakeredis_str_t *str = (bt_fakeredis_str_t *) key;
+    bt_fakeredis_value_t *val = (bt_fakeredis_value_t *) value;
+
+    if (bt_fakeredis_expired(val, now) ||
+        (NULL != type &&
+         !bt_fakeredis_str_is(type, bt_fakeredis_type_name(val->type))) ||
+        (NULL != pattern &&
+         !bt_fakeredis_match(pattern->data, pattern->len, str->data,
+                             str->len))) {
+      continue;
+    }
+
+    matches = g_list_prepend(matches, str);
+    count++;
+  }
+
+  bt_fakeredis_reply_array(out, count);
+
+  for (GList *item = matches; NULL != item; item = g_list_next(item)) {
+    bt_fakeredis_str_t *str = (bt_fakeredis_str_t *) item->data;
+    bt_fakeredis_reply_bulk(out, str->data, str->len);
+  }
+
+  g_list_free(matches);
+}
+
+/*
+ * Commands.
+ */
+
+void
+bt_fakeredis_ping(bt_fakeredis_t *server, bt_fakeredis_buf_t *out, int argc,
+                  const bt_fakeredis_str_t *argv)
+{
+  bt_fakeredis_appendf(out, "+PONG\r\n");
+}
+
+/* There is a single database, whatever is selected. */
+void
+bt_fakeredis_select(bt_fakeredis_t *server, bt_fakeredis_buf_t *out, int argc,
+                    const bt_fakeredis_str_t *argv)
+{
+  bt_fakeredis_reply_ok(out);
+}
+
+void
+bt_fakeredis_flushdb(bt_fakeredis_t *server, bt_fakeredis_buf_t *out, int argc,
+                     const bt_fakeredis_str_t *argv)
+{
+  g_hash_table_remove_all(server->keys);
+  bt_fakeredis_reply_ok(out);
+}
+
+void
+bt_fakeredis_get(bt_fakeredis_t *server, bt_fakeredis_buf_t *out, int argc,
+                 const bt_fakeredis_str_t *argv)
+{
+  bt_fakeredis_value_t *value;
+
+  if (!bt_fakeredis_fetch(server, out, &argv[1], BT_FAKEREDIS_STRING, false,
+                          &value)) {
+    return;
+  }
+
+  if (NULL == value) {
+    bt_fakeredis_reply_nil(out);
+  } else {
+    bt_fakeredis_reply_bulk(out, value->string->data, value->string->len);
+  }
+}
+
+void
+bt_fakeredis_set_string(bt_fakeredis_t *server, const bt_fakeredis_str_t *key,
+                        const bt_fakeredis_str_t *string, int64_t ttl_us)
+{
+  bt_fakeredis_value_t *value = bt_fakeredis_new_value(BT_FAKEREDIS_STRING);
+
+  value->string = bt_fakeredis_str_new(string->data, string->len);
+  value->expires_at = ttl_us > 0 ? g_get_monotonic_time() + ttl_us : 0;
+  bt_fakeredis_store(server, key, value);
+}
+
+void
+bt_fakeredis_set(bt_fakeredis_t *server, bt_fakeredis_buf_t *out, int argc,
+                 const bt_fakeredis_str_t *argv)
+{
+  long long ttl = 0;
+  int64_t unit = 0;
+
+  if (5 == argc && bt_fakeredis_str_is(&argv[3], "EX")) {
+    unit = G_USEC_PER_SEC;
+  } else if (5 == argc && bt_fakeredis_str_is(&argv[3], "PX")) {
+    unit = 1000;
+  } else if (3 != argc) {
+    bt_fakeredis_reply_error(out, "ERR syntax error");
+    return;
+  }
+
+  if (0 != unit && (!bt_fakeredis_str_integer(&argv[4], &ttl) || ttl <= 0)) {
+    bt_fakeredis_reply_error(out, "ERR invalid expire time in 'set' command");
+    return;
+  }
+
+  bt_fakeredis_set_string(server, &argv[1], &argv[2], ttl * unit);
+  bt_fakeredis_reply_ok(out);
+}
+
+void
+bt_fakeredis_setex(bt_fakeredis_t *server, bt_fakeredis_buf_t *out, int argc,
+                   const bt_fakeredis_str_t *argv)
+{
+  long long ttl;
+
+  if (!bt_fakeredis_str_integer(&argv[2], &ttl) || ttl <= 0) {
+    bt_fakeredis_reply_error(out, "ERR invalid expire time in 'setex' command");
+    return;
+  }
+
+  bt_fakeredis_set_string(server, &argv[1], &argv[3], ttl * G_USEC_PER_SEC);
+  bt_fakeredis_reply_ok(out);
+}
+
+void
+bt_fakeredis_del(bt_fakeredis_t *server, bt_fakeredis_buf_t *out, int argc,
+                 const bt_fakeredis_str_t *argv)
+{
+  long long removed = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (NULL != bt_fakeredis_lookup(server, &argv[i])) {
+      g_hash_table_remove(server->keys, &argv[i]);
+      removed++;
+    }
+  }
+
+  bt_fakeredis_reply_int(out, removed);
+}
+
+void
+bt_fakeredis_rename(bt_fakeredis_t *server, bt_fakeredis_buf_t *out, int argc,
+                    const bt_fakeredis_str_t *argv)
+{
+  gpointer key, value;
+
+  if (NULL == bt_fakeredis_lookup(server, &argv[1]) ||
+      !g_hash_table_lookup_extended(server->keys, &argv[1], &key, &value)) {
+    bt_fakeredis_reply_error(out, "ERR no such key");
+    return;
+  }
+
+  if (!bt_fakeredis_str_equal(&argv[1], &argv[2])) {
+    g_hash_table_steal(server->keys, &argv[1]);
+    free(key);
+    bt_fakeredis_store(server, &argv[2], (bt_fakeredis_value_t *) value);
+  }
+
+  bt_fakeredis_reply_ok(out);
+}
+
+void
+bt_fakeredis_expire(bt_fakeredis_t *server, bt_fakeredis_buf_t *out, int argc,
+                    const bt_fakeredis_str_t *argv)
+{
+  long long ttl;
+  bt_fakeredis_value_t *value = bt_fakeredis_lookup(server, &argv[1]);
+
+  if (!bt_fakeredis_str_integer(&argv[2], &ttl)) {
+    bt_fakeredis_reply_error(out, BT_FAKEREDIS_NOT_INTEGER);
+    return;
+  }
+
+  if (NULL == value) {
+    bt_fakeredis_reply_int(out, 0);
+    return;
+  }
+
+  if (ttl <= 0) {
+    g_hash_table_remove(server->keys, &argv[1]);
+  } else {
+    value->expires_at = g_get_monotonic_time() + ttl * G_USEC_PER_SEC;
+  }
+
+  bt_fakeredis_reply_int(out, 1);
+}
+
+void
+bt_fakeredis_pttl(bt_fakeredis_t *server, bt_fakeredis_buf_t *out, int argc,
+                  const bt_fakeredis_str_t *argv)
+{
+  bt_fakeredis_value_t *value = bt_fakeredis_lookup(server, &argv[1]);
+
+  if (NULL == value) {
+    bt_fakeredis_reply_int(out, -2);
+  } else if (0 == value->expires_at) {
+    bt_fakeredis_reply_int(out, -1);
+  } else {
+    bt_fakeredis_reply_int(out, (value->expires_at - g_get_monotonic_time() +
+                                 999) / 1000);
+  }
+}
+
+void
+bt_fakeredis_keys(bt_fakeredis_t *server, bt_fakeredis_buf_t *out, int argc,
+                  const bt_fakeredis_str_t *argv)
+{
+  bt_fakeredis_reply_keys(server, out, &argv[1], NULL);
+}
+
+/* Returns every match in the first call, with a cursor that ends the scan. */
+void
+bt_fakeredis_scan(bt_fakeredis_t *server, bt_fakeredis_buf_t *out, int argc,
+                  const bt_fakeredis_str_t *argv)
+{
+  const bt_fakeredis_str_t *pattern = NULL, *type = NULL;
+
+  for (int i = 2; i + 1 < argc; i += 2) {
+    if (bt_fakeredis_str_is(&argv[i], "MATCH")) {
+      pattern = &argv[i + 1];
+    } else if (bt_fakeredis_str_is(&argv[i], "TYPE")) {
+      type = &argv[i + 1];
+    } else if (!bt_fakeredis_str_is(&argv[i], "COUNT")) {
+      bt_fakeredis_reply_error(out, "ERR syntax error");
+      return;
+    }
+  }
+
+  bt_fakeredis_reply_array(out, 2);
+  bt_fakeredis_reply_bulk(out, "0", 1);
+  bt_fakeredis_reply_keys(server, out, pattern, type);
+}
+
+void
+bt_fakeredis_hget(bt_fakeredis_t *server, bt_fakeredis_buf_t *out, int argc,
+                  const bt_fakeredis_str_t *argv)
+{
+  bt_fakeredis_value_t *value;
+  bt_fakeredis_str_t *field = NULL;
+
+  if (!bt_fakeredis_fetch(server, out, &argv[1], BT_FAKEREDIS_HASH, false,
+                          &value)) {
+    return;
+  }
+
+  if (NULL != value) {
+    field = g_hash_table_lookup(value->fields, &argv[2]);
+  }
+
+  if (NULL == field) {
+    bt_fakeredis_reply_nil(out);
+  } else {
+    bt_fakeredis_reply_bulk(out, field->data, field->len);
+  }
+}
+
+void
+bt_fakeredis_hmget(bt_fakeredis_t *server, bt_fakeredis_buf_t *out, int argc,
+                   const bt_fakeredis_str_t *argv)
+{
+  bt_fakeredis_value_t *value;
+
+  if (!bt_fakeredis_fetch(server, out, &argv[1], BT_FAKEREDIS_HASH, false,
+                          &value)) {
+    return;
+  }
+
+  bt_fakeredis_reply_array(out, argc - 2);
+
+  for (int i = 2; i < argc; i++) {
+    bt_fakeredis_str_t *field = NULL;
+
+    if (NULL != value) {
+      field = g_hash_table_lookup(value->fields, &argv[i]);
+    }
+
+    if (NULL == field) {
+      bt_fakeredis_reply_nil(out);
+    } else {
+      bt_fakeredis_reply_bulk(out, field->data, field->len);
+    }
+  }
+}
+
+void
+bt_fakeredis_hset(bt_fakeredis_t *server, bt_fakeredis_buf_t *out, int argc,
+                  const bt_fakeredis_str_t *argv)
+{
+  bt_fakeredis_value_t *value;
+  long long added = 0;
+
+  if (argc % 2 != 0) {
+    bt_fakeredis_reply_error(out, "ERR wrong number of arguments for 'hset'");
+    return;
+  }
+
+  if (!bt_fakeredis_fetch(server, out, &argv[1], BT_FAKEREDIS_HASH, true,
+                          &value)) {
+    return;
+  }
+
+  for (int i = 2; i < argc; i += 2) {
+    added += g_hash_table_replace(value->fields,
+                                  bt_fakeredis_str_new(argv[i].data,
+                                                       argv[i].len),
+                                  bt_fakeredis_str_new(argv[i + 1].data,
+                                                       argv[i + 1].len));
+  }
+
+  bt_fakeredis_reply_int(out, added);
+}
+
+void
+bt_fakeredis_hincrby(bt_fakeredis_t *server, bt_fakeredis_buf_t *out, int argc,
+                     const bt_fakeredis_str_t *argv)
+{
+  bt_fakeredis_value_t *value;
+  long long increment, current = 0;
+
+  if (!bt_fakeredis_str_integer(&argv[3], &increment)) {
+    bt_fakeredis_reply_error(out, BT_FAKEREDIS_NOT_INTEGER);
+    return;
+  }
+
+  if (!bt_fakeredis_fetch(server, out, &argv[1], BT_FAKEREDIS_HASH, true,
+                          &value)) {
+    return;
+  }
+
+  bt_fakeredis_str_t *field = g_hash_table_lookup(value->fields, &argv[2]);
+
+  if (NULL != field && !bt_fakeredis_str_integer(field, &current)) {
+    bt_fakeredis_reply_error(out, "ERR hash value is not an integer");
+    return;
+  }
+
+  char number[32];
+  int number_len = sprintf(number, "%lld", current + increment);
+
+  g_hash_table_replace(value->fields,
+                       bt_fakeredis_str_new(argv[2].data, argv[2].len),
+                       bt_fakeredis_str_new(number, number_len));
+
+  bt_fakeredis_reply_int(out, current + increment);
+}
+
+void
+bt_fakeredis_hdel(bt_fakeredis_t *server, bt_fakeredis_buf_t *out, int argc,
+                  const bt_fakeredis_str_t *argv)
+{
+  bt_fakeredis_value_t *value;
+  long long removed = 0;
+
+  if (!bt_fakeredis_fetch(server, out, &argv[1], BT_FAKEREDIS_HASH, false,
+                          &value)) {
+    return;
+  }
+
+  for (int i = 2; NULL != value && i < argc; i++) {
+    removed += g_hash_table_remove(value->fields, &argv[i]);
+  }
+
+  bt_fakeredis_prune(server, &argv[1], value);
+  bt_fakeredis_reply_int(out, removed);
+}
+
+void
+bt_fakeredis_sadd(bt_fakeredis_t *server, bt_fakeredis_buf_t *out, int argc,
+                  const bt_fakeredis_str_t *argv)
+{
+  bt_fakeredis_value_t *value;
+  long long added = 0;
+
+  if (!bt_fakeredis_fetch(server, out, &argv[1], BT_FAKEREDIS_SET, true,
+                          &value)) {
+    return;
+  }
+
+  for (int i = 2; i < argc; i++) {
+    if (!g_hash_table_contains(value->fields, &argv[i])) {
+      bt_fakeredis_str_t *member = bt_fakeredis_str_new(argv[i].data,
+                                                        argv[i].len);
+      g_hash_table_insert(value->fields, member, member);
+      added++;
+    }
+  }
+
+  bt_fakeredis_reply_int(out, added);
+}
+
+void
+bt_fakeredis_sismember(bt_fakeredis_t *server, bt_fakeredis_buf_t *out,
+                       int argc, const bt_fakeredis_str_t *argv)
+{
+  bt_fakeredis_value_t *value;
+
+  if (!bt_fakeredis_fetch(server, out, &argv[1], BT_FAKEREDIS_SET, false,
+                          &value)) {
+    return;
+  }
+
+  bt_fakeredis_reply_int(out, NULL != value &&
+                         g_hash_table_contains(value->fields, &argv[2]));
+}
+
+void
+bt_fakeredis_smembers(bt_fakeredis_t *server, bt_fakeredis_buf_t *out,
+                      int argc, const bt_fakeredis_str_t *argv)
+{
+  bt_fakeredis_value_t *value;
+  GHashTableIter iter;
+  gpointer member;
+
+  if (!bt_fakeredis_fetch(server, out, &argv[1], BT_FAKEREDIS_SET, false,
+                          &value)) {
+    return;
+  }
+
+  if (NULL == value) {
+    bt_fakeredis_reply_array(out, 0);
+    return;
+  }
+
+  bt_fakeredis_reply_array(out, g_hash_table_size(value->fields));
+  g_hash_table_iter_init(&iter, value->fields);
+
+  while (g_hash_table_iter_next(&iter, &member, NULL)) {
+    bt_fakeredis_str_t *str = (bt_fakeredis_str_t *) member;
+    bt_fakeredis_reply_bulk(out, str->data, str->len);
+  }
+}
+
+void
+bt_fakeredis_zadd(bt_fakeredis_t *server, bt_fakeredis_buf_t *out, int argc,
+                  const bt_fakeredis_str_t *argv)
+{
+  bt_fakeredis_value_t *value;
+  long long added = 0;
+
+  if (argc % 2 != 0) {
+    bt_fakeredis_reply_error(out, "ERR syntax error");
+    return;
+  }
+
+  for (int i = 2; i < argc; i += 2) {
+    double score;
+
+    if (!bt_fakeredis_str_score(&argv[i], &score, NULL)) {
+      bt_fakeredis_reply_error(out, "ERR value is not a valid float");
+      return;
+    }
+  }
+
+  if (!bt_fakeredis_fetch(server, out, &argv[1], BT_FAKEREDIS_ZSET, true,
+                          &value)) {
+    return;
+  }
+
+  for (int i = 2; i < argc; i += 2) {
+    double *score = bt_fakeredis_alloc(sizeof(double));
+
+    bt_fakeredis_str_score(&argv[i], score, NULL);
+    added += g_hash_table_replace(value->fields,
+                                  bt_fakeredis_str_new(argv[i + 1].data,
+                                                       argv[i + 1].len),
+                                  score);
+  }
+
+  bt_fakeredis_reply_int(out, added);
+}
+
+void
+bt_fakeredis_zrem(bt_fakeredis_t *server, bt_fakeredis_buf_t *out, int argc,
+                  const bt_fakeredis_str_t *argv)
+{
+  bt_fakeredis_value_t *value;
+  long long removed = 0;
+
+  if (!bt_fakeredis_fetch(server, out, &argv[1], BT_FAKEREDIS_ZSET, false,
+                          &value)) {
+    return;
+  }
+
+  for (int i = 2; NULL != value && i < argc; i++) {
+    removed += g_hash_table_remove(value->fields, &argv[i]);
+  }
+
+  bt_fakeredis_prune(server, &argv[1], value);
+  bt_fakeredis_reply_int(out, removed);
+}
+
+/* Member of a sorted set, as returned by range queries. */
+typedef struct {
+  const bt_fakeredis_str_t *member;
+  double score;
+} bt_fakeredis_entry_t;
+
+int
+bt_fakeredis_entry_compare(const void *a, const void *b)
+{
+  const bt_fakeredis_entry_t *x = (const bt_fakeredis_entry_t *) a;
+  const bt_fakeredis_entry_t *y = (const bt_fakeredis_entry_t *) b;
+
+  if (x->score != y->score) {
+    return x->score < y->score ? -1 : 1;
+  }
+
+  int cmp = memcmp(x->member->data, y->member->data,
+                   MIN(x->member->len, y->member->len));
+
+  return 0 != cmp ? cmp : (int) x->member->len - (int) y->member->len;
+}
+
+/*
+ * Collects the members of the sorted set `key` scored within `min` and
+ * `max`, in order. Returns -1 after replying with an error.
+ */
+ssize_t
+bt_fakeredis_zrange(bt_fakeredis_t *server, bt_fakeredis_buf_t *out,
+                    const bt_fakeredis_str_t *argv,
+                    bt_fakeredis_entry_t **entries)
+{
+  bt_fakeredis_value_t *value;
+  double min, max;
+  bool min_exclusive, max_exclusive;
+
+  *entries = NULL;
+
+  if (!bt_fakeredis_str_score(&argv[2], &min, &min_exclusive) ||
+      !bt_fakeredis_str_score(&argv[3], &max, &max_exclusive)) {
+    bt_fakeredis_reply_error(out, "ERR min or max is not a float");
+    return -1;
+  }
+
+  if (!bt_fakeredis_fetch(server, out, &argv[1], BT_FAKEREDIS_ZSET, false,
+                          &value)) {
+    return -1;
+  }
+
+  if (NULL == value) {
+    return 0;
+  }
+
+  GHashTableIter iter;
+  gpointer member, score;
+  size_t count = 0;
+
+  *entries = bt_fakeredis_alloc(g_hash_table_size(value->fields) *
+                                sizeof(bt_fakeredis_entry_t) + 1);
+  g_hash_table_iter_init(&iter, value->fields);
+
+  while (g_hash_table_iter_next(&iter, &member, &score)) {
+    double s = *(double *) score;
+
+    if ((min_exclusive ? s > min : s >= min) &&
+        (max_exclusive ? s < max : s <= max)) {
+      (*entries)[count].member = (bt_fakeredis_str_t *) member;
+      (*entries)[count].score = s;
+      count++;
+    }
+  }
+
+  qsort(*entries, count, sizeof(bt_fakeredis_entry_t),
+        bt_fakeredis_entry_compare);
+  return count;
+}
+
+void
+bt_fakeredis_zcount(bt_fakeredis_t *server, bt_fakeredis_buf_t *out, int argc,
+                    const bt_fakeredis_str_t *argv)
+{
+  bt_fakeredis_entry_t *entries;
+  ssize_t count = bt_fakeredis_zrange(server, out, argv, &entries);
+
+  if (count >= 0) {
+    bt_fakeredis_reply_int(out, count);
+  }
+
+  free(entries);
+}
+
+void
+bt_fakeredis_zrangebyscore(bt_fakeredis_t *server, bt_fakeredis_buf_t *out,
+                           int argc, const bt_fakeredis_str_t *argv)
+{
+  bool with_scores = false;
+  long long offset = 0, limit = -1;
+
+  for (int i = 4; i < argc; i++) {
+    if (bt_fakeredis_str_is(&argv[i], "WITHSCORES")) {
+      with_scores = true;
+    } else if (bt_fakeredis_str_is(&argv[i], "LIMIT") && i + 2 < argc &&
+               bt_fakeredis_str_integer(&argv[i + 1], &offset) &&
+               bt_fakeredis_str_integer(&argv[i + 2], &limit)) {
+      i += 2;
+    } else {
+      bt_fakeredis_reply_error(out, "ERR syntax error");
+      return;
+    }
+  }
+
+  bt_fakeredis_entry_t *entries;
+  ssize_t count = bt_fakeredis_zrange(server, out, argv, &entries);
+
+  if (count < 0) {
+    return;
+  }
+
+  size_t first = offset < 0 ? (size_t) count : MIN((size_t) offset, count);
+  size_t last = limit < 0 ? (size_t) count : MIN(first + limit, count);
+
+  bt_fakeredis_reply_array(out, (last - first) * (with_scores ? 2 : 1));
+
+  for (size_t i = first; i < last; i++) {
+    bt_fakeredis_reply_bulk(out, entries[i].member->data,
+                            entries[i].member->len);
+    if (with_scores) {
+      bt_fakeredis_reply_score(out, entries[i].score);
+    }
+  }
+
+  free(entries);
+}
+
+void
+bt_fakeredis_zrange_by_rank(bt_fakeredis_t *server, bt_fakeredis_buf_t *out,
+                            int argc, const bt_fakeredis_str_t *argv)
+{
+  long long start, stop;
+
+  if (argc != 4 || !bt_fakeredis_str_integer(&argv[2], &start) ||
+      !bt_fakeredis_str_integer(&argv[3], &stop)) {
+    bt_fakeredis_reply_error(out, "ERR syntax error");
+    return;
+  }
+
+  /* Ranks are the positions within the whole set, ordered by score. */
+  bt_fakeredis_str_t range[4] = {
+    argv[0], argv[1], { "-inf", 4 }, { "+inf", 4 }
+  };
+  bt_fakeredis_entry_t *entries;
+  ssize_t count = bt_fakeredis_zrange(server, out, range, &entries);
+
+  if (count < 0) {
+    return;
+  }
+
+  /* Negative ranks count from the end, as in Redis. */
+  start = start < 0 ? MAX(0, count + start) : start;
+  stop = MIN(stop < 0 ? count + stop : stop, count - 1);
+
+  bt_fakeredis_reply_array(out, start <= stop ? stop - start + 1 : 0);
+
+  for (long long i = start; i <= stop; i++) {
+    bt_fakeredis_reply_bulk(out, entries[i].member->data,
+                            entries[i].member->len);
+  }
+
+  free(entries);
+}
+
+void
+bt_fakeredis_zremrangebyscore(bt_fakeredis_t *server, bt_fakeredis_buf_t *out,
+                              int argc, const bt_fakeredis_str_t *argv)
+{
+  bt_fakeredis_entry_t *entries;
+  bt_fakeredis_value_t *value;
+  ssize_t count = bt_fakeredis_zrange(server, out, argv, &entries);
+
+  if (count < 0) {
+    return;
+  }
+
+  if (count > 0 && bt_fakeredis_fetch(server, out, &argv[1],
+                                      BT_FAKEREDIS_ZSET, false, &value)) {
+    for (ssize_t i = 0; i < count; i++) {
+      g_hash_table_remove(value->fields, entries[i].member);
+    }
+    bt_fakeredis_prune(server, &argv[1], value);
+  }
+
+  bt_fakeredis_reply_int(out, count);
+  free(entries);
+}
+
+/* Commands understood by the server, with their minimum number of words. */
+static const struct {
+  const char *name;
+  int min_argc;
+  bt_fakeredis_command_fn fn;
+} bt_fakeredis_commands[] = {
+  { "PING",          1, bt_fakeredis_ping },
+  { "SELECT",        2, bt_fakeredis_select },
+  { "FLUSHDB",       1, bt_fakeredis_flushdb },
+  { "FLUSHALL",      1, bt_fakeredis_flushdb },
+  { "GET",           2, bt_fakeredis_get },
+  { "SET",           3, bt_fakeredis_set },
+  { "SETEX",         4, bt_fakeredis_setex },
+  { "DEL",           2, bt_fakeredis_del },
+  { "RENAME",        3, bt_fakeredis_rename },
+  { "EXPIRE",        3, bt_fakeredis_expire },
+  { "PTTL",          2, bt_fakeredis_pttl },
+  { "KEYS",          2, bt_fakeredis_keys },
+  { "SCAN",          2, bt_fakeredis_scan },
+  { "HGET",          3, bt_fakeredis_hget },
+  { "HMGET",         3, bt_fakeredis_hmget },
+  { "HSET",          4, bt_fakeredis_hset },
+  { "HINCRBY",       4, bt_fakeredis_hincrby },
+  { "HDEL",          3, bt_fakeredis_hdel },
+  { "SADD",          3, bt_fakeredis_sadd },
+  { "SISMEMBER",     3, bt_fakeredis_sismember },
+  { "SMEMBERS",      2, bt_fakeredis_smembers },
+  { "ZADD",          4, bt_fakeredis_zadd },
+  { "ZREM",          3, bt_fakeredis_zrem },
+  { "ZCOUNT",        4, bt_fakeredis_zcount },
+  { "ZRANGE",        4, bt_fakeredis_zrange_by_rank },
+  { "ZRANGEBYSCORE", 4, bt_fakeredis_zrangebyscore },
+  { "ZREMRANGEBYSCORE", 4, bt_fakeredis_zremrangebyscore }
+};
+
+void
+bt_fakeredis_execute(bt_fakeredis_t *server, bt_fakeredis_buf_t *out, int argc,
+                     const bt_fakeredis_str_t *argv)
+{
+  for (size_t i = 0; i < G_N_ELEMENTS(bt_fakeredis_commands); i++) {
+    if (!bt_fakeredis_str_is(&argv[0], bt_fakeredis_commands[i].name)) {
+      continue;
+    }
+
+    if (argc < bt_fakeredis_commands[i].min_argc) {
+      bt_fakeredis_appendf(out, "-ERR wrong number of arguments for '%s'\r\n",
+                           bt_fakeredis_commands[i].name);
+    } else {
+      bt_fakeredis_commands[i].fn(server, out, argc, argv);
+    }
+    return;
+  }
+
+  bt_fakeredis_reply_error(out, "ERR unknown command");
+}
+
+/*
+ * Protocol.
+ */
+
+/*
+ * Reads a `<prefix><integer>\r\n` line. Returns 1 once read, 0 if it is not
+ * all there yet and -1 if it is malformed.
+ */
+int
+bt_fakeredis_read_line(const char **pos, const char *end, char prefix,
+                       long long *value)
+{
+  if (*pos < end && prefix != **pos) {
+    return -1;
+  }
+
+  const char *cr = memchr(*pos, '\r', end - *pos);
+
+  if (NULL == cr || cr + 1 >= end) {
+    return end - *pos > 32 ? -1 : 0;
+  }
+
+  bt_fakeredis_str_t number = { .data = *pos + 1, .len = cr - *pos - 1 };
+
+  if ('\n' != cr[1] ||
+      !bt_fakeredis_str_integer(&number, value)) {
+    return -1;
+  }
+
+  *pos = cr + 2;
+  return 1;
+}
+
+/*
+ * Parses a command sent as an array of bulk strings. Returns the number of
+ * bytes it takes, 0 if it is not all there yet and -1 if it is malformed.
+ */
+ssize_t
+bt_fakeredis_parse(bt_fakeredis_t *server, const char *data, size_t len,
+                   int *argc)
+{
+  const char *pos = data, *end = data + len;
+  long long count, arg_len;
+  int status;
+
+  if ((status = bt_fakeredis_read_line(&pos, end, '*', &count)) <= 0) {
+    return status;
+  }
+
+  if (count <= 0 || count > 1024 * 1024) {
+    return -1;
+  }
+
+  if (count > server->argv_cap) {
+    server->argv_cap = count;
+    server->argv = realloc(server->argv, count * sizeof(bt_fakeredis_str_t));
+
+    if (NULL == server->argv) {
+      syslog(LOG_ERR, "Cannot allocate memory for fake Redis arguments");
+      exit(BT_EXIT_MALLOC_ERROR);
+    }
+  }
+
+  for (int i = 0; i < count; i++) {
+    if ((status = bt_fakeredis_read_line(&pos, end, '$', &arg_len)) <= 0) {
+      return status;
+    }
+
+    if (arg_len < 0 || arg_len > 512 * 1024 * 1024) {
+      return -1;
+    }
+
+    if (end - pos < arg_len + 2) {
+      return 0;
+    }
+
+    server->argv[i].data = pos;
+    server->argv[i].len = arg_len;
+    pos += arg_len + 2;
+  }
+
+  *argc = count;
+  return pos - data;
+}
+
+/* Uniformly distributed number in [0, 1). */
+double
+bt_fakeredis_random(bt_fakeredis_t *server)
+{
+  return rand_r(&server->seed) / (RAND_MAX + 1.0);
+}
+
+/* Queues `len` bytes of `data` to be sent at `due`, after earlier replies. */
+void
+bt_fakeredis_queue(bt_fakeredis_client_t *client, const char *data, size_t len,
+                   int64_t due, bool close)
+{
+  bt_fakeredis_reply_t *reply =
+    bt_fakeredis_alloc(sizeof(bt_fakeredis_reply_t) + len);
+
+  reply->data = (char *) (reply + 1);
+  memcpy(reply->data, data, len);
+  reply->len = len;
+  reply->sent = 0;
+  reply->close = close;
+  reply->next = NULL;
+
+  /* Replies on a connection never overtake each other. */
+  reply->due = NULL == client->tail ? due : MAX(due, client->tail->due);
+
+  if (NULL == client->tail) {
+    client->head = reply;
+  } else {
+    client->tail->next = reply;
+  }
+  client->tail = reply;
+}
+
+/* Runs the commands a client has sent so far, injecting the faults. */
+void
+bt_fakeredis_process(bt_fakeredis_t *server, bt_fakeredis_client_t *client)
+{
+  bt_fakeredis_faults_t faults;
+  size_t consumed = 0;
+  int argc;
+
+  g_mutex_lock(&server->lock);
+  faults = server->faults;
+  g_mutex_unlock(&server->lock);
+
+  while (!client->closing) {
+    ssize_t len = bt_fakeredis_parse(server, client->in.data + consumed,
+                                     client->in.len - consumed, &argc);
+    int64_t due = g_get_monotonic_time() + faults.latency_us;
+
+    if (0 == len) {
+      break;
+    }
+
+    if (faults.jitter_us > 0) {
+      due += (int64_t) (bt_fakeredis_random(server) * faults.jitter_us);
+    }
+    if (faults.tail_rate > 0 &&
+        bt_fakeredis_random(server) < faults.tail_rate) {
+      due += faults.tail_us;
+    }
+
+    server->out.len = 0;
+
+    if (len < 0) {
+      bt_fakeredis_reply_error(&server->out, "ERR Protocol error");
+      client->closing = true;
+    } else if (faults.disconnect_rate > 0 &&
+               bt_fakeredis_random(server) < faults.disconnect_rate) {
+      client->closing = true;
+    } else if (faults.error_rate > 0 &&
+               bt_fakeredis_random(server) < faults.error_rate) {
+      bt_fakeredis_reply_error(&server->out, "ERR injected fault");
+    } else {
+      bt_fakeredis_execute(server, &server->out, argc, server->argv);
+    }
+
+    if (server->out.len > 0) {
+      bt_fakeredis_queue(client, server->out.data, server->out.len, due, false);
+    }
+    if (client->closing) {
+      bt_fakeredis_queue(client, NULL, 0, due, true);
+    }
+
+    consumed += MAX(len, 0);
+  }
+
+  memmove(client->in.data, client->in.data + consumed,
+          client->in.len - consumed);
+  client->in.len -= consumed;
+}
+
+/* Reads what a client has sent. Returns false once it has hung up. */
+bool
+bt_fakeredis_receive(bt_fakeredis_t *server, bt_fakeredis_client_t *client)
+{
+  char chunk[16 * 1024];
+
+  while (true) {
+    ssize_t len = recv(client->fd, chunk, sizeof(chunk), 0);
+
+    if (len > 0) {
+      bt_fakeredis_append(&client->in, chunk, len);
+      continue;
+    }
+
+    if (len < 0 && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+      break;
+    }
+    if (len < 0 && EINTR == errno) {
+      continue;
+    }
+    return false;
+  }
+
+  bt_fakeredis_process(server, client);
+  return true;
+}
+
+/*
+ * Sends the replies that are due. Returns false once the connection must be
+ * closed; otherwise lowers `next_due` to when the next reply will be.
+ */
+bool
+bt_fakeredis_send(bt_fakeredis_client_t *client, int64_t now,
+                  int64_t stalled_until, int64_t *next_due)
+{
+  client->blocked = false;
+
+  while (NULL != client->head) {
+    bt_fakeredis_reply_t *reply = client->head;
+    int64_t due = MAX(reply->due, stalled_until);
+
+    if (due > now) {
+      *next_due = MIN(*next_due, due);
+      break;
+    }
+
+    if (reply->close) {
+      return false;
+    }
+
+    ssize_t len = send(client->fd, reply->data + reply->sent,
+                       reply->len - reply->sent, MSG_NOSIGNAL);
+
+    if (len < 0) {
+      if (EAGAIN == errno || EWOULDBLOCK == errno) {
+        client->blocked = true;
+        break;
+      }
+      if (EINTR == errno) {
+        continue;
+      }
+      return false;
+    }
+
+    reply->sent += len;
+
+    if (reply->sent == reply->len) {
+      client->head = reply->next;
+      if (NULL == client->head) {
+        client->tail = NULL;
+      }
+      free(reply);
+    }
+  }
+
+  return true;
+}
+
+void
+bt_fakeredis_free_client(bt_fakeredis_client_t *client)
+{
+  while (NULL != client->head) {
+    bt_fakeredis_reply_t *next = client->head->next;
+    free(client->head);
+    client->head = next;
+  }
+
+  close(client->fd);
+  free(client->in.data);
+  free(client);
+}
+
+void
+bt_fakeredis_accept(bt_fakeredis_t *server)
+{
+  int fd;
+
+  while ((fd = accept(server->listen_sock, NULL, NULL)) != -1) {
+    if (server->client_count == BT_FAKEREDIS_MAX_CLIENTS) {
+      syslog(LOG_ERR, "Fake Redis cannot take more clients");
+      close(fd);
+      continue;
+    }
+
+    /* Replies go out right away, as they do from Redis. */
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    bt_fakeredis_client_t *client =
+      bt_fakeredis_alloc(sizeof(bt_fakeredis_client_t));
+    memset(client, 0, sizeof(bt_fakeredis_client_t));
+    client->fd = fd;
+
+    server->clients[server->client_count++] = client;
+  }
+}
+
+/* Arms the timer to fire at `due`, or disarms it. */
+void
+bt_fakeredis_arm(bt_fakeredis_t *server, int64_t due)
+{
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+
+  if (INT64_MAX != due) {
+    spec.it_value.tv_sec = due / G_USEC_PER_SEC;
+    spec.it_value.tv_nsec = (due % G_USEC_PER_SEC) * 1000;
+  }
+
+  timerfd_settime(server->timer, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+gpointer
+bt_fakeredis_thread(gpointer data)
+{
+  bt_fakeredis_t *server = (bt_fakeredis_t *) data;
+  struct pollfd fds[3 + BT_FAKEREDIS_MAX_CLIENTS];
+
+  while (true) {
+    int64_t now = g_get_monotonic_time(), next_due = INT64_MAX;
+    int64_t stalled_until;
+
+    g_mutex_lock(&server->lock);
+    stalled_until = server->stalled_until;
+    g_mutex_unlock(&server->lock);
+
+    /* Sends what is due and drops the connections that were closed. */
+    for (int i = 0; i < server->client_count; i++) {
+      bt_fakeredis_client_t *client = server->clients[i];
+
+      if (!bt_fakeredis_send(client, now, stalled_until, &next_due)) {
+        bt_fakeredis_free_client(client);
+        server->clients[i--] = server->clients[--server->client_count];
+      }
+    }
+
+    bt_fakeredis_arm(server, next_due);
+
+    fds[0] = (struct pollfd) { .fd = server->stop_pipe[0], .events = POLLIN };
+    fds[1] = (struct pollfd) { .fd = server->listen_sock, .events = POLLIN };
+    fds[2] = (struct pollfd) { .fd = server->timer, .events = POLLIN };
+
+    for (int i = 0; i < server->client_count; i++) {
+      bt_fakeredis_client_t *client = server->clients[i];
+
+      fds[3 + i].fd = client->fd;
+      fds[3 + i].events = (client->closing ? 0 : POLLIN) |
+                          (client->blocked ? POLLOUT : 0);
+      fds[3 + i].revents = 0;
+    }
+
+    int nfds = 3 + server->client_count;
+
+    if (poll(fds, nfds, -1) == -1) {
+      if (EINTR == errno) {
+        continue;
+      }
+      syslog(LOG_ERR, "Error in poll()");
+      break;
+    }
+
+    if (fds[0].revents & POLLIN) {
+      break;
+    }
+
+    if (fds[2].revents & POLLIN) {
+      uint64_t expirations;
+      if (read(server->timer, &expirations, sizeof(expirations)) < 0) {
+        syslog(LOG_DEBUG, "Fake Redis timer was not readable");
+      }
+    }
+
+    /* Clients accepted now are polled from the next round on. */
+    for (int i = server->client_count - 1; i >= 0; i--) {
+      bt_fakeredis_client_t *client = server->clients[i];
+      short revents = fds[3 + i].revents;
+
+      if ((revents & (POLLIN | POLLHUP | POLLERR)) &&
+          !bt_fakeredis_receive(server, client)) {
+        bt_fakeredis_free_client(client);
+        server->clients[i] = server->clients[--server->client_count];
+      }
+    }
+
+    if (fds[1].revents & POLLIN) {
+      bt_fakeredis_accept(server);
+    }
+  }
+
+  for (int i = 0; i < server->client_count; i++) {
+    bt_fakeredis_free_client(server->clients[i]);
+  }
+  server->client_count = 0;
+
+  return NULL;
+}
+
+bt_fakeredis_t *
+bt_fakeredis_start(unsigned int seed)
+{
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+
+  bt_fakeredis_t *server = bt_fakeredis_alloc(sizeof(bt_fakeredis_t));
+  memset(server, 0, sizeof(bt_fakeredis_t));
+
+  server->seed = seed;
+  server->listen_sock = socket(AF_INET, SOCK_STREAM, 0);
+  server->timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+
+  if (-1 == server->listen_sock || -1 == server->timer ||
+      bind(server->listen_sock, (struct sockaddr *) &addr,
+           sizeof(addr)) == -1 ||
+      listen(server->listen_sock, BT_FAKEREDIS_MAX_CLIENTS) == -1 ||
+      getsockname(server->listen_sock, (struct sockaddr *) &addr,
+                  &addr_len) == -1 ||
+      pipe(server->stop_pipe) == -1) {
+    syslog(LOG_ERR, "Cannot start fake Redis server");
+
+    if (-1 != server->listen_sock) {
+      close(server->listen_sock);
+    }
+    if (-1 != server->timer) {
+      close(server->timer);
+    }
+    free(server);
+    return NULL;
+  }
+
+  fcntl(server->listen_sock, F_SETFL,
+        fcntl(server->listen_sock, F_GETFL) | O_NONBLOCK);
+
+  server->port = ntohs(addr.sin_port);
+  server->keys = g_hash_table_new_full(bt_fakeredis_str_hash,
+                                       bt_fakeredis_str_equal, free,
+                                       bt_fakeredis_free_value);
+  g_mutex_init(&server->lock);
+
+  server->thread = g_thread_new("fakeredis", bt_fakeredis_thread, server);
+
+  syslog(LOG_DEBUG, "Fake Redis listening on port %d", server->port);
+
+  return server;
+}
+
+uint16_t
+bt_fakeredis_port(const bt_fakeredis_t *server)
+{
+  return server->port;
+}
+
+void
+bt_fakeredis_set_faults(bt_fakeredis_t *server,
+                        const bt_fakeredis_faults_t *faults)
+{
+  g_mutex_lock(&server->lock);
+  server->faults = *faults;
+  g_mutex_unlock(&server->lock);
+}
+
+void
+bt_fakeredis_stall(bt_fakeredis_t *server, uint32_t duration_us)
+{
+  g_mutex_lock(&server->lock);
+  server->stalled_until = g_get_monotonic_time() + duration_us;
+  g_mutex_unlock(&server->lock);
+}
+
+void
+bt_fakeredis_stop(bt_fakeredis_t *server)
+{
+  if (NULL == server) {
+    return;
+  }
+
+  char byte = 0;
+  if (write(server->stop_pipe[1], &byte, 1) != 1) {
+    syslog(LOG_ERR, "Cannot stop fake Redis server");
+  }
+
+  g_thread_join(server->thread);
+
+  close(server->listen_sock);
+  close(server->timer);
+  close(server->stop_pipe[0]);
+  close(server->stop_pipe[1]);
+
+  g_hash_table_destroy(server->keys);
+  g_mutex_clear(&server->lock);
+  free(server->argv);
+  free(server->out.data);
+  free(server);
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BTTRACKER_FAKEREDIS_H_
+#define BTTRACKER_FAKEREDIS_H_
+
+/*
+ * Small Redis server embedded in tests and benchmarks. It listens on an
+ * ephemeral port of the loopback interface and speaks enough RESP to run
+ * the commands issued by the tracker, with all keys held in memory. Its
+ * replies can be delayed, failed or cut off to see how the tracker behaves
+ * when Redis misbehaves.
+ */
+typedef struct bt_fakeredis bt_fakeredis_t;
+
+/* Faults injected in the replies of a fake Redis server. */
+typedef struct {
+  uint32_t latency_us;    // Delay added to every reply
+  uint32_t jitter_us;     // Uniformly distributed delay added on top of it
+  double tail_rate;       // Fraction of replies delayed by `tail_us` more
+  uint32_t tail_us;       // Extra delay of the replies in the tail
+  double error_rate;      // Fraction of commands answered with an error
+  double disconnect_rate; // Fraction of commands that close the connection
+} bt_fakeredis_faults_t;
+
+/*
+ * Starts a fake Redis server with an empty keyspace and no faults. Random
+ * faults are drawn from a generator seeded with `seed`, so that runs can be
+ * reproduced.
+ */
+bt_fakeredis_t *
+bt_fakeredis_start(unsigned int seed);
+
+/* Port the server is listening on. */
+uint16_t
+bt_fakeredis_port(const bt_fakeredis_t *server);
+
+/* Replaces the faults injected in commands received from now on. */
+void
+bt_fakeredis_set_faults(bt_fakeredis_t *server,
+                        const bt_fakeredis_faults_t *faults);
+
+/* Holds back every reply for `duration_us`, as a blocked Redis would. */
+void
+bt_fakeredis_stall(bt_fakeredis_t *server, uint32_t duration_us);
+
+/* Closes all connections and stops the server. */
+void
+bt_fakeredis_stop(bt_fakeredis_t *server);
+
+#endif // BTTRACKER_FAKEREDIS_H_
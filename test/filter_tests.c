@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "minunit.h"
+
+/* Receives what went through the filter, sends requests to it. */
+static int filter_recv_sock = -1;
+static int filter_send_sock = -1;
+
+/* Sets up a filtered UDP socket on the loopback interface. */
+bool
+filter_open(void)
+{
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  filter_recv_sock = socket(AF_INET, SOCK_DGRAM, 0);
+  filter_send_sock = socket(AF_INET, SOCK_DGRAM, 0);
+
+  if (bind(filter_recv_sock, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+      getsockname(filter_recv_sock, (struct sockaddr *) &addr,
+                  &addr_len) == -1 ||
+      connect(filter_send_sock, (struct sockaddr *) &addr, addr_len) == -1) {
+    return false;
+  }
+
+  setsockopt(filter_recv_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+             sizeof(timeout));
+
+  bt_config_t config;
+  memset(&config, 0, sizeof(config));
+  config.bttracker_socket_filter = true;
+  bt_attach_filter(&config, filter_recv_sock);
+
+  return true;
+}
+
+void
+filter_close(void)
+{
+  close(filter_recv_sock);
+  close(filter_send_sock);
+}
+
+/* Writes a request header to `buf`. */
+void
+filter_header(char *buf, int64_t connection_id, int32_t action,
+              int32_t transaction_id)
+{
+  int64_t be_connection_id = htonll(connection_id);
+  int32_t be_action = htonl(action);
+  int32_t be_transaction_id = htonl(transaction_id);
+
+  memcpy(buf, &be_connection_id, 8);
+  memcpy(buf + 8, &be_action, 4);
+  memcpy(buf + 12, &be_transaction_id, 4);
+}
+
+/*
+ * Returns whether a datagram gets through the filter. A valid connect
+ * request follows it, so a dropped datagram is told apart without waiting.
+ */
+bool
+filter_passes(const char *buf, size_t len)
+{
+  char marker[16];
+  char received[BT_RECV_BUFLEN + 64];
+
+  filter_header(marker, BT_PROTOCOL_ID, BT_ACTION_CONNECT, -1);
+
+  send(filter_send_sock, buf, len, 0);
+  send(filter_send_sock, marker, sizeof(marker), 0);
+
+  ssize_t received_len = recv(filter_recv_sock, received, sizeof(received), 0);
+
+  if (received_len == sizeof(marker) &&
+      memcmp(received, marker, sizeof(marker)) == 0) {
+    return false;
+  }
+
+  bool passed = received_len == len && memcmp(received, buf, len) == 0;
+
+  /* Consumes the marker behind the datagram. */
+  recv(filter_recv_sock, received, sizeof(received), 0);
+
+  return passed;
+}
+
+char *
+test_filter_passes_valid_requests()
+{
+  char buf[BT_RECV_BUFLEN];
+  memset(buf, 0, sizeof(buf));
+
+  mu_assert("error, cannot set up the sockets", filter_open());
+
+  filter_header(buf, BT_PROTOCOL_ID, BT_ACTION_CONNECT, 1);
+  mu_assert("error, connect dropped", filter_passes(buf, 16));
+
+  filter_header(buf, 42, BT_ACTION_ANNOUNCE, 2);
+  mu_assert("error, announce dropped", filter_passes(buf, 98));
+
+  filter_header(buf, 42, BT_ACTION_SCRAPE, 3);
+  mu_assert("error, scrape dropped", filter_passes(buf, 36));
+  mu_assert("error, largest scrape dropped",
+            filter_passes(buf, BT_RECV_BUFLEN));
+
+  filter_close();
+  return NULL;
+}
+
+char *
+test_filter_drops_invalid_requests()
+{
+  char buf[BT_RECV_BUFLEN + 20];
+  memset(buf, 0, sizeof(buf));
+
+  mu_assert("error, cannot set up the sockets", filter_open());
+
+  filter_header(buf, BT_PROTOCOL_ID, BT_ACTION_CONNECT, 1);
+  mu_assert("error, short header passed", !filter_passes(buf, 15));
+
+  filter_header(buf, BT_PROTOCOL_ID + 1, BT_ACTION_CONNECT, 2);
+  mu_assert("error, bad magic passed", !filter_passes(buf, 16));
+
+  filter_header(buf, 42, BT_ACTION_ANNOUNCE, 3);
+  mu_assert("error, short announce passed", !filter_passes(buf, 97));
+
+  filter_header(buf, 42, BT_ACTION_SCRAPE, 4);
+  mu_assert("error, empty scrape passed", !filter_passes(buf, 16));
+  mu_assert("error, oversized scrape passed",
+            !filter_passes(buf, BT_RECV_BUFLEN + 20));
+
+  filter_header(buf, 42, BT_ACTION_ERROR, 5);
+  mu_assert("error, unknown action passed", !filter_passes(buf, 98));
+
+  filter_close();
+  return NULL;
+}
+
+char *
+all_tests()
+{
+  mu_run_test(test_filter_passes_valid_requests);
+  mu_run_test(test_filter_drops_invalid_requests);
+
+  return NULL;
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "minunit.h"
+
+/* Binds a UDP socket to a free port on the loopback interface. */
+int
+handoff_udp_sock(uint16_t *port)
+{
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  bind(sock, (struct sockaddr *) &addr, sizeof(addr));
+  getsockname(sock, (struct sockaddr *) &addr, &addr_len);
+  *port = ntohs(addr.sin_port);
+
+  return sock;
+}
+
+/* Takes the socket over, as a newer process would. */
+gpointer
+handoff_newer_process(gpointer data)
+{
+  g_usleep(50000);
+  return GINT_TO_POINTER(bt_handoff_receive((const char *) data));
+}
+
+char *
+test_handoff_without_listener()
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/bttracker-handoff-%d", (int) getpid());
+  unlink(path);
+
+  mu_assert("error, socket from nowhere", bt_handoff_receive(path) == -1);
+  return NULL;
+}
+
+char *
+test_handoff_interrupts_receiver()
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/bttracker-handoff-%d", (int) getpid());
+
+  uint16_t port;
+  int sock = handoff_udp_sock(&port);
+  bt_handoff_t *handoff = bt_new_handoff(path, sock);
+  mu_assert("error, not listening", handoff != NULL);
+
+  GThread *thread = g_thread_new("newer", handoff_newer_process, path);
+
+  /* Fails the test rather than hanging if the receiver is never woken. */
+  alarm(10);
+
+  int received = 0;
+  while (!bt_handoff_done(handoff)) {
+    char buff[16];
+    if (recv(sock, buff, sizeof(buff), 0) > 0) {
+      received++;
+    }
+  }
+
+  alarm(0);
+
+  int taken = GPOINTER_TO_INT(g_thread_join(thread));
+  mu_assert("error, socket not handed off", taken != -1);
+  mu_assert("error, datagram from nowhere", received == 0);
+
+  /* Same socket, so it is bound to the same port. */
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  getsockname(taken, (struct sockaddr *) &addr, &addr_len);
+  mu_assert("error, another socket handed off", ntohs(addr.sin_port) == port);
+
+  bt_free_handoff(handoff);
+  mu_assert("error, path of the newer process removed", access(path, F_OK) == 0);
+
+  unlink(path);
+  close(taken);
+  close(sock);
+  return NULL;
+}
+
+char *
+all_tests()
+{
+  mu_run_test(test_handoff_without_listener);
+  mu_run_test(test_handoff_interrupts_receiver);
+
+  return NULL;
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "minunit.h"
+
+void
+hot_info_hash(int8_t *info_hash, int n)
+{
+  memset(info_hash, 0, 20);
+  memcpy(info_hash, &n, sizeof(n));
+}
+
+char *
+test_hot_sketch_keeps_heavy_hitters()
+{
+  bt_hot_sketch_t *sketch = bt_new_hot_sketch(8);
+  int8_t info_hash[20];
+
+  /* One torrent gets a third of the requests, the rest are all different. */
+  for (int i = 0; i < 3000; i++) {
+    hot_info_hash(info_hash, i % 3 == 0 ? 0 : 1 + i);
+    bt_hot_sketch_add(sketch, info_hash);
+  }
+
+  mu_assert("error, sketch grew", sketch->length == 8);
+
+  hot_info_hash(info_hash, 0);
+  bt_hot_counter_t *counter = (bt_hot_counter_t *)
+    g_hash_table_lookup(sketch->index, info_hash);
+
+  mu_assert("error, heavy hitter evicted", counter != NULL);
+  mu_assert("error, heavy hitter undercounted", counter->count >= 1000);
+  mu_assert("error, heavy hitter not on top", sketch->heap[0] != counter);
+
+  bt_free_hot_sketch(sketch);
+  return NULL;
+}
+
+char *
+test_hot_merge()
+{
+  bt_config_t config;
+  memset(&config, 0, sizeof(bt_config_t));
+  config.hot_size = 2;
+  config.hot_min_requests = 10;
+
+  int8_t info_hash[20];
+
+  mu_assert("error, empty list has swarms", bt_hot_merge(&config) == 0);
+
+  for (int i = 0; i < 100; i++) {
+    hot_info_hash(info_hash, i % 4);
+    bt_hot_count(&config, info_hash);
+  }
+
+  hot_info_hash(info_hash, 9);
+  bt_hot_count(&config, info_hash);
+
+  /* Four swarms are over the threshold, only two fit. */
+  mu_assert("error, wrong number of hot swarms", bt_hot_merge(&config) == 2);
+
+  hot_info_hash(info_hash, 9);
+  mu_assert("error, cold swarm is hot", !bt_hot_find(&config, info_hash));
+
+  /* Counts start over after each merge. */
+  mu_assert("error, counts not reset", bt_hot_merge(&config) == 0);
+
+  hot_info_hash(info_hash, 0);
+  mu_assert("error, swarm still hot", !bt_hot_find(&config, info_hash));
+
+  return NULL;
+}
+
+char *
+test_hot_cache()
+{
+  bt_config_t config;
+  memset(&config, 0, sizeof(bt_config_t));
+  config.hot_size = 2;
+  config.hot_cache_time = 5;
+
+  bt_hot_cache_t *cache = bt_new_hot_cache(&config);
+  int8_t info_hash[20];
+  bt_torrent_stats_t stats = { .seeders = 3, .leechers = 4 }, cached;
+  bt_list *pool = NULL, *peers = NULL;
+  int peer_count = 0;
+
+  hot_info_hash(info_hash, 1);
+
+  mu_assert("error, stats found", !bt_hot_cached_stats(cache, info_hash, &cached, false));
+  bt_hot_cache_stats(cache, info_hash, &stats);
+  mu_assert("error, stats not found", bt_hot_cached_stats(cache, info_hash, &cached, false));
+  mu_assert("error, wrong stats", cached.seeders == 3 && cached.leechers == 4);
+
+  for (int i = 0; i < 10; i++) {
+    pool = bt_list_prepend(pool, bt_new_peer_addr(i, 6881));
+  }
+
+  mu_assert("error, leecher peers found", !bt_hot_cached_peers(cache, info_hash, false, 5, &peers, &peer_count, false));
+
+  peers = bt_hot_cache_peers(cache, info_hash, false, pool, 10, 5, &peer_count);
+  mu_assert("error, wrong number of peers drawn", peer_count == 5 && bt_list_length(peers) == 5);
+  bt_list_free(peers);
+  bt_list_free(pool);
+
+  mu_assert("error, leecher peers not found", bt_hot_cached_peers(cache, info_hash, false, 50, &peers, &peer_count, false));
+  mu_assert("error, wrong number of cached peers", peer_count == 10);
+  bt_list_free(peers);
+
+  mu_assert("error, seeder peers found", !bt_hot_cached_peers(cache, info_hash, true, 5, &peers, &peer_count, false));
+
+  bt_free_hot_cache(cache);
+  return NULL;
+}
+
+char *
+test_known_cache()
+{
+  bt_config_t config;
+  memset(&config, 0, sizeof(bt_config_t));
+  config.breaker_error_rate = 50;
+  config.breaker_known_swarms = 2;
+  config.breaker_known_peers = 4;
+
+  bt_known_cache_t *cache = bt_new_known_cache(&config);
+  int8_t info_hash[20];
+  bt_torrent_stats_t stats = { .seeders = 3, .leechers = 4 }, known;
+  bt_list *handed = NULL, *peers = NULL;
+  int peer_count = 0;
+
+  mu_assert("error, cache without the breaker", cache != NULL);
+
+  hot_info_hash(info_hash, 1);
+  mu_assert("error, stats found", !bt_known_stats(cache, info_hash, &known));
+  bt_known_store_stats(cache, info_hash, &stats);
+  mu_assert("error, stats not found", bt_known_stats(cache, info_hash, &known));
+  mu_assert("error, wrong stats", known.seeders == 3 && known.leechers == 4);
+
+  /* Peers handed out later push out the older ones. */
+  for (int i = 0; i < 3; i++) {
+    handed = bt_list_prepend(handed, bt_new_peer_addr(i, 6881));
+  }
+  bt_known_store_peers(cache, info_hash, false, handed, 3);
+  bt_list_free(handed);
+
+  handed = NULL;
+  for (int i = 2; i < 5; i++) {
+    handed = bt_list_prepend(handed, bt_new_peer_addr(i, 6881));
+  }
+  bt_known_store_peers(cache, info_hash, false, handed, 3);
+  bt_list_free(handed);
+
+  mu_assert("error, leecher peers not found", bt_known_peers(cache, info_hash, false, 50, &peers, &peer_count));
+  mu_assert("error, wrong number of known peers", peer_count == 4 && bt_list_length(peers) == 4);
+
+  int seen = 0;
+  for (bt_list *node = peers; node != NULL; node = node->next) {
+    seen |= 1 << ((bt_peer_addr_t *) node->data)->ipv4_addr;
+  }
+  mu_assert("error, wrong known peers", seen == 0x1e);
+  bt_list_free(peers);
+
+  mu_assert("error, seeder peers found", !bt_known_peers(cache, info_hash, true, 5, &peers, &peer_count));
+
+  /* The swarm served the longest time ago goes first. */
+  int8_t second[20], third[20];
+  hot_info_hash(second, 2);
+  hot_info_hash(third, 3);
+
+  bt_known_store_stats(cache, second, &stats);
+  bt_known_store_stats(cache, info_hash, &stats);
+  bt_known_store_stats(cache, third, &stats);
+
+  mu_assert("error, recent swarm dropped", bt_known_stats(cache, info_hash, &known));
+  mu_assert("error, old swarm kept", !bt_known_stats(cache, second, &known));
+  mu_assert("error, new swarm dropped", bt_known_stats(cache, third, &known));
+
+  bt_free_known_cache(cache);
+
+  config.breaker_error_rate = 0;
+  mu_assert("error, cache without the breaker", bt_new_known_cache(&config) == NULL);
+
+  return NULL;
+}
+
+char *
+all_tests()
+{
+  mu_run_test(test_hot_sketch_keeps_heavy_hitters);
+  mu_run_test(test_hot_merge);
+  mu_run_test(test_hot_cache);
+  mu_run_test(test_known_cache);
+
+  return NULL;
+}
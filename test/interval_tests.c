@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "minunit.h"
+
+/* Monotonic time handed to the adaptation, ahead of the real one. */
+static int64_t interval_now = 0;
+
+void
+interval_config(bt_config_t *config)
+{
+  memset(config, 0, sizeof(bt_config_t));
+  config->announce_wait_time = 1800;
+  config->announce_min_interval = 1500;
+  config->announce_max_interval = 3600;
+  config->announce_interval_step = 60;
+  config->announce_load_queue_threshold = 100;
+}
+
+/* Adapts the interval `times` times, one period apart. */
+int32_t
+interval_adapt(const bt_config_t *config, int times)
+{
+  if (0 == interval_now) {
+    interval_now = g_get_monotonic_time() / G_USEC_PER_SEC + 3600;
+  }
+
+  for (int i = 0; i < times; i++) {
+    interval_now += BT_INTERVAL_ADAPT_PERIOD;
+    bt_interval_adapt(config, interval_now);
+  }
+
+  return bt_stats_get(BT_STAT_ANNOUNCE_INTERVAL);
+}
+
+char *
+test_interval_adapts_to_load()
+{
+  bt_config_t config;
+  interval_config(&config);
+
+  bt_stats_set(BT_STAT_QUEUED_ANNOUNCE, 0);
+  mu_assert("error, interval not at WaitTime",
+            interval_adapt(&config, 100) == 1800);
+
+  bt_stats_set(BT_STAT_QUEUED_ANNOUNCE, 1000);
+  mu_assert("error, interval did not grow one step",
+            interval_adapt(&config, 1) == 1860);
+
+  /* Nothing changes until the period is over. */
+  bt_interval_adapt(&config, interval_now);
+  mu_assert("error, interval adapted twice in a period",
+            bt_stats_get(BT_STAT_ANNOUNCE_INTERVAL) == 1860);
+
+  mu_assert("error, interval went past MaxInterval",
+            interval_adapt(&config, 100) == 3600);
+
+  bt_stats_set(BT_STAT_QUEUED_ANNOUNCE, 0);
+  mu_assert("error, interval did not shrink one step",
+            interval_adapt(&config, 1) == 3540);
+  mu_assert("error, interval went below WaitTime",
+            interval_adapt(&config, 100) == 1800);
+
+  return NULL;
+}
+
+char *
+test_interval_unbounded_step()
+{
+  bt_config_t config;
+  interval_config(&config);
+  config.announce_interval_step = 0;
+
+  bt_stats_set(BT_STAT_QUEUED_ANNOUNCE, 1000);
+  mu_assert("error, interval did not jump to MaxInterval",
+            interval_adapt(&config, 1) == 3600);
+
+  bt_stats_set(BT_STAT_QUEUED_ANNOUNCE, 0);
+  mu_assert("error, interval did not jump back to WaitTime",
+            interval_adapt(&config, 1) == 1800);
+
+  return NULL;
+}
+
+char *
+test_interval_jitter_bounds()
+{
+  bt_config_t config;
+  interval_config(&config);
+  config.announce_interval_jitter = 10;
+
+  int32_t lowest = INT32_MAX, highest = 0;
+
+  for (int i = 0; i < 10000; i++) {
+    int32_t interval = bt_interval_spread(&config, 1800, 3600);
+    lowest = MIN(lowest, interval);
+    highest = MAX(highest, interval);
+  }
+
+  mu_assert("error, jitter too wide", lowest >= 1620 && highest <= 1980);
+  mu_assert("error, jitter too narrow", lowest < 1700 && highest > 1900);
+
+  /* Jitter never takes the interval out of its bounds. */
+  for (int i = 0; i < 10000; i++) {
+    int32_t interval = bt_interval_spread(&config, 3600, 3600);
+    mu_assert("error, jitter past MaxInterval", interval <= 3600);
+
+    interval = bt_interval_spread(&config, 1500, 3600);
+    mu_assert("error, jitter below MinInterval", interval >= 1500);
+  }
+
+  config.announce_interval_jitter = 0;
+  mu_assert("error, interval spread without jitter",
+            bt_interval_spread(&config, 1800, 3600) == 1800);
+
+  return NULL;
+}
+
+char *
+test_interval_defaults()
+{
+  bt_config_t config;
+  memset(&config, 0, sizeof(bt_config_t));
+  config.announce_wait_time = 1800;
+
+  mu_assert("error, MaxInterval does not default to WaitTime",
+            bt_max_announce_interval(&config) == 1800);
+
+  config.announce_max_interval = 1200;
+  mu_assert("error, MaxInterval below MinInterval",
+            bt_max_announce_interval(&config) == 1800);
+
+  return NULL;
+}
+
+char *
+test_interval_hot_cap()
+{
+  bt_config_t config;
+  interval_config(&config);
+  config.announce_max_interval = 1800;
+  config.hot_size = 64;
+  config.hot_interval_factor = 2.0;
+
+  mu_assert("error, hot interval past MaxInterval without its own cap",
+            bt_hot_announce_interval(&config) == 1800);
+  mu_assert("error, longest interval is not MaxInterval",
+            bt_longest_announce_interval(&config) == 1800);
+
+  config.hot_max_interval = 2700;
+  mu_assert("error, hot interval not capped by its own MaxInterval",
+            bt_hot_announce_interval(&config) == 2700);
+  mu_assert("error, longest interval does not cover hot swarms",
+            bt_longest_announce_interval(&config) == 2700);
+
+  config.hot_size = 0;
+  mu_assert("error, longest interval covers disabled hot swarms",
+            bt_longest_announce_interval(&config) == 1800);
+
+  return NULL;
+}
+
+char *
+all_tests()
+{
+  mu_run_test(test_interval_adapts_to_load);
+  mu_run_test(test_interval_unbounded_step);
+  mu_run_test(test_interval_jitter_bounds);
+  mu_run_test(test_interval_defaults);
+  mu_run_test(test_interval_hot_cap);
+
+  return NULL;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "minunit.h"
+
+#define ADDR_A 0x0100007f
+#define ADDR_B 0x0200007f
+
+void
+ratelimit_config(bt_config_t *config)
+{
+  memset(config, 0, sizeof(bt_config_t));
+
+  config->ratelimit_connect_rate   = 1;
+  config->ratelimit_connect_burst  = 2;
+  config->ratelimit_announce_rate  = 0.5;
+  config->ratelimit_announce_burst = 1;
+  config->ratelimit_table_size     = 1;
+}
+
+char *
+test_ratelimit_disabled()
+{
+  bt_config_t config;
+  memset(&config, 0, sizeof(bt_config_t));
+
+  mu_assert("error, expected no rate limiter", bt_new_ratelimit(&config) == NULL);
+
+  return NULL;
+}
+
+char *
+test_ratelimit_burst()
+{
+  bt_config_t config;
+  ratelimit_config(&config);
+  bt_ratelimit_t *limiter = bt_new_ratelimit(&config);
+
+  mu_assert("error, first connect refused", bt_ratelimit_allow(limiter, ADDR_A, BT_CLASS_CONNECT, 1));
+  mu_assert("error, second connect refused", bt_ratelimit_allow(limiter, ADDR_A, BT_CLASS_CONNECT, 1));
+  mu_assert("error, third connect accepted", !bt_ratelimit_allow(limiter, ADDR_A, BT_CLASS_CONNECT, 1));
+  mu_assert("error, other address refused", bt_ratelimit_allow(limiter, ADDR_B, BT_CLASS_CONNECT, 1));
+
+  bt_free_ratelimit(limiter);
+  return NULL;
+}
+
+char *
+test_ratelimit_refill()
+{
+  bt_config_t config;
+  ratelimit_config(&config);
+  bt_ratelimit_t *limiter = bt_new_ratelimit(&config);
+
+  mu_assert("error, first announce refused", bt_ratelimit_allow(limiter, ADDR_A, BT_CLASS_ANNOUNCE, 1));
+  mu_assert("error, announce accepted before refill", !bt_ratelimit_allow(limiter, ADDR_A, BT_CLASS_ANNOUNCE, 1000001));
+  mu_assert("error, announce refused after refill", bt_ratelimit_allow(limiter, ADDR_A, BT_CLASS_ANNOUNCE, 2000001));
+
+  bt_free_ratelimit(limiter);
+  return NULL;
+}
+
+char *
+test_ratelimit_separate_budgets()
+{
+  bt_config_t config;
+  ratelimit_config(&config);
+  bt_ratelimit_t *limiter = bt_new_ratelimit(&config);
+
+  mu_assert("error, announce refused", bt_ratelimit_allow(limiter, ADDR_A, BT_CLASS_ANNOUNCE, 1));
+  mu_assert("error, connect refused after announce", bt_ratelimit_allow(limiter, ADDR_A, BT_CLASS_CONNECT, 1));
+
+  for (int i = 0; i < 100; i++) {
+    mu_assert("error, unlimited scrape refused", bt_ratelimit_allow(limiter, ADDR_A, BT_CLASS_SCRAPE, 1));
+  }
+
+  bt_free_ratelimit(limiter);
+  return NULL;
+}
+
+char *
+test_ratelimit_bounded_table()
+{
+  bt_config_t config;
+  ratelimit_config(&config);
+  bt_ratelimit_t *limiter = bt_new_ratelimit(&config);
+
+  mu_assert("error, unexpected table size", limiter->sets == 1);
+
+  /* Exhausts the budget of one address, then floods the table. */
+  bt_ratelimit_allow(limiter, ADDR_A, BT_CLASS_ANNOUNCE, 1);
+
+  for (uint32_t addr = 1; addr <= 10000; addr++) {
+    bt_ratelimit_allow(limiter, addr << 8, BT_CLASS_ANNOUNCE, 2 + addr);
+  }
+
+  /* The address was evicted, so it starts over with a full bucket. */
+  mu_assert("error, evicted address refused", bt_ratelimit_allow(limiter, ADDR_A, BT_CLASS_ANNOUNCE, 10003));
+
+  bt_free_ratelimit(limiter);
+  return NULL;
+}
+
+char *
+all_tests()
+{
+  mu_run_test(test_ratelimit_disabled);
+  mu_run_test(test_ratelimit_burst);
+  mu_run_test(test_ratelimit_refill);
+  mu_run_test(test_ratelimit_separate_budgets);
+  mu_run_test(test_ratelimit_bounded_table);
+
+  return NULL;
+}
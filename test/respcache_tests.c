@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "minunit.h"
+
+#define SECOND (1000000)
+
+void
+respcache_request(char *buff, int32_t transaction_id)
+{
+  int64_t connection_id = htonll(42);
+  int32_t action = htonl(BT_ACTION_ANNOUNCE);
+
+  transaction_id = htonl(transaction_id);
+
+  memcpy(buff, &connection_id, 8);
+  memcpy(buff + 8, &action, 4);
+  memcpy(buff + 12, &transaction_id, 4);
+}
+
+bt_respcache_t *
+respcache_new(uint32_t table_size)
+{
+  bt_config_t config;
+  memset(&config, 0, sizeof(bt_config_t));
+
+  config.respcache_ttl = 5;
+  config.respcache_table_size = table_size;
+
+  return bt_new_respcache(&config);
+}
+
+char *
+test_respcache_disabled()
+{
+  bt_config_t config;
+  memset(&config, 0, sizeof(bt_config_t));
+
+  mu_assert("error, expected no cache", bt_new_respcache(&config) == NULL);
+
+  return NULL;
+}
+
+char *
+test_respcache_retransmit()
+{
+  bt_respcache_t *cache = respcache_new(1024);
+  struct sockaddr_in from = { .sin_addr.s_addr = 0x0100007f, .sin_port = 80 };
+  char buff[98] = { 0 }, response[BT_RESPCACHE_MAX_LEN];
+  size_t length = 0;
+
+  respcache_request(buff, 7);
+
+  mu_assert("error, new request found", bt_respcache_lookup(cache, buff, 98, &from, 1, response, &length) == BT_RESPCACHE_MISS);
+  mu_assert("error, retransmit not merged", bt_respcache_lookup(cache, buff, 98, &from, 2, response, &length) == BT_RESPCACHE_IN_FLIGHT);
+
+  bt_respcache_store(cache, buff, 98, &from, 3, "answer", 6);
+
+  mu_assert("error, retransmit not answered", bt_respcache_lookup(cache, buff, 98, &from, 4, response, &length) == BT_RESPCACHE_HIT);
+  mu_assert("error, wrong response", length == 6 && memcmp(response, "answer", 6) == 0);
+
+  from.sin_port = 81;
+  mu_assert("error, other port answered", bt_respcache_lookup(cache, buff, 98, &from, 5, response, &length) == BT_RESPCACHE_MISS);
+
+  bt_free_respcache(cache);
+  return NULL;
+}
+
+char *
+test_respcache_forget()
+{
+  bt_respcache_t *cache = respcache_new(1024);
+  struct sockaddr_in from = { .sin_addr.s_addr = 0x0100007f, .sin_port = 80 };
+  char buff[98] = { 0 }, response[BT_RESPCACHE_MAX_LEN];
+  size_t length = 0;
+
+  respcache_request(buff, 7);
+  bt_respcache_lookup(cache, buff, 98, &from, 1, response, &length);
+  bt_respcache_store(cache, buff, 98, &from, 2, NULL, 0);
+
+  mu_assert("error, dropped request still in flight", bt_respcache_lookup(cache, buff, 98, &from, 3, response, &length) == BT_RESPCACHE_MISS);
+
+  bt_respcache_store(cache, buff, 98, &from, 4, "answer", 6);
+
+  mu_assert("error, response not kept", bt_respcache_lookup(cache, buff, 98, &from, 5, response, &length) == BT_RESPCACHE_HIT);
+  mu_assert("error, response kept too long", bt_respcache_lookup(cache, buff, 98, &from, 4 + 5 * SECOND, response, &length) == BT_RESPCACHE_MISS);
+
+  bt_free_respcache(cache);
+  return NULL;
+}
+
+char *
+test_respcache_bounded_table()
+{
+  bt_respcache_t *cache = respcache_new(1);
+  struct sockaddr_in from = { .sin_addr.s_addr = 0x0100007f, .sin_port = 80 };
+  char buff[98] = { 0 }, response[BT_RESPCACHE_MAX_LEN];
+  size_t length = 0;
+
+  mu_assert("error, unexpected table size", cache->sets == 1);
+
+  respcache_request(buff, 0);
+  bt_respcache_store(cache, buff, 98, &from, 1, "answer", 6);
+
+  for (int32_t i = 1; i <= 10000; i++) {
+    respcache_request(buff, i);
+    bt_respcache_store(cache, buff, 98, &from, 1 + i, "answer", 6);
+  }
+
+  /* The first response was evicted to make room. */
+  respcache_request(buff, 0);
+  mu_assert("error, evicted response answered", bt_respcache_lookup(cache, buff, 98, &from, 10002, response, &length) == BT_RESPCACHE_MISS);
+
+  bt_free_respcache(cache);
+  return NULL;
+}
+
+char *
+test_respcache_high_ports()
+{
+  bt_respcache_t *cache = respcache_new(1024);
+  struct sockaddr_in from = { .sin_port = 0xc3d4 };
+  char buff[98] = { 0 }, response[BT_RESPCACHE_MAX_LEN];
+  size_t length = 0;
+
+  respcache_request(buff, 7);
+
+  /* Clients behind ephemeral ports must still be told apart by address. */
+  for (uint32_t i = 1; i <= 16; i++) {
+    from.sin_addr.s_addr = htonl(0x0a000000 + i);
+    bt_respcache_store(cache, buff, 98, &from, 1, "answer", 6);
+  }
+
+  for (uint32_t i = 1; i <= 16; i++) {
+    from.sin_addr.s_addr = htonl(0x0a000000 + i);
+    mu_assert("error, clients share a slot", bt_respcache_lookup(cache, buff, 98, &from, 2, response, &length) == BT_RESPCACHE_HIT);
+  }
+
+  bt_free_respcache(cache);
+  return NULL;
+}
+
+char *
+all_tests()
+{
+  mu_run_test(test_respcache_disabled);
+  mu_run_test(test_respcache_retransmit);
+  mu_run_test(test_respcache_forget);
+  mu_run_test(test_respcache_bounded_table);
+  mu_run_test(test_respcache_high_ports);
+
+  return NULL;
+}
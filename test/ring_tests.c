@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "minunit.h"
+
+/* Producers and consumers of the concurrent test, and items each pushes. */
+#define RING_THREADS (4)
+#define RING_ITEMS   (100000)
+
+/* State shared by the threads of the concurrent test. */
+typedef struct {
+  bt_ring_t ring;
+  int producer;
+  volatile int producers_left;
+  volatile uint8_t *seen;   // Times each item came out
+  volatile int duplicates;
+} ring_shared_t;
+
+/* Items are numbered from 1, since NULL tells the ring is empty. */
+#define RING_ITEM(n) ((void *) (uintptr_t) (n))
+
+char *
+test_ring_fifo()
+{
+  bt_ring_t ring;
+  bt_ring_init(&ring, 8);
+
+  for (uintptr_t i = 1; i <= 5; i++) {
+    mu_assert("error, push failed", bt_ring_push(&ring, RING_ITEM(i), i * 10));
+  }
+
+  int64_t stamp;
+  mu_assert("error, nothing to peek", bt_ring_peek(&ring, &stamp) && stamp == 10);
+
+  for (uintptr_t i = 1; i <= 5; i++) {
+    mu_assert("error, items out of order", bt_ring_pop(&ring) == RING_ITEM(i));
+  }
+
+  bt_ring_clear(&ring);
+  return NULL;
+}
+
+char *
+test_ring_edges()
+{
+  bt_ring_t ring;
+  int64_t stamp;
+  void *items[4];
+
+  /* Capacity is rounded up to a power of two. */
+  bt_ring_init(&ring, 3);
+  mu_assert("error, wrong capacity", ring.mask == 3);
+
+  mu_assert("error, empty ring popped", bt_ring_pop(&ring) == NULL);
+  mu_assert("error, empty ring peeked", !bt_ring_peek(&ring, &stamp));
+  mu_assert("error, empty ring batch", bt_ring_pop_batch(&ring, items, 4) == 0);
+
+  for (uintptr_t i = 1; i <= 4; i++) {
+    mu_assert("error, push failed", bt_ring_push(&ring, RING_ITEM(i), 0));
+  }
+  mu_assert("error, full ring took an item", !bt_ring_push(&ring, RING_ITEM(5), 0));
+
+  /* One pop makes room for exactly one push. */
+  mu_assert("error, wrong head", bt_ring_pop(&ring) == RING_ITEM(1));
+  mu_assert("error, freed slot not reused", bt_ring_push(&ring, RING_ITEM(5), 0));
+  mu_assert("error, full ring took an item", !bt_ring_push(&ring, RING_ITEM(6), 0));
+
+  mu_assert("error, ring not drained", bt_ring_pop_batch(&ring, items, 4) == 4);
+  mu_assert("error, drained ring popped", bt_ring_pop(&ring) == NULL);
+
+  bt_ring_clear(&ring);
+  return NULL;
+}
+
+char *
+test_ring_wraparound()
+{
+  bt_ring_t ring;
+  bt_ring_init(&ring, 4);
+
+  /* Positions run many times past the mask, one item short of full. */
+  uintptr_t pushed = 0, popped = 0;
+
+  for (int round = 0; round < 100; round++) {
+    while (pushed - popped < 3) {
+      mu_assert("error, push failed", bt_ring_push(&ring, RING_ITEM(++pushed), 0));
+    }
+    mu_assert("error, wrong item after wrap", bt_ring_pop(&ring) == RING_ITEM(++popped));
+  }
+
+  mu_assert("error, positions did not wrap", ring.enqueue_pos > 10 * (ring.mask + 1));
+
+  bt_ring_clear(&ring);
+  return NULL;
+}
+
+char *
+test_ring_batch_across_wrap()
+{
+  bt_ring_t ring;
+  void *items[8];
+  bt_ring_init(&ring, 8);
+
+  /* Moves the head near the end of the slots. */
+  for (uintptr_t i = 1; i <= 6; i++) {
+    bt_ring_push(&ring, RING_ITEM(i), 0);
+  }
+  mu_assert("error, head not moved", bt_ring_pop_batch(&ring, items, 6) == 6);
+
+  for (uintptr_t i = 7; i <= 13; i++) {
+    mu_assert("error, push failed", bt_ring_push(&ring, RING_ITEM(i), 0));
+  }
+
+  /* Slots 6 and 7, then 0 to 2, in a single batch. */
+  mu_assert("error, batch stopped at the wrap", bt_ring_pop_batch(&ring, items, 5) == 5);
+  for (uintptr_t i = 0; i < 5; i++) {
+    mu_assert("error, batch out of order", items[i] == RING_ITEM(7 + i));
+  }
+
+  /* A batch larger than what is queued takes the rest. */
+  mu_assert("error, wrong rest", bt_ring_pop_batch(&ring, items, 8) == 2);
+  mu_assert("error, rest out of order", items[0] == RING_ITEM(12) && items[1] == RING_ITEM(13));
+
+  bt_ring_clear(&ring);
+  return NULL;
+}
+
+gpointer
+ring_producer(gpointer data)
+{
+  ring_shared_t *shared = (ring_shared_t *) data;
+  uintptr_t first = __sync_fetch_and_add(&shared->producer, 1) * RING_ITEMS + 1;
+
+  for (uintptr_t i = first; i < first + RING_ITEMS; i++) {
+    while (!bt_ring_push(&shared->ring, RING_ITEM(i), 0)) {
+      g_thread_yield();
+    }
+  }
+
+  __sync_fetch_and_sub(&shared->producers_left, 1);
+  return NULL;
+}
+
+gpointer
+ring_consumer(gpointer data)
+{
+  ring_shared_t *shared = (ring_shared_t *) data;
+  void *items[16];
+
+  /* Batches of every size up to that of the buffer. */
+  for (size_t max = 1; true; max = max % 16 + 1) {
+    bool done = 0 == __atomic_load_n(&shared->producers_left, __ATOMIC_ACQUIRE);
+    size_t count = bt_ring_pop_batch(&shared->ring, items, max);
+
+    for (size_t i = 0; i < count; i++) {
+      uintptr_t n = (uintptr_t) items[i];
+
+      if (__sync_fetch_and_add(&shared->seen[n - 1], 1) != 0) {
+        __sync_fetch_and_add(&shared->duplicates, 1);
+      }
+    }
+
+    /* Producers were done before this pop, so an empty ring stays empty. */
+    if (0 == count && done) {
+      break;
+    } else if (0 == count) {
+      g_thread_yield();
+    }
+  }
+
+  return NULL;
+}
+
+char *
+test_ring_concurrent()
+{
+  ring_shared_t shared;
+  GThread *threads[2 * RING_THREADS];
+  size_t total = RING_THREADS * RING_ITEMS;
+
+  memset(&shared, 0, sizeof(shared));
+  bt_ring_init(&shared.ring, 64);
+  shared.producers_left = RING_THREADS;
+  shared.seen = (volatile uint8_t *) calloc(total, 1);
+
+  for (int i = 0; i < RING_THREADS; i++) {
+    threads[i] = g_thread_new("consumer", ring_consumer, &shared);
+    threads[RING_THREADS + i] = g_thread_new("producer", ring_producer, &shared);
+  }
+
+  for (int i = 0; i < 2 * RING_THREADS; i++) {
+    g_thread_join(threads[i]);
+  }
+
+  size_t missing = 0;
+  for (size_t i = 0; i < total; i++) {
+    missing += 0 == shared.seen[i];
+  }
+
+  mu_assert("error, items popped twice", 0 == shared.duplicates);
+  mu_assert("error, items lost", 0 == missing);
+  mu_assert("error, ring not empty", bt_ring_pop(&shared.ring) == NULL);
+
+  free((void *) shared.seen);
+  bt_ring_clear(&shared.ring);
+  return NULL;
+}
+
+char *
+all_tests()
+{
+  mu_run_test(test_ring_fifo);
+  mu_run_test(test_ring_edges);
+  mu_run_test(test_ring_wraparound);
+  mu_run_test(test_ring_batch_across_wrap);
+  mu_run_test(test_ring_concurrent);
+
+  return NULL;
+}
@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measures the cost of handing jobs from the receiver thread to workers,
+ * with the lock-free queues of the scheduler and with a mutex-protected
+ * queue that signals a condition for every job, as GLib thread pools and
+ * the previous scheduler do.
+ *
+ * With 0 workers, the producer drains the queue itself whenever it fills
+ * up, which gives the cost of the queue alone, without any contention.
+ *
+ *   sched_bench [jobs]
+ */
+
+#define BENCH_BACKLOG 4096  // The producer waits above this many jobs
+#define BENCH_PARK_US 1000
+
+typedef struct {
+  GMutex lock;
+  GCond cond;
+  GQueue queue;
+  bool stopping;
+} bench_locked_t;
+
+typedef struct {
+  bool lockfree;
+  bt_sched_t sched;
+  bench_locked_t locked;
+  bt_job_params_t *jobs;
+  int64_t *latencies;        // Nanoseconds from push to pop, by job
+  size_t popped;
+} bench_queue_t;
+
+int64_t
+bench_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int
+bench_compare(const void *a, const void *b)
+{
+  int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+  return x < y ? -1 : x > y;
+}
+
+/* Latency at a given quantile of the sorted samples. */
+int64_t
+bench_quantile(const int64_t *samples, size_t count, double quantile)
+{
+  return samples[MIN((size_t) (quantile * count), count - 1)];
+}
+
+guint
+bench_length(bench_queue_t *queue)
+{
+  if (queue->lockfree) {
+    return bt_sched_length(&queue->sched);
+  }
+
+  g_mutex_lock(&queue->locked.lock);
+  guint length = g_queue_get_length(&queue->locked.queue);
+  g_mutex_unlock(&queue->locked.lock);
+
+  return length;
+}
+
+void
+bench_push(bench_queue_t *queue, bt_job_params_t *params)
+{
+  params->enqueued_at = bench_now();
+
+  if (queue->lockfree) {
+    bt_sched_push(&queue->sched, params);
+    return;
+  }
+
+  g_mutex_lock(&queue->locked.lock);
+  g_queue_push_tail(&queue->locked.queue, params);
+  g_cond_signal(&queue->locked.cond);
+  g_mutex_unlock(&queue->locked.lock);
+}
+
+/* Takes some jobs, parking for a while if there are none. */
+guint
+bench_pop(bench_queue_t *queue, bt_job_params_t **jobs, bool *running)
+{
+  if (queue->lockfree) {
+    guint count = bt_sched_pop_batch(&queue->sched, BT_SCHED_ANY, jobs,
+                                     BT_WORKER_BATCH);
+
+    if (0 == count) {
+      *running = bt_sched_wait(&queue->sched, BENCH_PARK_US);
+    }
+    return count;
+  }
+
+  int64_t deadline = g_get_monotonic_time() + BENCH_PARK_US;
+  bench_locked_t *locked = &queue->locked;
+
+  g_mutex_lock(&locked->lock);
+
+  while (g_queue_is_empty(&locked->queue) && !locked->stopping) {
+    if (!g_cond_wait_until(&locked->cond, &locked->lock, deadline)) {
+      break;
+    }
+  }
+
+  jobs[0] = g_queue_pop_head(&locked->queue);
+  *running = !locked->stopping;
+  g_mutex_unlock(&locked->lock);
+
+  return NULL == jobs[0] ? 0 : 1;
+}
+
+/* Takes some jobs and records how long they waited. */
+bool
+bench_take(bench_queue_t *queue)
+{
+  bt_job_params_t *jobs[BT_WORKER_BATCH];
+  bool running = true;
+
+  guint count = bench_pop(queue, jobs, &running);
+  int64_t now = bench_now();
+
+  for (guint i = 0; i < count; i++) {
+    queue->latencies[jobs[i] - queue->jobs] = now - jobs[i]->enqueued_at;
+  }
+
+  __sync_fetch_and_add(&queue->popped, count);
+
+  return running;
+}
+
+gpointer
+bench_consumer(gpointer data)
+{
+  bench_queue_t *queue = (bench_queue_t *) data;
+
+  while (bench_take(queue)) {
+  }
+
+  return NULL;
+}
+
+/* Pushes `count` jobs to `consumers` threads and prints the results. */
+void
+bench_run(bt_config_t *config, bool lockfree, int consumers, size_t count)
+{
+  bench_queue_t queue;
+  GThread *threads[MAX(consumers, 1)];
+
+  memset(&queue, 0, sizeof(queue));
+  queue.lockfree = lockfree;
+  queue.jobs = (bt_job_params_t *) calloc(count, sizeof(bt_job_params_t));
+  queue.latencies = (int64_t *) calloc(count, sizeof(int64_t));
+
+  if (NULL == queue.jobs || NULL == queue.latencies) {
+    fprintf(stderr, "Cannot allocate memory for jobs\n");
+    exit(1);
+  }
+
+  if (lockfree) {
+    bt_sched_init(&queue.sched, config, 0);
+  } else {
+    g_mutex_init(&queue.locked.lock);
+    g_cond_init(&queue.locked.cond);
+    g_queue_init(&queue.locked.queue);
+  }
+
+  for (int i = 0; i < consumers; i++) {
+    threads[i] = g_thread_new("consumer", bench_consumer, &queue);
+  }
+
+  int64_t started_at = bench_now();
+
+  for (size_t i = 0; i < count; i++) {
+    bt_job_params_t *params = &queue.jobs[i];
+
+    params->class = BT_CLASS_CONNECT + i % 3;
+    params->received_at = g_get_monotonic_time();
+
+    while (bench_length(&queue) >= BENCH_BACKLOG) {
+      if (0 == consumers) {
+        bench_take(&queue);
+      } else {
+        g_thread_yield();
+      }
+    }
+
+    bench_push(&queue, params);
+  }
+
+  while (__atomic_load_n(&queue.popped, __ATOMIC_ACQUIRE) < count) {
+    if (0 == consumers) {
+      bench_take(&queue);
+    } else {
+      g_thread_yield();
+    }
+  }
+
+  double elapsed = bench_now() - started_at;
+
+  if (lockfree) {
+    bt_sched_stop(&queue.sched);
+  } else {
+    g_mutex_lock(&queue.locked.lock);
+    queue.locked.stopping = true;
+    g_cond_broadcast(&queue.locked.cond);
+    g_mutex_unlock(&queue.locked.lock);
+  }
+
+  for (int i = 0; i < consumers; i++) {
+    g_thread_join(threads[i]);
+  }
+
+  qsort(queue.latencies, count, sizeof(int64_t), bench_compare);
+
+  printf("%-10s %9d %9.1f %9" PRId64 " %9" PRId64 " %9" PRId64 "\n",
+         lockfree ? "lock-free" : "locked", consumers, elapsed / count,
+         bench_quantile(queue.latencies, count, 0.5),
+         bench_quantile(queue.latencies, count, 0.99),
+         queue.latencies[count - 1]);
+
+  if (lockfree) {
+    bt_sched_clear(&queue.sched);
+  } else {
+    g_queue_clear(&queue.locked.queue);
+    g_cond_clear(&queue.locked.cond);
+    g_mutex_clear(&queue.locked.lock);
+  }
+
+  free(queue.latencies);
+  free(queue.jobs);
+}
+
+int
+main(int argc, char **argv)
+{
+  bt_config_t config;
+  memset(&config, 0, sizeof(config));
+  config.sched_policy = BT_SCHED_FIFO;
+
+  size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+
+  if (0 == count) {
+    return 0;
+  }
+
+  printf("%-10s %9s %9s %9s %9s %9s\n", "queue", "workers", "ns/job",
+         "p50 ns", "p99 ns", "max ns");
+
+  for (int consumers = 0; consumers <= 4; consumers = MAX(1, 2 * consumers)) {
+    bench_run(&config, false, consumers, count);
+    bench_run(&config, true, consumers, count);
+  }
+
+  return 0;
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "minunit.h"
+
+void
+sched_config(bt_config_t *config, bt_sched_policy policy)
+{
+  memset(config, 0, sizeof(bt_config_t));
+
+  config->sched_policy = policy;
+  config->sched_connect_weight = 4;
+  config->sched_announce_weight = 2;
+  config->sched_scrape_weight = 1;
+}
+
+/* Queues `count` jobs of each class, interleaved, oldest first. */
+void
+sched_fill(bt_sched_t *sched, int count)
+{
+  for (int i = 0; i < count; i++) {
+    for (int class = BT_CLASS_SCRAPE; class >= BT_CLASS_CONNECT; class--) {
+      bt_job_params_t *params = calloc(1, sizeof(bt_job_params_t));
+      params->class = class;
+      params->received_at = i * BT_CLASS_COUNT + class;
+      bt_sched_push(sched, params);
+    }
+  }
+}
+
+char *
+test_sched_strict()
+{
+  bt_config_t config;
+  bt_sched_t sched;
+
+  sched_config(&config, BT_SCHED_STRICT);
+  bt_sched_init(&sched, &config, 0);
+  sched_fill(&sched, 10);
+
+  /* All connects first, then announces, then scrapes. */
+  for (int i = 0; i < 30; i++) {
+    bt_job_params_t *params = bt_sched_pop(&sched, BT_SCHED_ANY);
+
+    mu_assert("error, queue ran dry", params != NULL);
+    mu_assert("error, wrong class", params->class == i / 10);
+    free(params);
+  }
+
+  mu_assert("error, queue not empty", bt_sched_length(&sched) == 0);
+  mu_assert("error, job from nowhere", bt_sched_pop(&sched, BT_SCHED_ANY) == NULL);
+
+  /* A connect queued late still jumps ahead of everything else. */
+  sched_fill(&sched, 2);
+
+  bt_job_params_t *params = bt_sched_pop(&sched, BT_SCHED_ANY);
+  free(params);
+
+  bt_job_params_t *connect = calloc(1, sizeof(bt_job_params_t));
+  connect->class = BT_CLASS_CONNECT;
+  bt_sched_push(&sched, connect);
+
+  params = bt_sched_pop(&sched, BT_SCHED_ANY);
+  mu_assert("error, late connect waited", params->class == BT_CLASS_CONNECT);
+  free(params);
+
+  bt_sched_clear(&sched);
+  return NULL;
+}
+
+char *
+test_sched_weighted()
+{
+  bt_config_t config;
+  bt_sched_t sched;
+  int served[BT_CLASS_COUNT] = { 0 };
+
+  sched_config(&config, BT_SCHED_WEIGHTED);
+  bt_sched_init(&sched, &config, 0);
+  sched_fill(&sched, 100);
+
+  /* While every class has jobs, they are served 4:2:1. */
+  for (int i = 0; i < 70; i++) {
+    bt_job_params_t *params = bt_sched_pop(&sched, BT_SCHED_ANY);
+
+    mu_assert("error, queue ran dry", params != NULL);
+    served[params->class]++;
+    free(params);
+  }
+
+  mu_assert("error, wrong connect share", served[BT_CLASS_CONNECT] == 40);
+  mu_assert("error, wrong announce share", served[BT_CLASS_ANNOUNCE] == 20);
+  mu_assert("error, wrong scrape share", served[BT_CLASS_SCRAPE] == 10);
+
+  /* Batches are charged as that many picks in a row. */
+  bt_job_params_t *jobs[BT_SCHED_MAX_BATCH];
+  memset(served, 0, sizeof(served));
+
+  for (int i = 0; i < 20; i++) {
+    guint count = bt_sched_pop_batch(&sched, BT_SCHED_ANY, jobs, 7);
+
+    for (guint j = 0; j < count; j++) {
+      served[jobs[j]->class] += 1;
+      free(jobs[j]);
+    }
+  }
+
+  mu_assert("error, batches starved announces", served[BT_CLASS_ANNOUNCE] >= 20);
+  mu_assert("error, batches starved scrapes", served[BT_CLASS_SCRAPE] >= 10);
+  mu_assert("error, connects over their share",
+            served[BT_CLASS_CONNECT] <= 2 * served[BT_CLASS_ANNOUNCE] + 7);
+
+  bt_sched_clear(&sched);
+  return NULL;
+}
+
+char *
+test_sched_fifo_and_steal()
+{
+  bt_config_t config;
+  bt_sched_t sched;
+  int64_t last = -1;
+
+  sched_config(&config, BT_SCHED_FIFO);
+  bt_sched_init(&sched, &config, 0);
+  sched_fill(&sched, 5);
+
+  /* Thieves never get announces. */
+  bt_job_params_t *params;
+
+  while ((params = bt_sched_pop(&sched, BT_SCHED_STEALABLE)) != NULL) {
+    mu_assert("error, announce stolen", params->class != BT_CLASS_ANNOUNCE);
+    mu_assert("error, out of order", params->received_at > last);
+    last = params->received_at;
+    free(params);
+  }
+
+  mu_assert("error, announces gone", bt_sched_length(&sched) == 5);
+
+  bt_sched_clear(&sched);
+  return NULL;
+}
+
+char *
+test_sched_bound()
+{
+  bt_config_t config;
+  bt_sched_t sched;
+
+  sched_config(&config, BT_SCHED_FIFO);
+  bt_sched_init(&sched, &config, 4);
+  sched_fill(&sched, 2);
+
+  mu_assert("error, bound not enforced", bt_sched_length(&sched) == 4);
+
+  bt_sched_clear(&sched);
+  return NULL;
+}
+
+char *
+all_tests()
+{
+  mu_run_test(test_sched_strict);
+  mu_run_test(test_sched_weighted);
+  mu_run_test(test_sched_fifo_and_steal);
+  mu_run_test(test_sched_bound);
+
+  return NULL;
+}
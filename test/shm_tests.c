@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "minunit.h"
+
+#define PEER_ID_A "-BT0001-aaaaaaaaaaaa"
+#define PEER_ID_B "-BT0001-bbbbbbbbbbbb"
+#define PEER_ID_C "-BT0001-cccccccccccc"
+
+/* A table of its own for each run, with a single bucket. */
+void
+shm_config(bt_config_t *config, char *name, size_t name_len)
+{
+  memset(config, 0, sizeof(bt_config_t));
+  snprintf(name, name_len, "/bttracker-test-%d", (int) getpid());
+
+  config->shm_name = name;
+  config->shm_buckets = 1;
+  config->shm_peers_per_torrent = 4;
+  config->announce_peer_ttl = 1800;
+}
+
+void
+shm_info_hash(int8_t *info_hash, int n)
+{
+  memset(info_hash, 0, 20);
+  memcpy(info_hash, &n, sizeof(n));
+}
+
+void
+shm_insert(bt_config_t *config, const int8_t *info_hash, const char *peer_id,
+           uint32_t ipv4_addr, bool seeder)
+{
+  bt_peer_t peer;
+  memset(&peer, 0, sizeof(peer));
+  peer.ipv4_addr = ipv4_addr;
+  peer.port = 6881;
+
+  bt_shm_insert_peer(config, info_hash, (const int8_t *) peer_id, &peer, seeder);
+}
+
+char *
+test_shm_swarm()
+{
+  bt_config_t config;
+  char name[64];
+  shm_config(&config, name, sizeof(name));
+
+  mu_assert("error, cannot create table", bt_shm_open(&config));
+
+  int8_t info_hash[20];
+  bt_torrent_stats_t stats;
+  shm_info_hash(info_hash, 1);
+
+  shm_insert(&config, info_hash, PEER_ID_A, 0x0a000001, false);
+  shm_insert(&config, info_hash, PEER_ID_B, 0x0a000002, false);
+  shm_insert(&config, info_hash, PEER_ID_C, 0x0a000003, true);
+
+  /* Announcing again refreshes the same slot. */
+  shm_insert(&config, info_hash, PEER_ID_A, 0x0a000001, false);
+
+  bt_shm_get_torrent_stats(&config, info_hash, &stats);
+  mu_assert("error, wrong number of seeders", stats.seeders == 1);
+  mu_assert("error, wrong number of leechers", stats.leechers == 2);
+
+  int count = 0;
+  bt_list *peers = bt_shm_peer_list(&config, info_hash, 10, &count, false,
+                                    BT_LOCALITY_NONE);
+  mu_assert("error, wrong number of leechers listed", count == 2 && bt_list_length(peers) == 2);
+  bt_list_free(peers);
+
+  mu_assert("error, leecher not promoted", bt_shm_promote_peer(&config, info_hash, (const int8_t *) PEER_ID_A));
+  mu_assert("error, seeder promoted", !bt_shm_promote_peer(&config, info_hash, (const int8_t *) PEER_ID_C));
+
+  bt_shm_get_torrent_stats(&config, info_hash, &stats);
+  mu_assert("error, promotion not applied", stats.seeders == 2 && stats.leechers == 1);
+  mu_assert("error, download not counted", stats.downloads == 1);
+
+  bt_shm_remove_peer(&config, info_hash, (const int8_t *) PEER_ID_B);
+  bt_shm_get_torrent_stats(&config, info_hash, &stats);
+  mu_assert("error, peer not removed", stats.seeders == 2 && stats.leechers == 0);
+
+  bt_shm_close();
+  shm_unlink(name);
+  return NULL;
+}
+
+char *
+test_shm_peer_ttl()
+{
+  bt_config_t config;
+  char name[64];
+  shm_config(&config, name, sizeof(name));
+  config.announce_peer_ttl = 0;
+
+  mu_assert("error, cannot create table", bt_shm_open(&config));
+
+  int8_t info_hash[20];
+  bt_torrent_stats_t stats;
+  shm_info_hash(info_hash, 1);
+
+  shm_insert(&config, info_hash, PEER_ID_A, 0x0a000001, false);
+  bt_shm_get_torrent_stats(&config, info_hash, &stats);
+  mu_assert("error, fresh peer ignored", stats.leechers == 1);
+
+  /* Peers last seen before now - PeerTTL are ignored. */
+  sleep(2);
+  bt_shm_get_torrent_stats(&config, info_hash, &stats);
+  mu_assert("error, expired peer counted", stats.leechers == 0);
+
+  int count = 0;
+  bt_list *peers = bt_shm_peer_list(&config, info_hash, 10, &count, false,
+                                    BT_LOCALITY_NONE);
+  mu_assert("error, expired peer listed", count == 0 && peers == NULL);
+
+  bt_shm_close();
+  shm_unlink(name);
+  return NULL;
+}
+
+char *
+test_shm_eviction()
+{
+  bt_config_t config;
+  char name[64];
+  shm_config(&config, name, sizeof(name));
+
+  mu_assert("error, cannot create table", bt_shm_open(&config));
+
+  int8_t info_hash[20];
+  bt_torrent_stats_t stats;
+
+  /* A full torrent replaces its least recently seen peer. */
+  shm_info_hash(info_hash, 0);
+
+  for (int i = 0; i < 6; i++) {
+    char peer_id[21];
+    snprintf(peer_id, sizeof(peer_id), "-BT0001-%012d", i);
+    shm_insert(&config, info_hash, peer_id, 0x0a000001 + i, false);
+  }
+
+  bt_shm_get_torrent_stats(&config, info_hash, &stats);
+  mu_assert("error, torrent holds too many peers", stats.leechers == 4);
+
+  /* The single bucket holds 4 torrents, the oldest one goes first. */
+  for (int i = 1; i <= BT_SHM_WAYS; i++) {
+    shm_info_hash(info_hash, i);
+    shm_insert(&config, info_hash, PEER_ID_A, 0x0a000001, false);
+  }
+
+  shm_info_hash(info_hash, 0);
+  bt_shm_get_torrent_stats(&config, info_hash, &stats);
+  mu_assert("error, oldest torrent not evicted", stats.leechers == 0);
+
+  for (int i = 1; i <= BT_SHM_WAYS; i++) {
+    shm_info_hash(info_hash, i);
+    bt_shm_get_torrent_stats(&config, info_hash, &stats);
+    mu_assert("error, recent torrent evicted", stats.leechers == 1);
+  }
+
+  bt_shm_close();
+  shm_unlink(name);
+  return NULL;
+}
+
+char *
+test_shm_geometry_mismatch()
+{
+  bt_config_t config;
+  char name[64];
+  shm_config(&config, name, sizeof(name));
+
+  mu_assert("error, cannot create table", bt_shm_open(&config));
+  bt_shm_close();
+
+  mu_assert("error, cannot attach to table", bt_shm_open(&config));
+  bt_shm_close();
+
+  config.shm_peers_per_torrent = 8;
+  mu_assert("error, attached with other peer slots", !bt_shm_open(&config));
+
+  config.shm_peers_per_torrent = 4;
+  config.shm_buckets = 2;
+  mu_assert("error, attached with other buckets", !bt_shm_open(&config));
+
+  shm_unlink(name);
+  return NULL;
+}
+
+char *
+all_tests()
+{
+  mu_run_test(test_shm_swarm);
+  mu_run_test(test_shm_peer_ttl);
+  mu_run_test(test_shm_eviction);
+  mu_run_test(test_shm_geometry_mismatch);
+
+  return NULL;
+}
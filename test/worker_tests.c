@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2013, BtTracker Authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "minunit.h"
+
+/* A group of workers whose threads are not started. */
+bt_workers_t *
+worker_group(bt_config_t *config, int count)
+{
+  bt_workers_t *group = calloc(1, sizeof(bt_workers_t));
+
+  memset(config, 0, sizeof(bt_config_t));
+  group->config = config;
+  group->count = count;
+  group->workers = calloc(count, sizeof(bt_worker_t));
+
+  for (int i = 0; i < BT_WORKER_SHARDS; i++) {
+    group->owners[i] = i % count;
+  }
+
+  for (int i = 0; i < count; i++) {
+    group->workers[i].index = i;
+    group->workers[i].group = group;
+    bt_sched_init(&group->workers[i].sched, config, 0);
+  }
+
+  return group;
+}
+
+void
+worker_free_group(bt_workers_t *group)
+{
+  for (int i = 0; i < group->count; i++) {
+    bt_sched_clear(&group->workers[i].sched);
+  }
+
+  free(group->workers);
+  free(group);
+}
+
+bt_job_params_t *
+worker_job(bt_request_class class, uint8_t first, uint8_t second)
+{
+  bt_job_params_t *params = calloc(1, sizeof(bt_job_params_t));
+
+  params->class = class;
+  params->buflen = 98;
+  params->buff = calloc(1, params->buflen);
+  params->buff[16] = first;
+  params->buff[17] = second;
+
+  return params;
+}
+
+char *
+test_worker_announces_stick_to_owner()
+{
+  bt_config_t config;
+  bt_workers_t *group = worker_group(&config, 3);
+  bt_job_params_t *params = worker_job(BT_CLASS_ANNOUNCE, 0x12, 0x34);
+
+  bt_worker_t *owner = bt_workers_route(group, params);
+  int shard = bt_worker_shard(params->buff + 16);
+
+  mu_assert("error, wrong owner", owner->index == group->owners[shard]);
+
+  /* Still routed to the owner however busy it gets. */
+  for (int i = 0; i < 10; i++) {
+    bt_workers_push(group, worker_job(BT_CLASS_ANNOUNCE, 0x12, 0x34));
+    mu_assert("error, announce moved", bt_workers_route(group, params) == owner);
+  }
+
+  mu_assert("error, announces spread", bt_sched_length(&owner->sched) == 10);
+
+  /* Neighbouring shards belong to other workers. */
+  bt_job_params_t *other = worker_job(BT_CLASS_ANNOUNCE, 0x12, 0x35);
+  mu_assert("error, shards not dealt", bt_workers_route(group, other) != owner);
+
+  free(other->buff);
+  free(other);
+  free(params->buff);
+  free(params);
+  worker_free_group(group);
+  return NULL;
+}
+
+char *
+test_worker_connects_go_to_least_loaded()
+{
+  bt_config_t config;
+  bt_workers_t *group = worker_group(&config, 3);
+
+  bt_workers_push(group, worker_job(BT_CLASS_ANNOUNCE, 0, 0));
+  bt_workers_push(group, worker_job(BT_CLASS_ANNOUNCE, 0, 1));
+
+  bt_job_params_t *params = worker_job(BT_CLASS_CONNECT, 0, 0);
+  mu_assert("error, connect sent to a busy worker",
+            bt_workers_route(group, params)->index == 2);
+
+  free(params->buff);
+  free(params);
+  worker_free_group(group);
+  return NULL;
+}
+
+char *
+all_tests()
+{
+  mu_run_test(test_worker_announces_stick_to_owner);
+  mu_run_test(test_worker_connects_go_to_least_loaded);
+
+  return NULL;
+}